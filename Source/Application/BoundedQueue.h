@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <deque>
+#include <vector>
+
+/**
+ * Blocking FIFO queue of limited capacity connecting two pipeline stages.
+ *
+ * push blocks while the queue is full (backpressure on the producer), pop blocks while it is empty.
+ * close lets the consumers drain the remaining items, abort drops them and wakes everybody up.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    // Returns false if the queue was closed or aborted (the item is dropped)
+    bool push(T item)
+    {
+        QMutexLocker locker(&mutex_);
+        while (!closed_ && (int)items_.size() >= capacity_)
+            notFull_.wait(&mutex_);
+        if (closed_)
+            return false;
+
+        items_.push_back(std::move(item));
+        notEmpty_.wakeOne();
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        QMutexLocker locker(&mutex_);
+        while (!closed_ && items_.empty())
+            notEmpty_.wait(&mutex_);
+        if (items_.empty())
+            return false;
+
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.wakeOne();
+        return true;
+    }
+
+    // Waits for at least one item and takes up to maxItems, returns false once the queue is closed and empty
+    bool popBatch(std::vector<T>& items, int maxItems)
+    {
+        QMutexLocker locker(&mutex_);
+        while (!closed_ && items_.empty())
+            notEmpty_.wait(&mutex_);
+        if (items_.empty())
+            return false;
+
+        while (!items_.empty() && (int)items.size() < maxItems)
+        {
+            items.push_back(std::move(items_.front()));
+            items_.pop_front();
+        }
+        notFull_.wakeAll();
+        return true;
+    }
+
+    // No more items will be pushed
+    void close()
+    {
+        QMutexLocker locker(&mutex_);
+        closed_ = true;
+        notEmpty_.wakeAll();
+        notFull_.wakeAll();
+    }
+
+    // Closes the queue and drops the pending items
+    void abort()
+    {
+        QMutexLocker locker(&mutex_);
+        closed_ = true;
+        items_.clear();
+        notEmpty_.wakeAll();
+        notFull_.wakeAll();
+    }
+
+    int size() const
+    {
+        QMutexLocker locker(&mutex_);
+        return static_cast<int>(items_.size());
+    }
+
+private:
+    const int capacity_;
+    std::deque<T> items_;
+    bool closed_{false};
+
+    mutable QMutex mutex_;
+    QWaitCondition notEmpty_;
+    QWaitCondition notFull_;
+};
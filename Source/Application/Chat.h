@@ -39,6 +39,54 @@ struct ChatData
     virtual void reset() { };
 };
 
+/**
+ * @struct SamplerProfile
+ * @brief Paramètres d'échantillonnage d'un chat
+ *
+ * Les filtres sont appliqués dans l'ordre top-k, top-p, min-p, puis la température.
+ * Un top-k de 0, un top-p de 1 ou un min-p de 0 désactive le filtre correspondant.
+ */
+struct SamplerProfile
+{
+    float temperature_{LLM_SAMPLER_TEMPERATURE}; ///< Température (0 : toujours le token le plus probable)
+    int topK_{0};                                ///< Tokens les plus probables conservés
+    float topP_{1.0f};                           ///< Masse de probabilité conservée
+    float minP_{LLM_SAMPLER_MIN_P};              ///< Probabilité minimale, relative à celle du token le plus probable
+
+    bool operator==(const SamplerProfile& other) const
+    {
+        return temperature_ == other.temperature_ && topK_ == other.topK_ && topP_ == other.topP_
+               && minP_ == other.minP_;
+    }
+    bool operator!=(const SamplerProfile& other) const { return !(*this == other); }
+
+    /**
+     * @brief Convertit le profil en JSON
+     */
+    QJsonObject toJson() const
+    {
+        QJsonObject json;
+        json["temperature"] = temperature_;
+        json["topK"] = topK_;
+        json["topP"] = topP_;
+        json["minP"] = minP_;
+        return json;
+    }
+
+    /**
+     * @brief Lit un profil depuis du JSON, les valeurs absentes gardent leur valeur par défaut
+     */
+    static SamplerProfile fromJson(const QJsonObject& json)
+    {
+        SamplerProfile profile;
+        profile.temperature_ = json["temperature"].toDouble(profile.temperature_);
+        profile.topK_ = json["topK"].toInt(profile.topK_);
+        profile.topP_ = json["topP"].toDouble(profile.topP_);
+        profile.minP_ = json["minP"].toDouble(profile.minP_);
+        return profile;
+    }
+};
+
 /**
  * @class Chat
  * @brief Classe de base abstraite représentant un chat avec un modèle LLM
@@ -55,6 +103,9 @@ class Chat : public QAbstractListModel
     Q_PROPERTY(const QStringList& messages READ getMessages NOTIFY messagesChanged)
     Q_PROPERTY(int contextSizeUsed READ getContextSizeUsed NOTIFY contextSizeUsedChanged)
     Q_PROPERTY(int contextSize READ getContextSize WRITE setContextSize NOTIFY contextSizeChanged)
+    Q_PROPERTY(double prefillProgress READ getPrefillProgress NOTIFY prefillProgressChanged)
+    Q_PROPERTY(QString draftModel READ getDraftModel WRITE setDraftModel NOTIFY draftModelChanged)
+    Q_PROPERTY(double acceptanceRate READ getAcceptanceRate NOTIFY acceptanceRateChanged)
 
 public:
     /**
@@ -300,6 +351,85 @@ public:
      */
     int getContextSizeUsed() const { return getData()->n_ctx_used_; };
 
+    /**
+     * @brief Retourne l'avancement du décodage du prompt
+     * @return Fraction du prompt décodée, 1 si aucun prompt n'est en cours de décodage
+     */
+    double getPrefillProgress() const { return prefillProgress_; }
+
+    /**
+     * @brief Définit l'avancement du décodage du prompt
+     * @param progress Fraction du prompt décodée (1 en fin de décodage)
+     */
+    void setPrefillProgress(double progress)
+    {
+        if (prefillProgress_ != progress)
+        {
+            prefillProgress_ = progress;
+            emit prefillProgressChanged();
+        }
+    }
+
+    /**
+     * @brief Retourne le modèle de brouillon du décodage spéculatif
+     * @return Nom du modèle, vide si aucun
+     */
+    const QString& getDraftModel() const { return draftModel_; }
+
+    /**
+     * @brief Définit le modèle de brouillon du décodage spéculatif
+     * @param model Nom d'un petit modèle au vocabulaire identique à celui du chat (vide : aucun)
+     *
+     * Pris en compte à la génération suivante.
+     */
+    void setDraftModel(const QString& model)
+    {
+        if (draftModel_ != model)
+        {
+            draftModel_ = model;
+            emit draftModelChanged();
+        }
+    }
+
+    /**
+     * @brief Retourne le profil d'échantillonnage du chat
+     */
+    const SamplerProfile& getSampler() const { return sampler_; }
+
+    /**
+     * @brief Définit le profil d'échantillonnage du chat
+     * @param sampler Température et filtres des tokens
+     *
+     * Pris en compte à la génération suivante.
+     */
+    void setSampler(const SamplerProfile& sampler)
+    {
+        if (sampler_ != sampler)
+        {
+            sampler_ = sampler;
+            emit samplerChanged();
+        }
+    }
+
+    /**
+     * @brief Retourne le taux d'acceptation des tokens proposés par le modèle de brouillon
+     * @return Fraction des tokens proposés acceptés, -1 sans décodage spéculatif
+     */
+    double getAcceptanceRate() const { return acceptanceRate_; }
+
+    /**
+     * @brief Définit le taux d'acceptation des tokens proposés
+     * @param rate Fraction des tokens proposés acceptés, -1 sans décodage spéculatif
+     */
+    void setAcceptanceRate(double rate)
+    {
+        if (acceptanceRate_ != rate)
+        {
+            acceptanceRate_ = rate;
+            emit acceptanceRateChanged();
+        }
+    }
+
     /**
      * @brief Retourne les données de chat
      * @return Pointeur vers les données de chat
@@ -309,13 +439,16 @@ public:
 
     /**
      * @brief Définit les données de chat
-     * @param data Pointeur vers les données de chat
+     * @param data Pointeur vers les données de chat (nullptr : retour aux données propres du chat)
      */
     void setData(ChatData* data) 
     {
-        data->n_ctx_ = data_.n_ctx_;
-        data->n_ctx_used_ = data_.n_ctx_used_;
-        data->context_tokens_ = data_.context_tokens_;
+        if (data)
+        {
+            data->n_ctx_ = data_.n_ctx_;
+            data->n_ctx_used_ = data_.n_ctx_used_;
+            data->context_tokens_ = data_.context_tokens_;
+        }
         dataPtr_ = data; 
     }
 
@@ -427,6 +560,26 @@ signals:
      */
     void contextSizeUsedChanged();
 
+    /**
+     * @brief Signal émis lorsque l'avancement du décodage du prompt change
+     */
+    void prefillProgressChanged();
+
+    /**
+     * @brief Signal émis lorsque le modèle de brouillon change
+     */
+    void draftModelChanged();
+
+    /**
+     * @brief Signal émis lorsque le profil d'échantillonnage change
+     */
+    void samplerChanged();
+
+    /**
+     * @brief Signal émis lorsque le taux d'acceptation des tokens proposés change
+     */
+    void acceptanceRateChanged();
+
 protected:
     /**
      * @brief Finalise le flux de streaming
@@ -441,11 +594,15 @@ protected:
  
     bool streamed_{false};          ///< Indique si le streaming est activé
     bool processing_{false};        ///< Indique si le chat est en cours de traitement
+    double prefillProgress_{1.0};   ///< Avancement du décodage du prompt (1 : aucun en cours)
+    double acceptanceRate_{-1.0};   ///< Taux d'acceptation des tokens proposés (-1 : pas de décodage spéculatif)
 
     QString id_;                    ///< Identifiant stable du chat (UUID)
     QString name_;                  ///< Nom du chat
     QString currentApi_;            ///< API LLM courante
     QString currentModel_;          ///< Modèle LLM courant
+    QString draftModel_;            ///< Modèle de brouillon du décodage spéculatif (vide : aucun)
+    SamplerProfile sampler_;        ///< Profil d'échantillonnage
     QString initialContext_;        ///< Contexte initial du chat
 
     QStringList messages_;          ///< Liste des messages sous forme de texte
@@ -157,6 +157,7 @@ void ChatController::deleteChat(int index)
 
         checkChatsProcessingFinished();
 
+        llmServices_->deleteChat(chatToRemove);
         chatToRemove->deleteLater();
 
         emit chatListChanged();
@@ -259,6 +260,13 @@ void ChatController::setModel(const QString& modelName)
     }
 }
 
+void ChatController::preloadModel(const QString& modelName)
+{
+    LLMService* currentApi = currentChat_ ? llmServices_->get(currentChat_->getCurrentApi()) : nullptr;
+    if (currentApi)
+        currentApi->preloadModel(modelName);
+}
+
 void ChatController::setAPI(const QString& apiName)
 {
     if (currentChat_)
@@ -118,6 +118,12 @@ public:
      * @param modelName Nom du modèle à utiliser
      */
     Q_INVOKABLE void setModel(const QString& modelName);
+
+    /**
+     * @brief Charge un modèle en arrière-plan avant qu'il ne soit choisi
+     * @param modelName Nom du modèle à précharger
+     */
+    Q_INVOKABLE void preloadModel(const QString& modelName);
     
     /**
      * @brief Définit l'API LLM à utiliser
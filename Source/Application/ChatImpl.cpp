@@ -105,6 +105,9 @@ void ChatImpl::addContent(const QString& role, const QString& content)
         lastBotIndex_ = messages_.size() - 1;
         currentAIStream_ = content;
         currentAIRole_ = role;
+        streamRow_ = lastBotIndex_;
+        streamRowOpen_ = true;
+        streamTag_.clear();
     }
 
     emit messageAdded(role, content);
@@ -118,16 +121,17 @@ void ChatImpl::finalizeStream()
     {
         qDebug() << "Chat::finalizeStream: ";
 
-        // History is already updated during streaming in updateCurrentAIStream()
-        if (history_.isEmpty() || history_.last().role_ != currentAIRole_ || history_.last().content_ != currentAIStream_)
+        // History is already updated during streaming in updateCurrentAIStream(), except an unfinished tag
+        if (!streamTag_.isEmpty())
         {
-            qWarning() << "Chat::finalizeStream: history was not updated during streaming, adding now";
-            addMessage(currentAIRole_, currentAIStream_);
+            flushStream();
+            emit dataChanged(index(streamRow_), index(streamRow_), { Content });
             emit messagesChanged();
         }
 
         currentAIStream_.clear();
         currentAIRole_ = "assistant";
+        streamRowOpen_ = false;
         emit streamFinishedSignal();
     }
 }
@@ -150,97 +154,165 @@ void ChatImpl::updateCurrentAIStream(const QString& text)
     if (text.isEmpty())
         return;
 
+    // the stream only appends to its rows : from the one being written, or the next one, to the last one
+    int firstRow = streamRowOpen_ ? streamRow_ : streamRow_ + 1;
+    streamRolesChanged_ = false;
+
     bool finalized = text.endsWith("<end>");
     if (finalized)
-        currentAIStream_ = text.chopped(5);
-    else 
-        currentAIStream_ += text;
-
-    //qDebug() << "Chat::updateCurrentAIStream:" << text;
-    
-    sanitizeStream(currentAIStream_);
-
-    //qDebug() << "Chat::updateCurrentAIStream:" << currentAIStream_;
-
-    // find all "thought" or default assistant messages in the stream
-    struct MessageStringView
     {
-        MessageStringView(const QString& role, const QStringView& content) : role_(role), content_(content) { }
-        QString role_;
-        QStringView content_;
-    };
-    QVector<MessageStringView> messages;
-    long long currentIndex = 0L;
-    QStringView currentContent = currentAIStream_;
-    while (currentIndex < currentContent.length())
-    {
-        currentContent.slice(currentIndex);
-        if (currentContent.isEmpty())
-            break;
-
-        qsizetype iThinkBegin = currentContent.indexOf(QLatin1StringView("<think>"));
-        qsizetype iThinkEnd = currentContent.indexOf(QLatin1StringView("</think>"), iThinkBegin == -1 ? 0 : iThinkBegin + 7);
-        currentIndex = iThinkEnd != -1 ? iThinkEnd + 8 : currentContent.length();
-
-        // add default message before this thought
-        if (iThinkBegin > 0)
-            messages.emplace_back("assistant", currentContent.first(iThinkBegin));
-
-        // "think" END tag found !
-        if (iThinkEnd != -1)
+        QString response = text.chopped(5);
+        sanitizeStream(response);
+        if (response.startsWith(currentAIStream_))
         {
-            // "think" BEGIN tag found !
-            if (iThinkBegin != -1)            
-                messages.emplace_back("thought", currentContent.mid(iThinkBegin + 7, iThinkEnd - iThinkBegin - 7));
-            // here, no "think" BEGIN tag so the thought message should begin at index 0
-            else
-                messages.emplace_back("thought", currentContent.left(iThinkEnd));
-
-            // switch to default assistant role
-            currentIndex = iThinkEnd + 8;
-            currentAIRole_ = "assistant";
-        }
-        // NO "think" END tag and "think" BEGIN tag found !
-        else if (iThinkBegin != -1)
-        {
-            // switch to "thought" role
-            currentAIRole_ = "thought";
-            messages.emplace_back(currentAIRole_, currentContent.sliced(iThinkBegin + 7));
+            // the usual case : the final response goes on with the pieces not displayed yet
+            parseStream(QStringView(response).sliced(currentAIStream_.size()));
         }
-        // NO 'think" tags
         else
         {
-            // no think tags, keep on the current role (should be "thought" or default)
-            messages.emplace_back(currentAIRole_, currentContent);
-            // end of the loop
-            currentIndex = currentContent.length();
+            // written again from the first row of the response
+            resetStream();
+            firstRow = std::max(lastBotIndex_, 0);
+            parseStream(response);
         }
+        flushStream();
+        currentAIStream_.clear();
+    }
+    else
+    {
+        QString piece = text;
+        if (currentAIStream_.isEmpty())
+            sanitizeStream(piece);
+        currentAIStream_ += piece;
+        parseStream(piece);
+    }
+
+    if (streamRow_ >= firstRow)
+    {
+        if (streamRolesChanged_)
+            emit dataChanged(index(firstRow), index(streamRow_), { Role, Content });
+        else
+            emit dataChanged(index(firstRow), index(streamRow_), { Content });
+    }
+
+    emit messagesChanged();
+    emit streamUpdated(text);
+    emit contextSizeUsedChanged();
+}
+
+void ChatImpl::parseStream(QStringView text)
+{
+    static const QStringView thinkBegin(u"<think>");
+    static const QStringView thinkEnd(u"</think>");
+
+    // a tag cut by the previous piece is completed by this one
+    QString joined;
+    if (!streamTag_.isEmpty())
+    {
+        joined = streamTag_;
+        joined += text;
+        text = joined;
+        streamTag_.clear();
     }
 
-    // where to write the messages found ?
-    // at the begin of the ai response, a new message is appended in messages_
-    int msgindex = lastBotIndex_;
-    for (MessageStringView& msg : messages)
+    qsizetype begin = 0;
+    qsizetype position = 0;
+    while ((position = text.indexOf(u'<', position)) != -1)
     {
-        if (msgindex < messages_.size())
+        QStringView rest = text.sliced(position);
+        if (rest.startsWith(thinkBegin))
         {
-            modifyMessage(msgindex, msg.role_, msg.content_.toString());
-            messages_[msgindex] = QString("%1 %2\n").arg(aiPrompt_).arg(msg.content_.toString());
+            writeStream(text.sliced(begin, position - begin));
+            if (!streamRowOpen_ || !history_[streamRow_].content_.isEmpty())
+                openStreamRow("thought");
+            else if (history_[streamRow_].role_ != "thought")
+            {
+                // nothing written yet by this role : the thought takes its row
+                history_[streamRow_].role_ = "thought";
+                streamRolesChanged_ = true;
+            }
+            currentAIRole_ = "thought";
+            position += thinkBegin.size();
+            begin = position;
         }
-        else
+        else if (rest.startsWith(thinkEnd))
+        {
+            writeStream(text.sliced(begin, position - begin));
+            if (!streamRowOpen_)
+                openStreamRow("thought");
+            else if (history_[streamRow_].role_ != "thought")
+            {
+                // the opening tag was in the prompt : what was written is a thought
+                history_[streamRow_].role_ = "thought";
+                streamRolesChanged_ = true;
+            }
+            currentAIRole_ = "assistant";
+            streamRowOpen_ = false;
+            position += thinkEnd.size();
+            begin = position;
+        }
+        else if (thinkBegin.startsWith(rest) || thinkEnd.startsWith(rest))
         {
-            addMessage(msg.role_, msg.content_.toString());
-            messages_.emplace_back(QString("%1 %2\n").arg(aiPrompt_).arg(msg.content_.toString()));
+            // the beginning of a tag ends this piece : kept until the next one
+            writeStream(text.sliced(begin, position - begin));
+            streamTag_ = rest.toString();
+            return;
         }
-        msgindex++;
+        else
+            ++position;
     }
+    writeStream(text.sliced(begin));
+}
 
-    if (finalized)
-        currentAIStream_.clear();
+void ChatImpl::writeStream(QStringView text)
+{
+    if (text.isEmpty())
+        return;
 
-    emit messagesChanged();
-    emit streamUpdated(text);
-    emit contextSizeUsedChanged();
+    if (!streamRowOpen_)
+        openStreamRow(currentAIRole_);
+
+    history_[streamRow_].content_ += text;
+    messages_[streamRow_].insert(messages_[streamRow_].size() - 1, text);
+}
+
+void ChatImpl::openStreamRow(const QString& role)
+{
+    addMessage(role, "");
+    messages_.append(QString("%1 \n").arg(aiPrompt_));
+    streamRow_ = history_.size() - 1;
+    streamRowOpen_ = true;
+}
+
+void ChatImpl::flushStream()
+{
+    // an unfinished tag is only text
+    QString tag = streamTag_;
+    streamTag_.clear();
+    writeStream(tag);
+}
+
+void ChatImpl::resetStream()
+{
+    // the rows written after the first one of the response are removed
+    if (lastBotIndex_ >= 0 && lastBotIndex_ + 1 < history_.size())
+    {
+        const qsizetype count = history_.size() - lastBotIndex_ - 1;
+        beginRemoveRows(QModelIndex(), lastBotIndex_ + 1, history_.size() - 1);
+        history_.remove(lastBotIndex_ + 1, count);
+        endRemoveRows();
+        messages_.remove(lastBotIndex_ + 1, count);
+    }
+    if (lastBotIndex_ >= 0)
+    {
+        history_[lastBotIndex_] = { "assistant", "" };
+        messages_[lastBotIndex_] = QString("%1 \n").arg(aiPrompt_);
+        streamRolesChanged_ = true;
+    }
+    streamRow_ = lastBotIndex_;
+    streamRowOpen_ = lastBotIndex_ >= 0;
+    streamTag_.clear();
+    currentAIRole_ = "assistant";
 }
 
 QString ChatImpl::getFormattedHistory() const
@@ -290,6 +362,10 @@ QJsonObject ChatImpl::toJson() const
     // TODO : fix api and model with the last api/model used by this chat
     json["api"] = currentApi_;
     json["model"] = currentModel_;
+    if (!draftModel_.isEmpty())
+        json["draftModel"] = draftModel_;
+    if (sampler_ != SamplerProfile())
+        json["sampler"] = sampler_.toJson();
     json["stream"] = streamed_;
     json["userPrompt"] = userPrompt_;
     json["aiPrompt"] = aiPrompt_;
@@ -339,6 +415,8 @@ void ChatImpl::fromJson(const QJsonObject& json)
         currentApi_ = api;
     if (!model.isEmpty())
         currentModel_ = model;
+    draftModel_ = json["draftModel"].toString();
+    sampler_ = SamplerProfile::fromJson(json["sampler"].toObject());
 
     streamed_ = json["stream"].toBool(true);
     userPrompt_ = json["userPrompt"].toString("🧑 >");
@@ -369,6 +447,9 @@ void ChatImpl::fromJson(const QJsonObject& json)
     messages_.clear();
     for (const auto& msg : history_)
         messages_.append(QString("%1 %2\n").arg(msg.role_ == "user" ? userPrompt_ : aiPrompt_).arg(msg.content_));
+    streamRow_ = -1;
+    streamRowOpen_ = false;
+    streamTag_.clear();
 
     qDebug() << "ChatImpl::fromJson" << this;
 
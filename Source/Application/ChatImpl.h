@@ -127,10 +127,45 @@ private:
 
     void sanitizeStream(QString& text);
 
+    /**
+     * @brief Analyse un morceau du flux de l'IA et l'ajoute aux messages de la réponse
+     * @param text Morceau du flux, sans le texte déjà analysé
+     *
+     * Machine à états incrémentale : le texte est ajouté au dernier message, les balises
+     * <think> et </think> changent de message et de rôle. Une balise coupée entre deux morceaux
+     * est conservée dans streamTag_ jusqu'au morceau suivant.
+     */
+    void parseStream(QStringView text);
+
+    /**
+     * @brief Ajoute du texte au message en cours d'écriture, ouvert avec le rôle courant si besoin
+     */
+    void writeStream(QStringView text);
+
+    /**
+     * @brief Ajoute un message vide à la réponse, qui reçoit la suite du flux
+     * @param role Rôle du message (assistant, thought)
+     */
+    void openStreamRow(const QString& role);
+
+    /**
+     * @brief Écrit comme du texte une balise inachevée à la fin du flux
+     */
+    void flushStream();
+
+    /**
+     * @brief Revient au premier message de la réponse, vidé, et supprime les suivants
+     */
+    void resetStream();
+
     int lastBotIndex_;       ///< Index du dernier message du bot
 
     QString userPrompt_;     ///< Prompt utilisateur courant
     QString aiPrompt_;       ///< Prompt de l'IA courant
     QString currentAIRole_{"assistant"};  ///< Rôle courant de l'IA (assistant, thought)
     QString currentAIStream_; ///< Flux courant de l'IA en cours de streaming
+    QString streamTag_;      ///< Début de balise <think> ou </think> en attente du morceau suivant
+    int streamRow_{-1};      ///< Message en cours d'écriture par le flux
+    bool streamRowOpen_{false};      ///< Le message streamRow_ reçoit encore le texte du rôle courant
+    bool streamRolesChanged_{false}; ///< Un rôle a changé pendant la mise à jour courante du flux
 };
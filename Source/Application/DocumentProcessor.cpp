@@ -10,67 +10,67 @@
 
 std::vector<DocumentChunk> DocumentProcessor::processFile(const QString& filePath, int chunkSize, int overlap)
 {
-    std::vector<DocumentChunk> chunks;
-    QFileInfo info(filePath);
-    QString extension = info.suffix().toLower();
-    QString fullText;
-    int pageCount = 1;
+    return chunkPages(QFileInfo(filePath).fileName(), extractPages(filePath), chunkSize, overlap);
+}
+
+QStringList DocumentProcessor::supportedFilters()
+{
+    return { "*.pdf", "*.txt", "*.md" };
+}
+
+std::vector<DocumentPage> DocumentProcessor::extractPages(const QString& filePath)
+{
+    std::vector<DocumentPage> pages;
+    QString extension = QFileInfo(filePath).suffix().toLower();
 
-    // 1. Extraction
     if (extension == "pdf")
     {
-        // For PDFs, we might want to chunk page by page to keep page numbers accurate,
-        // but for simplicity in this primitive phase, we'll process the whole text
-        // OR process page by page. Let's process page by page to get better metadata.
-
+        // PDFs are processed page by page to keep page numbers accurate
         std::unique_ptr<Poppler::Document> doc(Poppler::Document::load(filePath));
         if (!doc || doc->isLocked())
         {
             qWarning() << "DocumentProcessor: Failed to load PDF or it is locked:" << filePath;
-            return chunks;
+            return pages;
         }
 
-        pageCount = doc->numPages();
-        int globalChunkIndex = 0;
-
+        int pageCount = doc->numPages();
+        pages.reserve(pageCount);
         for (int i = 0; i < pageCount; ++i)
         {
             std::unique_ptr<Poppler::Page> pdfPage(doc->page(i));
             if (!pdfPage)
                 continue;
 
-            QString pageText = pdfPage->text(QRectF()); // Extract text from whole page
-
-            // Chunk this page
-            std::vector<QString> textChunks = chunkText(pageText, chunkSize, overlap);
-            for (const QString& text : textChunks)
-            {
-                chunks.push_back({ text, info.fileName(), i + 1, globalChunkIndex++ });
-            }
+            pages.push_back({ pdfPage->text(QRectF()), i + 1 }); // Extract text from whole page
         }
-        return chunks;
     }
     else if (extension == "txt" || extension == "md")
     {
-        fullText = extractTextFromTxt(filePath);
+        QString fullText = extractTextFromTxt(filePath);
+        if (!fullText.isEmpty())
+            pages.push_back({ fullText, -1 });
     }
     else
     {
         qWarning() << "DocumentProcessor: Unsupported file type:" << extension;
-        return chunks;
     }
 
-    // 2. Chunking for non-PDF (or if we had merged PDF text)
-    if (!fullText.isEmpty())
+    return pages;
+}
+
+std::vector<DocumentChunk> DocumentProcessor::chunkPages(
+    const QString& sourceFile, const std::vector<DocumentPage>& pages, int chunkSize, int overlap)
+{
+    std::vector<DocumentChunk> chunks;
+    int globalChunkIndex = 0;
+    for (const DocumentPage& page : pages)
     {
-        std::vector<QString> textChunks = chunkText(fullText, chunkSize, overlap);
-        int index = 0;
+        std::vector<QString> textChunks = chunkText(page.text, chunkSize, overlap);
         for (const QString& text : textChunks)
         {
-            chunks.push_back({ text, info.fileName(), -1, index++ });
+            chunks.push_back({ text, sourceFile, page.pageNumber, globalChunkIndex++ });
         }
     }
-
     return chunks;
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QString>
+#include <QStringList>
 #include <vector>
 
 struct DocumentChunk
@@ -11,12 +12,26 @@ struct DocumentChunk
     int chunkIndex;
 };
 
+struct DocumentPage
+{
+    QString text;
+    int pageNumber; // -1 for text files
+};
+
 class DocumentProcessor
 {
 public:
     // Main entry point: processes a file and returns a list of chunks
     static std::vector<DocumentChunk> processFile(const QString& filePath, int chunkSize = 512, int overlap = 50);
 
+    // Pipeline stages: extraction (Poppler / text file) then chunking, usable from different threads
+    static std::vector<DocumentPage> extractPages(const QString& filePath);
+    static std::vector<DocumentChunk> chunkPages(
+        const QString& sourceFile, const std::vector<DocumentPage>& pages, int chunkSize = 512, int overlap = 50);
+
+    // Name filters of the supported files ("*.pdf", ...)
+    static QStringList supportedFilters();
+
 private:
     // Extraction engines
     static QString extractTextFromPdf(const QString& path);
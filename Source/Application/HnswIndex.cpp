@@ -0,0 +1,389 @@
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+
+#include "VectorKernels.h"
+
+#include "HnswIndex.h"
+
+// "HNSW" : graph file written next to the vector file (native byte order, like RAG2)
+static const quint32 MAGIC = 0x57534E48;
+static const quint32 VERSION = 1;
+
+// Bounds of the graph parameters accepted from a file (levels grow as log(count) / log(M))
+static const quint32 MAX_M = 1024;
+static const qint32 MAX_LEVEL = 64;
+
+struct HnswIndexHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 dim;
+    quint32 M;
+    quint32 efConstruction;
+    qint32 maxLevel;
+    qint32 entryPoint;
+    quint32 count;
+    // followed by levels (count int), layer 0 links (count * (2M + 1) int),
+    // then the upper links of each node (levels[i] * (M + 1) int)
+};
+
+HnswIndex::HnswIndex(int dim, const Parameters& parameters, VectorAccessor vectorAt) :
+    dim_(dim), parameters_(parameters), vectorAt_(std::move(vectorAt)), random_(42)
+{
+    parameters_.M = std::max(parameters_.M, 2);
+    parameters_.efConstruction = std::max(parameters_.efConstruction, parameters_.M);
+    levelMultiplier_ = 1.0 / std::log(double(parameters_.M));
+}
+
+void HnswIndex::clear()
+{
+    levels_.clear();
+    level0Links_.clear();
+    upperLinks_.clear();
+    entryPoint_ = -1;
+    maxLevel_ = -1;
+}
+
+int HnswIndex::randomLevel()
+{
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return static_cast<int>(-std::log(1.0 - distribution(random_)) * levelMultiplier_);
+}
+
+float HnswIndex::dot(const float* a, const float* b) const
+{
+    return VectorKernels::dot(a, b, dim_);
+}
+
+int* HnswIndex::links(int index, int level)
+{
+    if (!level)
+        return level0Links_.data() + (size_t)index * (maxLinks(0) + 1);
+    return upperLinks_[index].data() + (size_t)(level - 1) * (maxLinks(level) + 1);
+}
+
+const int* HnswIndex::links(int index, int level) const
+{
+    return const_cast<HnswIndex*>(this)->links(index, level);
+}
+
+void HnswIndex::add(int index)
+{
+    if (index != count())
+    {
+        qWarning() << "HnswIndex: Rows must be added in order:" << index << "expected" << count();
+        return;
+    }
+
+    const int level = randomLevel();
+    levels_.push_back(level);
+    level0Links_.resize(level0Links_.size() + maxLinks(0) + 1, 0);
+    upperLinks_.emplace_back((size_t)level * (maxLinks(1) + 1), 0);
+
+    if (entryPoint_ < 0)
+    {
+        entryPoint_ = index;
+        maxLevel_ = level;
+        return;
+    }
+
+    const float* vector = vectorAt_(index);
+    int entry = greedyClosest(vector, entryPoint_, maxLevel_, level);
+    for (int l = std::min(level, maxLevel_); l >= 0; --l)
+    {
+        std::vector<ScoredIndex> candidates = searchLayer(vector, entry, parameters_.efConstruction, l);
+        entry = candidates.front().second;
+
+        selectNeighbors(candidates, parameters_.M);
+        for (const ScoredIndex& candidate : candidates)
+        {
+            connect(index, candidate.second, l);
+            connect(candidate.second, index, l);
+        }
+    }
+
+    if (level > maxLevel_)
+    {
+        maxLevel_ = level;
+        entryPoint_ = index;
+    }
+}
+
+std::vector<HnswIndex::ScoredIndex> HnswIndex::search(const float* query, int topK) const
+{
+    if (entryPoint_ < 0 || topK <= 0)
+        return {};
+
+    const int entry = greedyClosest(query, entryPoint_, maxLevel_, 0);
+    std::vector<ScoredIndex> results = searchLayer(query, entry, std::max(parameters_.efSearch, topK), 0);
+    if ((int)results.size() > topK)
+        results.resize(topK);
+    return results;
+}
+
+int HnswIndex::greedyClosest(const float* query, int entry, int fromLevel, int toLevel) const
+{
+    float best = similarity(query, entry);
+    for (int l = fromLevel; l > toLevel; --l)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            const int* neighbors = links(entry, l);
+            for (int i = 1; i <= neighbors[0]; ++i)
+            {
+                const float score = similarity(query, neighbors[i]);
+                if (score > best)
+                {
+                    best = score;
+                    entry = neighbors[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+    return entry;
+}
+
+std::vector<HnswIndex::ScoredIndex> HnswIndex::searchLayer(const float* query, int entry, int ef, int level) const
+{
+    // visit marks are per thread, so concurrent searches do not share them
+    thread_local std::vector<quint32> visited;
+    thread_local quint32 visitTag = 0;
+    if (visited.size() < levels_.size())
+        visited.resize(levels_.size(), 0);
+    if (++visitTag == 0)
+    {
+        std::fill(visited.begin(), visited.end(), 0);
+        visitTag = 1;
+    }
+
+    // candidates : best first, results : worst first
+    std::priority_queue<ScoredIndex> candidates;
+    std::priority_queue<ScoredIndex, std::vector<ScoredIndex>, std::greater<ScoredIndex>> results;
+
+    const float score = similarity(query, entry);
+    candidates.emplace(score, entry);
+    results.emplace(score, entry);
+    visited[entry] = visitTag;
+
+    while (!candidates.empty())
+    {
+        const ScoredIndex current = candidates.top();
+        if ((int)results.size() >= ef && current.first < results.top().first)
+            break;
+        candidates.pop();
+
+        const int* neighbors = links(current.second, level);
+        for (int i = 1; i <= neighbors[0]; ++i)
+        {
+            const int neighbor = neighbors[i];
+            if (visited[neighbor] == visitTag)
+                continue;
+            visited[neighbor] = visitTag;
+
+            const float neighborScore = similarity(query, neighbor);
+            if ((int)results.size() < ef || neighborScore > results.top().first)
+            {
+                candidates.emplace(neighborScore, neighbor);
+                results.emplace(neighborScore, neighbor);
+                if ((int)results.size() > ef)
+                    results.pop();
+            }
+        }
+    }
+
+    std::vector<ScoredIndex> sorted(results.size());
+    for (auto it = sorted.rbegin(); it != sorted.rend(); ++it)
+    {
+        *it = results.top();
+        results.pop();
+    }
+    return sorted;
+}
+
+void HnswIndex::selectNeighbors(std::vector<ScoredIndex>& candidates, int maxLinks) const
+{
+    if ((int)candidates.size() <= maxLinks)
+        return;
+
+    std::vector<ScoredIndex> selected;
+    selected.reserve(maxLinks);
+    for (const ScoredIndex& candidate : candidates)
+    {
+        if ((int)selected.size() >= maxLinks)
+            break;
+
+        const float* vector = vectorAt_(candidate.second);
+        bool keep = true;
+        for (const ScoredIndex& neighbor : selected)
+        {
+            if (dot(vector, vectorAt_(neighbor.second)) > candidate.first)
+            {
+                keep = false;
+                break;
+            }
+        }
+        if (keep)
+            selected.push_back(candidate);
+    }
+    candidates.swap(selected);
+}
+
+void HnswIndex::connect(int index, int neighbor, int level)
+{
+    int* neighbors = links(index, level);
+    const int max = maxLinks(level);
+    if (neighbors[0] < max)
+    {
+        neighbors[++neighbors[0]] = neighbor;
+        return;
+    }
+
+    // full : keep the most diverse links among the current ones and the new one
+    const float* vector = vectorAt_(index);
+    std::vector<ScoredIndex> candidates;
+    candidates.reserve(max + 1);
+    for (int i = 1; i <= max; ++i)
+        candidates.emplace_back(dot(vector, vectorAt_(neighbors[i])), neighbors[i]);
+    candidates.emplace_back(dot(vector, vectorAt_(neighbor)), neighbor);
+    std::sort(candidates.begin(), candidates.end(), std::greater<ScoredIndex>());
+
+    selectNeighbors(candidates, max);
+    neighbors[0] = static_cast<int>(candidates.size());
+    for (size_t i = 0; i < candidates.size(); ++i)
+        neighbors[i + 1] = candidates[i].second;
+}
+
+bool HnswIndex::save(const QString& path) const
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "HnswIndex: Cannot open file for writing:" << path;
+        return false;
+    }
+
+    HnswIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.dim = dim_;
+    header.M = parameters_.M;
+    header.efConstruction = parameters_.efConstruction;
+    header.maxLevel = maxLevel_;
+    header.entryPoint = entryPoint_;
+    header.count = count();
+
+    auto writeBlock = [&file](const void* data, qint64 size)
+    {
+        return !size || file.write(reinterpret_cast<const char*>(data), size) == size;
+    };
+
+    bool ok = writeBlock(&header, sizeof(header));
+    ok = ok && writeBlock(levels_.data(), levels_.size() * sizeof(int));
+    ok = ok && writeBlock(level0Links_.data(), level0Links_.size() * sizeof(int));
+    for (size_t i = 0; ok && i < upperLinks_.size(); ++i)
+        ok = writeBlock(upperLinks_[i].data(), upperLinks_[i].size() * sizeof(int));
+
+    if (!ok || !file.commit())
+    {
+        qWarning() << "HnswIndex: Cannot write file:" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool HnswIndex::load(const QString& path, int expectedCount)
+{
+    clear();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "HnswIndex: Cannot open file for reading:" << path;
+        return false;
+    }
+
+    auto readBlock = [&file](void* data, qint64 size)
+    {
+        return !size || file.read(reinterpret_cast<char*>(data), size) == size;
+    };
+
+    HnswIndexHeader header;
+    if (!readBlock(&header, sizeof(header)) || header.magic != MAGIC || header.version != VERSION)
+    {
+        qWarning() << "HnswIndex: Invalid header in:" << path;
+        return false;
+    }
+
+    // checked before sizing anything from the header : the graph covers the rows, its entry point is valid
+    const bool empty = header.count == 0;
+    if ((int)header.dim != dim_ || header.count != (quint32)expectedCount || expectedCount < 0
+        || header.M < 2 || header.M > MAX_M
+        || (empty ? header.entryPoint != -1 || header.maxLevel != -1
+                  : header.entryPoint < 0 || header.entryPoint >= (qint32)header.count
+                        || header.maxLevel < 0 || header.maxLevel > MAX_LEVEL))
+    {
+        qWarning() << "HnswIndex: Index does not match the vectors:" << path;
+        return false;
+    }
+
+    // the levels and the layer 0 links must be in the file
+    const quint64 level0Size = (quint64)header.count * (2 * header.M + 2) * sizeof(int);
+    if (level0Size > quint64(file.size()) - sizeof(header))
+    {
+        qWarning() << "HnswIndex: Truncated file:" << path;
+        return false;
+    }
+
+    parameters_.M = header.M;
+    parameters_.efConstruction = std::max((int)std::min<quint32>(header.efConstruction, INT_MAX), parameters_.M);
+    levelMultiplier_ = 1.0 / std::log(double(parameters_.M));
+
+    levels_.resize(header.count);
+    level0Links_.resize((size_t)header.count * (maxLinks(0) + 1));
+    bool ok = readBlock(levels_.data(), levels_.size() * sizeof(int));
+    ok = ok && readBlock(level0Links_.data(), level0Links_.size() * sizeof(int));
+    upperLinks_.resize(header.count);
+    for (quint32 i = 0; ok && i < header.count; ++i)
+    {
+        ok = levels_[i] >= 0 && levels_[i] <= header.maxLevel;
+        upperLinks_[i].resize(ok ? (size_t)levels_[i] * (maxLinks(1) + 1) : 0);
+        ok = ok && readBlock(upperLinks_[i].data(), upperLinks_[i].size() * sizeof(int));
+    }
+
+    // the greedy descent starts from the entry point on the top layer
+    ok = ok && (empty || levels_[header.entryPoint] == header.maxLevel);
+
+    // link lists must stay inside the graph
+    for (quint32 i = 0; ok && i < header.count; ++i)
+    {
+        for (int l = 0; ok && l <= levels_[i]; ++l)
+        {
+            const int* neighbors = links(i, l);
+            ok = neighbors[0] >= 0 && neighbors[0] <= maxLinks(l);
+            for (int j = 1; ok && j <= neighbors[0]; ++j)
+                ok = neighbors[j] >= 0 && neighbors[j] < (int)header.count && levels_[neighbors[j]] >= l;
+        }
+    }
+
+    if (!ok)
+    {
+        qWarning() << "HnswIndex: Truncated file:" << path;
+        clear();
+        return false;
+    }
+
+    entryPoint_ = header.entryPoint;
+    maxLevel_ = header.maxLevel;
+    return true;
+}
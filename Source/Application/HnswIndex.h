@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QString>
+#include <functional>
+#include <random>
+#include <utility>
+#include <vector>
+
+/**
+ * Hierarchical Navigable Small World graph (approximate nearest neighbour index).
+ *
+ * The index only stores the graph : vectors are read through the accessor, by row index,
+ * so it can sit on top of the VectorStore rows (mapped or appended).
+ * Similarity is the dot product, the stored embeddings being normalized.
+ * Rows are inserted incrementally, in row order. The graph is serialized to its own file.
+ */
+class HnswIndex
+{
+public:
+    struct Parameters
+    {
+        int M = 16;               ///< links per node on the upper layers (2 * M on layer 0)
+        int efConstruction = 200; ///< size of the candidate list while inserting
+        int efSearch = 64;        ///< size of the candidate list while searching (at least topK)
+    };
+
+    using VectorAccessor = std::function<const float*(int index)>;
+    using ScoredIndex = std::pair<float, int>;
+
+    HnswIndex(int dim, const Parameters& parameters, VectorAccessor vectorAt);
+
+    // Inserts row `index`, which must be the next one (index == count())
+    void add(int index);
+
+    // Top K rows sorted by similarity (descending)
+    std::vector<ScoredIndex> search(const float* query, int topK) const;
+
+    // Graph persistence, load replaces the parameters by the saved ones (except efSearch)
+    // and fails unless the graph covers exactly `expectedCount` rows
+    bool save(const QString& path) const;
+    bool load(const QString& path, int expectedCount);
+    void clear();
+
+    int count() const { return static_cast<int>(levels_.size()); }
+    const Parameters& parameters() const { return parameters_; }
+    void setEfSearch(int efSearch) { parameters_.efSearch = efSearch; }
+
+private:
+    int randomLevel();
+    float similarity(const float* query, int index) const { return dot(query, vectorAt_(index)); }
+    float dot(const float* a, const float* b) const;
+
+    // Greedy descent from `entry` on the layers ]toLevel, fromLevel]
+    int greedyClosest(const float* query, int entry, int fromLevel, int toLevel) const;
+    // Best `ef` nodes of a layer, sorted by similarity (descending)
+    std::vector<ScoredIndex> searchLayer(const float* query, int entry, int ef, int level) const;
+    // Diversity heuristic : keeps the candidates closer to the base node than to any kept neighbour
+    void selectNeighbors(std::vector<ScoredIndex>& candidates, int maxLinks) const;
+    void connect(int index, int neighbor, int level);
+
+    // Link list of a node on a layer : count followed by maxLinks(level) slots
+    int* links(int index, int level);
+    const int* links(int index, int level) const;
+    int maxLinks(int level) const { return level ? parameters_.M : 2 * parameters_.M; }
+
+    int dim_;
+    Parameters parameters_;
+    VectorAccessor vectorAt_;
+
+    std::vector<int> levels_;                  ///< top layer of each node
+    std::vector<int> level0Links_;             ///< count * (2M + 1)
+    std::vector<std::vector<int>> upperLinks_; ///< per node, levels_[i] blocks of (M + 1)
+    int entryPoint_{-1};
+    int maxLevel_{-1};
+
+    std::mt19937 random_;
+    double levelMultiplier_;
+};
@@ -0,0 +1,192 @@
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QThread>
+
+#include "IngestionPipeline.h"
+
+// Threads walking the directories, in addition to the extraction workers and the chunking stage
+static const int DISCOVERY_THREADS = 2;
+// Capacity of the queue of discovered files
+static const int FILE_QUEUE_SIZE = 1024;
+
+IngestionPipeline::IngestionPipeline(EmbedFunction embed, Sink sink, int embeddingBatchSize, int extractionWorkers) :
+    embed_(std::move(embed)),
+    sink_(std::move(sink)),
+    embeddingBatchSize_(std::max(embeddingBatchSize, 1)),
+    extractionWorkers_(extractionWorkers > 0 ? extractionWorkers : std::max(QThread::idealThreadCount(), 1)),
+    files_(FILE_QUEUE_SIZE),
+    documents_(2 * extractionWorkers_),
+    chunks_(4 * embeddingBatchSize_)
+{
+    // the workers block on the queues : every stage must get its own thread
+    pool_.setMaxThreadCount(extractionWorkers_ + 1 + DISCOVERY_THREADS);
+}
+
+IngestionPipeline::~IngestionPipeline()
+{
+    cancel();
+    pool_.waitForDone();
+}
+
+void IngestionPipeline::cancel()
+{
+    cancelled_ = true;
+    files_.abort();
+    documents_.abort();
+    chunks_.abort();
+}
+
+void IngestionPipeline::run(const QStringList& paths)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // consumers first, so the queues are drained as soon as the producers start
+    activeExtractions_ = extractionWorkers_;
+    for (int i = 0; i < extractionWorkers_; ++i)
+        pool_.start([this]() { extract(); });
+    pool_.start([this]() { chunk(); });
+
+    // run() holds one discovery token until every root path is scheduled
+    activeDiscoveries_ = 1;
+    for (const QString& root : paths)
+    {
+        // absolute paths all along : they identify the documents
+        QFileInfo info(root);
+        const QString path = info.absoluteFilePath();
+        if (info.isDir())
+        {
+            ++activeDiscoveries_;
+            pool_.start([this, path]() { discover(path, false); });
+        }
+        else if (info.isFile())
+        {
+            ++filesDiscovered_;
+            files_.push(path);
+        }
+    }
+    if (--activeDiscoveries_ == 0)
+        files_.close();
+
+    // the embedding stage runs on the calling thread
+    embed();
+    pool_.waitForDone();
+
+    qDebug() << "IngestionPipeline:" << filesExtracted_ << "files," << chunksEmbedded_ << "chunks in" << timer.elapsed()
+             << "ms" << (cancelled_ ? "(cancelled)" : "");
+}
+
+void IngestionPipeline::discover(const QString& dirPath, bool recursive)
+{
+    // the top level directory is split by subdirectory, each one being walked by its own task
+    if (!recursive)
+    {
+        QDirIterator dirs(dirPath, QDir::Dirs | QDir::NoDotAndDotDot);
+        while (dirs.hasNext() && !cancelled_)
+        {
+            const QString subdir = dirs.next();
+            ++activeDiscoveries_;
+            pool_.start([this, subdir]() { discover(subdir, true); });
+        }
+    }
+
+    QDirIterator it(dirPath, DocumentProcessor::supportedFilters(), QDir::Files,
+        recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+    while (it.hasNext() && !cancelled_)
+    {
+        ++filesDiscovered_;
+        if (!files_.push(it.next()))
+            break;
+    }
+
+    if (--activeDiscoveries_ == 0)
+        files_.close();
+}
+
+void IngestionPipeline::extract()
+{
+    QString path;
+    while (!cancelled_ && files_.pop(path))
+    {
+        if (filter_ && !filter_(path))
+        {
+            ++filesSkipped_;
+            continue;
+        }
+
+        ExtractedDocument document{ path, QFileInfo(path).fileName(), DocumentProcessor::extractPages(path) };
+        ++filesExtracted_;
+        if (!documents_.push(std::move(document)))
+            break;
+    }
+
+    if (--activeExtractions_ == 0)
+        documents_.close();
+}
+
+void IngestionPipeline::chunk()
+{
+    ExtractedDocument document;
+    while (!cancelled_ && documents_.pop(document))
+    {
+        std::vector<DocumentChunk> chunks = DocumentProcessor::chunkPages(document.sourceFile, document.pages);
+        chunksCreated_ += static_cast<int>(chunks.size());
+
+        // a document without chunks still reaches the sink, to be recorded
+        if (chunks.empty() && !chunks_.push({ document.path, DocumentChunk(), true, true }))
+            break;
+        for (size_t i = 0; i < chunks.size(); ++i)
+        {
+            if (!chunks_.push({ document.path, std::move(chunks[i]), i + 1 == chunks.size(), false }))
+                break;
+        }
+    }
+
+    chunks_.close();
+}
+
+void IngestionPipeline::embed()
+{
+    std::vector<PendingChunk> batch;
+    batch.reserve(embeddingBatchSize_);
+    while (!cancelled_ && chunks_.popBatch(batch, embeddingBatchSize_))
+    {
+        QStringList texts;
+        texts.reserve(batch.size());
+        for (const PendingChunk& pending : batch)
+        {
+            if (!pending.empty)
+                texts << pending.chunk.content;
+        }
+
+        std::vector<std::vector<float>> embeddings;
+        if (!texts.isEmpty())
+            embeddings = embed_(texts);
+        embeddings.resize(texts.size());
+        chunksEmbedded_ += static_cast<int>(texts.size());
+
+        // the batch may span several documents : the sink gets them one by one
+        std::vector<DocumentChunk> chunks;
+        std::vector<std::vector<float>> chunkEmbeddings;
+        size_t next = 0;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            PendingChunk& pending = batch[i];
+            if (!pending.empty)
+            {
+                chunks.push_back(std::move(pending.chunk));
+                chunkEmbeddings.push_back(std::move(embeddings[next++]));
+            }
+            if (pending.last || i + 1 == batch.size() || batch[i + 1].path != pending.path)
+            {
+                sink_(pending.path, chunks, chunkEmbeddings, pending.last);
+                chunks.clear();
+                chunkEmbeddings.clear();
+            }
+        }
+        batch.clear();
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <QStringList>
+#include <QThreadPool>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "DocumentProcessor.h"
+
+/**
+ * Staged document ingestion : discovery -> extraction -> chunking -> embedding.
+ *
+ * Directories are walked in parallel (one task per top-level subdirectory), a pool of workers
+ * extracts the files (Poppler / text), a chunking stage splits the pages and the embedding stage
+ * sends batches of chunks to the embedding function, then hands them to the sink.
+ * Stages are connected by bounded queues, so a slow stage throttles the previous ones.
+ * An optional filter lets the extraction workers skip the files which did not change.
+ * The sink receives the chunks of each document in order, and learns when a document is complete.
+ *
+ * The counters can be read from any thread while run() is in progress.
+ */
+class IngestionPipeline
+{
+public:
+    using EmbedFunction = std::function<std::vector<std::vector<float>>(const QStringList& texts)>;
+    // Chunks of one document (`path`), `complete` is set with its last ones (possibly none)
+    using Sink = std::function<void(const QString& path, std::vector<DocumentChunk>& chunks,
+        std::vector<std::vector<float>>& embeddings, bool complete)>;
+    // Returns false to skip the file, called by the extraction workers
+    using Filter = std::function<bool(const QString& path)>;
+
+    IngestionPipeline(EmbedFunction embed, Sink sink, int embeddingBatchSize, int extractionWorkers = 0);
+    ~IngestionPipeline();
+
+    void setFilter(Filter filter) { filter_ = std::move(filter); }
+
+    // Ingests the files and directories (recursively), blocks until all the stages are done
+    void run(const QStringList& paths);
+
+    // Stops all the stages, run() returns as soon as the workers noticed it
+    void cancel();
+    bool isCancelled() const { return cancelled_; }
+
+    int filesDiscovered() const { return filesDiscovered_; }
+    int filesExtracted() const { return filesExtracted_; }
+    int filesSkipped() const { return filesSkipped_; }
+    int chunksCreated() const { return chunksCreated_; }
+    int chunksEmbedded() const { return chunksEmbedded_; }
+
+private:
+    struct ExtractedDocument
+    {
+        QString path;
+        QString sourceFile;
+        std::vector<DocumentPage> pages;
+    };
+
+    // Chunk on its way to the embedding stage, or the end marker of a document without chunks
+    struct PendingChunk
+    {
+        QString path;
+        DocumentChunk chunk;
+        bool last{false};  ///< last item of the document
+        bool empty{false}; ///< marker only, no chunk
+    };
+
+    void discover(const QString& dirPath, bool recursive);
+    void extract();
+    void chunk();
+    void embed();
+
+    EmbedFunction embed_;
+    Sink sink_;
+    Filter filter_;
+    int embeddingBatchSize_;
+    int extractionWorkers_;
+
+    QThreadPool pool_;
+    BoundedQueue<QString> files_;
+    BoundedQueue<ExtractedDocument> documents_;
+    BoundedQueue<PendingChunk> chunks_;
+
+    // the last running task of a stage closes its output queue
+    std::atomic<int> activeDiscoveries_{0};
+    std::atomic<int> activeExtractions_{0};
+    std::atomic<bool> cancelled_{false};
+
+    std::atomic<int> filesDiscovered_{0};
+    std::atomic<int> filesExtracted_{0};
+    std::atomic<int> filesSkipped_{0};
+    std::atomic<int> chunksCreated_{0};
+    std::atomic<int> chunksEmbedded_{0};
+};
@@ -44,12 +44,16 @@ public:
     virtual bool start() { return true; };
     virtual bool stop() { return true; };
     virtual void setModel(Chat* chat, QString model = "") {}
+    virtual void preloadModel(const QString& model) { Q_UNUSED(model); }
     virtual bool isReady() const { return true; }
 
     virtual void post(Chat* chat, const QString& content, bool streamed = true) {}
 
     virtual void stopStream(Chat* chat) { Q_UNUSED(chat); }
 
+    // The chat is deleted by the user : the service drops what it keeps for it
+    virtual void deleteChat(Chat* chat) { Q_UNUSED(chat); }
+
     virtual QString formatMessages(const Chat* chat) const { return {}; }
     
     virtual QString formatMessage(const Chat* chat, int historyIndex) const { return {}; }
@@ -94,6 +98,14 @@ public:
     }
 
     virtual std::vector<float> getEmbedding(const QString& text) { return {}; }
+    virtual std::vector<std::vector<float>> getEmbeddings(const QStringList& texts)
+    {
+        std::vector<std::vector<float>> embeddings;
+        embeddings.reserve(texts.size());
+        for (const QString& text : texts)
+            embeddings.push_back(getEmbedding(text));
+        return embeddings;
+    }
     virtual std::vector<LLMModel> getAvailableModels() const { return {}; }
     
     LLMServices* llmservices_;
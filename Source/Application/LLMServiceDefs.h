@@ -3,8 +3,23 @@
 #include "define.h"
 
 const int LLM_DEFAULT_CONTEXT_SIZE = 2048;
-const int LLM_BATCH_SIZE = 2048;
+const int LLM_BATCH_SIZE = 512;
+const int LLM_UBATCH_SIZE = 512;
 const int LLM_MAX_TOKEN_LEN = 20;
+const int LLM_EMBEDDING_MIN_CONTEXT_SIZE = 512;
+const int LLM_EMBEDDING_BATCH_SIZE = 4096;
+const int LLM_EMBEDDING_MAX_SEQUENCES = 64;
+const int LLM_ENGINE_MAX_SEQUENCES = 4;
+const int LLM_STREAM_FRAME_MS = 16;
+const int LLM_PREFIX_CACHE_SIZE = 512;
+const int LLM_SESSION_CACHE_SIZE = 2048;
+const int LLM_CONTEXT_SHIFT_KEEP = 256;
+const int LLM_DRAFT_MAX_TOKENS = 8;
+const float LLM_DRAFT_MIN_PROBABILITY = 0.75f;
+const float LLM_SAMPLER_TEMPERATURE = 0.8f;
+const float LLM_SAMPLER_MIN_P = 0.05f;
+const int LLM_MODEL_MEMORY_BUDGET = 0;
+const int LLM_MEMORY_MARGIN = 256;
 
 class LLMEnum : public QObject
 {
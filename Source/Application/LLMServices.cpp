@@ -95,6 +95,16 @@ void LLMServices::stop(Chat* chat)
         api->stopStream(chat);
 }
 
+void LLMServices::deleteChat(Chat* chat)
+{
+    // the chat may have used several services
+    for (LLMService* api : apiEntries_)
+    {
+        if (api)
+            api->deleteChat(chat);
+    }
+}
+
 bool LLMServices::isServiceAvailable(LLMEnum::LLMType service) const 
 { 
     LLMService* api = get(service);
@@ -166,6 +176,24 @@ std::vector<float> LLMServices::getEmbedding(const QString& text)
     return {};
 }
 
+std::vector<std::vector<float>> LLMServices::getEmbeddings(const QStringList& texts)
+{
+    // Prefer LlamaCpp
+    for (LLMService* api : apiEntries_)
+    {
+        if (api->type_ == LLMEnum::LLMType::LlamaCpp && api->isReady())
+        {
+            std::vector<std::vector<float>> res = api->getEmbeddings(texts);
+            for (const std::vector<float>& emb : res)
+            {
+                if (!emb.empty())
+                    return res;
+            }
+        }
+    }
+    return std::vector<std::vector<float>>(texts.size());
+}
+
 bool LLMServices::loadServiceJsonFile()
 {
     QFile file("LLMService.json");
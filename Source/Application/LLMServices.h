@@ -51,6 +51,12 @@ public:
      * @param chat Chat à arrêter
      */
     void stop(Chat* chat);
+
+    /**
+     * @brief Signale la suppression d'un chat à toutes les APIs
+     * @param chat Chat supprimé
+     */
+    void deleteChat(Chat* chat);
     
     /**
      * @brief Envoie une requête à une API LLM
@@ -129,6 +135,13 @@ public:
      */
     std::vector<float> getEmbedding(const QString& text);
 
+    /**
+     * @brief Génère les embeddings d'une liste de textes en un minimum de passes
+     * @param texts Textes à encoder
+     * @return Un embedding par texte, dans le même ordre (vide en cas d'échec)
+     */
+    std::vector<std::vector<float>> getEmbeddings(const QStringList& texts);
+
     /**
      * @brief Retourne la taille de contexte par défaut
      * @return Taille de contexte par défaut
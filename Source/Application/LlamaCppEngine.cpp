@@ -0,0 +1,954 @@
+#include "LlamaCppEngine.h"
+
+#include <algorithm>
+#include <map>
+
+#include "LlamaCppService.h"
+#include "LlamaSessionStore.h"
+
+namespace
+{
+// tokens kept free at the end of a chat context (same margin as LlamaGenerateStep)
+const int CONTEXT_MARGIN = 50;
+}
+
+struct LlamaCppEngine::Request
+{
+    LlamaCppChatData* data{nullptr};
+    std::vector<llama_token> tokens; // context to have in the kv cache before sampling
+    TokenCallback onToken;
+    FinishCallback onFinished;
+    ProgressCallback onProgress;
+    int prefill{0};                  // tokens to decode at admission, before the first sampling
+    bool stop{false};
+};
+
+struct LlamaCppEngine::Sequence
+{
+    llama_seq_id id{0};
+    LlamaCppChatData* data{nullptr};  // chat owning the kv cache of the sequence (nullptr : free)
+    std::vector<llama_token> cached;  // tokens in the kv cache, at positions 0..n-1
+    std::vector<llama_token> pending; // tokens to decode : prompt suffix, then the last sampled token
+    std::vector<llama_token> draft;   // tokens proposed after the sampled token, at the end of pending during a step
+    std::unique_ptr<Request> request; // running request (nullptr : idle, the kv cache is kept)
+    quint64 admitted{0};              // admission of the running request
+    quint64 used{0};                  // last use, for the LRU eviction of the idle sequences
+    int chunk{0};                     // pending tokens submitted in the current batch
+    int logits{-1};                   // batch index of the logits sampled after the current batch
+
+    // cells of the kv cache by block of positions : (block, end position), a block starts where the
+    // previous one ends. Blocks copied from another sequence share their cells with it.
+    std::vector<std::pair<quint64, int>> blocks;
+    quint64 block{0};                 // block receiving the decoded tokens
+};
+
+LlamaCppEngine::LlamaCppEngine(LlamaModelData* model, int n_ctx, int n_seq_max, int n_batch, int n_ubatch) :
+    model_(model),
+    n_seq_max_(std::max(1, n_seq_max)),
+    batchSize_(std::max(1, n_batch)),
+    ubatchSize_(std::clamp(n_ubatch, 1, batchSize_))
+{
+    sequences_.resize(n_seq_max_);
+    for (int i = 0; i < n_seq_max_; ++i)
+        sequences_[i].id = i;
+
+    resize(n_ctx);
+    if (!ctx_)
+    {
+        qWarning() << "LlamaCppEngine: unable to create the shared context for" << model_->modelName_;
+        return;
+    }
+
+    thread_ = QThread::create([this]() { run(); });
+    thread_->start();
+}
+
+LlamaCppEngine::~LlamaCppEngine()
+{
+    if (thread_)
+    {
+        {
+            QMutexLocker locker(&mutex_);
+            quit_ = true;
+            condition_.wakeAll();
+        }
+        thread_->wait();
+        delete thread_;
+    }
+
+    if (ctx_)
+    {
+        llama_batch_free(batch_);
+        llama_free(ctx_);
+    }
+}
+
+int LlamaCppEngine::contextSize() const
+{
+    QMutexLocker locker(&mutex_);
+    return n_ctx_;
+}
+
+bool LlamaCppEngine::submit(LlamaCppChatData* data, TokenCallback onToken, FinishCallback onFinished,
+                            ProgressCallback onProgress)
+{
+    QMutexLocker locker(&mutex_);
+    if (!ctx_)
+        return false;
+
+    for (const std::unique_ptr<Request>& request : waiting_)
+    {
+        if (request->data == data)
+            return false;
+    }
+    for (const Sequence& sequence : sequences_)
+    {
+        if (sequence.request && sequence.data == data)
+            return false;
+    }
+
+    std::unique_ptr<Request> request = std::make_unique<Request>();
+    request->data = data;
+    request->tokens = data->context_tokens_;
+    request->onToken = std::move(onToken);
+    request->onFinished = std::move(onFinished);
+    request->onProgress = std::move(onProgress);
+    waiting_.push_back(std::move(request));
+
+    condition_.wakeAll();
+    return true;
+}
+
+void LlamaCppEngine::cancel(LlamaCppChatData* data)
+{
+    QMutexLocker locker(&mutex_);
+
+    for (auto it = waiting_.begin(); it != waiting_.end(); ++it)
+    {
+        if ((*it)->data == data)
+        {
+            std::unique_ptr<Request> request = std::move(*it);
+            waiting_.erase(it);
+            if (request->onFinished)
+                request->onFinished(0, QString());
+            return;
+        }
+    }
+
+    for (Sequence& sequence : sequences_)
+    {
+        if (sequence.request && sequence.data == data)
+        {
+            sequence.request->stop = true;
+            condition_.wakeAll();
+            return;
+        }
+    }
+}
+
+void LlamaCppEngine::release(LlamaCppChatData* data)
+{
+    QMutexLocker locker(&mutex_);
+
+    // the batch being decoded may use the sampler of the chat
+    while (busy_)
+        condition_.wait(&mutex_);
+
+    waiting_.erase(std::remove_if(waiting_.begin(), waiting_.end(),
+                       [data](const std::unique_ptr<Request>& request) { return request->data == data; }),
+        waiting_.end());
+
+    for (Sequence& sequence : sequences_)
+    {
+        if (sequence.data == data)
+        {
+            sequence.request.reset();
+            evict(sequence);
+        }
+    }
+}
+
+void LlamaCppEngine::reserve(int n_ctx)
+{
+    QMutexLocker locker(&mutex_);
+    if (n_ctx > n_ctx_ && n_ctx > requestedContext_)
+    {
+        requestedContext_ = n_ctx;
+        condition_.wakeAll();
+    }
+}
+
+void LlamaCppEngine::saveSession(LlamaCppChatData* data)
+{
+    if (!data->sessions_)
+        return;
+
+    QMutexLocker locker(&mutex_);
+
+    // the cells are being written by the current step
+    while (busy_)
+        condition_.wait(&mutex_);
+
+    for (const Sequence& sequence : sequences_)
+    {
+        if (sequence.data == data && !sequence.cached.empty())
+        {
+            data->sessions_->save(ctx_, sequence.id, data->chatId_, sessionKey_, sequence.cached);
+            return;
+        }
+    }
+}
+
+void LlamaCppEngine::run()
+{
+    QMutexLocker locker(&mutex_);
+    while (true)
+    {
+        while (!quit_ && !hasWork())
+            condition_.wait(&mutex_);
+        if (quit_)
+            break;
+
+        step(locker);
+    }
+}
+
+bool LlamaCppEngine::hasWork() const
+{
+    if (requestedContext_ > n_ctx_ || !waiting_.empty())
+        return true;
+
+    for (const Sequence& sequence : sequences_)
+    {
+        if (sequence.request)
+            return true;
+    }
+    return false;
+}
+
+void LlamaCppEngine::step(QMutexLocker<QMutex>& locker)
+{
+    if (requestedContext_ > n_ctx_)
+        resize(requestedContext_);
+
+    if (!ctx_)
+    {
+        // the context could not be created again : nothing can run anymore
+        for (Sequence& sequence : sequences_)
+        {
+            if (sequence.request)
+                finish(sequence, -2);
+        }
+        while (!waiting_.empty())
+        {
+            std::unique_ptr<Request> request = std::move(waiting_.front());
+            waiting_.pop_front();
+            if (request->onFinished)
+                request->onFinished(-2, QString());
+        }
+        return;
+    }
+
+    admit();
+
+    // stopped requests end before the next decode
+    for (Sequence& sequence : sequences_)
+    {
+        if (sequence.request && sequence.request->stop)
+            finish(sequence, 0);
+    }
+
+    // next token of the generating sequences first, then the prompt chunks in admission order
+    std::vector<Sequence*> order;
+    for (Sequence& sequence : sequences_)
+    {
+        if (sequence.request && !sequence.pending.empty())
+            order.push_back(&sequence);
+    }
+    std::sort(order.begin(), order.end(),
+        [](const Sequence* a, const Sequence* b)
+        {
+            const bool aDecoding = a->pending.size() == 1;
+            const bool bDecoding = b->pending.size() == 1;
+            return aDecoding != bDecoding ? aDecoding : a->admitted < b->admitted;
+        });
+
+    batch_.n_tokens = 0;
+    for (Sequence* sequence : order)
+    {
+        // preempted to make room for a previous one
+        if (!sequence->request)
+            continue;
+
+        const int room = n_batch_ - batch_.n_tokens;
+        if (room <= 0)
+            break;
+
+        const int n_context = sequence->cached.size() + sequence->pending.size();
+        if (n_context >= sequence->data->n_ctx_ - CONTEXT_MARGIN && !expandContext(*sequence)
+            && !shiftContext(*sequence))
+        {
+            qWarning() << "LlamaCppEngine: error -1 = ontext exceeded";
+            finish(*sequence, -1);
+            continue;
+        }
+
+        // the sampled token carries the tokens proposed after it, verified with its logits
+        const bool decoding = sequence->pending.size() == 1;
+        if (decoding)
+        {
+            LlamaCppChatData* data = sequence->data;
+            const int n_draft = std::min({ room - 1, data->n_ctx_ - CONTEXT_MARGIN - n_context - 1, data->draftMax_ });
+            sequence->draft = data->proposeDraft(sequence->cached, sequence->pending, n_draft);
+            sequence->pending.insert(sequence->pending.end(), sequence->draft.begin(), sequence->draft.end());
+        }
+
+        // a decode step may preempt other sequences, a prompt chunk takes what is free
+        int n_tokens = std::min(room, (int)sequence->pending.size());
+        if (!makeRoom(n_tokens, sequence, decoding))
+        {
+            n_tokens = std::min(n_tokens, n_ctx_ - usedCells() - batch_.n_tokens);
+            if (n_tokens < (int)sequence->pending.size() && !sequence->draft.empty())
+            {
+                sequence->pending.resize(1);
+                sequence->draft.clear();
+                n_tokens = std::min(n_tokens, 1);
+            }
+            if (n_tokens <= 0)
+                continue;
+        }
+
+        addToBatch(*sequence, n_tokens);
+    }
+
+    if (!batch_.n_tokens)
+    {
+        // nothing fits : a chat context larger than the kv cache which cannot grow
+        if (requestedContext_ <= n_ctx_)
+        {
+            for (Sequence& sequence : sequences_)
+            {
+                if (sequence.request)
+                {
+                    qWarning() << "LlamaCppEngine: error -1 = ontext exceeded";
+                    finish(sequence, -1);
+                }
+            }
+        }
+        return;
+    }
+
+    busy_ = true;
+    locker.unlock();
+
+    const int ret = llama_decode(ctx_, batch_);
+
+    // sample the sequences whose context is completely decoded, verifying their proposed tokens
+    std::vector<std::pair<Sequence*, std::vector<llama_token>>> sampled;
+    if (ret == 0)
+    {
+        for (Sequence& sequence : sequences_)
+        {
+            if (sequence.chunk && sequence.logits >= 0)
+                sampled.emplace_back(&sequence,
+                    LlamaSpeculativeAccept(sequence.data->smpl_, ctx_, sequence.logits, sequence.draft));
+        }
+    }
+
+    locker.relock();
+    busy_ = false;
+    condition_.wakeAll();
+
+    if (ret != 0)
+    {
+        std::vector<Sequence*> decoded;
+        for (Sequence& sequence : sequences_)
+        {
+            if (sequence.chunk)
+                decoded.push_back(&sequence);
+            sequence.chunk = 0;
+            sequence.logits = -1;
+
+            // the tokens are proposed again at the next step
+            sequence.pending.resize(sequence.pending.size() - sequence.draft.size());
+            sequence.draft.clear();
+        }
+
+        if (ret == 1)
+        {
+            // no kv slot : drop an idle sequence and retry at the next step
+            qDebug() << "LlamaCppEngine: no kv slot for a batch of" << batch_.n_tokens << "tokens";
+            const int n_free = n_ctx_ - usedCells();
+            batch_.n_tokens = 0;
+            if (makeRoom(n_free + 1, nullptr, false))
+                return;
+        }
+        else
+            qWarning() << "LlamaCppEngine: error -2 = failed to decode" << ret;
+
+        for (Sequence* sequence : decoded)
+        {
+            // drop what the failed batch left in the kv cache
+            llama_memory_seq_rm(llama_get_memory(ctx_), sequence->id, sequence->cached.size(), -1);
+            finish(*sequence, ret == 1 ? -1 : -2);
+        }
+        return;
+    }
+
+    for (Sequence& sequence : sequences_)
+    {
+        if (!sequence.chunk)
+            continue;
+
+        sequence.cached.insert(sequence.cached.end(), sequence.pending.begin(), sequence.pending.begin() + sequence.chunk);
+        if (sequence.blocks.empty() || sequence.blocks.back().first != sequence.block)
+            sequence.blocks.emplace_back(sequence.block, 0);
+        sequence.blocks.back().second = sequence.cached.size();
+        sequence.pending.erase(sequence.pending.begin(), sequence.pending.begin() + sequence.chunk);
+        sequence.chunk = 0;
+        sequence.logits = -1;
+        sequence.data->n_ctx_used_ = sequence.cached.size();
+
+        // a prompt decoded over several steps, until its last chunk
+        Request& request = *sequence.request;
+        if (request.onProgress && request.prefill > n_batch_)
+        {
+            request.onProgress(1.0 - double(sequence.pending.size()) / request.prefill);
+            if (sequence.pending.empty())
+                request.prefill = 0;
+        }
+    }
+
+    const llama_vocab* vocab = llama_model_get_vocab(model_->model_);
+    for (std::pair<Sequence*, std::vector<llama_token>>& entry : sampled)
+    {
+        Sequence& sequence = *entry.first;
+        LlamaCppChatData* data = sequence.data;
+        std::vector<llama_token>& tokens = entry.second;
+
+        // the accepted tokens end at the first end of generation, the rejected ones leave the kv cache
+        auto eog = std::find_if(tokens.begin(), tokens.end(),
+                                [vocab](llama_token token) { return llama_vocab_is_eog(vocab, token); });
+        if (eog != tokens.end())
+            tokens.erase(eog + 1, tokens.end());
+        if (!sequence.draft.empty())
+        {
+            const int n_rejected = sequence.draft.size() - (tokens.size() - 1);
+            if (n_rejected > 0)
+            {
+                const int n_cached = sequence.cached.size() - n_rejected;
+                llama_memory_seq_rm(llama_get_memory(ctx_), sequence.id, n_cached, -1);
+                sequence.cached.resize(n_cached);
+                sequence.blocks.back().second = n_cached;
+                data->n_ctx_used_ = n_cached;
+            }
+            data->draftStats_.drafted += sequence.draft.size();
+            data->draftStats_.accepted += tokens.size() - 1;
+            sequence.draft.clear();
+        }
+
+        int status = 1;
+        for (llama_token token : tokens)
+        {
+            data->currentToken_ = token;
+            data->response_tokens_.push_back(token);
+
+            if (llama_vocab_is_eog(vocab, token))
+            {
+                status = 0;
+                break;
+            }
+
+            if (!data->detokenizer_.push(vocab, token))
+            {
+                qWarning() << "LlamaCppEngine: error -3 = failed to convert token to piece";
+                status = -3;
+                break;
+            }
+        }
+
+        // a character split between tokens is sent with its last token
+        data->response_ = data->detokenizer_.take();
+        if (!data->response_.isEmpty() && sequence.request->onToken)
+            sequence.request->onToken(data->response_);
+
+        if (status <= 0)
+        {
+            finish(sequence, status);
+            continue;
+        }
+
+        sequence.pending.assign(1, tokens.back());
+    }
+}
+
+void LlamaCppEngine::admit()
+{
+    while (!waiting_.empty())
+    {
+        Request& request = *waiting_.front();
+
+        // the whole context must fit next to the running sequences (idle ones can be evicted),
+        // otherwise a partially decoded prompt would be preempted again by the running ones
+        int runningCells = 0;
+        bool running = false;
+        for (const Sequence& sequence : sequences_)
+        {
+            if (sequence.request)
+            {
+                runningCells += sequence.cached.size() + sequence.pending.size();
+                running = true;
+            }
+        }
+        if (running && runningCells + (int)request.tokens.size() > n_ctx_)
+            break;
+
+        // the sequence holding the kv cache of the chat, a free one or the least recently used idle one
+        Sequence* target = nullptr;
+        for (Sequence& sequence : sequences_)
+        {
+            if (sequence.data == request.data)
+            {
+                target = &sequence;
+                break;
+            }
+        }
+        if (!target)
+        {
+            for (Sequence& sequence : sequences_)
+            {
+                if (!sequence.data)
+                {
+                    target = &sequence;
+                    break;
+                }
+            }
+        }
+        if (!target)
+        {
+            for (Sequence& sequence : sequences_)
+            {
+                if (!sequence.request && (!target || sequence.used < target->used))
+                    target = &sequence;
+            }
+        }
+        if (!target)
+            break;
+
+        if (target->data != request.data)
+        {
+            evict(*target);
+            target->data = request.data;
+        }
+
+        // decode only the part of the context missing from the kv cache,
+        // at least the last token since its logits are needed to sample the answer
+        const std::vector<llama_token>& tokens = request.tokens;
+        size_t common = 0;
+        while (common < target->cached.size() && common < tokens.size() && target->cached[common] == tokens[common])
+            ++common;
+        if (common && common == tokens.size())
+            --common;
+
+        if (common < target->cached.size())
+        {
+            if (!llama_memory_seq_rm(llama_get_memory(ctx_), target->id, common, -1))
+            {
+                // partial removal not supported by this memory (recurrent models)
+                llama_memory_seq_rm(llama_get_memory(ctx_), target->id, -1, -1);
+                common = 0;
+            }
+            truncate(*target, common);
+        }
+        sharePrefix(*target, tokens);
+        common = target->cached.size();
+        target->pending.assign(tokens.begin() + common, tokens.end());
+
+        target->request = std::move(waiting_.front());
+        target->request->prefill = target->pending.size();
+        waiting_.pop_front();
+        target->admitted = target->used = ++clock_;
+
+        if (target->pending.empty())
+            finish(*target, 0);
+    }
+}
+
+void LlamaCppEngine::sharePrefix(Sequence& target, const std::vector<llama_token>& tokens)
+{
+    // the last token is always decoded again
+    const int maxLength = int(tokens.size()) - 1;
+    const int own = int(target.cached.size());
+
+    // the longest prefix held by another sequence, its cells are shared
+    Sequence* donor = nullptr;
+    int shared = own;
+    for (Sequence& sequence : sequences_)
+    {
+        if (&sequence == &target || sequence.cached.empty())
+            continue;
+        int common = 0;
+        while (common < maxLength && common < int(sequence.cached.size()) && sequence.cached[common] == tokens[common])
+            ++common;
+        if (common > shared)
+        {
+            shared = common;
+            donor = &sequence;
+        }
+    }
+
+    // or a saved state of a previous sequence
+    LlamaPrefixCache::Match match;
+    if (model_->prefixCache_)
+        match = model_->prefixCache_->lookup(tokens);
+    int restored = std::min(match.length, maxLength);
+
+    llama_memory_t mem = llama_get_memory(ctx_);
+
+    // a reopened chat may have its session saved on disk
+    LlamaCppChatData* data = target.data;
+    if (!own && data->sessions_ && std::max(shared, restored) < maxLength
+        && data->sessions_->contains(data->chatId_, sessionKey_) && makeRoom(maxLength, &target, false))
+    {
+        int loaded = data->sessions_->restore(ctx_, target.id, data->chatId_, sessionKey_, tokens, maxLength);
+        if (loaded > std::max(shared, restored))
+        {
+            target.cached.assign(tokens.begin(), tokens.begin() + loaded);
+            target.blocks.clear();
+            truncate(target, loaded);
+            target.blocks.emplace_back(target.block, loaded);
+            return;
+        }
+        llama_memory_seq_rm(mem, target.id, -1, -1);
+
+        // the donor may have been evicted to make room
+        if (donor && donor->cached.empty())
+            donor = nullptr;
+    }
+
+    if (donor && shared >= restored)
+    {
+        llama_memory_seq_rm(mem, target.id, -1, -1);
+        llama_memory_seq_cp(mem, donor->id, target.id, 0, shared);
+        target.cached.assign(tokens.begin(), tokens.begin() + shared);
+        target.blocks = donor->blocks;
+        truncate(target, shared);
+        qDebug() << "LlamaCppEngine: sharing" << shared << "tokens of the sequence" << donor->id << "with" << target.id;
+    }
+    else if (restored > own && LlamaPrefixCache::worthStoring(restored)
+             && makeRoom(int(match.state->tokens.size()), &target, false))
+    {
+        restored = LlamaPrefixCache::restoreSequence(ctx_, target.id, match, maxLength);
+        target.cached.assign(tokens.begin(), tokens.begin() + restored);
+        target.blocks.clear();
+        truncate(target, restored);
+        if (restored)
+            target.blocks.emplace_back(target.block, restored);
+    }
+}
+
+int LlamaCppEngine::addToBatch(Sequence& sequence, int maxTokens)
+{
+    const int n_tokens = std::min(maxTokens, (int)sequence.pending.size());
+    const int first = sequence.cached.size();
+    for (int i = 0; i < n_tokens; ++i)
+    {
+        const int idx = batch_.n_tokens++;
+        batch_.token[idx] = sequence.pending[i];
+        batch_.pos[idx] = first + i;
+        batch_.n_seq_id[idx] = 1;
+        batch_.seq_id[idx][0] = sequence.id;
+        batch_.logits[idx] = false;
+    }
+
+    // the whole context is decoded by this batch : its last logits give the next token,
+    // preceded by those of the sampled token and of the proposed tokens which verify them
+    if (n_tokens == (int)sequence.pending.size())
+    {
+        sequence.logits = batch_.n_tokens - 1 - sequence.draft.size();
+        for (int idx = sequence.logits; idx < batch_.n_tokens; ++idx)
+            batch_.logits[idx] = true;
+    }
+
+    sequence.chunk = n_tokens;
+    sequence.used = ++clock_;
+    return n_tokens;
+}
+
+bool LlamaCppEngine::makeRoom(int n_cells, const Sequence* keep, bool preempting)
+{
+    while (n_ctx_ - usedCells() - batch_.n_tokens < n_cells)
+    {
+        // idle sequences first (least recently used), then the last admitted running ones
+        Sequence* victim = nullptr;
+        for (Sequence& sequence : sequences_)
+        {
+            if (&sequence != keep && !sequence.request && !sequence.cached.empty()
+                && (!victim || sequence.used < victim->used))
+                victim = &sequence;
+        }
+        if (!victim && preempting)
+        {
+            for (Sequence& sequence : sequences_)
+            {
+                if (&sequence != keep && sequence.request && !sequence.chunk && !sequence.cached.empty()
+                    && (!victim || sequence.admitted > victim->admitted))
+                    victim = &sequence;
+            }
+        }
+        if (!victim)
+            return false;
+
+        if (victim->request)
+            preempt(*victim);
+        else
+            evict(*victim);
+    }
+    return true;
+}
+
+void LlamaCppEngine::evict(Sequence& sequence)
+{
+    if (!sequence.cached.empty())
+    {
+        // the chat or another one may come back with the same prefix
+        if (model_->prefixCache_)
+            model_->prefixCache_->storeSequence(ctx_, sequence.id, sequence.cached);
+        llama_memory_seq_rm(llama_get_memory(ctx_), sequence.id, -1, -1);
+    }
+    truncate(sequence, 0);
+    sequence.pending.clear();
+    sequence.data = nullptr;
+    sequence.chunk = 0;
+    sequence.logits = -1;
+}
+
+void LlamaCppEngine::preempt(Sequence& sequence)
+{
+    qDebug() << "LlamaCppEngine: kv cache full, preempting sequence" << sequence.id;
+
+    // the request is decoded again from its first token when it is readmitted
+    std::unique_ptr<Request> request = std::move(sequence.request);
+    request->tokens = sequence.cached;
+    request->tokens.insert(request->tokens.end(), sequence.pending.begin(), sequence.pending.end());
+    evict(sequence);
+    waiting_.push_front(std::move(request));
+}
+
+bool LlamaCppEngine::expandContext(Sequence& sequence)
+{
+    LlamaCppChatData* data = sequence.data;
+    Chat* chat = data->chat_;
+    if (!chat || !chat->getLLMServices()->getAutoExpandContext())
+        return false;
+
+    const int newSize = data->n_ctx_ * 2;
+    if (newSize > llama_model_n_ctx_train(model_->model_))
+        return false;
+
+    qDebug() << "LlamaCppEngine: Auto-expanding context to" << newSize;
+    data->n_ctx_ = newSize;
+    if (newSize > n_ctx_)
+        requestedContext_ = std::max(requestedContext_, newSize);
+    QMetaObject::invokeMethod(chat, "contextSizeChanged", Qt::QueuedConnection);
+    return true;
+}
+
+bool LlamaCppEngine::shiftContext(Sequence& sequence)
+{
+    LlamaCppChatData* data = sequence.data;
+    if (!data->contextShift_)
+        return false;
+
+    const int n_past = sequence.cached.size();
+    int n_keep = std::min(LLM_CONTEXT_SHIFT_KEEP, n_past / 4);
+
+    // seq_add moves the cells for all the sequences using them
+    for (const Sequence& other : sequences_)
+    {
+        if (&other == &sequence)
+            continue;
+        for (const std::pair<quint64, int>& block : sequence.blocks)
+        {
+            for (const std::pair<quint64, int>& otherBlock : other.blocks)
+            {
+                if (block.first == otherBlock.first)
+                    n_keep = std::max(n_keep, block.second);
+            }
+        }
+    }
+
+    // the tokens of the answer being generated are not in context_tokens_, they are kept
+    const int n_discard = std::min((n_past - n_keep) / 2, int(data->context_tokens_.size()) - n_keep);
+    llama_memory_t mem = llama_get_memory(ctx_);
+    if (n_discard <= 0 || !llama_memory_can_shift(mem) || !llama_memory_seq_rm(mem, sequence.id, n_keep, n_keep + n_discard))
+        return false;
+    llama_memory_seq_add(mem, sequence.id, n_keep + n_discard, n_past, -n_discard);
+
+    std::vector<llama_token> kept(sequence.cached.begin() + n_keep + n_discard, sequence.cached.end());
+    truncate(sequence, n_keep);
+    sequence.cached.insert(sequence.cached.end(), kept.begin(), kept.end());
+    sequence.blocks.emplace_back(sequence.block, sequence.cached.size());
+    data->context_tokens_.erase(data->context_tokens_.begin() + n_keep, data->context_tokens_.begin() + n_keep + n_discard);
+    data->n_ctx_used_ = sequence.cached.size();
+
+    qDebug() << "LlamaCppEngine: context shift of the sequence" << sequence.id << ":" << n_discard
+             << "tokens dropped after the first" << n_keep;
+    return true;
+}
+
+void LlamaCppEngine::resize(int n_ctx)
+{
+    // the cells of the sequences are kept in memory while the context is recreated
+    std::vector<std::vector<uint8_t>> states(sequences_.size());
+    if (ctx_)
+    {
+        qDebug() << "LlamaCppEngine: growing the shared context from" << n_ctx_ << "to" << n_ctx;
+        for (Sequence& sequence : sequences_)
+        {
+            if (sequence.cached.empty())
+                continue;
+            std::vector<uint8_t>& state = states[sequence.id];
+            state.resize(llama_state_seq_get_size(ctx_, sequence.id));
+            state.resize(llama_state_seq_get_data(ctx_, state.data(), state.size(), sequence.id));
+        }
+
+        llama_batch_free(batch_);
+        llama_free(ctx_);
+        ctx_ = nullptr;
+    }
+
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = n_ctx;
+    // prompt chunks and generated tokens share each step : a long prompt does not hold the others
+    params.n_batch = std::min(n_ctx, batchSize_);
+    params.n_ubatch = std::min<int>(params.n_batch, ubatchSize_);
+    params.n_seq_max = n_seq_max_;
+    // sequences share the cells : a long chat can use what the others do not
+    params.kv_unified = true;
+    params.type_k = GGML_TYPE_Q8_0;
+    params.type_v = GGML_TYPE_Q8_0;
+    params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+
+    ctx_ = LLamaInitializeContext(model_->model_, params);
+    sessionKey_ = LlamaSessionStore::contextKey(model_->fileHash_, params);
+    n_ctx_ = ctx_ ? (int)llama_n_ctx(ctx_) : 0;
+    n_batch_ = ctx_ ? (int)llama_n_batch(ctx_) : 0;
+    if (ctx_)
+        batch_ = llama_batch_init(n_batch_, 0, 1);
+
+    std::vector<Sequence*> restored;
+    for (Sequence& sequence : sequences_)
+    {
+        std::vector<uint8_t>& state = states[sequence.id];
+        if (ctx_ && !state.empty() && llama_state_seq_set_data(ctx_, state.data(), state.size(), sequence.id))
+        {
+            std::vector<llama_token> tokens = std::move(sequence.cached);
+
+            // the cells shared before are shared again
+            Sequence* donor = nullptr;
+            int shared = 0;
+            for (Sequence* other : restored)
+            {
+                int common = 0;
+                while (common < int(tokens.size()) && common < int(other->cached.size()) && other->cached[common] == tokens[common])
+                    ++common;
+                if (common > shared)
+                {
+                    shared = common;
+                    donor = other;
+                }
+            }
+            llama_memory_t mem = llama_get_memory(ctx_);
+            if (donor && llama_memory_seq_rm(mem, sequence.id, 0, shared))
+            {
+                llama_memory_seq_cp(mem, donor->id, sequence.id, 0, shared);
+                sequence.cached = donor->cached;
+                sequence.blocks = donor->blocks;
+            }
+            else
+            {
+                shared = 0;
+                sequence.blocks.clear();
+            }
+            truncate(sequence, shared);
+            sequence.cached = std::move(tokens);
+            if (int(sequence.cached.size()) > shared)
+                sequence.blocks.emplace_back(sequence.block, sequence.cached.size());
+
+            restored.push_back(&sequence);
+            continue;
+        }
+
+        // the kv cache is lost : running requests are decoded again, idle sequences are dropped
+        if (ctx_ && !state.empty())
+            qWarning() << "LlamaCppEngine: failed to restore the kv cache of the sequence" << sequence.id;
+        if (sequence.request)
+            sequence.pending.insert(sequence.pending.begin(), sequence.cached.begin(), sequence.cached.end());
+        else
+            sequence.data = nullptr;
+        if (ctx_)
+            llama_memory_seq_rm(llama_get_memory(ctx_), sequence.id, -1, -1);
+        truncate(sequence, 0);
+    }
+}
+
+void LlamaCppEngine::finish(Sequence& sequence, int status)
+{
+    std::unique_ptr<Request> request = std::move(sequence.request);
+    LlamaCppChatData* data = sequence.data;
+
+    // the sampled token which was not decoded goes back to the next prompt
+    sequence.pending.clear();
+
+    const llama_vocab* vocab = llama_model_get_vocab(model_->model_);
+    const bool eog = data->response_tokens_.size() && llama_vocab_is_eog(vocab, data->response_tokens_.back());
+    QString response = LLamaDetokenize(*data, data->response_tokens_, eog);
+
+    if (data->response_tokens_.size())
+    {
+        data->context_tokens_.insert(data->context_tokens_.end(), data->response_tokens_.begin(), data->response_tokens_.end());
+        data->response_tokens_.clear();
+    }
+
+    if (request && request->onFinished)
+        request->onFinished(status, response);
+}
+
+void LlamaCppEngine::truncate(Sequence& sequence, int n_tokens)
+{
+    sequence.cached.resize(n_tokens);
+    while (!sequence.blocks.empty())
+    {
+        int begin = sequence.blocks.size() > 1 ? sequence.blocks[sequence.blocks.size() - 2].second : 0;
+        if (begin < n_tokens)
+            break;
+        sequence.blocks.pop_back();
+    }
+    if (!sequence.blocks.empty())
+        sequence.blocks.back().second = std::min(sequence.blocks.back().second, n_tokens);
+
+    // the next tokens go to new cells, even at positions of cells still used by other sequences
+    sequence.block = ++blockClock_;
+}
+
+int LlamaCppEngine::usedCells() const
+{
+    // a cell shared by several sequences is counted once : a block spans its longest use
+    std::map<quint64, std::pair<int, int>> spans;
+    for (const Sequence& sequence : sequences_)
+    {
+        int begin = 0;
+        for (const std::pair<quint64, int>& block : sequence.blocks)
+        {
+            auto it = spans.emplace(block.first, std::make_pair(begin, block.second)).first;
+            it->second.second = std::max(it->second.second, block.second);
+            begin = block.second;
+        }
+    }
+
+    int used = 0;
+    for (const auto& span : spans)
+        used += span.second.second - span.second.first;
+    return used;
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "LLMServiceDefs.h"
+#include "llama-cpp.h"
+
+struct LlamaModelData;
+struct LlamaCppChatData;
+
+/**
+ * @class LlamaCppEngine
+ * @brief Moteur de génération partagé par tous les chats d'un même modèle
+ *
+ * Un seul llama_context, avec n_seq_max séquences et un cache KV unifié, sert tous les chats
+ * du modèle : chaque chat occupe une séquence tant que son cache KV est conservé.
+ *
+ * Un thread d'ordonnancement construit à chaque étape un unique llama_batch qui regroupe
+ * le prochain token de chaque séquence en cours de génération, puis des tranches des prompts
+ * en attente de prefill dans la limite de n_batch (continuous batching). Les requêtes sont
+ * admises dès qu'une séquence se libère. Une séquence inactive garde son cache KV pour le tour
+ * suivant du chat, qui ne décode alors que les tokens ajoutés ; elle est évincée (LRU) lorsque
+ * sa place ou ses cellules du cache sont demandées. Si le cache est plein, la dernière séquence
+ * admise est préemptée et sera recalculée lorsque son contexte tiendra de nouveau.
+ *
+ * Les tokens proposés par le drafter d'un chat (décodage spéculatif) sont ajoutés au batch après
+ * son token échantillonné, puis vérifiés avec leurs logits : les tokens refusés sont retirés du cache KV.
+ *
+ * Toutes les méthodes publiques peuvent être appelées depuis n'importe quel thread.
+ * Les callbacks des requêtes sont appelés depuis le thread du moteur.
+ */
+class LlamaCppEngine
+{
+public:
+    /**
+     * @brief Callback recevant chaque morceau de texte généré
+     */
+    using TokenCallback = std::function<void(const QString& piece)>;
+
+    /**
+     * @brief Callback de fin de génération
+     *
+     * status vaut 0 en fin normale (ou arrêt demandé), sinon le code d'erreur négatif
+     * de la génération (-1 contexte dépassé, -2 échec du décodage, -3 échec de conversion).
+     * response contient la réponse complète.
+     */
+    using FinishCallback = std::function<void(int status, const QString& response)>;
+
+    /**
+     * @brief Callback d'avancement du décodage d'un prompt plus long qu'un batch
+     *
+     * progress est la fraction du prompt décodée, 1 lorsque le premier token va être échantillonné.
+     */
+    using ProgressCallback = std::function<void(double progress)>;
+
+    /**
+     * @brief Constructeur de LlamaCppEngine
+     * @param model Modèle chargé
+     * @param n_ctx Nombre de cellules du cache KV partagé
+     * @param n_seq_max Nombre maximal de séquences (chats) conservées simultanément
+     * @param n_batch Tokens décodés au plus par étape, prompts et tokens générés confondus
+     * @param n_ubatch Taille des micro-batchs, qui dimensionne les buffers de calcul
+     */
+    LlamaCppEngine(LlamaModelData* model, int n_ctx, int n_seq_max, int n_batch = LLM_BATCH_SIZE,
+                   int n_ubatch = LLM_UBATCH_SIZE);
+
+    /**
+     * @brief Destructeur, arrête le thread et libère le contexte
+     *
+     * Les requêtes en cours sont abandonnées sans appel de leurs callbacks.
+     */
+    ~LlamaCppEngine();
+
+    /**
+     * @brief Indique si le contexte a pu être créé
+     */
+    bool isValid() const { return ctx_ != nullptr; }
+
+    /**
+     * @brief Retourne le modèle du moteur
+     */
+    LlamaModelData* model() const { return model_; }
+
+    /**
+     * @brief Retourne la taille du cache KV partagé en tokens
+     */
+    int contextSize() const;
+
+    /**
+     * @brief Retourne le nombre maximal de séquences
+     */
+    int maxSequences() const { return n_seq_max_; }
+
+    /**
+     * @brief Demande une génération pour un chat
+     * @param data Données du chat, context_tokens_ contient déjà le nouveau prompt
+     * @param onToken Callback appelé pour chaque token généré
+     * @param onFinished Callback appelé une fois en fin de génération
+     * @param onProgress Callback appelé après chaque tranche d'un long prompt (optionnel)
+     * @return false si une génération est déjà en cours pour ce chat
+     *
+     * Seuls les tokens absents du cache KV de la séquence du chat sont décodés.
+     */
+    bool submit(LlamaCppChatData* data, TokenCallback onToken, FinishCallback onFinished,
+                ProgressCallback onProgress = nullptr);
+
+    /**
+     * @brief Arrête la génération d'un chat
+     * @param data Données du chat
+     *
+     * La génération se termine à l'étape suivante (onFinished est appelé avec le statut 0).
+     */
+    void cancel(LlamaCppChatData* data);
+
+    /**
+     * @brief Libère la séquence d'un chat et son cache KV
+     * @param data Données du chat
+     *
+     * Attend la fin de l'étape en cours : au retour, le moteur ne référence plus data.
+     * La requête éventuelle est abandonnée sans appel de ses callbacks.
+     */
+    void release(LlamaCppChatData* data);
+
+    /**
+     * @brief Garantit une taille minimale du cache KV partagé
+     * @param n_ctx Nombre de cellules nécessaires à un chat
+     *
+     * L'agrandissement est appliqué par le thread du moteur entre deux étapes.
+     */
+    void reserve(int n_ctx);
+
+    /**
+     * @brief Sauvegarde sur disque le cache KV de la séquence d'un chat
+     * @param data Données du chat, avec le store de sessions et l'identifiant du chat
+     *
+     * Attend la fin de l'étape en cours. Sans effet si le chat n'occupe aucune séquence.
+     */
+    void saveSession(LlamaCppChatData* data);
+
+private:
+    struct Request;
+    struct Sequence;
+
+    /**
+     * @brief Boucle du thread d'ordonnancement
+     */
+    void run();
+
+    /**
+     * @brief Indique si une étape a du travail (appelée avec mutex_ verrouillé)
+     */
+    bool hasWork() const;
+
+    /**
+     * @brief Exécute une étape : admission, construction du batch, décodage et échantillonnage
+     * @param locker Verrou de mutex_, relâché pendant le décodage
+     */
+    void step(QMutexLocker<QMutex>& locker);
+
+    /**
+     * @brief Admet les requêtes en attente dans les séquences disponibles
+     *
+     * Une requête n'est admise que si tout son contexte tient à côté des séquences en cours.
+     */
+    void admit();
+
+    /**
+     * @brief Complète le cache KV d'une séquence avec le plus long préfixe connu de ses tokens
+     * @param target Séquence admise, son cache contient déjà le préfixe commun avec ses tokens
+     * @param tokens Tokens de la requête
+     *
+     * Le préfixe est partagé avec une autre séquence (llama_memory_seq_cp) ou restauré depuis
+     * le cache des préfixes du modèle ou la session du chat sauvegardée sur disque, s'il est plus
+     * long que celui déjà présent.
+     */
+    void sharePrefix(Sequence& target, const std::vector<llama_token>& tokens);
+
+    /**
+     * @brief Ajoute au batch les tokens d'une séquence
+     * @param sequence Séquence à décoder
+     * @param maxTokens Nombre maximal de tokens ajoutés
+     * @return Nombre de tokens ajoutés
+     */
+    int addToBatch(Sequence& sequence, int maxTokens);
+
+    /**
+     * @brief Libère des cellules du cache KV
+     * @param n_cells Nombre de cellules nécessaires
+     * @param keep Séquence à ne pas évincer
+     * @param preempting Autorise la préemption des séquences en cours de génération
+     * @return true si les cellules sont disponibles
+     *
+     * Évince les séquences inactives (LRU), puis préempte les dernières séquences admises.
+     */
+    bool makeRoom(int n_cells, const Sequence* keep, bool preempting);
+
+    /**
+     * @brief Vide le cache KV d'une séquence
+     */
+    void evict(Sequence& sequence);
+
+    /**
+     * @brief Remet la requête d'une séquence en tête de la file d'attente
+     */
+    void preempt(Sequence& sequence);
+
+    /**
+     * @brief Traite un chat arrivé à sa limite de contexte
+     * @return true si le contexte du chat a été agrandi
+     */
+    bool expandContext(Sequence& sequence);
+
+    /**
+     * @brief Libère de la place dans le contexte d'un chat en oubliant le milieu de sa conversation
+     * @return true si des tokens ont été retirés
+     *
+     * Les cellules partagées avec d'autres séquences ne peuvent pas être décalées : elles restent
+     * dans la partie conservée, avec les premiers tokens du chat.
+     */
+    bool shiftContext(Sequence& sequence);
+
+    /**
+     * @brief Recrée le contexte avec un cache KV plus grand
+     *
+     * L'état de chaque séquence est copié en mémoire puis restauré dans le nouveau contexte,
+     * les préfixes partagés le sont de nouveau.
+     */
+    void resize(int n_ctx);
+
+    /**
+     * @brief Termine la requête d'une séquence
+     * @param sequence Séquence concernée
+     * @param status Statut transmis au callback de fin
+     *
+     * Ajoute la réponse aux tokens du contexte du chat ; la séquence garde son cache KV.
+     */
+    void finish(Sequence& sequence, int status);
+
+    /**
+     * @brief Tronque le cache KV connu d'une séquence (les cellules sont déjà retirées)
+     * @param sequence Séquence concernée
+     * @param n_tokens Nombre de tokens conservés
+     */
+    void truncate(Sequence& sequence, int n_tokens);
+
+    /**
+     * @brief Nombre de cellules du cache KV occupées, les cellules partagées comptant une fois
+     */
+    int usedCells() const;
+
+    LlamaModelData* model_{nullptr};          ///< Modèle du moteur
+    llama_context* ctx_{nullptr};             ///< Contexte partagé par les séquences
+    llama_batch batch_{};                     ///< Batch de chaque étape (n_batch tokens)
+    int n_ctx_{0};                            ///< Cellules du cache KV
+    int n_batch_{0};                          ///< Taille maximale d'un batch
+    int batchSize_{LLM_BATCH_SIZE};           ///< Taille de batch demandée (bornée par n_ctx)
+    int ubatchSize_{LLM_UBATCH_SIZE};         ///< Taille des micro-batchs demandée
+    int n_seq_max_{0};                        ///< Nombre de séquences
+    int requestedContext_{0};                 ///< Taille demandée par reserve(), appliquée entre deux étapes
+    QString sessionKey_;                      ///< Clé des sessions sauvegardées avec ce contexte
+
+    std::vector<Sequence> sequences_;         ///< Une entrée par seq_id
+    std::deque<std::unique_ptr<Request>> waiting_; ///< Requêtes en attente d'admission
+    quint64 clock_{0};                        ///< Horloge des admissions et utilisations (LRU)
+    quint64 blockClock_{0};                   ///< Identifiants des blocs de cellules
+
+    mutable QMutex mutex_;                    ///< Protège l'état de l'ordonnanceur et les appels llama hors décodage
+    QWaitCondition condition_;                ///< Signale du travail ou la fin d'une étape
+    QThread* thread_{nullptr};                ///< Thread d'ordonnancement
+    bool busy_{false};                        ///< Étape en cours de décodage (mutex_ relâché)
+    bool quit_{false};                        ///< Arrêt du thread demandé
+};
@@ -1,10 +1,15 @@
+#include <QFileInfo>
+#include <QLoggingCategory>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QScopeGuard>
+#include <QStandardPaths>
 
 #include <QtConcurrent/QtConcurrent>
 
 #include "LlamaCppService.h"
+#include "LlamaMemoryEstimator.h"
 
 
 const QString LlamaGenerationErrors_[4] =
@@ -15,6 +20,12 @@ const QString LlamaGenerationErrors_[4] =
     QString("failed to convert token to piece")
 };
 
+// Returned by LlamaGenerateStep when it decoded a chunk of a long prompt : not an error, nothing sampled
+const int LlamaPrefillStep_ = -4;
+
+// Traces of the generation steps, disabled by default : QT_LOGGING_RULES="llama.generate.debug=true"
+Q_LOGGING_CATEGORY(llamaGenerate, "llama.generate", QtWarningMsg)
+
 
 // Utility function to check available GPU memory
 bool checkGpuMemoryAvailable(size_t requiredBytes)
@@ -61,100 +72,27 @@ bool checkGpuMemoryAvailable(size_t requiredBytes)
     return hasEnoughMemory || !requiredBytes;
 }
 
-// Function to wait for GPU memory to be released
-// CUDA operations are asynchronous, so after llama_free(), we need to wait
-// for the CUDA driver to actually release the memory before we can reallocate
-void waitForGpuMemoryPurge()
-{
-    qDebug() << "Waiting for GPU memory to be released...";
-    
-    // Iterate through all available devices (for logging)
-    for (size_t i = 0; i < ggml_backend_dev_count(); i++)
-    {
-        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
-        if (dev)
-        {
-            QString devName = QString::fromUtf8(ggml_backend_dev_name(dev));
-            qDebug() << QString("Device %1 waiting for memory release...").arg(devName);
-        }
-    }
-    
-    // Wait for CUDA to release memory
-    // CUDA operations are asynchronous and memory may take time to be released
-    // We wait in multiple steps to allow the system to release progressively
-    QThread::msleep(100);
-    QThread::msleep(100);
-    QThread::msleep(100);
-    
-    qDebug() << "GPU memory release wait completed";
-}
-
-llama_context* LLamaInitializeContext(llama_model* model, const llama_context_params& params)
+llama_context* LLamaInitializeContext(llama_model* model, llama_context_params& params)
 {
-    llama_context* ctx = nullptr;
-
-    // Estimate required memory (approximate: context + batch + buffers)
-    // Based on logs, we need:
-    // - KV cache: 256 MiB (allocated first)
-    // - Compute buffers: 258.5 MiB (allocated next, fails here)
-    // - Total: ~514-520 MiB to be safe
-    // We add a 20% safety margin for fragmentation
-    size_t kvCacheMemory = 256 * 1024 * 1024; // 256 MiB for KV cache
-    size_t computeBuffers = 271056896; // 258.5 MiB for compute buffers
-    size_t estimatedMemory = kvCacheMemory + computeBuffers;
-    estimatedMemory = static_cast<size_t>(estimatedMemory * 1.2); // +20% safety margin
-    
-    qDebug() << "LlamaCppChatData::initialize: Creating context with n_ctx=" << params.n_ctx;
-    qDebug() << QString("Estimated memory required: %1 MiB (KV cache: 256 MiB + Buffers: 258.5 MiB + 20% margin)")
-                .arg(estimatedMemory / (1024 * 1024));
-    
-    // Check available memory before creating the context
-    if (!checkGpuMemoryAvailable(estimatedMemory))
-    {
-        qWarning() << "Insufficient GPU memory detected, waiting for release...";
-        
-        // Release all other contexts if possible
-        // Note: We cannot directly access the service from here,
-        // so we just wait for memory to be released
-        waitForGpuMemoryPurge();
-                
-        // Check again after purge
-        if (!checkGpuMemoryAvailable(estimatedMemory))
-        {
-            qWarning() << "llama-cpp error: Insufficient GPU memory even after purge";
-            qWarning() << QString("Required: %1 MiB, but insufficient memory available").arg(estimatedMemory / (1024 * 1024));
-            qWarning() << "Check that GPU memory is sufficient and no other process is using the GPU";
-            qWarning() << "Try closing other applications using the GPU or reduce n_ctx";
-            return nullptr;
-        }
-    }
-    
-    ctx = llama_init_from_model(model, params);
+    // a smaller kv cache rather than a failed allocation : the estimate decides before allocating
+    const LlamaModelShape shape = LlamaModelShape::fromModel(model);
+    const qint64 available = LlamaAvailableDeviceMemory();
+    const ggml_type type_k = params.type_k;
+    const ggml_type type_v = params.type_v;
+    const bool fits = LlamaFitContext(shape, params, available);
+
+    qDebug() << "LLamaInitializeContext: n_ctx" << params.n_ctx << "n_ubatch" << params.n_ubatch << "n_seq"
+             << params.n_seq_max << "kv" << ggml_type_name(params.type_k) << ggml_type_name(params.type_v)
+             << "estimated" << LlamaEstimateContext(shape, params) / (1024 * 1024) << "MiB, available"
+             << available / (1024 * 1024) << "MiB";
+    if (params.type_k != type_k || params.type_v != type_v)
+        qDebug() << "LLamaInitializeContext: kv cache quantized further to fit the free memory";
+    if (!fits)
+        qWarning() << "LLamaInitializeContext: the context may not fit the free memory, reduce n_ctx or close chats";
+
+    llama_context* ctx = llama_init_from_model(model, params);
     if (!ctx)
-    {
-        qWarning() << "llama-cpp error: failed to create the llama_context - possible GPU memory issue";
-        qWarning() << "Waiting for GPU release and rechecking...";
-        
-        // On failure, wait for memory to be released and retry once
-        waitForGpuMemoryPurge();
-        
-        if (!checkGpuMemoryAvailable(estimatedMemory))
-        {
-            qWarning() << "GPU memory still insufficient after purge";
-            return nullptr;
-        }
-        
-        // Retry once after purge
-        qDebug() << "Retrying context creation after purge...";
-        ctx = llama_init_from_model(model, params);
-        if (!ctx)
-        {
-            qWarning() << "llama-cpp error: Final failure to create context";
-            qWarning() << "Check that GPU memory is sufficient and no other process is using the GPU";
-            return nullptr;
-        }
-    }
-
+        qWarning() << "llama-cpp error: failed to create the llama_context of" << params.n_ctx << "tokens";
     return ctx;
 }
 
@@ -183,7 +121,8 @@ std::vector<llama_token> LlamaTokenize(llama_context* ctx, llama_model* model, c
 
 std::vector<llama_token> LlamaTokenize(LlamaCppChatData& data, const QString& prompt)
 {
-    return LlamaTokenize(data.ctx_, data.model_->model_, prompt);
+    // the context may be shared with other chats : the special tokens begin the chat tokens
+    return LlamaTokenize(data.model_->model_, prompt, data.context_tokens_.empty());
 }
 
 QString LLamaDetokenize(LlamaCppChatData& data, const std::vector<llama_token>& tokens, bool skipLastToken)
@@ -191,32 +130,47 @@ QString LLamaDetokenize(LlamaCppChatData& data, const std::vector<llama_token>&
     // param skipLastToken : generally to remove the "end of sentence" token
 
     const llama_vocab* vocab = llama_model_get_vocab(data.model_->model_);
-    const int size = tokens.size() * LLM_MAX_TOKEN_LEN;
-    if (size > 65535)
+    const int n_tokens = std::max<int>(tokens.size() - (skipLastToken ? 1 : 0), 0);
+    if (!n_tokens)
+        return {};
+
+    // most tokens are shorter than LLM_MAX_TOKEN_LEN, otherwise the text is converted again with the needed size
+    std::string text(n_tokens * LLM_MAX_TOKEN_LEN, '\0');
+    int n = llama_detokenize(vocab, tokens.data(), n_tokens, text.data(), text.size(), true, true);
+    if (n < 0)
     {
-        qCritical() << "LLamaDetokenize : size > 65535 ..." << size;
+        text.resize(-n);
+        n = llama_detokenize(vocab, tokens.data(), n_tokens, text.data(), text.size(), true, true);
+    }
+    if (n < 0)
+    {
+        qWarning() << "LLamaDetokenize: failed to convert" << n_tokens << "tokens";
         return {};
     }
-    char text1[65535] = {0};
-    int n = llama_detokenize(vocab, tokens.data(), tokens.size() + (skipLastToken ? -1 : 0), text1, sizeof(text1) - 1, true, true);
-    return QString(text1);
+    return QString::fromUtf8(text.data(), n);
 }
 
-int LlamaGenerateStep(LlamaCppChatData& data)
+llama_sampler* LlamaCreateSampler(const SamplerProfile& profile)
 {
-    qDebug() << "LlamaGenerateStep:";
+    // the filters and the temperature in one pass over the vocabulary, then the draw
+    llama_sampler* smpl = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(smpl, llama_sampler_init_fused(profile.topK_, profile.topP_, profile.minP_,
+                                                           profile.temperature_, 1));
+    llama_sampler_chain_add(smpl, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+    return smpl;
+}
 
+int LlamaGenerateStep(LlamaCppChatData& data)
+{
     const llama_vocab* vocab = llama_model_get_vocab(data.model_->model_);
+    llama_memory_t mem = llama_get_memory(data.ctx_);
 
     // check if we have enough space in the context to evaluate this batch
     data.n_ctx_ = llama_n_ctx(data.ctx_);
+    data.n_ctx_used_ = data.n_past_;
 
-    data.n_ctx_used_ = 1 + llama_memory_seq_pos_max(llama_get_memory(data.ctx_), 0) 
-                         - llama_memory_seq_pos_min(llama_get_memory(data.ctx_), 0);
-
-    qDebug() << "... before sampling :"
-             << " tokens in RAM: " << data.batch_.n_tokens
-             << " tokens in VRAM:" << data.n_ctx_used_;
+    qCDebug(llamaGenerate) << "LlamaGenerateStep: tokens to decode" << data.batch_.n_tokens << "in the kv cache"
+                           << data.n_ctx_used_;
 
     if (data.batch_.n_tokens + data.n_ctx_used_ >= data.n_ctx_ - 50) // add 50 tokens for security
     {
@@ -224,56 +178,134 @@ int LlamaGenerateStep(LlamaCppChatData& data)
         return -1;
     }
 
-    int ret = llama_decode(data.ctx_, data.batch_);
-    if (ret != 0)
+    // a prompt longer than n_batch is decoded one chunk per step, the caller can stop or report in between
+    const int n_batch = llama_n_batch(data.ctx_);
+    if (data.batch_.n_tokens > n_batch)
     {
-        qWarning() << "LlamaGenerateStep: error -2 = failed to decode";
-        return -2;
+        llama_batch chunk = data.batch_;
+        chunk.n_tokens = n_batch;
+        if (llama_decode(data.ctx_, chunk) != 0)
+        {
+            qWarning() << "LlamaGenerateStep: error -2 = failed to decode";
+            data.n_past_ = llama_memory_seq_pos_max(mem, 0) + 1;
+            return -2;
+        }
+        data.n_past_ += n_batch;
+        data.batch_.token += n_batch;
+        data.batch_.n_tokens -= n_batch;
+        return LlamaPrefillStep_;
     }
 
-    // sample the next token
-    data.currentToken_ = llama_sampler_sample(data.smpl_, data.ctx_, -1);
-    // store the new generated token in response vector
-    data.response_tokens_.push_back(data.currentToken_);
+    // the tokens proposed after the sampled token are decoded and verified with it
+    std::vector<llama_token> draft;
+    if (data.batch_.token == &data.currentToken_ && data.draftBatch_.token)
+        draft = data.proposeDraft(data.context_tokens_, data.response_tokens_,
+                                  std::min(data.draftMax_, data.n_ctx_ - 50 - data.n_ctx_used_ - 2));
 
-    data.n_ctx_used_ = 1 + llama_memory_seq_pos_max(llama_get_memory(data.ctx_), 0) 
-                         - llama_memory_seq_pos_min(llama_get_memory(data.ctx_), 0);
+    std::vector<llama_token>& sampled = data.sampled_;
+    if (draft.empty())
+    {
+        int ret = llama_decode(data.ctx_, data.batch_);
+        if (ret != 0)
+        {
+            qWarning() << "LlamaGenerateStep: error -2 = failed to decode";
+            data.n_past_ = llama_memory_seq_pos_max(mem, 0) + 1;
+            return -2;
+        }
+        data.n_past_ += data.batch_.n_tokens;
 
-    qDebug() << "... after sampling :"
-             << "tokens in RAM: " << data.context_tokens_.size() + data.response_tokens_.size()
-             << "tokens in VRAM:" << data.n_ctx_used_;
-    
-    // is it an end of generation?
-    if (llama_vocab_is_eog(vocab, data.currentToken_))
+        // sample the next token
+        sampled.clear();
+        sampled.push_back(llama_sampler_sample(data.smpl_, data.ctx_, -1));
+    }
+    else
     {
-        qDebug() << "LlamaGenerateStep: end of generation";
-        return 0;
+        const int n_past = data.n_past_;
+
+        llama_batch& batch = data.draftBatch_;
+        batch.n_tokens = draft.size() + 1;
+        for (int i = 0; i < batch.n_tokens; ++i)
+        {
+            batch.token[i] = i ? draft[i - 1] : data.currentToken_;
+            batch.pos[i] = n_past + i;
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = 0;
+            batch.logits[i] = true;
+        }
+        if (llama_decode(data.ctx_, batch) != 0)
+        {
+            qWarning() << "LlamaGenerateStep: error -2 = failed to decode";
+            llama_memory_seq_rm(mem, 0, n_past, -1);
+            return -2;
+        }
+
+        // the accepted tokens end at the first end of generation, the rejected ones leave the kv cache
+        sampled = LlamaSpeculativeAccept(data.smpl_, data.ctx_, 0, draft);
+        auto eog = std::find_if(sampled.begin(), sampled.end(),
+                                [vocab](llama_token token) { return llama_vocab_is_eog(vocab, token); });
+        if (eog != sampled.end())
+            sampled.erase(eog + 1, sampled.end());
+        data.n_past_ = n_past + sampled.size();
+        llama_memory_seq_rm(mem, 0, data.n_past_, -1);
+
+        data.draftStats_.drafted += draft.size();
+        data.draftStats_.accepted += sampled.size() - 1;
     }
 
-    // convert the token, add it to the response
-    char buf[256];
-    int n = llama_token_to_piece(vocab, data.currentToken_, buf, sizeof(buf), 0, true);
-    // failed to convert token to piece
-    if (n < 0)
+    data.n_ctx_used_ = data.n_past_;
+
+    // store the new generated tokens in response vector and convert them, a split character waits for its end
+    for (llama_token token : sampled)
     {
-        qWarning() << "LlamaGenerateStep: error -3 = failed to convert token to piece";
-        return -3;
+        data.currentToken_ = token;
+        data.response_tokens_.push_back(token);
+
+        // is it an end of generation?
+        if (llama_vocab_is_eog(vocab, data.currentToken_))
+        {
+            qCDebug(llamaGenerate) << "LlamaGenerateStep: end of generation";
+            return 0;
+        }
+
+        // failed to convert token to piece
+        if (!data.detokenizer_.push(vocab, data.currentToken_))
+        {
+            qWarning() << "LlamaGenerateStep: error -3 = failed to convert token to piece";
+            return -3;
+        }
     }
 
-    buf[n] = 0;
-    //qDebug() << "LlamaGenerateStep: response:" << buf << "tokenid:" << data.tokenId_;
-    data.response_ = QString(buf);
+    data.response_ = data.detokenizer_.take();
 
     return static_cast<int>(data.currentToken_);
 }
 
 
+// Parameters of the context owned by a chat
+static llama_context_params chatContextParams(const LlamaCppChatData& data, int n_ctx)
+{
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = n_ctx;
+    // longer prompts are decoded by chunks, the compute buffers follow n_ubatch and not the context
+    ctx_params.n_batch = std::min(n_ctx, data.n_batch_);
+    ctx_params.n_ubatch = std::min<int>(ctx_params.n_batch, data.n_ubatch_);
+    // TODO: 
+    // Add method to detect quantification capabilities for the model
+    // Use it to set the quantification type, with Q8_0 as default
+    // If large context, use Q4_0
+    // KV cache quantification
+    ctx_params.type_k = GGML_TYPE_Q8_0;  // Keys Quantification 
+    ctx_params.type_v = GGML_TYPE_Q8_0;  // Values Quantification
+    ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    return ctx_params;
+}
+
 LlamaCppChatData::~LlamaCppChatData()
 {
     deinitialize();
 }
 
-void LlamaCppChatData::initialize(LlamaModelData* model)
+void LlamaCppChatData::initialize(LlamaModelData* model, LlamaCppEngine* engine)
 {
     model_ = model;
 
@@ -299,27 +331,26 @@ void LlamaCppChatData::initialize(LlamaModelData* model)
         qDebug() << "llama_initialize: enlarge the context size to:" << new_ctx;
     }
 
-    // initialize the context
-    llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ctx = n_ctx_;
-    //ctx_params.n_batch = n_ctx_ > LLM_BATCH_SIZE ? LLM_BATCH_SIZE : n_ctx_; // Limit batch size to reasonable value
-    ctx_params.n_batch = n_ctx_;
-    // TODO: 
-    // Add method to detect quantification capabilities for the model
-    // Use it to set the quantification type, with Q8_0 as default
-    // If large context, use Q4_0
-    // KV cache quantification
-    ctx_params.type_k = GGML_TYPE_Q8_0;  // Keys Quantification 
-    ctx_params.type_v = GGML_TYPE_Q8_0;  // Values Quantification
-    ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
-
-    ctx_ = LLamaInitializeContext(model_->model_, ctx_params);
+    if (engine)
+    {
+        // the context is shared with the other chats of the model, it only has to be large enough
+        engine_ = engine;
+        engine_->reserve(n_ctx_);
+    }
+    else
+    {
+        // initialize the context
+        llama_context_params ctx_params = chatContextParams(*this, n_ctx_);
+        ctx_ = LLamaInitializeContext(model_->model_, ctx_params);
+        sessionKey_ = LlamaSessionStore::contextKey(model_->fileHash_, ctx_params);
+
+        // the sampled token and the tokens proposed after it, all with their logits
+        if (draftMax_ > 0)
+            draftBatch_ = llama_batch_init(draftMax_ + 1, 0, 1);
+    }
 
     // initialize the sampler
-    smpl_ = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(smpl_, llama_sampler_init_min_p(0.05f, 1));
-    llama_sampler_chain_add(smpl_, llama_sampler_init_temp(0.8f));
-    llama_sampler_chain_add(smpl_, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+    smpl_ = LlamaCreateSampler(sampler_);
 
     // initialize the default chat template
     llamaCppChattemplate_ = llama_model_chat_template(model_->model_, /* name */ nullptr);
@@ -329,27 +360,103 @@ void LlamaCppChatData::initialize(LlamaModelData* model)
 
 void LlamaCppChatData::deinitialize()
 {
+    // a new context may fit once the memory is released
+    n_ctx_grow_failed_ = 0;
+
+    // free the sequence first, the engine may be sampling with smpl_
+    if (engine_)
+    {
+        engine_->release(this);
+        engine_ = nullptr;
+    }
     if (smpl_)
     {
         llama_sampler_free(smpl_);
         smpl_ = nullptr;
     }
+    if (draftBatch_.token)
+    {
+        llama_batch_free(draftBatch_);
+        draftBatch_ = {};
+    }
     if (ctx_)
     {
+        // keep the kv cache of the conversation for the next context of this model
+        if (model_ && model_->prefixCache_)
+            model_->prefixCache_->storeSequence(ctx_, 0, cachedTokens());
+
         qDebug() << "LlamaCppChatData::deinitialize: Freeing llama context ...";
         // Free the context
         llama_free(ctx_);
         ctx_ = nullptr;
-        
-        // Wait a bit to allow CUDA to release GPU memory
-        // CUDA operations are asynchronous and memory may not be
-        // immediately available after llama_free()
-        qDebug() << "LlamaCppChatData::deinitialize: Waiting for GPU memory release...";
-        waitForGpuMemoryPurge();
         qDebug() << "LlamaCppChatData::deinitialize: Context freed";
     }
 }
 
+std::vector<llama_token> LlamaCppChatData::cachedTokens() const
+{
+    if (!ctx_)
+        return {};
+
+    std::vector<llama_token> tokens = context_tokens_;
+    tokens.insert(tokens.end(), response_tokens_.begin(), response_tokens_.end());
+    size_t n_cached = llama_memory_seq_pos_max(llama_get_memory(ctx_), 0) + 1;
+    if (n_cached > tokens.size())
+        return {};
+    tokens.resize(n_cached);
+    return tokens;
+}
+
+void LlamaCppChatData::saveSession()
+{
+    if (!sessions_ || chatId_.isEmpty())
+        return;
+
+    if (engine_)
+        engine_->saveSession(this);
+    else if (ctx_)
+        sessions_->save(ctx_, 0, chatId_, sessionKey_, cachedTokens());
+}
+
+double LlamaCppChatData::prefillProgress() const
+{
+    if (!n_prefill_ || batch_.token == &currentToken_)
+        return 1.0;
+    return std::clamp(1.0 - double(batch_.n_tokens) / n_prefill_, 0.0, 1.0);
+}
+
+std::vector<llama_token> LlamaCppChatData::proposeDraft(const std::vector<llama_token>& head,
+                                                        const std::vector<llama_token>& tail, int n_max) const
+{
+    // the drafter may be replaced meanwhile, this one lives until the end of the step
+    std::shared_ptr<LlamaDrafter> drafter = std::atomic_load(&drafter_);
+    if (!drafter || n_max <= 0 || tail.empty())
+        return {};
+
+    std::vector<llama_token> tokens;
+    tokens.reserve(head.size() + tail.size());
+    tokens.insert(tokens.end(), head.begin(), head.end());
+    tokens.insert(tokens.end(), tail.begin(), tail.end());
+    return drafter->propose(tokens, n_max);
+}
+
+void LlamaCppChatData::setDrafter(std::shared_ptr<LlamaDrafter> drafter, const QString& draftModelName)
+{
+    std::atomic_store(&drafter_, std::move(drafter));
+    draftModelName_ = draftModelName;
+    draftStats_ = {};
+}
+
+void LlamaCppChatData::setSampler(const SamplerProfile& profile)
+{
+    sampler_ = profile;
+    if (!smpl_)
+        return;
+
+    llama_sampler_free(smpl_);
+    smpl_ = LlamaCreateSampler(sampler_);
+}
+
 void LlamaCppChatData::clear()
 {
     if (context_tokens_.size())
@@ -358,13 +465,53 @@ void LlamaCppChatData::clear()
     context_tokens_.clear();
     response_tokens_.clear();
     response_.clear();
+    detokenizer_.reset();
 }
 
 bool prepareStartGeneration(LlamaCppChatData& data, Chat* chat, bool resetted=false);
 
+// Restores in the empty sequence of the chat the longest known prefix of its tokens, from the memory
+// of the model or from the session saved on disk. Returns the number of tokens restored.
+int restoreConversation(LlamaCppChatData& data)
+{
+    const int maxLength = int(data.context_tokens_.size()) - 1;
+
+    LlamaPrefixCache::Match match;
+    if (data.model_->prefixCache_)
+        match = data.model_->prefixCache_->lookup(data.context_tokens_);
+
+    // the session of a reopened chat, unless the memory already has as much
+    int n_restored = 0;
+    if (data.sessions_ && std::min(match.length, maxLength) < maxLength)
+    {
+        n_restored = data.sessions_->restore(data.ctx_, 0, data.chatId_, data.sessionKey_, data.context_tokens_, maxLength);
+        if (n_restored && n_restored < match.length)
+        {
+            llama_memory_seq_rm(llama_get_memory(data.ctx_), 0, -1, -1);
+            n_restored = 0;
+        }
+    }
+    if (!n_restored)
+        n_restored = LlamaPrefixCache::restoreSequence(data.ctx_, 0, match, maxLength);
+
+    return n_restored;
+}
+
 void LlamaCppChatData::reset()
 {
     qDebug() << "LlamaCppChatData::reset";
+
+    // with a shared context, the kv cache of the chat is kept
+    if (engine_)
+    {
+        engine_->reserve(n_ctx_);
+        return;
+    }
+
+    // a larger context receives the kv cache of this one, the current batch is still to decode
+    if (ctx_ && n_ctx_ > int(llama_n_ctx(ctx_)) && growContext())
+        return;
+
     deinitialize();
     if (model_)
         initialize(model_);
@@ -375,20 +522,93 @@ void LlamaCppChatData::reset()
     prepareStartGeneration(*this, chat_, true);
 }
 
+bool LlamaCppChatData::growContext()
+{
+    // the cells of the conversation are kept in memory while the context is recreated
+    std::vector<uint8_t> state(llama_state_seq_get_size(ctx_, 0));
+    state.resize(llama_state_seq_get_data(ctx_, state.data(), state.size(), 0));
+    if (state.empty())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int previousSize = llama_n_ctx(ctx_);
+    llama_free(ctx_);
+    llama_context_params ctx_params = chatContextParams(*this, n_ctx_);
+    ctx_ = LLamaInitializeContext(model_->model_, ctx_params);
+    if (!ctx_)
+    {
+        qWarning() << "LlamaCppChatData::growContext: unable to create a context of" << n_ctx_ << "tokens";
+        // the generation stops growing the context : it shifts it or ends with an error instead
+        n_ctx_grow_failed_ = n_ctx_;
+        n_ctx_ = previousSize;
+        ctx_params = chatContextParams(*this, n_ctx_);
+        ctx_ = LLamaInitializeContext(model_->model_, ctx_params);
+        if (!ctx_)
+            return false;
+    }
+    // the kv cache may have been quantized further : restoring the state then fails and the prompt is decoded again
+    sessionKey_ = LlamaSessionStore::contextKey(model_->fileHash_, ctx_params);
+
+    if (!llama_state_seq_set_data(ctx_, state.data(), state.size(), 0))
+    {
+        qWarning() << "LlamaCppChatData::growContext: failed to restore the kv cache";
+        llama_memory_seq_rm(llama_get_memory(ctx_), 0, -1, -1);
+        return false;
+    }
+
+    qDebug() << "LlamaCppChatData::growContext: context grown from" << previousSize << "to" << llama_n_ctx(ctx_)
+             << "tokens in" << timer.elapsed() << "ms";
+    return true;
+}
+
+bool LlamaCppChatData::shiftContext()
+{
+    if (!contextShift_ || !ctx_)
+        return false;
+
+    llama_memory_t mem = llama_get_memory(ctx_);
+    const int n_past = llama_memory_seq_pos_max(mem, 0) + 1;
+    const int n_keep = std::min(LLM_CONTEXT_SHIFT_KEEP, n_past / 4);
+
+    // the tokens of the answer being generated are not in context_tokens_, they are kept
+    const int n_discard = std::min((n_past - n_keep) / 2, int(context_tokens_.size()) - n_keep);
+    if (n_discard <= 0 || !llama_memory_can_shift(mem) || !llama_memory_seq_rm(mem, 0, n_keep, n_keep + n_discard))
+        return false;
+    llama_memory_seq_add(mem, 0, n_keep + n_discard, n_past, -n_discard);
+    n_past_ = n_past - n_discard;
+
+    // the batch of a prompt points into the tokens
+    const bool prompt = batch_.token != &currentToken_;
+    context_tokens_.erase(context_tokens_.begin() + n_keep, context_tokens_.begin() + n_keep + n_discard);
+    if (prompt)
+    {
+        const int n_cached = n_past - n_discard;
+        batch_ = llama_batch_get_one(context_tokens_.data() + n_cached, context_tokens_.size() - n_cached);
+    }
+
+    qDebug() << "LlamaCppChatData::shiftContext:" << n_discard << "tokens dropped after the first" << n_keep;
+    return true;
+}
+
 bool prepareStartGeneration(LlamaCppChatData& data, Chat* chat, bool resetted)
 {
     data.chat_ = chat;
+    data.chatId_ = chat->getId();
     data.response_.clear();
     data.response_tokens_.clear();
-    
-    std::vector<llama_token>* entryTokens = &data.context_tokens_;
+    data.detokenizer_.reset();
 
+    // a profile changed since the last generation
+    if (chat->getSampler() != data.sampler_)
+        data.setSampler(chat->getSampler());
+    
     // if a history exists and the tokens are not already got, do it with the full history
     if (chat->getHistory().size() > 2 && !data.context_tokens_.size())
     {
         QString formatedEntry = chat->getFormattedHistory();
         data.context_tokens_ = LlamaTokenize(data, formatedEntry);
-        entryTokens = &data.context_tokens_;
         qDebug() << "prepareStartGeneration: tokenize all history";
     }
     // otherwise add only the new user prompt
@@ -397,11 +617,27 @@ bool prepareStartGeneration(LlamaCppChatData& data, Chat* chat, bool resetted)
         QString formatedEntry = chat->getFormattedMessage("user", -1);
         data.prompt_tokens_ = LlamaTokenize(data, formatedEntry);
         data.context_tokens_.insert(data.context_tokens_.end(), data.prompt_tokens_.begin(), data.prompt_tokens_.end());
-        entryTokens = &data.prompt_tokens_;
         qDebug() << "prepareStartGeneration: insert new user message in prompt";
     }
 
-    data.batch_ = llama_batch_get_one(entryTokens->data(), entryTokens->size());
+    // decode what the kv cache is missing : the new prompt, or the whole conversation with a new context
+    int n_cached = 0;
+    if (data.ctx_)
+    {
+        llama_memory_t mem = llama_get_memory(data.ctx_);
+        n_cached = llama_memory_seq_pos_max(mem, 0) + 1;
+        if (n_cached >= int(data.context_tokens_.size()))
+        {
+            llama_memory_seq_rm(mem, 0, -1, -1);
+            n_cached = 0;
+        }
+        if (!n_cached)
+            n_cached = restoreConversation(data);
+    }
+
+    data.batch_ = llama_batch_get_one(data.context_tokens_.data() + n_cached, data.context_tokens_.size() - n_cached);
+    data.n_prefill_ = data.batch_.n_tokens;
+    data.n_past_ = n_cached;
 
     return true;
 }
@@ -411,13 +647,57 @@ void setBatchForNextToken(LlamaCppChatData& data)
     data.batch_ = llama_batch_get_one(&data.currentToken_, 1);
 }
 
+// adds a piece to the stream of a chat : only the first piece since the last update of the chat schedules one,
+// the next ones are gathered with it
+static void LlamaStreamPiece(LLMServices* service, const std::shared_ptr<LlamaStreamBuffer>& stream,
+                             const QPointer<Chat>& target, const QString& piece)
+{
+    if (piece.isEmpty() || !stream->append(piece))
+        return;
+
+    QMetaObject::invokeMethod(service,
+        [service, target, stream]()
+        {
+            QTimer::singleShot(LLM_STREAM_FRAME_MS, service,
+                [target, stream]()
+                {
+                    const QString text = stream->take();
+                    if (target && !text.isEmpty())
+                        target->updateCurrentAIStream(text);
+                });
+        },
+        Qt::QueuedConnection);
+}
+
+void LlamaCppProcess::streamPiece(Chat* chat, const QString& piece)
+{
+    LlamaStreamPiece(service_, stream_, chat, piece);
+}
+
+// replaces the streamed text by the final response, the pieces not displayed yet are dropped
+static void LlamaFinishStream(Chat* chat, LlamaStreamBuffer& stream, const QString& response)
+{
+    stream.take();
+    chat->updateCurrentAIStream(response + "<end>");
+}
+
 struct LlamaCppProcessAsync : public LlamaCppProcess
 {
-    LlamaCppProcessAsync(LlamaCppChatData* data, LLMServices* service) : LlamaCppProcess(0, data, service) {}
+    LlamaCppProcessAsync(LlamaCppChatData* data, LLMServices* service) : LlamaCppProcess(0, data, service)
+    {
+        // one generation at a time per chat, the decode steps run back-to-back on this executor
+        executor_.setMaxThreadCount(1);
+    }
     ~LlamaCppProcessAsync() override { stop(); }
 
     void start(Chat* chat, const QString& content, bool streamed) override
     {
+        if (future_.isRunning())
+        {
+            qWarning() << "LlamaCppProcessAsync::start: a generation is already running for this chat";
+            return;
+        }
+
         // Prepare tokens and batch for asynchronous generation
         if (!prepareStartGeneration(*data_, chat))
         {
@@ -431,76 +711,136 @@ struct LlamaCppProcessAsync : public LlamaCppProcess
             chat->setProcessing(true);
 
         // Launch asynchronous generation
-        if (!asyncTimer_)
-        {
-            asyncTimer_ = new QTimer(service_); // parented to service_ for memory management
-            asyncTimer_->setInterval(100);
-            QObject::connect(asyncTimer_, &QTimer::timeout, service_,
-                [this]()
-                {
-                    generate();
-                });
-        }
+        abort_ = false;
+        future_ = QtConcurrent::run(&executor_, [this]() { generate(); });
+    }
 
-        startProcess();
+    void stop() override
+    {
+        stopProcess();
+        future_.waitForFinished();
     }
 
-    void stop() override { stopProcess(); }
+    void stopProcess() override
+    {
+        // interrupts the running llama_decode too, through the abort callback
+        abort_ = true;
+    }
 
-    void startProcess()
+    static bool abortCallback(void* userData)
     {
-        if (asyncTimer_ && !asyncTimer_->isActive())
-            asyncTimer_->start();
+        return static_cast<LlamaCppProcessAsync*>(userData)->abort_.load();
     }
 
-    void stopProcess() override
+    // posts the progress of a long prompt to the chat from the thread of the service
+    void postProgress(double progress)
     {
-        if (asyncTimer_ && asyncTimer_->isActive())
-            asyncTimer_->stop();
+        QPointer<Chat> target(data_->chat_);
+        QMetaObject::invokeMethod(service_,
+            [target, progress]()
+            {
+                if (target)
+                    target->setPrefillProgress(progress);
+            },
+            Qt::QueuedConnection);
+    }
+
+    // posts the final response to the chat from the thread of the service
+    void finish(const QString& response)
+    {
+        QPointer<Chat> target(data_->chat_);
+        std::shared_ptr<LlamaStreamBuffer> stream = stream_;
+        const double acceptanceRate = data_->draftStats_.acceptanceRate();
+        QMetaObject::invokeMethod(service_,
+            [target, stream, response, acceptanceRate]()
+            {
+                if (!target)
+                    return;
+                LlamaFinishStream(target, *stream, response);
+                target->setAcceptanceRate(acceptanceRate);
+                target->setProcessing(false);
+            },
+            Qt::QueuedConnection);
     }
 
     void generate() override
     {
         if (!data_->chat_)
-        {
-            stopProcess();
             return;
-        }
 
-        data_->currentToken_= LlamaGenerateStep(*data_);
+        llama_set_abort_callback(data_->ctx_, abortCallback, this);
 
-        if (data_->currentToken_ == -1 && data_->chat_ && data_->chat_->getLLMServices()->getAutoExpandContext())
+        bool prefilling = false;
+        while (!abort_)
         {
-            qDebug() << "LlamaCppProcessAsync: Context auto-expanded. Re-initializing context...";   
-            // Auto-expand logic
-            int newSize = data_->n_ctx_ * 2;
-            int n_ctx_train = llama_model_n_ctx_train(data_->model_->model_);
-            if (newSize <= n_ctx_train)
+            data_->currentToken_ = LlamaGenerateStep(*data_);
+
+            if (data_->currentToken_ == LlamaPrefillStep_)
             {
-                qDebug() << "LlamaCppProcessAsync: Auto-expanding context to" << newSize;
-                data_->chat_->setContextSize(newSize);
-                // break to next step
-                return;
+                postProgress(data_->prefillProgress());
+                prefilling = true;
+                continue;
+            }
+            if (prefilling)
+            {
+                postProgress(1.0);
+                prefilling = false;
             }
-        }
 
-        data_->chat_->updateCurrentAIStream(data_->response_);
-        
-        if (data_->currentToken_ <= 0)
-        {
-            stopProcess();
+            if (data_->currentToken_ == -1 && data_->chat_->getLLMServices()->getAutoExpandContext())
+            {
+                // Auto-expand logic
+                int newSize = data_->n_ctx_ * 2;
+                int n_ctx_train = llama_model_n_ctx_train(data_->model_->model_);
+                if (newSize <= n_ctx_train && (!data_->n_ctx_grow_failed_ || newSize < data_->n_ctx_grow_failed_))
+                {
+                    qDebug() << "LlamaCppProcessAsync: Auto-expanding context to" << newSize;
+                    data_->chat_->setContextSize(newSize);
+                    llama_set_abort_callback(data_->ctx_, abortCallback, this);
+                    continue;
+                }
+            }
 
-            if (data_->chat_)
-                data_->chat_->setProcessing(false);
+            // or forget the middle of the conversation to go on in the same context
+            if (data_->currentToken_ == -1 && data_->shiftContext())
+                continue;
 
-            data_->chat_ = nullptr;
-            return;
+            if (data_->currentToken_ <= 0) // End of generation
+            {
+                if (data_->currentToken_ == -2 && abort_)
+                {
+                    // the decode was interrupted: the kv cache no longer matches the tokens, rebuild it next time
+                    llama_memory_seq_rm(llama_get_memory(data_->ctx_), 0, -1, -1);
+                    data_->context_tokens_.clear();
+                    data_->response_tokens_.clear();
+                }
+                else if (data_->currentToken_ < 0)
+                    qWarning() << "LlamaCppProcessAsync: generation error:" << LlamaGenerationErrors_[-data_->currentToken_];
+                break;
+            }
+
+            streamPiece(data_->chat_, data_->response_);
+
+            setBatchForNextToken(*data_);
+        }
+
+        QString finalResponse = LLamaDetokenize(*data_, data_->response_tokens_, true);
+
+        if (data_->response_tokens_.size())
+        {
+            data_->context_tokens_.insert(data_->context_tokens_.end(), data_->response_tokens_.begin(), data_->response_tokens_.end());
+            data_->response_tokens_.clear();
         }
 
-        setBatchForNextToken(*data_);
+        if (prefilling)
+            postProgress(1.0);
+        finish(finalResponse);
+        data_->chat_ = nullptr;
     }
 
-    QTimer* asyncTimer_ = nullptr;
+    QThreadPool executor_;
+    QFuture<void> future_;
+    std::atomic<bool> abort_{ false };
 };
 
 struct LlamaCppProcessThread : public LlamaCppProcess
@@ -537,16 +877,26 @@ struct LlamaCppProcessThread : public LlamaCppProcess
 
             // Connect worker signals
             QObject::connect(worker_, &LlamaCppWorker::tokenGenerated, service_,
-                [this, chat](const QString& token)
+                [this, chat](const QString& response)
                 {
-                    chat->updateCurrentAIStream(token);
+                    LlamaFinishStream(chat, *stream_, response);
+                });
+
+            QObject::connect(worker_, &LlamaCppWorker::prefillProgress, service_,
+                [this, chat](double progress)
+                {
+                    chat->setPrefillProgress(progress);
                 });
 
             QObject::connect(worker_, &LlamaCppWorker::generationFinished, service_,
                 [this, chat]()
                 {
-                    if (chat)                    
+                    if (chat)
+                    {
+                        chat->setPrefillProgress(1.0);
+                        chat->setAcceptanceRate(data_->draftStats_.acceptanceRate());
                         chat->setProcessing(false);
+                    }
                     
                     QMutexLocker locker(&mutex_);
                     data_->chat_ = nullptr;
@@ -612,6 +962,76 @@ struct LlamaCppProcessThread : public LlamaCppProcess
     std::atomic<bool> isProcessing_{ false };
 };
 
+struct LlamaCppProcessEngine : public LlamaCppProcess
+{
+    LlamaCppProcessEngine(LlamaCppChatData* data, LLMServices* service) : LlamaCppProcess(2, data, service) {}
+    ~LlamaCppProcessEngine() override { stop(); }
+
+    void start(Chat* chat, const QString& content, bool streamed) override
+    {
+        if (!data_->engine_ || !prepareStartGeneration(*data_, chat))
+        {
+            if (chat)
+                chat->setProcessing(false);
+            return;
+        }
+
+        chat->setProcessing(true);
+
+        // the engine thread runs the callbacks : the chat is updated from the thread of the service
+        QPointer<Chat> target(chat);
+        LLMServices* service = service_;
+        LlamaCppChatData* data = data_;
+        std::shared_ptr<LlamaStreamBuffer> stream = stream_;
+        bool submitted = data_->engine_->submit(data_,
+            [service, target, stream](const QString& piece)
+            {
+                LlamaStreamPiece(service, stream, target, piece);
+            },
+            [service, target, data, stream](int status, const QString& response)
+            {
+                const double acceptanceRate = data->draftStats_.acceptanceRate();
+                QMetaObject::invokeMethod(service,
+                    [target, stream, status, response, acceptanceRate]()
+                    {
+                        if (status < 0)
+                            qWarning() << "LlamaCppProcessEngine: generation error:" << LlamaGenerationErrors_[-status];
+                        if (!target)
+                            return;
+                        LlamaFinishStream(target, *stream, response);
+                        target->setPrefillProgress(1.0);
+                        target->setAcceptanceRate(acceptanceRate);
+                        target->setProcessing(false);
+                    },
+                    Qt::QueuedConnection);
+            },
+            [service, target](double progress)
+            {
+                QMetaObject::invokeMethod(service,
+                    [target, progress]()
+                    {
+                        if (target)
+                            target->setPrefillProgress(progress);
+                    },
+                    Qt::QueuedConnection);
+            });
+
+        if (!submitted)
+        {
+            qWarning() << "LlamaCppProcessEngine::start: a generation is already running for this chat";
+            chat->setProcessing(false);
+        }
+    }
+
+    void stop() override { stopProcess(); }
+
+    void stopProcess() override
+    {
+        if (data_->engine_)
+            data_->engine_->cancel(data_);
+    }
+};
+
 LlamaCppWorker::LlamaCppWorker(LlamaCppProcess* process) : process_(process)
 {
     thread_ = new QThread();
@@ -654,6 +1074,7 @@ void LlamaCppWorker::processRequest()
 
     process->isProcessing_ = true;
 
+    bool prefilling = false;
     while (!process->stopRequested_.load())
     {
         locker.unlock();
@@ -663,13 +1084,25 @@ void LlamaCppWorker::processRequest()
 
         locker.relock();
 
+        if (data.currentToken_ == LlamaPrefillStep_)
+        {
+            emit prefillProgress(data.prefillProgress());
+            prefilling = true;
+            continue;
+        }
+        if (prefilling)
+        {
+            emit prefillProgress(1.0);
+            prefilling = false;
+        }
+
         if (data.currentToken_ == -1 && data.chat_ && data.chat_->getLLMServices()->getAutoExpandContext())
         {
             qDebug() << "LlamaCppWorker: Context auto-expanded. Re-initializing context...";
             // Auto-expand logic
             int newSize = data.n_ctx_ * 2;
             int n_ctx_train = llama_model_n_ctx_train(data.model_->model_);
-            if (newSize <= n_ctx_train)
+            if (newSize <= n_ctx_train && (!data.n_ctx_grow_failed_ || newSize < data.n_ctx_grow_failed_))
             {
                 qDebug() << "LlamaCppWorker: Auto-expanding context to" << newSize;
                 data.chat_->setContextSize(newSize);
@@ -678,6 +1111,10 @@ void LlamaCppWorker::processRequest()
             }
         }
 
+        // or forget the middle of the conversation to go on in the same context
+        if (data.currentToken_ == -1 && data.shiftContext())
+            continue;
+
         if (data.currentToken_ <= 0) // End of generation
         {
             if (data.currentToken_ < 0)
@@ -685,8 +1122,8 @@ void LlamaCppWorker::processRequest()
             break;
         }
 
-        // Emit generated token
-        emit tokenGenerated(data.response_);
+        // the chat displays the pieces once per frame
+        process->streamPiece(data.chat_, data.response_);
         setBatchForNextToken(data);
     }
 
@@ -702,7 +1139,7 @@ void LlamaCppWorker::processRequest()
     //QString allcontext = LLamaDetokenize(data, data.context_tokens_, false);
     //qDebug() << "allcontext:" << allcontext;
     
-    emit tokenGenerated(finalResponse + "<end>");
+    emit tokenGenerated(finalResponse);
     process->isProcessing_ = false;
     emit generationFinished();
 }
@@ -737,20 +1174,54 @@ LlamaCppService::LlamaCppService(LLMServices* service, const QVariantMap& params
     // Enable threaded version by default
     setUseThreadedVersion(true);
 
+    // Chats of a same model share one context and are batched together
+    QSettings settings;
+    setUseSharedEngine(settings.value("llamaSharedEngine", true).toBool());
+    setMaxSequences(settings.value("llamaMaxSequences", LLM_ENGINE_MAX_SEQUENCES).toInt());
+    setPrefixCacheSize(settings.value("llamaPrefixCacheSize", LLM_PREFIX_CACHE_SIZE).toInt());
+    setContextShift(settings.value("llamaContextShift", false).toBool());
+    setBatchSize(settings.value("llamaBatchSize", LLM_BATCH_SIZE).toInt(),
+                 settings.value("llamaUBatchSize", LLM_UBATCH_SIZE).toInt());
+    setDraftTokens(settings.value("llamaDraftTokens", LLM_DRAFT_MAX_TOKENS).toInt());
+    setPromptLookup(settings.value("llamaPromptLookup", true).toBool());
+    setModelMemoryBudget(settings.value("llamaModelMemoryBudget", LLM_MODEL_MEMORY_BUDGET).toInt());
+
+    // kv cache of the chats saved next to the chat database, restored when they are reopened
+    int sessionCacheSize = settings.value("llamaSessionCacheSize", LLM_SESSION_CACHE_SIZE).toInt();
+    if (sessionCacheSize > 0)
+    {
+        QDir dataLocation(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+        sessions_ = std::make_unique<LlamaSessionStore>(
+            dataLocation.filePath("kvcache"), qint64(sessionCacheSize) * 1024 * 1024);
+    }
+
     // Display information about available backends
     qDebug() << "=== Configuration LlamaCpp ===";
     qDebug() << "GPU activé:" << isUsingGpu();
     qDebug() << "Couches GPU:" << getGpuLayers();
     qDebug() << "Taille contexte:" << getContextSize();
     qDebug() << "Version threadée:" << isUsingThreadedVersion();
+    qDebug() << "Moteur partagé:" << isUsingSharedEngine() << "séquences:" << getMaxSequences();
+    qDebug() << "Cache des préfixes (Mo):" << getPrefixCacheSize();
+    qDebug() << "Sessions sur disque (Mo):" << sessionCacheSize;
+    qDebug() << "Glissement du contexte:" << isUsingContextShift();
+    qDebug() << "Batch:" << getBatchSize() << "micro-batch:" << getUBatchSize();
+    qDebug() << "Tokens proposés (décodage spéculatif):" << getDraftTokens();
+    qDebug() << "Propositions par n-grammes du prompt:" << isUsingPromptLookup();
+    qDebug() << "Budget mémoire des modèles (Mo):" << getModelMemoryBudget() << "(0 : automatique)";
 }
 
 LlamaCppService::~LlamaCppService()
 {
     qDebug() << "~LlamaCppService";
 
-    for (LlamaCppChatData& data : datas_)
-        clearData(&data);
+    for (auto& data : datas_)
+        clearData(data.second.get());
+
+    qDeleteAll(engines_);
+    engines_.clear();
+
+    clearEmbeddingContexts();
 
     for (LlamaModelData& model : models_)
     {
@@ -766,11 +1237,14 @@ LlamaCppService::~LlamaCppService()
 
 LlamaCppChatData* LlamaCppService::createData(Chat* chat)
 {
-    LlamaCppChatData& data = datas_[chat];
-    data.chat_ = chat;
-    chat->setData(&data);
+    std::unique_ptr<LlamaCppChatData>& data = datas_[chat];
+    if (!data)
+        data = std::make_unique<LlamaCppChatData>();
+    data->chat_ = chat;
+    data->chatId_ = chat->getId();
+    chat->setData(data.get());
 
-    return &data;
+    return data.get();
 }
 
 void LlamaCppService::initializeData(LlamaCppChatData* data, LlamaModelData* model)
@@ -780,18 +1254,26 @@ void LlamaCppService::initializeData(LlamaCppChatData* data, LlamaModelData* mod
         qWarning() << "LlamaCppService::initializeData ... no model !";
         return;        
     }
-    data->initialize(model);
+    LlamaCppEngine* engine = useSharedEngine_ ? getEngine(model) : nullptr;
+    data->sessions_ = sessions_.get();
+    data->contextShift_ = contextShift_;
+    data->n_batch_ = batchSize_;
+    data->n_ubatch_ = ubatchSize_;
+    data->draftMax_ = draftTokens_;
+    data->initialize(model, engine);
 
     if (!data->generateProcess_)
     {
-        if (useThreadedVersion_)
+        if (engine)
+            data->generateProcess_ = new LlamaCppProcessEngine(data, llmservices_);
+        else if (useThreadedVersion_)
             data->generateProcess_ = new LlamaCppProcessThread(data, llmservices_);
         else
             data->generateProcess_ = new LlamaCppProcessAsync(data, llmservices_);
     }    
 }
 
-void LlamaCppService::clearData(LlamaCppChatData* data)
+void LlamaCppService::clearData(LlamaCppChatData* data, bool saveSession)
 {
     qDebug() << "LlamaCppService::clearData: Cleaning up data:" << data;
     
@@ -804,16 +1286,17 @@ void LlamaCppService::clearData(LlamaCppChatData* data)
         data->generateProcess_ = nullptr;
     }
     
-    // Free context resources
+    // Free context resources, the kv cache is saved for the next opening of the chat
+    if (saveSession)
+        data->saveSession();
     data->deinitialize();
+    data->setDrafter(nullptr, QString());
     data->clear();
 
-    // Wait for GPU memory to be released
-    // CUDA operations are asynchronous, we need to wait for the driver to release memory
-    waitForGpuMemoryPurge();
-    
     qDebug() << "LlamaCppService::clearData: Cleanup completed";
 
+    if (data->model_)
+        residency_.release(data->model_->modelName_);
     data->model_ = nullptr;
 }
 
@@ -828,15 +1311,25 @@ void LlamaCppService::clearModelInMemory(const QString& modelName)
 
     qDebug() << "LlamaCppService::clearModelInMemory:" << modelName;
 
+    // pooled embedding contexts, the shared engine and the drafters reference the model, free them first
+    clearEmbeddingContexts(modelName);
+    clearEngine(modelName);
+    for (auto& data : datas_)
+    {
+        if (data.second->draftModelName_ == modelName)
+            data.second->setDrafter(nullptr, QString());
+    }
+
     llama_model_free(model.model_);
+    model.prefixCache_.reset();
+    residency_.remove(modelName);
 
-    waitForGpuMemoryPurge();
     bool check = checkGpuMemoryAvailable(0);
 
     model.model_ = nullptr;
 }
 
-LlamaModelData* LlamaCppService::loadModel(const QString& modelName, int numGpuLayers, bool clearOtherModels)
+LlamaModelData* LlamaCppService::loadModel(const QString& modelName, int numGpuLayers)
 {
     LlamaModelData modelData;
 
@@ -853,10 +1346,36 @@ LlamaModelData* LlamaCppService::loadModel(const QString& modelName, int numGpuL
         }
     }
 
-    if (clearOtherModels && lastModelAddedInMemory_ && modelName != lastModelAddedInMemory_->modelName_)
+    // room for the model within the budget : the least recently used models nobody references are freed
+    const qint64 incoming = QFileInfo(modelData.modelPath_).size();
+    const qint64 budget = getModelMemoryBudgetBytes();
+    for (const QString& evicted : residency_.evictionCandidates(incoming, budget))
     {
-        qDebug() << "LlamaCppService::loadModel: Clear last model" << modelName;
-        clearModelInMemory(lastModelAddedInMemory_->modelName_);
+        qDebug() << "LlamaCppService::loadModel: evicting" << evicted << "for" << modelName;
+        clearModelInMemory(evicted);
+    }
+    if (residency_.size() + incoming > budget)
+        qWarning() << "LlamaCppService::loadModel: the models in use exceed the memory budget of"
+                   << budget / (1024 * 1024) << "MiB";
+
+    // as many layers on the gpu as its free memory holds along with a default context
+    if (numGpuLayers > 0 && LlamaHasGpuDevice())
+    {
+        const LlamaModelShape shape = LlamaModelShape::fromFile(modelData.modelPath_);
+        llama_context_params ctx_params = llama_context_default_params();
+        ctx_params.n_ctx = useSharedEngine_ ? defaultContextSize_ * maxSequences_ : defaultContextSize_;
+        ctx_params.n_ubatch = ubatchSize_;
+        ctx_params.n_seq_max = useSharedEngine_ ? maxSequences_ : 1;
+        ctx_params.type_k = GGML_TYPE_Q8_0;
+        ctx_params.type_v = GGML_TYPE_Q8_0;
+        ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+        const int fitted = LlamaFitGpuLayers(shape, ctx_params, LlamaAvailableDeviceMemory());
+        if (shape.isValid() && fitted < std::min(numGpuLayers, shape.n_layer + 1))
+        {
+            qDebug() << "LlamaCppService::loadModel:" << fitted << "of" << shape.n_layer + 1
+                     << "layers fit the free gpu memory";
+            numGpuLayers = fitted;
+        }
     }
 
     // initialize the model
@@ -874,7 +1393,11 @@ LlamaModelData* LlamaCppService::loadModel(const QString& modelName, int numGpuL
     modelData.modelName_ = modelName;
     modelData.n_gpu_layers_ = numGpuLayers;
     modelData.use_gpu_ = numGpuLayers > 0;
+    modelData.fileHash_ = LlamaSessionStore::modelHash(modelData.modelPath_);
+    if (prefixCacheSize_ > 0)
+        modelData.prefixCache_ = std::make_shared<LlamaPrefixCache>(size_t(prefixCacheSize_) * 1024 * 1024);
     models_[modelName] = modelData;
+    residency_.add(modelName, llama_model_size(modelData.model_));
 
     lastModelAddedInMemory_ = &models_[modelName];
 
@@ -893,17 +1416,82 @@ void LlamaCppService::setModelInternal(LlamaCppChatData* data, const QString& mo
         clearData(data);
     }
 
-    LlamaModelData* model = this->getModel(modelName);
-    if (!model || !model->model_)                        
-        model = this->loadModel(modelName, 99, onlyOneModelInMemory_);
-    
+    // the reference goes to the chat, released by clearData
+    LlamaModelData* model = acquireModel(modelName, 99);
     if (model && !data->model_)
         initializeData(data, model);
+    else if (model)
+        residency_.release(modelName);
 
     emit modelLoadingFinished(modelName, true);
     qDebug() << "LlamaCppService::setModelInternal ... end!";
 }
 
+void LlamaCppService::setDraftModelInternal(LlamaCppChatData* data, const QString& draftModelName)
+{
+    // a draft model which cannot be used is not tried again for this chat
+    if (draftModelName == data->draftModelName_ && (std::atomic_load(&data->drafter_) || !promptLookup_))
+        return;
+
+    data->setDrafter(nullptr, draftModelName);
+    if (!data->model_ || !data->model_->model_)
+        return;
+
+    // the rejected tokens are removed from the kv cache : not possible with the state of a recurrent model
+    llama_model* target = data->model_->model_;
+    if (llama_model_is_recurrent(target) || llama_model_is_hybrid(target))
+    {
+        qDebug() << "LlamaCppService::setDraftModelInternal: no speculative decoding with a recurrent model";
+        return;
+    }
+
+    std::shared_ptr<LlamaDrafter> drafter = createModelDrafter(data, draftModelName);
+    if (drafter)
+        qDebug() << "LlamaCppService::setDraftModelInternal:" << draftModelName << "drafts for the chat" << data->chatId_;
+    else if (promptLookup_)
+        drafter = std::make_shared<LlamaNgramDrafter>();
+
+    data->setDrafter(drafter, draftModelName);
+}
+
+std::shared_ptr<LlamaDrafter> LlamaCppService::createModelDrafter(LlamaCppChatData* data, const QString& draftModelName)
+{
+    if (draftModelName.isEmpty() || draftModelName == data->model_->modelName_)
+        return nullptr;
+
+    // the draft model is loaded next to the model of the chat, which stays the last one loaded
+    LlamaModelData* lastModel = lastModelAddedInMemory_;
+    LlamaModelData* draft = acquireModel(draftModelName, data->model_->n_gpu_layers_);
+    lastModelAddedInMemory_ = lastModel;
+    if (!draft)
+    {
+        qWarning() << "LlamaCppService::createModelDrafter: unable to load the draft model" << draftModelName;
+        return nullptr;
+    }
+
+    llama_model* target = data->model_->model_;
+    if (!LlamaModelDrafter::isCompatible(target, draft->model_))
+    {
+        qWarning() << "LlamaCppService::createModelDrafter: the vocabulary of" << draftModelName
+                   << "differs from the one of" << data->model_->modelName_;
+        residency_.release(draftModelName);
+        return nullptr;
+    }
+
+    // the draft model is referenced as long as the drafter lives
+    LlamaModelResidency* residency = &residency_;
+    std::shared_ptr<LlamaModelDrafter> drafter(
+        new LlamaModelDrafter(draft->model_, target, data->n_ctx_, batchSize_),
+        [residency, draftModelName](LlamaModelDrafter* drafter)
+        {
+            delete drafter;
+            residency->release(draftModelName);
+        });
+    if (!drafter->isValid())
+        return nullptr;
+    return drafter;
+}
+
 void LlamaCppService::setModel(Chat* chat, QString modelName)
 {
     LlamaCppChatData* data = getData(chat);
@@ -949,6 +1537,7 @@ void LlamaCppService::post(Chat* chat, const QString& content, bool streamed)
         [this, data, chat]() 
         {
             setModelInternal(data, chat->getCurrentModel());
+            setDraftModelInternal(data, chat->getDraftModel());
         })
         .then(
         [this, data, chat, content, streamed]() 
@@ -960,7 +1549,7 @@ void LlamaCppService::post(Chat* chat, const QString& content, bool streamed)
             }
             
             // Check that context is properly initialized
-            if (!data->ctx_)
+            if (!data->isInitialized())
             {
                 qWarning() << "LlamaCppService::post: context not initialized - cannot generate";
                 qWarning() << "Context could not be created, likely due to insufficient GPU memory";
@@ -982,7 +1571,7 @@ void LlamaCppService::post(Chat* chat, const QString& content, bool streamed)
 QString LlamaCppService::formatMessages(const Chat* chat) const
 {
     const LlamaCppChatData* data = getData(chat);
-    if (!data || !data->ctx_)
+    if (!data || !data->isInitialized())
         return {};
 
     const char* START_THINK = "<think>";
@@ -1003,7 +1592,7 @@ QString LlamaCppService::formatMessages(const Chat* chat) const
             messages.push_back({ "assistant", strdup((thought+message.content_).toUtf8().constData()) });
     }
 
-    std::vector<char> formatted(llama_n_ctx(data->ctx_) * LLM_MAX_TOKEN_LEN);
+    std::vector<char> formatted(data->n_ctx_ * LLM_MAX_TOKEN_LEN);
     int new_len = llama_chat_apply_template(data->llamaCppChattemplate_, messages.data(),
                                             messages.size(), true, formatted.data(), formatted.size());
     
@@ -1019,7 +1608,7 @@ QString LlamaCppService::formatMessage(const Chat* chat, int historyIndex) const
     const ChatMessage& message = chat->getHistory()[historyIndex];
     std::vector<llama_chat_message> messages;
     messages.push_back({ strdup(message.role_.toUtf8().constData()), strdup(message.content_.toUtf8().constData()) });
-    std::vector<char> formatted(llama_n_ctx(data->ctx_) * LLM_MAX_TOKEN_LEN);
+    std::vector<char> formatted(data->n_ctx_ * LLM_MAX_TOKEN_LEN);
     int new_len = llama_chat_apply_template(
         data->llamaCppChattemplate_, messages.data(), messages.size(), true, formatted.data(), formatted.size());
     for (llama_chat_message& msg : messages)
@@ -1041,6 +1630,22 @@ void LlamaCppService::stopStream(Chat* chat)
         data->generateProcess_->stopProcess();
 }
 
+void LlamaCppService::deleteChat(Chat* chat)
+{
+    LlamaCppChatData* data = getData(chat);
+    if (data)
+    {
+        // no session save, its files are removed below
+        clearData(data, false);
+        chat->setData(nullptr);
+        datas_.erase(chat);
+    }
+
+    // the kv cache files of the chat would otherwise stay on disk until evicted
+    if (sessions_)
+        sessions_->remove(chat->getId());
+}
+
 // GPU configuration methods
 void LlamaCppService::setDefaultGpuLayers(int n_gpu_layers)
 {
@@ -1157,104 +1762,379 @@ std::vector<LLMModel> LlamaCppService::getAvailableModels() const
 
 LlamaModelData* LlamaCppService::getModel(const QString& modelname)
 {
-    QHash<QString, LlamaModelData>::iterator it = models_.find(modelname);
+    QMap<QString, LlamaModelData>::iterator it = models_.find(modelname);
     return it != models_.end() ? &it.value() : nullptr;
 }
 
 const LlamaModelData* LlamaCppService::getModel(const QString& modelname) const
 {
-    QHash<QString, LlamaModelData>::const_iterator it = models_.find(modelname);
+    QMap<QString, LlamaModelData>::const_iterator it = models_.find(modelname);
     return it != models_.end() ? &it.value() : nullptr;
 }
 
 LlamaCppChatData* LlamaCppService::getData(Chat* chat)
 {
-    QHash<const Chat*, LlamaCppChatData>::iterator it = datas_.find(chat);
-    return it != datas_.end() ? &it.value() : nullptr;
+    auto it = datas_.find(chat);
+    return it != datas_.end() ? it->second.get() : nullptr;
 }
 
 const LlamaCppChatData* LlamaCppService::getData(const Chat* chat) const
 {
-    QHash<const Chat*, LlamaCppChatData>::const_iterator it = datas_.find(chat);
-    return it != datas_.end() ? &it.value() : nullptr;
+    auto it = datas_.find(chat);
+    return it != datas_.end() ? it->second.get() : nullptr;
 }
 
-std::vector<float> LlamaCppService::getEmbedding(const QString& text)
-{   
-    std::vector<float> embedding;
+LlamaCppEngine* LlamaCppService::getEngine(LlamaModelData* model)
+{
+    LlamaCppEngine*& engine = engines_[model->modelName_];
+    if (!engine)
+    {
+        // room for a default context per sequence, grown when a chat needs more
+        qDebug() << "LlamaCppService::getEngine: new shared engine for" << model->modelName_
+                 << "sequences:" << maxSequences_;
+        engine = new LlamaCppEngine(model, defaultContextSize_ * maxSequences_, maxSequences_, batchSize_, ubatchSize_);
+    }
+    if (!engine->isValid())
+    {
+        delete engine;
+        engines_.remove(model->modelName_);
+        return nullptr;
+    }
+    return engine;
+}
+
+void LlamaCppService::clearEngine(const QString& modelName)
+{
+    LlamaCppEngine* engine = engines_.take(modelName);
+    if (!engine)
+        return;
+
+    for (auto& data : datas_)
+    {
+        if (data.second->engine_ == engine)
+            clearData(data.second.get());
+    }
+    delete engine;
+}
 
-    llama_model* model = nullptr;
-    llama_context* ctx = nullptr;
-    bool decode = false;
-    float* emb_ptr = nullptr;
+LlamaModelData* LlamaCppService::acquireEmbeddingModel()
+{
+    QMutexLocker locker(&modelMutex_);
 
-    // Get a model
+    LlamaModelData* model = nullptr;
     if (embeddingModel_ && embeddingModel_->model_)
-        model = embeddingModel_->model_;
+        model = embeddingModel_;
     else if (lastModelAddedInMemory_ && lastModelAddedInMemory_->model_)
-        model = lastModelAddedInMemory_->model_;
+        model = lastModelAddedInMemory_;
     else
     {
-        std::vector<LLMModel> models = getAvailableModels();       
-        if (models.size())
+        std::vector<LLMModel> models = getAvailableModels();
+        if (!models.size())
         {
-            QString modelName = models.front().toString();
-            embeddingModel_ = loadModel(modelName, 99, false);
-            model = embeddingModel_->model_;
-            qDebug() << "LlamaCppService::getEmbedding: loading model for embeddings" << modelName;
-        }
-        else
             qDebug() << "LlamaCppService::getEmbedding: no models";
-    }       
-    
-    // Create Context for Embedding
-    // We use a temporary context to avoid interfering with chat state
+            return nullptr;
+        }
+
+        QString modelName = models.front().toString();
+        qDebug() << "LlamaCppService::getEmbedding: loading model for embeddings" << modelName;
+        embeddingModel_ = model = loadModel(modelName, 99);
+    }
+
+    if (model)
+        residency_.acquire(model->modelName_);
+    return model;
+}
+
+LlamaModelData* LlamaCppService::acquireModel(const QString& modelName, int numGpuLayers)
+{
+    QMutexLocker locker(&modelMutex_);
+
+    LlamaModelData* model = getModel(modelName);
+    if (!model || !model->model_)
+        model = loadModel(modelName, numGpuLayers);
     if (model)
+        residency_.acquire(modelName);
+    return model;
+}
+
+void LlamaCppService::preloadModel(const QString& modelName)
+{
+    if (modelName.isEmpty())
+        return;
+
+    QFuture<void> f = QtConcurrent::run(
+        [this, modelName]()
+        {
+            if (acquireModel(modelName, 99))
+                residency_.release(modelName);
+        });
+}
+
+qint64 LlamaCppService::getModelMemoryBudgetBytes() const
+{
+    if (modelMemoryBudget_ > 0)
+        return qint64(modelMemoryBudget_) * 1024 * 1024;
+
+    // half of the memory of the devices holding the models, the contexts need the rest
+    size_t gpuTotal = 0;
+    size_t cpuTotal = 0;
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++)
     {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        size_t freeMem = 0;
+        size_t totalMem = 0;
+        ggml_backend_dev_memory(dev, &freeMem, &totalMem);
+        if (ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU)
+            cpuTotal += totalMem;
+        else
+            gpuTotal += totalMem;
+    }
+    return qint64(defaultUseGpu_ && gpuTotal ? gpuTotal : cpuTotal) / 2;
+}
+
+LlamaEmbeddingContext* LlamaCppService::acquireEmbeddingContext(LlamaModelData* model, int n_tokens)
+{
+    std::vector<LlamaEmbeddingContext*>& pool = embeddingContexts_[model->modelName_];
+
+    // a context never exceeds the training context : larger requests are served (truncated) by the largest one
+    n_tokens = std::min(n_tokens, LLM_EMBEDDING_BATCH_SIZE);
+    int n_ctx_train = llama_model_n_ctx_train(model->model_);
+    if (n_ctx_train > 0)
+        n_tokens = std::min(n_tokens, n_ctx_train);
+
+    // reuse a free context large enough for this chunk
+    LlamaEmbeddingContext* ectx = nullptr;
+    for (LlamaEmbeddingContext* entry : pool)
+    {
+        if (!entry->inUse_ && entry->n_ctx_ >= n_tokens)
+        {
+            ectx = entry;
+            break;
+        }
+    }
+
+    if (!ectx)
+    {
+        // size the context for the chunk length (power of two, bounded by the training context)
+        int n_ctx = LLM_EMBEDDING_MIN_CONTEXT_SIZE;
+        while (n_ctx < n_tokens)
+            n_ctx *= 2;
+        if (n_ctx_train > 0 && n_ctx > n_ctx_train)
+            n_ctx = n_ctx_train;
+
+        // replace a free context that became too small, otherwise grow the pool
+        for (LlamaEmbeddingContext* entry : pool)
+        {
+            if (!entry->inUse_)
+            {
+                ectx = entry;
+                break;
+            }
+        }
+        if (!ectx)
+        {
+            ectx = new LlamaEmbeddingContext();
+            pool.push_back(ectx);
+        }
+        if (ectx->ctx_)
+            llama_free(ectx->ctx_);
+
+        // the whole batch must fit in one ubatch for non-causal embedding models
+        // a unified kv buffer lets any sequence use the full context
         llama_context_params params = llama_context_default_params();
-        params.embeddings = true; // Enable embeddings
-        // Use a reasonable context size for chunks (512 was chunk size, so 1024 or 2048 is safe)
-        params.n_ctx = 2048;
-        params.n_batch = 2048;
-        ctx = LLamaInitializeContext(model, params);
+        params.embeddings = true;
+        params.n_ctx = n_ctx;
+        params.n_batch = n_ctx;
+        params.n_ubatch = n_ctx;
+        params.n_seq_max = LLM_EMBEDDING_MAX_SEQUENCES;
+        params.kv_unified = true;
+
+        qDebug() << "LlamaCppService::getEmbedding: new pooled context n_ctx=" << n_ctx
+                 << "pool size:" << pool.size();
+
+        ectx->ctx_ = LLamaInitializeContext(model->model_, params);
+        ++embeddingContextAllocations_;
+        ectx->n_ctx_ = ectx->ctx_ ? n_ctx : 0;
+        ectx->n_seq_max_ = ectx->ctx_ ? (int)llama_n_seq_max(ectx->ctx_) : 0;
+        if (!ectx->ctx_)
+            return nullptr;
     }
-    // Tokenize
-    if (ctx)
+
+    ectx->inUse_ = true;
+    return ectx;
+}
+
+void LlamaCppService::releaseEmbeddingContext(LlamaEmbeddingContext* ectx)
+{
+    if (!ectx)
+        return;
+
+    // clear the memory so the next request starts at position 0
+    if (ectx->ctx_)
+        llama_memory_clear(llama_get_memory(ectx->ctx_), true);
+    ectx->inUse_ = false;
+}
+
+void LlamaCppService::clearEmbeddingContexts(const QString& modelName)
+{
+    QMutexLocker locker(&embeddingMutex_);
+
+    for (auto it = embeddingContexts_.begin(); it != embeddingContexts_.end();)
     {
-        std::vector<llama_token> tokens = LlamaTokenize(ctx, model, text);
-        if (!tokens.empty())
+        if (!modelName.isEmpty() && it.key() != modelName)
         {
-            llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
-            decode = llama_decode(ctx, batch) == 0;
+            ++it;
+            continue;
         }
+
+        for (LlamaEmbeddingContext* ectx : it.value())
+        {
+            if (ectx->inUse_)
+                qWarning() << "LlamaCppService::clearEmbeddingContexts: freeing a context still in use" << it.key();
+            if (ectx->ctx_)
+                llama_free(ectx->ctx_);
+            delete ectx;
+        }
+        it = embeddingContexts_.erase(it);
     }
-    // Extract Embedding
-    if (decode)
-        emb_ptr = llama_get_embeddings(ctx);
-    // Normalize (Cosine Similarity requires normalized vectors or division by norm)
-    // We normalize here for storage efficiency and search speed
-    if (emb_ptr)
+}
+
+std::vector<float> LlamaCppService::getEmbedding(const QString& text)
+{
+    std::vector<std::vector<float>> embeddings = getEmbeddings(QStringList(text));
+    return embeddings.size() ? std::move(embeddings.front()) : std::vector<float>();
+}
+
+std::vector<std::vector<float>> LlamaCppService::getEmbeddings(const QStringList& texts)
+{
+    std::vector<std::vector<float>> embeddings(texts.size());
+    if (texts.isEmpty())
+        return embeddings;
+
+    // Get a model, referenced until the end so that it is not evicted meanwhile
+    LlamaModelData* modelData = acquireEmbeddingModel();
+    llama_model* model = modelData ? modelData->model_ : nullptr;
+    if (!model)
     {
-        int n_embd = llama_model_n_embd(model);
-        embedding = std::vector<float>(emb_ptr, emb_ptr + n_embd);
+        qWarning() << "LlamaCppService::getEmbeddings: no model !";
+        return embeddings;
+    }
+    auto releaseModel = qScopeGuard([this, modelData]() { residency_.release(modelData->modelName_); });
+
+    QMutexLocker locker(&embeddingMutex_);
+
+    // Tokenize
+    std::vector<std::vector<llama_token>> tokens(texts.size());
+    int n_tokens_total = 0;
+    int n_tokens_max = 0;
+    for (int i = 0; i < texts.size(); ++i)
+    {
+        tokens[i] = LlamaTokenize(model, texts[i]);
+        n_tokens_total += tokens[i].size();
+        n_tokens_max = std::max(n_tokens_max, (int)tokens[i].size());
+    }
+    if (!n_tokens_max)
+        return embeddings;
+
+    // Borrow a pooled context for Embedding, large enough for the longest chunk
+    // but not larger than the training context (longer texts are truncated to the batch)
+    // We use a dedicated context to avoid interfering with chat state
+    int n_tokens_batch = std::max(n_tokens_max, std::min(n_tokens_total, LLM_EMBEDDING_BATCH_SIZE));
+    const int n_ctx_train = llama_model_n_ctx_train(model);
+    if (n_ctx_train > 0)
+        n_tokens_batch = std::min(n_tokens_batch, n_ctx_train);
+    LlamaEmbeddingContext* ectx = acquireEmbeddingContext(modelData, n_tokens_batch);
 
-        float norm = 0.0f;
-        for (float f : embedding)
-            norm += f * f;
-        norm = std::sqrt(norm);
+    locker.unlock();
 
-        if (norm > 1e-6) // Avoid div by zero
+    if (!ectx)
+    {
+        qWarning() << "LlamaCppService::getEmbeddings: no context !";
+        return embeddings;
+    }
+
+    llama_context* ctx = ectx->ctx_;
+    const int n_batch = ectx->n_ctx_;
+    const int n_embd = llama_model_n_embd(model);
+    const bool pooled = llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_NONE;
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+    // texts packed in the current batch : <text index, batch index of its last token>
+    std::vector<std::pair<int, int>> packed;
+    packed.reserve(ectx->n_seq_max_);
+
+    auto flush = [&]()
+    {
+        if (!batch.n_tokens)
+            return;
+
+        if (llama_decode(ctx, batch) == 0)
         {
-            for (float& f : embedding)
-                f /= norm;
-        }     
+            for (int s = 0; s < (int)packed.size(); ++s)
+            {
+                // Extract Embedding
+                const float* emb_ptr = pooled ? llama_get_embeddings_seq(ctx, s)
+                                              : llama_get_embeddings_ith(ctx, packed[s].second);
+                if (!emb_ptr)
+                    continue;
+
+                // Normalize (Cosine Similarity requires normalized vectors or division by norm)
+                // We normalize here for storage efficiency and search speed
+                std::vector<float>& embedding = embeddings[packed[s].first];
+                embedding.assign(emb_ptr, emb_ptr + n_embd);
+
+                float norm = 0.0f;
+                for (float f : embedding)
+                    norm += f * f;
+                norm = std::sqrt(norm);
+
+                if (norm > 1e-6) // Avoid div by zero
+                {
+                    for (float& f : embedding)
+                        f /= norm;
+                }
+            }
+        }
+        else
+            qWarning() << "LlamaCppService::getEmbeddings: failed to decode a batch of" << packed.size() << "texts";
+
+        // clear the memory so the next batch starts at position 0
+        llama_memory_clear(llama_get_memory(ctx), true);
+        batch.n_tokens = 0;
+        packed.clear();
+    };
+
+    for (int i = 0; i < (int)tokens.size(); ++i)
+    {
+        std::vector<llama_token>& textTokens = tokens[i];
+        if (textTokens.empty())
+            continue;
+        if ((int)textTokens.size() > n_batch)
+            textTokens.resize(n_batch);
+
+        // the batch is full : decode it
+        if (batch.n_tokens + (int)textTokens.size() > n_batch || (int)packed.size() >= ectx->n_seq_max_)
+            flush();
+
+        const llama_seq_id seq = packed.size();
+        for (int pos = 0; pos < (int)textTokens.size(); ++pos)
+        {
+            const int idx = batch.n_tokens++;
+            batch.token[idx] = textTokens[pos];
+            batch.pos[idx] = pos;
+            batch.n_seq_id[idx] = 1;
+            batch.seq_id[idx][0] = seq;
+            batch.logits[idx] = pos + 1 == (int)textTokens.size();
+        }
+        packed.emplace_back(i, batch.n_tokens - 1);
     }
+    flush();
 
-    if (ctx)
-        llama_free(ctx);
+    llama_batch_free(batch);
 
-    if (!emb_ptr)
-        qWarning() << "LlamaCppService::getEmbedding: error !";
+    locker.relock();
+    releaseEmbeddingContext(ectx);
 
-    return embedding;       
+    return embeddings;
 }
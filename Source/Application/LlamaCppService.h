@@ -1,8 +1,18 @@
 #pragma once
 
 #include "LLMServices.h"
+#include "LlamaCppEngine.h"
+#include "LlamaDetokenizer.h"
+#include "LlamaModelResidency.h"
+#include "LlamaPrefixCache.h"
+#include "LlamaSessionStore.h"
+#include "LlamaSpeculative.h"
+#include "LlamaStreamBuffer.h"
 #include "llama-cpp.h"
 
+#include <memory>
+#include <unordered_map>
+
 struct LlamaCppChatData;
 
 /**
@@ -52,9 +62,20 @@ struct LlamaCppProcess
      */
     virtual void generate() {}
 
+    /**
+     * @brief Ajoute un morceau généré au flux du chat (depuis n'importe quel thread)
+     * @param chat Chat associé
+     * @param piece Morceau de texte
+     *
+     * Le chat est mis à jour depuis le thread du service à la prochaine image, avec tous
+     * les morceaux ajoutés entre-temps.
+     */
+    void streamPiece(Chat* chat, const QString& piece);
+
     int type_;                    ///< Type de processus
     LlamaCppChatData* data_;      ///< Données du chat associées
     LLMServices* service_;        ///< Service LLM parent
+    std::shared_ptr<LlamaStreamBuffer> stream_{std::make_shared<LlamaStreamBuffer>()}; ///< Morceaux en attente d'affichage
 };
 
 /**
@@ -67,9 +88,26 @@ struct LlamaModelData
 {
     QString modelName_;           ///< Nom du modèle
     QString modelPath_;           ///< Chemin vers le fichier du modèle
+    QString fileHash_;            ///< Empreinte du fichier du modèle (clé des sessions sauvegardées)
     int n_gpu_layers_{99};        ///< Nombre de couches à charger sur GPU (99 = toutes)
     bool use_gpu_{true};          ///< Activer/désactiver GPU
     llama_model* model_{nullptr};  ///< Pointeur vers le modèle llama.cpp
+    std::shared_ptr<LlamaPrefixCache> prefixCache_; ///< États KV des préfixes déjà décodés avec ce modèle
+};
+
+/**
+ * @struct LlamaEmbeddingContext
+ * @brief Contexte llama.cpp réutilisable pour le calcul des embeddings
+ * 
+ * Les contextes d'embeddings sont conservés dans un pool du service
+ * afin d'éviter une allocation (et une sonde mémoire GPU) par chunk.
+ */
+struct LlamaEmbeddingContext
+{
+    llama_context* ctx_{nullptr};  ///< Contexte llama.cpp en mode embeddings
+    int n_ctx_{0};                 ///< Taille du contexte en tokens (égale à n_batch et n_ubatch)
+    int n_seq_max_{0};             ///< Nombre maximal de séquences par batch
+    bool inUse_{false};            ///< Indique si le contexte est emprunté par un appel en cours
 };
 
 /**
@@ -96,8 +134,9 @@ struct LlamaCppChatData : public ChatData
     /**
      * @brief Initialise les données du chat
      * @param model Modèle à utiliser (optionnel)
+     * @param engine Moteur partagé du modèle (optionnel, sinon le chat crée son propre contexte)
      */
-    void initialize(LlamaModelData* model = nullptr);
+    void initialize(LlamaModelData* model = nullptr, LlamaCppEngine* engine = nullptr);
     
     /**
      * @brief Désinitialise les données du chat
@@ -113,6 +152,27 @@ struct LlamaCppChatData : public ChatData
      */
     void reset() override;
 
+    /**
+     * @brief Agrandit le contexte propre au chat à n_ctx_ en conservant son cache KV
+     * @return true si le cache KV a été transféré dans le nouveau contexte
+     *
+     * L'état de la séquence est copié en mémoire avant la libération de l'ancien contexte,
+     * puis restauré dans le nouveau : la génération en cours continue sans nouveau décodage.
+     * Si le nouveau contexte ne peut pas être alloué, l'ancienne taille est recréée et la taille
+     * refusée est retenue dans n_ctx_grow_failed_ : la génération ne tente plus de l'atteindre.
+     */
+    bool growContext();
+
+    /**
+     * @brief Libère de la place dans le contexte propre au chat en oubliant le milieu de la conversation
+     * @return true si des tokens ont été retirés
+     *
+     * Les premiers tokens (LLM_CONTEXT_SHIFT_KEEP au plus) et la réponse en cours sont conservés,
+     * la moitié des suivants est retirée du cache KV (llama_memory_seq_rm) et les positions
+     * restantes sont décalées (llama_memory_seq_add). Sans effet si contextShift_ est faux.
+     */
+    bool shiftContext();
+
     /**
      * @brief Vide les données du chat
      * 
@@ -120,12 +180,76 @@ struct LlamaCppChatData : public ChatData
      */
     void clear();
 
+    /**
+     * @brief Indique si le chat dispose d'un contexte (propre ou partagé)
+     */
+    bool isInitialized() const { return ctx_ || engine_; }
+
+    /**
+     * @brief Retourne les tokens présents dans le cache KV du contexte propre au chat
+     *
+     * Pendant une génération, la réponse n'est pas encore dans context_tokens_.
+     */
+    std::vector<llama_token> cachedTokens() const;
+
+    /**
+     * @brief Sauvegarde sur disque le cache KV du chat
+     */
+    void saveSession();
+
+    /**
+     * @brief Retourne l'avancement du décodage du prompt en cours
+     * @return Fraction décodée, 1 si le prompt tient dans un batch ou est décodé
+     */
+    double prefillProgress() const;
+
+    /**
+     * @brief Propose les tokens suivant le dernier token échantillonné (décodage spéculatif)
+     * @param head Tokens du contexte
+     * @param tail Tokens suivants, le dernier est le token échantillonné qui va être décodé
+     * @param n_max Nombre maximal de tokens proposés
+     * @return Tokens proposés, aucun sans drafter
+     */
+    std::vector<llama_token> proposeDraft(const std::vector<llama_token>& head, const std::vector<llama_token>& tail,
+                                          int n_max) const;
+
+    /**
+     * @brief Remplace le drafter du chat
+     * @param drafter Nouveau drafter (nullptr désactive le décodage spéculatif)
+     * @param draftModelName Nom du modèle de brouillon
+     *
+     * Peut être appelée pendant une génération : l'étape en cours termine avec l'ancien drafter.
+     */
+    void setDrafter(std::shared_ptr<LlamaDrafter> drafter, const QString& draftModelName);
+
+    /**
+     * @brief Remplace le profil d'échantillonnage, l'échantillonneur est recréé s'il existe
+     * @param profile Profil du chat
+     *
+     * À appeler entre deux générations.
+     */
+    void setSampler(const SamplerProfile& profile);
+
     Chat* chat_{nullptr};                       ///< Pointeur vers le chat associé
 
     QString response_;                          ///< Réponse courante
 
     LlamaModelData* model_{nullptr};            ///< Modèle utilisé
-    llama_context* ctx_{nullptr};               ///< Contexte llama.cpp
+    llama_context* ctx_{nullptr};               ///< Contexte llama.cpp propre au chat
+    LlamaCppEngine* engine_{nullptr};           ///< Moteur partagé (le chat n'a alors pas de contexte propre)
+    LlamaSessionStore* sessions_{nullptr};      ///< Sauvegarde des sessions du service (optionnelle)
+    QString sessionKey_;                        ///< Clé de session du contexte propre au chat
+    QString chatId_;                            ///< Identifiant du chat des sessions sauvegardées
+    bool contextShift_{false};                  ///< Glissement du contexte plutôt qu'une erreur lorsqu'il est plein
+    int n_ctx_grow_failed_{0};                  ///< Taille de contexte dont l'allocation a échoué (0 : aucune)
+    int n_batch_{LLM_BATCH_SIZE};               ///< Tokens décodés au plus par étape (tranches du prompt)
+    int n_ubatch_{LLM_UBATCH_SIZE};             ///< Taille des micro-batchs, qui dimensionne les buffers de calcul
+    int n_prefill_{0};                          ///< Tokens du prompt à décoder au début de la génération
+    std::shared_ptr<LlamaDrafter> drafter_;     ///< Propositions du décodage spéculatif (nullptr : désactivé)
+    QString draftModelName_;                    ///< Modèle de brouillon du drafter
+    int draftMax_{LLM_DRAFT_MAX_TOKENS};        ///< Tokens proposés au plus par étape
+    LlamaSpeculativeStats draftStats_;          ///< Statistiques du décodage spéculatif
+    SamplerProfile sampler_;                    ///< Profil de l'échantillonneur
     llama_sampler* smpl_{nullptr};              ///< Échantillonneur llama.cpp
     const char* llamaCppChattemplate_{nullptr}; ///< Template de chat
 
@@ -134,14 +258,62 @@ struct LlamaCppChatData : public ChatData
         /*tokens*/ nullptr,
         /*embd*/ nullptr
     }; 
+    llama_batch draftBatch_{};                  ///< Batch du token courant et des tokens proposés (contexte propre)
     llama_token currentToken_{-1};              ///< ID du token courant
+    int n_past_{0};                             ///< Positions du cache KV du contexte propre, suivies à chaque étape
+    std::vector<llama_token> sampled_;          ///< Tokens échantillonnés par la dernière étape (mémoire réutilisée)
     
     std::vector<llama_token> prompt_tokens_;    ///< tokens générés pour le dernier message prompt utilisateur
     std::vector<llama_token> response_tokens_;  ///< tokens générés pour la reponse
+    LlamaDetokenizer detokenizer_;              ///< Texte des tokens générés, par caractères complets
 
     LlamaCppProcess* generateProcess_{nullptr}; ///< Processus de génération
 };
 
+/**
+ * @brief Crée un contexte llama.cpp dimensionné d'après la mémoire disponible
+ * @param model Modèle chargé
+ * @param params Paramètres du contexte, le cache KV est quantifié davantage s'il ne tient pas en mémoire
+ * @return Contexte créé, ou nullptr en cas d'échec
+ *
+ * La mémoire du contexte est estimée à partir des hyperparamètres du modèle (LlamaEstimateContext) :
+ * type_k et type_v sont abaissés avant l'allocation plutôt qu'après un échec.
+ */
+llama_context* LLamaInitializeContext(llama_model* model, llama_context_params& params);
+
+/**
+ * @brief Décode le batch courant du chat et échantillonne le token suivant
+ * @param data Données du chat, avec un contexte propre et le batch à décoder
+ * @return Token échantillonné, 0 en fin de génération, LlamaPrefillStep_ après une tranche d'un long prompt,
+ *         ou une erreur négative (voir LlamaGenerationErrors_)
+ *
+ * Chemin critique de la génération : la position du cache KV est suivie dans data.n_past_ plutôt que
+ * demandée au contexte, et les traces ne sont écrites que si la catégorie "llama.generate" est activée
+ * (QT_LOGGING_RULES="llama.generate.debug=true").
+ */
+int LlamaGenerateStep(LlamaCppChatData& data);
+
+/**
+ * @brief Prépare le batch du token échantillonné pour l'étape suivante
+ */
+void setBatchForNextToken(LlamaCppChatData& data);
+
+/**
+ * @brief Crée l'échantillonneur d'un profil
+ * @param profile Profil d'échantillonnage
+ * @return Chaîne llama.cpp : filtres et température en une passe (llama_sampler_init_fused), puis tirage
+ */
+llama_sampler* LlamaCreateSampler(const SamplerProfile& profile);
+
+/**
+ * @brief Convertit des tokens en texte
+ * @param data Données du chat (pour le vocabulaire du modèle)
+ * @param tokens Tokens à convertir
+ * @param skipLastToken Ignore le dernier token (en général la fin de génération)
+ * @return Texte correspondant, sans limite de longueur
+ */
+QString LLamaDetokenize(LlamaCppChatData& data, const std::vector<llama_token>& tokens, bool skipLastToken);
+
 /**
  * @class LlamaCppWorker
  * @brief Worker pour le traitement asynchrone avec Llama.cpp
@@ -184,10 +356,16 @@ public slots:
 
 signals:
     /**
-     * @brief Signal émis lorsqu'un token est généré
-     * @param token Token généré
+     * @brief Signal émis avec la réponse complète à la fin de la génération
+     * @param token Réponse complète (les tokens passent par le flux du processus)
      */
     void tokenGenerated(const QString& token);
+
+    /**
+     * @brief Signal émis après le décodage d'une tranche d'un long prompt
+     * @param progress Fraction du prompt décodée
+     */
+    void prefillProgress(double progress);
     
     /**
      * @brief Signal émis lorsque la génération est terminée
@@ -277,6 +455,12 @@ public:
      */
     void stopStream(Chat* chat) override;
 
+    /**
+     * @brief Libère les données d'un chat supprimé et efface ses sessions sauvegardées
+     * @param chat Chat supprimé
+     */
+    void deleteChat(Chat* chat) override;
+
     /**
      * @brief Crée des données de chat pour Llama.cpp
      * @param chat Chat associé
@@ -294,8 +478,9 @@ public:
     /**
      * @brief Efface les données de chat
      * @param data Données à effacer
+     * @param saveSession Sauvegarde le cache KV pour la prochaine ouverture du chat
      */
-    void clearData(LlamaCppChatData* data);
+    void clearData(LlamaCppChatData* data, bool saveSession = true);
     
     /**
      * @brief Efface un modèle de la mémoire
@@ -303,6 +488,27 @@ public:
      */
     void clearModelInMemory(const QString& modelName);
 
+    /**
+     * @brief Libère le moteur de génération partagé d'un modèle
+     * @param modelName Nom du modèle concerné
+     *
+     * Les chats qui l'utilisent sont désinitialisés.
+     */
+    void clearEngine(const QString& modelName);
+
+    /**
+     * @brief Libère les contextes d'embeddings du pool
+     * @param modelName Nom du modèle concerné (tous les modèles si vide)
+     */
+    void clearEmbeddingContexts(const QString& modelName = QString());
+
+    /**
+     * @brief Retourne le nombre de contextes d'embeddings créés depuis le démarrage
+     *
+     * Un pool qui réutilise ses contextes n'en crée plus une fois sa taille atteinte.
+     */
+    int getEmbeddingContextAllocations() const { return embeddingContextAllocations_; }
+
     // Activer/désactiver la version threadée
     /**
      * @brief Active ou désactive la version threadée
@@ -316,6 +522,139 @@ public:
      */
     bool isUsingThreadedVersion() const { return useThreadedVersion_; }
 
+    /**
+     * @brief Active ou désactive le moteur partagé par les chats d'un même modèle
+     * @param useSharedEngine true pour générer via LlamaCppEngine (continuous batching)
+     *
+     * Ne concerne que les chats initialisés ensuite.
+     */
+    void setUseSharedEngine(bool useSharedEngine) { useSharedEngine_ = useSharedEngine; }
+
+    /**
+     * @brief Retourne si le moteur partagé est utilisé
+     * @return true si les chats d'un même modèle partagent un contexte
+     */
+    bool isUsingSharedEngine() const { return useSharedEngine_; }
+
+    /**
+     * @brief Définit le nombre de séquences (chats) d'un moteur partagé
+     * @param maxSequences Nombre de séquences des moteurs créés ensuite
+     */
+    void setMaxSequences(int maxSequences) { maxSequences_ = std::max(1, maxSequences); }
+
+    /**
+     * @brief Retourne le nombre de séquences d'un moteur partagé
+     */
+    int getMaxSequences() const { return maxSequences_; }
+
+    /**
+     * @brief Définit la taille du cache des préfixes de chaque modèle
+     * @param sizeMB Taille en Mo des états KV conservés (0 désactive le cache)
+     *
+     * Ne concerne que les modèles chargés ensuite.
+     */
+    void setPrefixCacheSize(int sizeMB) { prefixCacheSize_ = std::max(0, sizeMB); }
+
+    /**
+     * @brief Retourne la taille du cache des préfixes en Mo
+     */
+    int getPrefixCacheSize() const { return prefixCacheSize_; }
+
+    /**
+     * @brief Retourne la sauvegarde sur disque du cache KV des chats (nullptr si désactivée)
+     */
+    LlamaSessionStore* getSessionStore() const { return sessions_.get(); }
+
+    /**
+     * @brief Active ou désactive le glissement du contexte
+     * @param contextShift true pour oublier le milieu de la conversation lorsque le contexte est plein
+     *
+     * Utilisé lorsque le contexte ne peut pas être agrandi (agrandissement automatique désactivé
+     * ou taille d'entraînement du modèle atteinte). Ne concerne que les chats initialisés ensuite.
+     */
+    void setContextShift(bool contextShift) { contextShift_ = contextShift; }
+
+    /**
+     * @brief Retourne si le glissement du contexte est activé
+     */
+    bool isUsingContextShift() const { return contextShift_; }
+
+    /**
+     * @brief Définit la taille des batchs de décodage
+     * @param n_batch Tokens décodés au plus par étape : un prompt plus long est décodé par tranches,
+     *                entre lesquelles les autres chats avancent
+     * @param n_ubatch Taille des micro-batchs, qui dimensionne les buffers de calcul (au plus n_batch)
+     *
+     * Ne concerne que les contextes créés ensuite.
+     */
+    void setBatchSize(int n_batch, int n_ubatch)
+    {
+        batchSize_ = std::max(1, n_batch);
+        ubatchSize_ = std::clamp(n_ubatch, 1, batchSize_);
+    }
+
+    /**
+     * @brief Retourne le nombre maximal de tokens décodés par étape
+     */
+    int getBatchSize() const { return batchSize_; }
+
+    /**
+     * @brief Retourne la taille des micro-batchs
+     */
+    int getUBatchSize() const { return ubatchSize_; }
+
+    /**
+     * @brief Définit le nombre de tokens proposés par étape du décodage spéculatif
+     * @param n_draft Tokens proposés au plus après chaque token échantillonné (0 désactive les propositions)
+     *
+     * Ne concerne que les chats initialisés ensuite.
+     */
+    void setDraftTokens(int n_draft) { draftTokens_ = std::max(0, n_draft); }
+
+    /**
+     * @brief Retourne le nombre de tokens proposés par étape du décodage spéculatif
+     */
+    int getDraftTokens() const { return draftTokens_; }
+
+    /**
+     * @brief Active les propositions par n-grammes du prompt (prompt lookup)
+     * @param promptLookup true pour proposer aux chats sans modèle de brouillon les suites des passages du prompt
+     *
+     * Ne concerne que les chats dont le drafter est choisi ensuite.
+     */
+    void setPromptLookup(bool promptLookup) { promptLookup_ = promptLookup; }
+
+    /**
+     * @brief Indique si les propositions par n-grammes du prompt sont activées
+     */
+    bool isUsingPromptLookup() const { return promptLookup_; }
+
+    /**
+     * @brief Définit le budget mémoire des modèles chargés
+     * @param megabytes Taille maximale de l'ensemble des modèles en Mo (0 : la moitié de la mémoire des GPU,
+     *                  ou de la mémoire système sans GPU)
+     *
+     * Les modèles restent chargés dans ce budget, les moins récemment utilisés sont libérés
+     * au chargement d'un autre modèle s'ils ne sont plus utilisés.
+     */
+    void setModelMemoryBudget(int megabytes) { modelMemoryBudget_ = std::max(0, megabytes); }
+
+    /**
+     * @brief Retourne le budget mémoire des modèles en Mo (0 : automatique)
+     */
+    int getModelMemoryBudget() const { return modelMemoryBudget_; }
+
+    /**
+     * @brief Retourne le budget mémoire des modèles en octets, calculé s'il est automatique
+     */
+    qint64 getModelMemoryBudgetBytes() const;
+
+    /**
+     * @brief Charge un modèle en arrière-plan, pour qu'un chat puisse l'utiliser sans attendre
+     * @param modelName Nom du modèle
+     */
+    void preloadModel(const QString& modelName) override;
+
     // Configuration GPU
     /**
      * @brief Définit le nombre de couches GPU par défaut
@@ -397,6 +736,16 @@ public:
      */
     std::vector<float> getEmbedding(const QString& text) override;
 
+    /**
+     * @brief Génère les embeddings d'une liste de textes
+     * @param texts Textes à encoder
+     * @return Un embedding par texte, dans le même ordre (vide en cas d'échec)
+     * 
+     * Les textes sont regroupés dans un même llama_batch (un seq_id par texte)
+     * dans la limite de n_batch et n_seq_max du contexte d'embeddings.
+     */
+    std::vector<std::vector<float>> getEmbeddings(const QStringList& texts) override;
+
     // Informations sur les backends disponibles
     /**
      * @brief Retourne la liste des backends disponibles
@@ -418,24 +767,47 @@ public:
      */
     static LlamaCppService* createDefault(LLMServices* service, const QString& name);
 
-    QHash<QString, LlamaModelData> models_;          ///< Modèles chargés
-    QHash<const Chat*, LlamaCppChatData> datas_;     ///< Données de chat
+    QMap<QString, LlamaModelData> models_;           ///< Modèles chargés (adresses stables, référencées par les chats)
+    /// Données de chat (adresses stables, référencées par les chats, les processus et les séquences des moteurs)
+    std::unordered_map<const Chat*, std::unique_ptr<LlamaCppChatData> > datas_;
 
     int defaultGpuLayers_{99};                       ///< Couches GPU par défaut
     int defaultContextSize_{LLM_DEFAULT_CONTEXT_SIZE}; ///< Taille de contexte par défaut
     bool defaultUseGpu_{true};                       ///< Utilisation GPU par défaut
     bool useThreadedVersion_{false};                 ///< Version threadée activée
-    bool onlyOneModelInMemory_{true};                ///< Un seul modèle en mémoire
+    bool useSharedEngine_{false};                    ///< Moteur partagé par modèle activé
+    int maxSequences_{LLM_ENGINE_MAX_SEQUENCES};     ///< Séquences par moteur partagé
+    int prefixCacheSize_{LLM_PREFIX_CACHE_SIZE};     ///< Taille du cache des préfixes par modèle (Mo)
+    std::unique_ptr<LlamaSessionStore> sessions_;    ///< Cache KV des chats sauvegardé sur disque
+    bool contextShift_{false};                       ///< Glissement du contexte plein activé
+    int batchSize_{LLM_BATCH_SIZE};                  ///< Tokens décodés au plus par étape
+    int ubatchSize_{LLM_UBATCH_SIZE};                ///< Taille des micro-batchs
+    int draftTokens_{LLM_DRAFT_MAX_TOKENS};          ///< Tokens proposés au plus par étape du décodage spéculatif
+    bool promptLookup_{true};                        ///< Propositions par n-grammes du prompt sans modèle de brouillon
+    int modelMemoryBudget_{LLM_MODEL_MEMORY_BUDGET}; ///< Budget mémoire des modèles chargés (Mo, 0 : automatique)
+    LlamaModelResidency residency_;                  ///< Taille, références et utilisation des modèles chargés
 
 private:
     /**
-     * @brief Charge un modèle en mémoire
+     * @brief Charge un modèle en mémoire (modelMutex_ verrouillé)
      * @param model Nom du modèle
      * @param numGpuLayers Nombre de couches GPU
-     * @param clearOtherModels Effacer les autres modèles
      * @return Pointeur vers les données du modèle chargé
+     *
+     * Les modèles les moins récemment utilisés et non référencés sont libérés
+     * pour que le modèle tienne dans le budget mémoire.
      */
-    LlamaModelData* loadModel(const QString& model, int numGpuLayers, bool clearOtherModels);
+    LlamaModelData* loadModel(const QString& model, int numGpuLayers);
+
+    /**
+     * @brief Retourne un modèle chargé, en le chargeant si nécessaire, et lui ajoute une référence
+     * @param modelName Nom du modèle
+     * @param numGpuLayers Nombre de couches GPU s'il est chargé
+     * @return Pointeur vers les données du modèle, ou nullptr s'il n'a pas pu être chargé
+     *
+     * La référence est à retirer par residency_.release() : le modèle n'est pas évincé d'ici là.
+     */
+    LlamaModelData* acquireModel(const QString& modelName, int numGpuLayers);
     
     /**
      * @brief Définit un modèle interne pour des données de chat
@@ -444,6 +816,63 @@ private:
      */
     void setModelInternal(LlamaCppChatData* data, const QString& modelName);
 
+    /**
+     * @brief Met en place le décodage spéculatif d'un chat avec son modèle de brouillon
+     * @param data Données de chat, avec leur modèle
+     * @param draftModelName Nom du modèle de brouillon (vide : aucun)
+     *
+     * Le modèle de brouillon est chargé à côté du modèle du chat. Sans modèle de brouillon utilisable,
+     * les propositions sont faites par n-grammes du prompt si elles sont activées.
+     */
+    void setDraftModelInternal(LlamaCppChatData* data, const QString& draftModelName);
+
+    /**
+     * @brief Crée le drafter d'un modèle de brouillon pour un chat
+     * @param data Données de chat, avec leur modèle
+     * @param draftModelName Nom du modèle de brouillon (vide : aucun)
+     * @return Drafter, nullptr si le modèle de brouillon est absent, non chargé ou de vocabulaire différent
+     */
+    std::shared_ptr<LlamaDrafter> createModelDrafter(LlamaCppChatData* data, const QString& draftModelName);
+
+    /**
+     * @brief Retourne le moteur partagé d'un modèle (le crée si nécessaire)
+     * @param model Modèle chargé
+     * @return Moteur du modèle, ou nullptr si son contexte n'a pas pu être créé
+     */
+    LlamaCppEngine* getEngine(LlamaModelData* model);
+
+    /**
+     * @brief Retourne le modèle utilisé pour les embeddings (le charge si nécessaire) et lui ajoute une référence
+     * @return Pointeur vers les données du modèle, ou nullptr si aucun modèle
+     *
+     * La référence est à retirer par residency_.release() à la fin du calcul.
+     */
+    LlamaModelData* acquireEmbeddingModel();
+
+    /**
+     * @brief Emprunte un contexte d'embeddings du pool
+     * @param model Modèle d'embeddings
+     * @param n_tokens Nombre de tokens à encoder dans un même batch
+     * @return Contexte disponible et vidé, ou nullptr en cas d'échec
+     * 
+     * Doit être appelée avec embeddingMutex_ verrouillé.
+     */
+    LlamaEmbeddingContext* acquireEmbeddingContext(LlamaModelData* model, int n_tokens);
+
+    /**
+     * @brief Rend un contexte d'embeddings au pool
+     * @param ectx Contexte emprunté
+     * 
+     * Doit être appelée avec embeddingMutex_ verrouillé.
+     */
+    void releaseEmbeddingContext(LlamaEmbeddingContext* ectx);
+
     LlamaModelData* lastModelAddedInMemory_{nullptr};  ///< Dernier modèle chargé
     LlamaModelData* embeddingModel_{nullptr};          ///< Modèle pour les embeddings
+
+    QHash<QString, std::vector<LlamaEmbeddingContext*>> embeddingContexts_; ///< Pool de contextes d'embeddings par modèle
+    int embeddingContextAllocations_{0};               ///< Contextes d'embeddings créés (diagnostic du pool)
+    QHash<QString, LlamaCppEngine*> engines_;          ///< Moteurs de génération partagés par modèle
+    QMutex embeddingMutex_;                            ///< Protège le pool de contextes d'embeddings
+    QMutex modelMutex_;                                ///< Sérialise le chargement et l'éviction des modèles
 };
@@ -0,0 +1,54 @@
+#include <algorithm>
+
+#include "LlamaDetokenizer.h"
+
+// Room reserved for the piece of a token before converting it, a longer piece is converted again
+static const size_t PIECE_RESERVE = 32;
+
+// Length of the complete characters : a lead byte among the 3 last bytes may wait for its continuation bytes
+static size_t completeLength(const std::string& bytes)
+{
+    const size_t size = bytes.size();
+    for (size_t i = 1; i <= std::min<size_t>(size, 3); ++i)
+    {
+        const unsigned char c = bytes[size - i];
+        if ((c & 0xC0) == 0x80)
+            continue;
+
+        // an invalid lead byte is left to the conversion, which replaces it
+        const size_t length = c >= 0xF8 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return length > i ? size - i : size;
+    }
+    return size;
+}
+
+bool LlamaDetokenizer::push(const llama_vocab* vocab, llama_token token)
+{
+    // the piece is written in place after the pending bytes
+    const size_t size = bytes_.size();
+    bytes_.resize(size + PIECE_RESERVE);
+    int n = llama_token_to_piece(vocab, token, &bytes_[size], PIECE_RESERVE, 0, true);
+    if (n < 0)
+    {
+        bytes_.resize(size - n);
+        n = llama_token_to_piece(vocab, token, &bytes_[size], -n, 0, true);
+    }
+    bytes_.resize(size + std::max(n, 0));
+    return n >= 0;
+}
+
+void LlamaDetokenizer::append(const char* bytes, size_t size)
+{
+    bytes_.append(bytes, size);
+}
+
+QString LlamaDetokenizer::take()
+{
+    const size_t length = completeLength(bytes_);
+    if (!length)
+        return {};
+
+    QString text = QString::fromUtf8(bytes_.data(), length);
+    bytes_.erase(0, length);
+    return text;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QString>
+#include <string>
+
+#include "llama-cpp.h"
+
+/**
+ * @class LlamaDetokenizer
+ * @brief Détokenisation incrémentale des tokens d'une génération
+ *
+ * Un token peut ne contenir qu'une partie d'un caractère UTF-8 (tokens d'octets, emojis, idéogrammes) :
+ * les octets des tokens sont accumulés et seuls les caractères complets sont rendus, les octets
+ * d'un caractère incomplet attendent les tokens suivants.
+ *
+ * Le tampon garde sa capacité d'une étape à l'autre : après les premiers tokens, ajouter un token
+ * n'alloue plus de mémoire, quelle que soit la longueur de la génération.
+ */
+class LlamaDetokenizer
+{
+public:
+    /**
+     * @brief Ajoute le texte d'un token
+     * @param vocab Vocabulaire du modèle
+     * @param token Token généré (les tokens spéciaux sont rendus)
+     * @return false si le token n'a pas pu être converti
+     */
+    bool push(const llama_vocab* vocab, llama_token token);
+
+    /**
+     * @brief Ajoute des octets UTF-8
+     * @param bytes Octets, éventuellement une partie d'un caractère
+     * @param size Nombre d'octets
+     */
+    void append(const char* bytes, size_t size);
+
+    /**
+     * @brief Récupère les caractères complets ajoutés depuis le dernier appel
+     * @return Texte des caractères complets, vide si aucun
+     */
+    QString take();
+
+    /**
+     * @brief Nombre d'octets en attente (caractères non récupérés ou incomplets)
+     */
+    size_t pending() const { return bytes_.size(); }
+
+    /**
+     * @brief Oublie les octets en attente, au début d'une génération
+     */
+    void reset() { bytes_.clear(); }
+
+private:
+    std::string bytes_;   ///< Octets non récupérés, dont la fin d'un caractère éventuellement incomplet
+};
@@ -0,0 +1,198 @@
+#include <QDebug>
+#include <QFile>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#include "LLMServiceDefs.h"
+#include "LlamaMemoryEstimator.h"
+
+// Integer metadata of the architecture of a model, such as "llama.attention.key_length"
+static int modelMetadata(const llama_model* model, const char* architecture, const char* key)
+{
+    char value[64];
+    const std::string name = std::string(architecture) + "." + key;
+    if (llama_model_meta_val_str(model, name.c_str(), value, sizeof(value)) <= 0)
+        return 0;
+    return std::atoi(value);
+}
+
+// Size of a row of n elements, in f16 when n is not a multiple of the blocks of the type
+static qint64 rowSize(ggml_type type, qint64 n)
+{
+    if (n % ggml_blck_size(type))
+        type = GGML_TYPE_F16;
+    return ggml_row_size(type, n);
+}
+
+// True if the elements of the type a are smaller than those of the type b
+static bool isSmallerType(ggml_type a, ggml_type b)
+{
+    return ggml_type_size(a) * ggml_blck_size(b) < ggml_type_size(b) * ggml_blck_size(a);
+}
+
+static bool isGpuDevice(ggml_backend_dev_t dev)
+{
+    const enum ggml_backend_dev_type type = ggml_backend_dev_type(dev);
+    return type == GGML_BACKEND_DEVICE_TYPE_GPU || type == GGML_BACKEND_DEVICE_TYPE_IGPU;
+}
+
+LlamaModelShape LlamaModelShape::fromModel(const llama_model* model)
+{
+    LlamaModelShape shape;
+    if (!model)
+        return shape;
+
+    shape.n_layer = llama_model_n_layer(model);
+    shape.n_embd = llama_model_n_embd(model);
+    shape.n_head = llama_model_n_head(model);
+    shape.n_head_kv = llama_model_n_head_kv(model);
+    shape.n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    shape.recurrent = llama_model_is_recurrent(model);
+    shape.weights = llama_model_size(model);
+    shape.n_params = llama_model_n_params(model);
+
+    // the heads may be larger than n_embd / n_head (gemma), the feed-forward size is not in the api
+    char architecture[64] = {};
+    llama_model_meta_val_str(model, "general.architecture", architecture, sizeof(architecture));
+    const int n_embd_head = shape.n_head ? shape.n_embd / shape.n_head : 0;
+    shape.n_embd_head_k = modelMetadata(model, architecture, "attention.key_length");
+    shape.n_embd_head_v = modelMetadata(model, architecture, "attention.value_length");
+    shape.n_ff = modelMetadata(model, architecture, "feed_forward_length");
+    if (shape.n_embd_head_k <= 0)
+        shape.n_embd_head_k = n_embd_head;
+    if (shape.n_embd_head_v <= 0)
+        shape.n_embd_head_v = n_embd_head;
+    if (shape.n_ff <= 0)
+        shape.n_ff = 4 * shape.n_embd;
+    return shape;
+}
+
+LlamaModelShape LlamaModelShape::fromFile(const QString& path)
+{
+    // the metadata only, the allocations are simulated
+    llama_model_params params = llama_model_default_params();
+    params.no_alloc = true;
+    params.use_mmap = false;
+    params.n_gpu_layers = 0;
+    llama_model* model = llama_model_load_from_file(QFile::encodeName(path).constData(), params);
+    if (!model)
+    {
+        qWarning() << "LlamaModelShape::fromFile: unable to read" << path;
+        return {};
+    }
+
+    LlamaModelShape shape = fromModel(model);
+    llama_model_free(model);
+    return shape;
+}
+
+qint64 LlamaEstimateKvCache(const LlamaModelShape& shape, int n_ctx, ggml_type type_k, ggml_type type_v)
+{
+    if (shape.recurrent)
+        return 0;
+
+    const qint64 k = rowSize(type_k, qint64(shape.n_embd_head_k) * shape.n_head_kv);
+    const qint64 v = rowSize(type_v, qint64(shape.n_embd_head_v) * shape.n_head_kv);
+    return (k + v) * n_ctx * shape.n_layer;
+}
+
+qint64 LlamaEstimateCompute(const LlamaModelShape& shape, const llama_context_params& params)
+{
+    const qint64 n_ubatch = std::min(params.n_ubatch, params.n_ctx);
+    const qint64 n_ctx = params.n_ctx;
+    const qint64 f32 = sizeof(float);
+
+    // the largest intermediate tensors of a micro-batch, the allocator reuses the memory of the others
+    const qint64 logits = shape.n_vocab * n_ubatch * f32;
+    const qint64 feedForward = 2 * qint64(shape.n_ff) * n_ubatch * f32;
+    qint64 attention = 0;
+    if (params.flash_attn_type == LLAMA_FLASH_ATTN_TYPE_ENABLED)
+        attention = 2 * n_ctx * shape.n_embd_head_k * shape.n_head_kv * qint64(sizeof(ggml_fp16_t));
+    else
+        attention = n_ctx * n_ubatch * shape.n_head * f32;
+    const qint64 peak = std::max({ logits, feedForward, attention });
+
+    // the activations of a layer next to it, and the logits kept for each sequence
+    const qint64 activations = 8 * qint64(shape.n_embd) * n_ubatch * f32;
+    const qint64 outputs = qint64(shape.n_vocab) * std::max<qint64>(params.n_seq_max, LLM_DRAFT_MAX_TOKENS + 1) * f32;
+    return peak + activations + outputs;
+}
+
+qint64 LlamaEstimateContext(const LlamaModelShape& shape, const llama_context_params& params)
+{
+    return LlamaEstimateKvCache(shape, params.n_ctx, params.type_k, params.type_v)
+           + LlamaEstimateCompute(shape, params);
+}
+
+bool LlamaFitContext(const LlamaModelShape& shape, llama_context_params& params, qint64 available)
+{
+    if (LlamaEstimateContext(shape, params) <= available)
+        return true;
+
+    // quantized values need the flash attention
+    const bool quantizeValues = params.flash_attn_type == LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    for (ggml_type type : { GGML_TYPE_Q8_0, GGML_TYPE_Q4_0 })
+    {
+        if (isSmallerType(type, params.type_k))
+            params.type_k = type;
+        if (quantizeValues && isSmallerType(type, params.type_v))
+            params.type_v = type;
+        if (LlamaEstimateContext(shape, params) <= available)
+            return true;
+    }
+    return false;
+}
+
+int LlamaFitGpuLayers(const LlamaModelShape& shape, const llama_context_params& params, qint64 available)
+{
+    if (!shape.isValid())
+        return 0;
+
+    // the output head is sized from the vocabulary, the layers share the rest of the weights
+    const double bytesPerParam = shape.n_params > 0 ? double(shape.weights) / shape.n_params : 0.0;
+    const qint64 output = std::min<qint64>(qint64(bytesPerParam * shape.n_vocab * shape.n_embd), shape.weights / 2);
+    const qint64 layer = std::max<qint64>(0, shape.weights - 2 * output) / shape.n_layer;
+    const qint64 kvLayer = LlamaEstimateKvCache(shape, params.n_ctx, params.type_k, params.type_v) / shape.n_layer;
+    const qint64 compute = LlamaEstimateCompute(shape, params);
+
+    int n_layers = 0;
+    qint64 used = compute;
+    while (n_layers < shape.n_layer && used + layer + kvLayer <= available)
+    {
+        used += layer + kvLayer;
+        ++n_layers;
+    }
+    if (n_layers == shape.n_layer && used + output <= available)
+        ++n_layers;
+    return n_layers;
+}
+
+bool LlamaHasGpuDevice()
+{
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++)
+    {
+        if (isGpuDevice(ggml_backend_dev_get(i)))
+            return true;
+    }
+    return false;
+}
+
+qint64 LlamaAvailableDeviceMemory()
+{
+    const bool gpu = LlamaHasGpuDevice();
+    qint64 available = 0;
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++)
+    {
+        // the memory of the gpus, or of the system without gpu
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        if (gpu ? !isGpuDevice(dev) : ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_CPU)
+            continue;
+
+        size_t freeMem = 0;
+        size_t totalMem = 0;
+        ggml_backend_dev_memory(dev, &freeMem, &totalMem);
+        available += freeMem;
+    }
+    return available - qint64(LLM_MEMORY_MARGIN) * 1024 * 1024;
+}
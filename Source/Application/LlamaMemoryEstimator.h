@@ -0,0 +1,99 @@
+#pragma once
+
+#include <QString>
+#include <QtGlobal>
+
+#include "llama-cpp.h"
+
+/**
+ * @struct LlamaModelShape
+ * @brief Hyperparamètres d'un modèle qui déterminent la mémoire de ses poids et de ses contextes
+ */
+struct LlamaModelShape
+{
+    int n_layer{0};         ///< Nombre de couches
+    int n_embd{0};          ///< Dimension des embeddings
+    int n_head{0};          ///< Têtes d'attention
+    int n_head_kv{0};       ///< Têtes des clés et des valeurs (GQA)
+    int n_embd_head_k{0};   ///< Dimension d'une tête des clés
+    int n_embd_head_v{0};   ///< Dimension d'une tête des valeurs
+    int n_ff{0};            ///< Dimension des couches feed-forward
+    int n_vocab{0};         ///< Taille du vocabulaire
+    bool recurrent{false};  ///< État récurrent plutôt qu'un cache KV par token
+    qint64 weights{0};      ///< Taille des poids
+    qint64 n_params{0};     ///< Nombre de paramètres
+
+    /**
+     * @brief Indique si les hyperparamètres ont pu être lus
+     */
+    bool isValid() const { return n_layer > 0 && n_embd > 0 && n_head > 0; }
+
+    /**
+     * @brief Lit les hyperparamètres d'un modèle chargé
+     */
+    static LlamaModelShape fromModel(const llama_model* model);
+
+    /**
+     * @brief Lit les hyperparamètres d'un fichier de modèle sans charger ses poids
+     * @param path Chemin du fichier GGUF
+     * @return Hyperparamètres, invalides si le fichier n'a pas pu être lu
+     */
+    static LlamaModelShape fromFile(const QString& path);
+};
+
+/**
+ * @brief Estime la taille du cache KV d'un contexte
+ * @param shape Hyperparamètres du modèle
+ * @param n_ctx Taille du contexte (toutes séquences confondues)
+ * @param type_k Type des clés
+ * @param type_v Type des valeurs
+ * @return Taille en octets, pour toutes les couches
+ */
+qint64 LlamaEstimateKvCache(const LlamaModelShape& shape, int n_ctx, ggml_type type_k, ggml_type type_v);
+
+/**
+ * @brief Estime la taille des buffers de calcul et de sortie d'un contexte
+ * @param shape Hyperparamètres du modèle
+ * @param params Paramètres du contexte (n_ctx, n_ubatch, n_seq_max, flash attention)
+ * @return Taille en octets
+ *
+ * Le pic du graphe est le plus grand de ses tenseurs intermédiaires pour un micro-batch :
+ * logits, scores d'attention (sans flash attention) ou activations feed-forward.
+ */
+qint64 LlamaEstimateCompute(const LlamaModelShape& shape, const llama_context_params& params);
+
+/**
+ * @brief Estime la mémoire d'un contexte : cache KV, buffers de calcul et de sortie
+ */
+qint64 LlamaEstimateContext(const LlamaModelShape& shape, const llama_context_params& params);
+
+/**
+ * @brief Quantifie le cache KV d'un contexte jusqu'à ce qu'il tienne dans la mémoire disponible
+ * @param shape Hyperparamètres du modèle
+ * @param params Paramètres du contexte, dont type_k et type_v sont abaissés au besoin (F16, Q8_0 puis Q4_0)
+ * @param available Mémoire disponible en octets
+ * @return true si le contexte tient, sinon params a le cache KV le plus compact
+ *
+ * Les valeurs ne sont quantifiées qu'avec la flash attention activée, qui en a besoin.
+ */
+bool LlamaFitContext(const LlamaModelShape& shape, llama_context_params& params, qint64 available);
+
+/**
+ * @brief Calcule le nombre de couches du modèle qui tiennent sur le GPU avec un contexte
+ * @param shape Hyperparamètres du modèle
+ * @param params Paramètres du contexte utilisé avec le modèle
+ * @param available Mémoire GPU disponible en octets
+ * @return Couches à décharger, de 0 à n_layer + 1 (toutes les couches et la tête de sortie)
+ */
+int LlamaFitGpuLayers(const LlamaModelShape& shape, const llama_context_params& params, qint64 available);
+
+/**
+ * @brief Indique si un GPU est disponible
+ */
+bool LlamaHasGpuDevice();
+
+/**
+ * @brief Mémoire libre des GPU, ou de la mémoire système sans GPU
+ * @return Octets libres, moins la marge LLM_MEMORY_MARGIN
+ */
+qint64 LlamaAvailableDeviceMemory();
@@ -0,0 +1,93 @@
+#include <QMutexLocker>
+#include <algorithm>
+#include <vector>
+
+#include "LlamaModelResidency.h"
+
+void LlamaModelResidency::add(const QString& name, qint64 bytes)
+{
+    QMutexLocker locker(&mutex_);
+    Entry& entry = entries_[name];
+    entry.bytes = bytes;
+    entry.lastUse = ++clock_;
+}
+
+void LlamaModelResidency::remove(const QString& name)
+{
+    QMutexLocker locker(&mutex_);
+    entries_.remove(name);
+}
+
+void LlamaModelResidency::touch(const QString& name)
+{
+    QMutexLocker locker(&mutex_);
+    auto it = entries_.find(name);
+    if (it != entries_.end())
+        it->lastUse = ++clock_;
+}
+
+void LlamaModelResidency::acquire(const QString& name)
+{
+    QMutexLocker locker(&mutex_);
+    auto it = entries_.find(name);
+    if (it == entries_.end())
+        return;
+    ++it->references;
+    it->lastUse = ++clock_;
+}
+
+void LlamaModelResidency::release(const QString& name)
+{
+    QMutexLocker locker(&mutex_);
+    auto it = entries_.find(name);
+    if (it != entries_.end() && it->references > 0)
+        --it->references;
+}
+
+int LlamaModelResidency::references(const QString& name) const
+{
+    QMutexLocker locker(&mutex_);
+    auto it = entries_.find(name);
+    return it != entries_.end() ? it->references : 0;
+}
+
+bool LlamaModelResidency::contains(const QString& name) const
+{
+    QMutexLocker locker(&mutex_);
+    return entries_.contains(name);
+}
+
+qint64 LlamaModelResidency::size() const
+{
+    QMutexLocker locker(&mutex_);
+    qint64 total = 0;
+    for (const Entry& entry : entries_)
+        total += entry.bytes;
+    return total;
+}
+
+QStringList LlamaModelResidency::evictionCandidates(qint64 incoming, qint64 budget) const
+{
+    QMutexLocker locker(&mutex_);
+
+    qint64 total = incoming;
+    std::vector<std::pair<quint64, QString>> unused;
+    for (auto it = entries_.begin(); it != entries_.end(); ++it)
+    {
+        total += it->bytes;
+        if (!it->references)
+            unused.emplace_back(it->lastUse, it.key());
+    }
+
+    // least recently used first, until the incoming model fits
+    std::sort(unused.begin(), unused.end());
+    QStringList candidates;
+    for (const auto& [lastUse, name] : unused)
+    {
+        if (total <= budget)
+            break;
+        total -= entries_.value(name).bytes;
+        candidates.append(name);
+    }
+    return candidates;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @class LlamaModelResidency
+ * @brief Suivi des modèles chargés en mémoire, de leur taille et de leurs utilisateurs
+ *
+ * Plusieurs modèles restent chargés tant que leur taille totale tient dans un budget mémoire :
+ * repasser d'un chat à un autre sur un modèle différent ne recharge plus le fichier GGUF.
+ * Au chargement d'un nouveau modèle, les modèles les moins récemment utilisés sont évincés
+ * pour lui faire de la place.
+ *
+ * Un modèle est référencé par les chats qui l'utilisent, par les drafters dont il est le modèle
+ * de brouillon et par les calculs d'embeddings en cours : un modèle référencé n'est jamais évincé.
+ *
+ * Seule la comptabilité est tenue ici, le service charge et libère les modèles.
+ * Toutes les méthodes peuvent être appelées depuis n'importe quel thread.
+ */
+class LlamaModelResidency
+{
+public:
+    /**
+     * @brief Enregistre un modèle chargé, le plus récemment utilisé
+     * @param name Nom du modèle
+     * @param bytes Taille du modèle en mémoire
+     */
+    void add(const QString& name, qint64 bytes);
+
+    /**
+     * @brief Oublie un modèle libéré, avec ses références
+     */
+    void remove(const QString& name);
+
+    /**
+     * @brief Indique qu'un modèle vient d'être utilisé
+     */
+    void touch(const QString& name);
+
+    /**
+     * @brief Ajoute une référence à un modèle enregistré (sans effet sinon), devenu le plus récemment utilisé
+     */
+    void acquire(const QString& name);
+
+    /**
+     * @brief Retire une référence à un modèle enregistré (sans effet sinon)
+     */
+    void release(const QString& name);
+
+    /**
+     * @brief Retourne le nombre de références d'un modèle
+     */
+    int references(const QString& name) const;
+
+    /**
+     * @brief Indique si un modèle est enregistré
+     */
+    bool contains(const QString& name) const;
+
+    /**
+     * @brief Taille totale des modèles enregistrés
+     */
+    qint64 size() const;
+
+    /**
+     * @brief Choisit les modèles à évincer avant d'en charger un autre
+     * @param incoming Taille du modèle à charger
+     * @param budget Taille maximale de l'ensemble des modèles
+     * @return Modèles non référencés, du moins récemment utilisé au plus récent, à libérer pour que
+     *         le modèle à charger tienne dans le budget (tous ceux qui le peuvent s'il ne tient pas)
+     */
+    QStringList evictionCandidates(qint64 incoming, qint64 budget) const;
+
+private:
+    /**
+     * @brief Modèle enregistré
+     */
+    struct Entry
+    {
+        qint64 bytes{0};     ///< Taille en mémoire
+        int references{0};   ///< Chats, drafters et embeddings qui l'utilisent
+        quint64 lastUse{0};  ///< Horloge de la dernière utilisation
+    };
+
+    mutable QMutex mutex_;           ///< Protège les entrées
+    QHash<QString, Entry> entries_;  ///< Modèles chargés, par nom
+    quint64 clock_{0};               ///< Horloge des utilisations
+};
@@ -0,0 +1,266 @@
+#include <QDebug>
+#include <QMutexLocker>
+#include <algorithm>
+
+#include "LlamaPrefixCache.h"
+
+struct LlamaPrefixCache::Node
+{
+    std::vector<llama_token> edge;                          // tokens from the parent to this node
+    Node* parent{nullptr};
+    std::map<llama_token, std::unique_ptr<Node>> children;  // keyed by the first token of their edge
+    std::shared_ptr<const State> state;                     // only leaves hold a state
+    quint64 used{0};
+};
+
+// Memory accounted for a stored state
+static size_t stateCost(const LlamaPrefixCache::State& state)
+{
+    return state.data.size() + state.tokens.size() * sizeof(llama_token);
+}
+
+LlamaPrefixCache::Node* LlamaPrefixCache::findLeaf(Node* node, bool newest)
+{
+    if (node->children.empty())
+        return node->state ? node : nullptr;
+
+    Node* best = nullptr;
+    for (auto& child : node->children)
+    {
+        Node* leaf = findLeaf(child.second.get(), newest);
+        if (leaf && (!best || (newest ? leaf->used > best->used : leaf->used < best->used)))
+            best = leaf;
+    }
+    return best;
+}
+
+LlamaPrefixCache::LlamaPrefixCache(size_t maxBytes) : root_(std::make_unique<Node>()), maxBytes_(maxBytes)
+{
+}
+
+LlamaPrefixCache::~LlamaPrefixCache() = default;
+
+void LlamaPrefixCache::store(const std::vector<llama_token>& tokens, std::vector<uint8_t>&& data)
+{
+    if (!worthStoring(tokens.size()) || data.empty())
+        return;
+
+    QMutexLocker locker(&mutex_);
+
+    // walk down the tree, splitting the edge where the tokens diverge
+    Node* node = root_.get();
+    size_t i = 0;
+    while (i < tokens.size())
+    {
+        auto it = node->children.find(tokens[i]);
+        if (it == node->children.end())
+        {
+            auto leaf = std::make_unique<Node>();
+            leaf->edge.assign(tokens.begin() + i, tokens.end());
+            leaf->parent = node;
+            Node* next = leaf.get();
+            node->children[tokens[i]] = std::move(leaf);
+            node = next;
+            break;
+        }
+
+        Node* child = it->second.get();
+        size_t common = 0;
+        while (common < child->edge.size() && i + common < tokens.size() && child->edge[common] == tokens[i + common])
+            ++common;
+
+        if (common < child->edge.size())
+        {
+            auto middle = std::make_unique<Node>();
+            middle->edge.assign(child->edge.begin(), child->edge.begin() + common);
+            middle->parent = node;
+
+            std::unique_ptr<Node> moved = std::move(it->second);
+            moved->edge.erase(moved->edge.begin(), moved->edge.begin() + common);
+            moved->parent = middle.get();
+            middle->children[moved->edge.front()] = std::move(moved);
+
+            Node* next = middle.get();
+            it->second = std::move(middle);
+            child = next;
+        }
+
+        node = child;
+        i += common;
+    }
+
+    // a longer sequence already holds these tokens
+    if (!node->children.empty())
+    {
+        if (Node* leaf = findLeaf(node, true))
+            leaf->used = ++clock_;
+        return;
+    }
+
+    // the shorter sequences held by this one are redundant
+    for (Node* ancestor = node->parent; ancestor; ancestor = ancestor->parent)
+    {
+        if (ancestor->state)
+        {
+            bytes_ -= stateCost(*ancestor->state);
+            ancestor->state.reset();
+            --count_;
+        }
+    }
+
+    if (node->state)
+    {
+        bytes_ -= stateCost(*node->state);
+        --count_;
+    }
+
+    auto state = std::make_shared<State>();
+    state->tokens = tokens;
+    state->data = std::move(data);
+    bytes_ += stateCost(*state);
+    ++count_;
+    node->state = std::move(state);
+    node->used = ++clock_;
+
+    evict();
+}
+
+LlamaPrefixCache::Match LlamaPrefixCache::lookup(const std::vector<llama_token>& tokens)
+{
+    QMutexLocker locker(&mutex_);
+
+    // follow the tokens as deep as they match, every leaf below shares that prefix
+    Node* node = root_.get();
+    size_t i = 0;
+    while (i < tokens.size())
+    {
+        auto it = node->children.find(tokens[i]);
+        if (it == node->children.end())
+            break;
+
+        Node* child = it->second.get();
+        size_t common = 0;
+        while (common < child->edge.size() && i + common < tokens.size() && child->edge[common] == tokens[i + common])
+            ++common;
+
+        node = child;
+        i += common;
+        if (common < child->edge.size())
+            break;
+    }
+
+    Match match;
+    if (i == 0)
+        return match;
+
+    Node* leaf = findLeaf(node, true);
+    if (!leaf)
+        return match;
+
+    leaf->used = ++clock_;
+    match.length = static_cast<int>(i);
+    match.state = leaf->state;
+    return match;
+}
+
+void LlamaPrefixCache::clear()
+{
+    QMutexLocker locker(&mutex_);
+    root_ = std::make_unique<Node>();
+    bytes_ = 0;
+    count_ = 0;
+}
+
+size_t LlamaPrefixCache::size() const
+{
+    QMutexLocker locker(&mutex_);
+    return bytes_;
+}
+
+int LlamaPrefixCache::count() const
+{
+    QMutexLocker locker(&mutex_);
+    return count_;
+}
+
+void LlamaPrefixCache::storeSequence(llama_context* ctx, llama_seq_id seq_id, const std::vector<llama_token>& tokens)
+{
+    if (!ctx || !worthStoring(tokens.size()))
+        return;
+
+    size_t size = llama_state_seq_get_size(ctx, seq_id);
+    if (!size || size > maxBytes_)
+        return;
+
+    std::vector<uint8_t> data(size);
+    size_t written = llama_state_seq_get_data(ctx, data.data(), data.size(), seq_id);
+    if (!written)
+    {
+        qWarning() << "LlamaPrefixCache::storeSequence: failed to save the state of the sequence" << seq_id;
+        return;
+    }
+    data.resize(written);
+
+    store(tokens, std::move(data));
+}
+
+int LlamaPrefixCache::restoreSequence(llama_context* ctx, llama_seq_id seq_id, const Match& match, int maxLength)
+{
+    int length = std::min(match.length, maxLength);
+    if (!ctx || !match.state || !worthStoring(length))
+        return 0;
+
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (!llama_state_seq_set_data(ctx, match.state->data.data(), match.state->data.size(), seq_id))
+    {
+        qWarning() << "LlamaPrefixCache::restoreSequence: failed to restore the state in the sequence" << seq_id;
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
+        return 0;
+    }
+
+    // keep only the common prefix
+    if (length < static_cast<int>(match.state->tokens.size()) && !llama_memory_seq_rm(mem, seq_id, length, -1))
+    {
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
+        return 0;
+    }
+
+    qDebug() << "LlamaPrefixCache::restoreSequence:" << length << "tokens restored in the sequence" << seq_id;
+    return length;
+}
+
+void LlamaPrefixCache::evict()
+{
+    while (bytes_ > maxBytes_)
+    {
+        Node* leaf = findLeaf(root_.get(), false);
+        if (!leaf)
+            break;
+        remove(leaf);
+    }
+}
+
+void LlamaPrefixCache::remove(Node* node)
+{
+    bytes_ -= stateCost(*node->state);
+    node->state.reset();
+    --count_;
+
+    // drop the empty branch
+    while (node != root_.get() && !node->state && node->children.empty())
+    {
+        Node* parent = node->parent;
+        parent->children.erase(node->edge.front());
+        node = parent;
+    }
+
+    // merge a node left with a single child
+    if (node != root_.get() && !node->state && node->children.size() == 1)
+    {
+        Node* parent = node->parent;
+        std::unique_ptr<Node> child = std::move(node->children.begin()->second);
+        child->edge.insert(child->edge.begin(), node->edge.begin(), node->edge.end());
+        child->parent = parent;
+        parent->children[child->edge.front()] = std::move(child);
+    }
+}
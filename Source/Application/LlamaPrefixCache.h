@@ -0,0 +1,138 @@
+#pragma once
+
+#include <QMutex>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "llama-cpp.h"
+
+/**
+ * @class LlamaPrefixCache
+ * @brief Cache des états KV de séquences, indexé par préfixe de tokens
+ *
+ * Un arbre radix sur les identifiants de tokens associe les séquences déjà décodées
+ * (prompt système, préambule RAG, tours précédents) à l'état KV sauvegardé par
+ * llama_state_seq_get_data. Une nouvelle requête recherche l'état qui partage le plus long
+ * préfixe avec ses tokens : après restauration (llama_state_seq_set_data) et troncature au
+ * préfixe commun, seul le suffixe différent est décodé.
+ *
+ * Le cache est borné en octets, les états les moins récemment utilisés sont évincés.
+ * Un état dont les tokens sont le préfixe d'un état plus long est redondant et n'est pas conservé.
+ *
+ * Toutes les méthodes peuvent être appelées depuis n'importe quel thread.
+ */
+class LlamaPrefixCache
+{
+public:
+    /**
+     * @brief État KV sauvegardé d'une séquence
+     */
+    struct State
+    {
+        std::vector<llama_token> tokens; ///< Tokens décodés dans l'état
+        std::vector<uint8_t> data;       ///< Données de llama_state_seq_get_data
+    };
+
+    /**
+     * @brief Résultat d'une recherche
+     */
+    struct Match
+    {
+        int length{0};                       ///< Nombre de tokens communs avec la requête
+        std::shared_ptr<const State> state;  ///< État à restaurer puis tronquer à length tokens
+    };
+
+    /**
+     * @brief Constructeur de LlamaPrefixCache
+     * @param maxBytes Taille maximale des états conservés
+     */
+    explicit LlamaPrefixCache(size_t maxBytes);
+
+    /**
+     * @brief Destructeur
+     */
+    ~LlamaPrefixCache();
+
+    /**
+     * @brief Conserve l'état d'une séquence
+     * @param tokens Tokens décodés dans la séquence
+     * @param data Données de llama_state_seq_get_data
+     *
+     * Ignoré si la séquence est trop courte ou si un état plus long la contient déjà.
+     */
+    void store(const std::vector<llama_token>& tokens, std::vector<uint8_t>&& data);
+
+    /**
+     * @brief Cherche l'état partageant le plus long préfixe avec des tokens
+     * @param tokens Tokens de la requête
+     * @return Préfixe commun et état correspondant (length vaut 0 si aucun état ne convient)
+     */
+    Match lookup(const std::vector<llama_token>& tokens);
+
+    /**
+     * @brief Indique si une séquence mérite d'être conservée
+     * @param n_tokens Nombre de tokens de la séquence
+     */
+    static bool worthStoring(size_t n_tokens) { return n_tokens >= MIN_TOKENS; }
+
+    /**
+     * @brief Vide le cache
+     */
+    void clear();
+
+    /**
+     * @brief Taille des états conservés en octets
+     */
+    size_t size() const;
+
+    /**
+     * @brief Nombre d'états conservés
+     */
+    int count() const;
+
+    /**
+     * @brief Capture l'état d'une séquence d'un contexte et le conserve
+     * @param ctx Contexte llama.cpp
+     * @param seq_id Séquence à sauvegarder
+     * @param tokens Tokens décodés dans la séquence
+     */
+    void storeSequence(llama_context* ctx, llama_seq_id seq_id, const std::vector<llama_token>& tokens);
+
+    /**
+     * @brief Restaure dans une séquence l'état trouvé par lookup()
+     * @param ctx Contexte llama.cpp
+     * @param seq_id Séquence cible, son contenu est remplacé
+     * @param match Résultat de lookup()
+     * @param maxLength Nombre maximal de tokens restaurés
+     * @return Nombre de tokens restaurés dans la séquence (0 si aucun, la séquence est alors vide)
+     */
+    static int restoreSequence(llama_context* ctx, llama_seq_id seq_id, const Match& match, int maxLength);
+
+private:
+    struct Node;
+
+    static constexpr size_t MIN_TOKENS = 32; ///< Taille minimale d'une séquence conservée
+
+    /**
+     * @brief Retourne la feuille la plus (ou la moins) récemment utilisée d'un sous-arbre
+     */
+    static Node* findLeaf(Node* node, bool newest);
+
+    /**
+     * @brief Évince les états les moins récemment utilisés au-delà de maxBytes_ (mutex_ verrouillé)
+     */
+    void evict();
+
+    /**
+     * @brief Retire l'état d'un nœud et les nœuds devenus inutiles (mutex_ verrouillé)
+     */
+    void remove(Node* node);
+
+    mutable QMutex mutex_;          ///< Protège l'arbre
+    std::unique_ptr<Node> root_;    ///< Racine de l'arbre radix
+    size_t maxBytes_{0};            ///< Taille maximale des états
+    size_t bytes_{0};               ///< Taille des états conservés
+    int count_{0};                  ///< Nombre d'états conservés
+    quint64 clock_{0};              ///< Horloge des utilisations (LRU)
+};
@@ -0,0 +1,184 @@
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <algorithm>
+
+#include "LlamaSessionStore.h"
+
+// Bytes read at the beginning and at the end of a model file for its hash
+static const qint64 MODEL_HASH_SAMPLE = 1024 * 1024;
+
+LlamaSessionStore::LlamaSessionStore(const QString& directory, qint64 maxBytes) :
+    directory_(directory),
+    maxBytes_(maxBytes)
+{
+    QDir dir(directory_);
+    if (!dir.exists())
+        dir.mkpath(".");
+}
+
+QString LlamaSessionStore::modelHash(const QString& modelPath)
+{
+    // hashing a whole model takes seconds : its size, header and tail identify it
+    QFile file(modelPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return {};
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(file.size()));
+    hash.addData(file.read(MODEL_HASH_SAMPLE));
+    if (file.size() > 2 * MODEL_HASH_SAMPLE)
+    {
+        file.seek(file.size() - MODEL_HASH_SAMPLE);
+        hash.addData(file.read(MODEL_HASH_SAMPLE));
+    }
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+QString LlamaSessionStore::contextKey(const QString& modelHash, const llama_context_params& params)
+{
+    // the parameters changing the layout of the saved kv cache
+    QString parameters = QString("%1:%2:%3:%4")
+                             .arg(modelHash)
+                             .arg(int(params.type_k))
+                             .arg(int(params.type_v))
+                             .arg(int(params.flash_attn_type));
+    return QString::fromLatin1(QCryptographicHash::hash(parameters.toUtf8(), QCryptographicHash::Sha1).toHex().left(16));
+}
+
+QString LlamaSessionStore::filePath(const QString& chatId, const QString& key) const
+{
+    return QDir(directory_).filePath(chatId + "_" + key + ".kv");
+}
+
+bool LlamaSessionStore::save(llama_context* ctx, llama_seq_id seq_id, const QString& chatId, const QString& key,
+                             const std::vector<llama_token>& tokens)
+{
+    if (!ctx || chatId.isEmpty() || key.isEmpty() || tokens.empty())
+        return false;
+
+    QMutexLocker locker(&mutex_);
+
+    // written aside first : a failed write keeps the previous session
+    const QString path = filePath(chatId, key);
+    const QString temporary = path + ".tmp";
+    size_t written = llama_state_seq_save_file(
+        ctx, QFile::encodeName(temporary).constData(), seq_id, tokens.data(), tokens.size());
+    if (!written || written > size_t(maxBytes_))
+    {
+        if (written)
+            qDebug() << "LlamaSessionStore::save: session larger than the store, not kept:" << written;
+        else
+            qWarning() << "LlamaSessionStore::save: failed to write" << temporary;
+        QFile::remove(temporary);
+        return false;
+    }
+
+    QFile::remove(path);
+    if (!QFile::rename(temporary, path))
+    {
+        qWarning() << "LlamaSessionStore::save: failed to rename" << temporary;
+        QFile::remove(temporary);
+        return false;
+    }
+
+    qDebug() << "LlamaSessionStore::save:" << tokens.size() << "tokens," << written << "bytes for the chat" << chatId;
+
+    evict(path);
+    return true;
+}
+
+int LlamaSessionStore::restore(llama_context* ctx, llama_seq_id seq_id, const QString& chatId, const QString& key,
+                               const std::vector<llama_token>& tokens, int maxLength)
+{
+    if (!ctx || maxLength <= 0)
+        return 0;
+
+    QMutexLocker locker(&mutex_);
+
+    const QString path = filePath(chatId, key);
+    if (!QFile::exists(path))
+        return 0;
+
+    std::vector<llama_token> saved(llama_n_ctx(ctx));
+    size_t n_saved = 0;
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (!llama_state_seq_load_file(
+            ctx, QFile::encodeName(path).constData(), seq_id, saved.data(), saved.size(), &n_saved))
+    {
+        // unreadable or too large for this context : it would fail again
+        qWarning() << "LlamaSessionStore::restore: failed to load" << path;
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
+        QFile::remove(path);
+        return 0;
+    }
+
+    // keep only what the chat still has in common with the session
+    int common = 0;
+    const int n_max = std::min<int>(std::min<int>(n_saved, tokens.size()), maxLength);
+    while (common < n_max && saved[common] == tokens[common])
+        ++common;
+
+    if (!common || (common < int(n_saved) && !llama_memory_seq_rm(mem, seq_id, common, -1)))
+    {
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
+        return 0;
+    }
+
+    // most recently used
+    QFile file(path);
+    if (file.open(QIODevice::ReadWrite))
+        file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+    qDebug() << "LlamaSessionStore::restore:" << common << "tokens restored for the chat" << chatId;
+    return common;
+}
+
+bool LlamaSessionStore::contains(const QString& chatId, const QString& key) const
+{
+    QMutexLocker locker(&mutex_);
+    return QFile::exists(filePath(chatId, key));
+}
+
+void LlamaSessionStore::remove(const QString& chatId)
+{
+    QMutexLocker locker(&mutex_);
+    QDir dir(directory_);
+    for (const QString& name : dir.entryList({ chatId + "_*.kv" }, QDir::Files))
+        dir.remove(name);
+}
+
+qint64 LlamaSessionStore::size() const
+{
+    QMutexLocker locker(&mutex_);
+    qint64 total = 0;
+    for (const QFileInfo& info : QDir(directory_).entryInfoList({ "*.kv" }, QDir::Files))
+        total += info.size();
+    return total;
+}
+
+void LlamaSessionStore::evict(const QString& keep)
+{
+    // newest first : the oldest ones beyond the budget are removed
+    qint64 total = 0;
+    const QFileInfo kept(keep);
+    for (const QFileInfo& info : QDir(directory_).entryInfoList({ "*.kv" }, QDir::Files, QDir::Time))
+    {
+        if (info.absoluteFilePath() == kept.absoluteFilePath())
+        {
+            total += info.size();
+            continue;
+        }
+        if (total + info.size() > maxBytes_)
+        {
+            qDebug() << "LlamaSessionStore: evicting" << info.fileName();
+            QFile::remove(info.absoluteFilePath());
+            continue;
+        }
+        total += info.size();
+    }
+}
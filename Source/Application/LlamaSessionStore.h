@@ -0,0 +1,106 @@
+#pragma once
+
+#include <QMutex>
+#include <QString>
+#include <vector>
+
+#include "llama-cpp.h"
+
+/**
+ * @class LlamaSessionStore
+ * @brief Sauvegarde sur disque du cache KV des chats
+ *
+ * L'état KV de la séquence d'un chat est écrit par llama_state_seq_save_file dans un fichier
+ * du répertoire du store (à côté de la base des chats), avec les tokens correspondants.
+ * Le nom du fichier contient l'identifiant du chat et une clé calculée à partir de l'empreinte
+ * du fichier du modèle et des paramètres du contexte qui déterminent le format du cache KV :
+ * un état n'est restauré qu'avec le même modèle et la même configuration.
+ *
+ * La restauration est paresseuse : elle a lieu à la première génération du chat rouvert,
+ * et seul le préfixe commun avec les tokens du chat est conservé.
+ *
+ * La taille totale des fichiers est bornée, les moins récemment utilisés sont supprimés.
+ *
+ * Toutes les méthodes peuvent être appelées depuis n'importe quel thread.
+ */
+class LlamaSessionStore
+{
+public:
+    /**
+     * @brief Constructeur de LlamaSessionStore
+     * @param directory Répertoire des fichiers de session
+     * @param maxBytes Taille maximale de l'ensemble des fichiers
+     */
+    LlamaSessionStore(const QString& directory, qint64 maxBytes);
+
+    /**
+     * @brief Calcule l'empreinte d'un fichier de modèle
+     * @param modelPath Chemin du fichier du modèle
+     * @return Empreinte hexadécimale (taille, début et fin du fichier)
+     */
+    static QString modelHash(const QString& modelPath);
+
+    /**
+     * @brief Calcule la clé des sessions d'un modèle avec des paramètres de contexte
+     * @param modelHash Empreinte du fichier du modèle
+     * @param params Paramètres du contexte
+     * @return Clé hexadécimale
+     */
+    static QString contextKey(const QString& modelHash, const llama_context_params& params);
+
+    /**
+     * @brief Sauvegarde l'état KV d'une séquence pour un chat
+     * @param ctx Contexte llama.cpp
+     * @param seq_id Séquence du chat
+     * @param chatId Identifiant du chat
+     * @param key Clé du modèle et du contexte
+     * @param tokens Tokens décodés dans la séquence
+     * @return true si le fichier a été écrit
+     */
+    bool save(llama_context* ctx, llama_seq_id seq_id, const QString& chatId, const QString& key,
+              const std::vector<llama_token>& tokens);
+
+    /**
+     * @brief Restaure l'état KV sauvegardé d'un chat dans une séquence
+     * @param ctx Contexte llama.cpp
+     * @param seq_id Séquence cible, son contenu est remplacé
+     * @param chatId Identifiant du chat
+     * @param key Clé du modèle et du contexte
+     * @param tokens Tokens actuels du chat
+     * @param maxLength Nombre maximal de tokens restaurés
+     * @return Nombre de tokens restaurés (0 si aucun, la séquence est alors vide)
+     */
+    int restore(llama_context* ctx, llama_seq_id seq_id, const QString& chatId, const QString& key,
+                const std::vector<llama_token>& tokens, int maxLength);
+
+    /**
+     * @brief Indique si une session existe pour un chat
+     */
+    bool contains(const QString& chatId, const QString& key) const;
+
+    /**
+     * @brief Supprime les sessions d'un chat
+     */
+    void remove(const QString& chatId);
+
+    /**
+     * @brief Taille totale des fichiers de session
+     */
+    qint64 size() const;
+
+private:
+    /**
+     * @brief Chemin du fichier de session d'un chat
+     */
+    QString filePath(const QString& chatId, const QString& key) const;
+
+    /**
+     * @brief Supprime les sessions les moins récemment utilisées au-delà de maxBytes_ (mutex_ verrouillé)
+     * @param keep Fichier à conserver
+     */
+    void evict(const QString& keep);
+
+    mutable QMutex mutex_;  ///< Sérialise les accès aux fichiers
+    QString directory_;     ///< Répertoire des fichiers de session
+    qint64 maxBytes_{0};    ///< Taille maximale des fichiers
+};
@@ -0,0 +1,192 @@
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "LlamaCppService.h"
+#include "LlamaSpeculative.h"
+
+// First token id compared between two vocabularies : the first ones are control tokens which may differ
+static const llama_token VOCAB_CHECK_START = 5;
+// Largest difference of size between two vocabularies : the extra tokens are never proposed
+static const int VOCAB_MAX_SIZE_DIFFERENCE = 128;
+// Shortest and longest n-grams matched by the prompt lookup
+static const int NGRAM_MIN = 2;
+static const int NGRAM_MAX = 4;
+
+static llama_context_params drafterContextParams(int n_ctx, int n_batch)
+{
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = n_ctx;
+    params.n_batch = std::min(n_ctx, n_batch);
+    params.n_ubatch = params.n_batch;
+    params.n_seq_max = 1;
+    return params;
+}
+
+LlamaModelDrafter::LlamaModelDrafter(llama_model* model, const llama_model* target, int n_ctx, int n_batch) :
+    model_(model),
+    n_batch_(n_batch)
+{
+    n_vocab_ = std::min(llama_vocab_n_tokens(llama_model_get_vocab(model)),
+                        llama_vocab_n_tokens(llama_model_get_vocab(target)));
+    llama_context_params params = drafterContextParams(n_ctx, n_batch_);
+    ctx_ = LLamaInitializeContext(model_, params);
+    if (!ctx_)
+        qWarning() << "LlamaModelDrafter: unable to create the draft context";
+}
+
+LlamaModelDrafter::~LlamaModelDrafter()
+{
+    if (ctx_)
+        llama_free(ctx_);
+}
+
+bool LlamaModelDrafter::isCompatible(const llama_model* target, const llama_model* draft)
+{
+    const llama_vocab* vt = llama_model_get_vocab(target);
+    const llama_vocab* vd = llama_model_get_vocab(draft);
+
+    if (llama_vocab_type(vt) != llama_vocab_type(vd) || llama_vocab_bos(vt) != llama_vocab_bos(vd)
+        || llama_vocab_eos(vt) != llama_vocab_eos(vd) || llama_vocab_get_add_bos(vt) != llama_vocab_get_add_bos(vd))
+        return false;
+
+    const int n_target = llama_vocab_n_tokens(vt);
+    const int n_draft = llama_vocab_n_tokens(vd);
+    if (std::abs(n_target - n_draft) > VOCAB_MAX_SIZE_DIFFERENCE)
+        return false;
+
+    for (llama_token token = VOCAB_CHECK_START; token < std::min(n_target, n_draft); ++token)
+    {
+        if (std::strcmp(llama_vocab_get_text(vt, token), llama_vocab_get_text(vd, token)) != 0)
+            return false;
+    }
+    return true;
+}
+
+std::vector<llama_token> LlamaModelDrafter::propose(const std::vector<llama_token>& tokens, int n_max)
+{
+    if (!ctx_ || tokens.empty() || n_max <= 0)
+        return {};
+
+    // a longer conversation gets a larger context, the kv cache is decoded again
+    const int n_needed = tokens.size() + n_max;
+    if (n_needed > int(llama_n_ctx(ctx_)))
+    {
+        int n_ctx = llama_n_ctx(ctx_);
+        while (n_ctx < n_needed)
+            n_ctx *= 2;
+        llama_free(ctx_);
+        cached_.clear();
+        llama_context_params params = drafterContextParams(n_ctx, n_batch_);
+        ctx_ = LLamaInitializeContext(model_, params);
+        if (!ctx_)
+        {
+            qWarning() << "LlamaModelDrafter: unable to grow the draft context to" << n_ctx << "tokens";
+            return {};
+        }
+    }
+
+    // keep what the draft kv cache has in common with the tokens, the last token is always decoded for its logits
+    llama_memory_t mem = llama_get_memory(ctx_);
+    size_t common = 0;
+    const size_t n_common = std::min(cached_.size(), tokens.size() - 1);
+    while (common < n_common && cached_[common] == tokens[common])
+        ++common;
+    if (common < cached_.size() && !llama_memory_seq_rm(mem, 0, common, -1))
+    {
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        common = 0;
+    }
+    cached_.assign(tokens.begin(), tokens.begin() + common);
+
+    for (size_t i = common; i < tokens.size(); i += n_batch_)
+    {
+        const int n_tokens = std::min<size_t>(n_batch_, tokens.size() - i);
+        if (llama_decode(ctx_, llama_batch_get_one(const_cast<llama_token*>(tokens.data()) + i, n_tokens)) != 0)
+        {
+            qWarning() << "LlamaModelDrafter: failed to decode the context";
+            llama_memory_seq_rm(mem, 0, -1, -1);
+            cached_.clear();
+            return {};
+        }
+        cached_.insert(cached_.end(), tokens.begin() + i, tokens.begin() + i + n_tokens);
+    }
+
+    // greedy drafts, while the draft model is confident enough
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    std::vector<llama_token> draft;
+    while (int(draft.size()) < n_max)
+    {
+        const float* logits = llama_get_logits_ith(ctx_, -1);
+        llama_token best = 0;
+        for (llama_token token = 1; token < n_vocab_; ++token)
+        {
+            if (logits[token] > logits[best])
+                best = token;
+        }
+
+        float sum = 0.0f;
+        for (llama_token token = 0; token < n_vocab_; ++token)
+            sum += std::exp(logits[token] - logits[best]);
+        if (1.0f / sum < LLM_DRAFT_MIN_PROBABILITY)
+            break;
+
+        draft.push_back(best);
+        if (int(draft.size()) == n_max || llama_vocab_is_eog(vocab, best))
+            break;
+
+        if (llama_decode(ctx_, llama_batch_get_one(&draft.back(), 1)) != 0)
+            break;
+        cached_.push_back(best);
+    }
+
+    return draft;
+}
+
+std::vector<llama_token> LlamaNgramDrafter::propose(const std::vector<llama_token>& tokens, int n_max)
+{
+    const int size = tokens.size();
+    if (n_max <= 0 || size < NGRAM_MIN + 1)
+        return {};
+
+    // the most recent of the longest earlier occurrences of the last tokens
+    int best = -1;
+    int bestLength = NGRAM_MIN - 1;
+    for (int i = size - 2; i >= 0 && bestLength < NGRAM_MAX; --i)
+    {
+        if (tokens[i] != tokens[size - 1])
+            continue;
+
+        int length = 1;
+        while (length < NGRAM_MAX && length <= i && tokens[i - length] == tokens[size - 1 - length])
+            ++length;
+        if (length > bestLength)
+        {
+            best = i;
+            bestLength = length;
+        }
+    }
+    if (best < 0)
+        return {};
+
+    // the tokens which followed it
+    const int begin = best + 1;
+    const int end = std::min(size, begin + n_max);
+    return std::vector<llama_token>(tokens.begin() + begin, tokens.begin() + end);
+}
+
+std::vector<llama_token> LlamaSpeculativeAccept(llama_sampler* smpl, llama_context* ctx, int first,
+                                                const std::vector<llama_token>& draft)
+{
+    std::vector<llama_token> accepted;
+    accepted.reserve(draft.size() + 1);
+    for (size_t i = 0; i <= draft.size(); ++i)
+    {
+        const llama_token token = llama_sampler_sample(smpl, ctx, first + i);
+        accepted.push_back(token);
+        if (i == draft.size() || token != draft[i])
+            break;
+    }
+    return accepted;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QtGlobal>
+#include <vector>
+
+#include "llama-cpp.h"
+
+/**
+ * @class LlamaDrafter
+ * @brief Proposition des prochains tokens d'une génération (décodage spéculatif)
+ *
+ * Les tokens proposés sont décodés par le modèle du chat dans le même batch que le token
+ * échantillonné, puis vérifiés par LlamaSpeculativeAccept() : une étape produit alors
+ * plusieurs tokens pour un seul décodage du modèle.
+ *
+ * Un drafter n'est utilisé que par une génération à la fois.
+ */
+class LlamaDrafter
+{
+public:
+    /**
+     * @brief Destructeur virtuel
+     */
+    virtual ~LlamaDrafter() = default;
+
+    /**
+     * @brief Propose la suite d'une séquence
+     * @param tokens Tokens de la séquence, le dernier est le token échantillonné qui va être décodé
+     * @param n_max Nombre maximal de tokens proposés
+     * @return Tokens proposés, éventuellement aucun
+     */
+    virtual std::vector<llama_token> propose(const std::vector<llama_token>& tokens, int n_max) = 0;
+};
+
+/**
+ * @class LlamaModelDrafter
+ * @brief Propositions d'un petit modèle de la même famille que celui du chat
+ *
+ * Le drafter a son propre contexte sur le modèle de brouillon, dont le cache KV suit les tokens
+ * du chat : à chaque proposition, seuls les tokens ajoutés depuis la précédente sont décodés.
+ * Les tokens sont proposés de manière gloutonne tant que le modèle de brouillon en est assez sûr.
+ */
+class LlamaModelDrafter : public LlamaDrafter
+{
+public:
+    /**
+     * @brief Constructeur de LlamaModelDrafter
+     * @param model Modèle de brouillon chargé
+     * @param target Modèle du chat, dont le vocabulaire borne les tokens proposés
+     * @param n_ctx Taille initiale du contexte (agrandi avec la conversation)
+     * @param n_batch Tokens décodés au plus par appel à llama_decode
+     */
+    LlamaModelDrafter(llama_model* model, const llama_model* target, int n_ctx, int n_batch);
+
+    /**
+     * @brief Destructeur, libère le contexte de brouillon
+     */
+    ~LlamaModelDrafter() override;
+
+    /**
+     * @brief Indique si le contexte de brouillon a pu être créé
+     */
+    bool isValid() const { return ctx_ != nullptr; }
+
+    /**
+     * @brief Retourne le modèle de brouillon
+     */
+    llama_model* model() const { return model_; }
+
+    /**
+     * @brief Indique si un modèle de brouillon peut proposer des tokens à un modèle
+     * @param target Modèle du chat
+     * @param draft Modèle de brouillon
+     * @return true si les deux vocabulaires sont identiques (type, tokens spéciaux et textes des tokens)
+     */
+    static bool isCompatible(const llama_model* target, const llama_model* draft);
+
+    std::vector<llama_token> propose(const std::vector<llama_token>& tokens, int n_max) override;
+
+private:
+    llama_model* model_{nullptr};       ///< Modèle de brouillon
+    llama_context* ctx_{nullptr};       ///< Contexte de brouillon (séquence 0)
+    int n_batch_{0};                    ///< Tokens décodés au plus par appel
+    int n_vocab_{0};                    ///< Tokens communs aux deux vocabulaires
+    std::vector<llama_token> cached_;   ///< Tokens présents dans le cache KV de brouillon
+};
+
+/**
+ * @class LlamaNgramDrafter
+ * @brief Propositions sans modèle de brouillon, par recherche de n-grammes dans le contexte (prompt lookup)
+ *
+ * Les derniers tokens de la séquence sont recherchés dans ses tokens précédents : les tokens qui
+ * suivaient leur occurrence la plus récente (la plus longue, jusqu'à 4 tokens) sont proposés.
+ * Efficace lorsque la réponse recopie des passages du prompt (contexte RAG, code modifié).
+ * Sans état ni mémoire supplémentaire : un parcours des tokens par proposition.
+ */
+class LlamaNgramDrafter : public LlamaDrafter
+{
+public:
+    std::vector<llama_token> propose(const std::vector<llama_token>& tokens, int n_max) override;
+};
+
+/**
+ * @struct LlamaSpeculativeStats
+ * @brief Statistiques du décodage spéculatif d'un chat
+ */
+struct LlamaSpeculativeStats
+{
+    quint64 drafted{0};   ///< Tokens proposés
+    quint64 accepted{0};  ///< Tokens proposés acceptés par le modèle du chat
+
+    /**
+     * @brief Taux d'acceptation des tokens proposés (-1 si aucun)
+     */
+    double acceptanceRate() const { return drafted ? double(accepted) / drafted : -1.0; }
+};
+
+/**
+ * @brief Vérifie les tokens proposés avec les logits du modèle du chat
+ * @param smpl Échantillonneur du chat
+ * @param ctx Contexte qui vient de décoder le token courant suivi des tokens proposés, avec leurs logits
+ * @param first Index dans le batch des logits du token courant, ceux des tokens proposés suivent
+ * @param draft Tokens proposés
+ * @return Tokens acceptés, suivis du token échantillonné après le dernier d'entre eux
+ *
+ * Rejection sampling avec des propositions déterministes : à chaque position, un token est
+ * échantillonné avec la chaîne du chat et le token proposé n'est accepté que s'il est identique,
+ * soit avec la probabilité que lui donne le modèle du chat. Au premier refus, le token échantillonné
+ * suit la distribution du modèle privée du token refusé. La génération suit donc exactement
+ * la distribution de l'échantillonneur du chat.
+ */
+std::vector<llama_token> LlamaSpeculativeAccept(llama_sampler* smpl, llama_context* ctx, int first,
+                                                const std::vector<llama_token>& draft);
@@ -0,0 +1,55 @@
+#include "LlamaStreamBuffer.h"
+
+LlamaStreamBuffer::~LlamaStreamBuffer()
+{
+    Piece* piece = head_.exchange(nullptr);
+    while (piece)
+    {
+        Piece* next = piece->next_;
+        delete piece;
+        piece = next;
+    }
+}
+
+bool LlamaStreamBuffer::append(const QString& piece)
+{
+    if (piece.isEmpty())
+        return false;
+
+    // the node may be taken as soon as it is linked : the previous head is kept aside
+    Piece* previous = head_.load(std::memory_order_relaxed);
+    Piece* node = new Piece{ piece, previous };
+    while (!head_.compare_exchange_weak(previous, node, std::memory_order_release, std::memory_order_relaxed))
+        node->next_ = previous;
+    return previous == nullptr;
+}
+
+QString LlamaStreamBuffer::take()
+{
+    Piece* piece = head_.exchange(nullptr, std::memory_order_acquire);
+    if (!piece)
+        return {};
+
+    // the pieces are linked from the newest one : reversed to be concatenated in order
+    Piece* oldest = nullptr;
+    qsizetype length = 0;
+    while (piece)
+    {
+        Piece* next = piece->next_;
+        piece->next_ = oldest;
+        oldest = piece;
+        length += piece->text_.size();
+        piece = next;
+    }
+
+    QString text;
+    text.reserve(length);
+    while (oldest)
+    {
+        Piece* next = oldest->next_;
+        text += oldest->text_;
+        delete oldest;
+        oldest = next;
+    }
+    return text;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QString>
+#include <atomic>
+
+/**
+ * @class LlamaStreamBuffer
+ * @brief Tampon sans verrou des morceaux de texte d'une génération en streaming
+ *
+ * Le thread de génération ajoute chaque morceau détokenisé sans attendre le thread de l'interface,
+ * qui récupère tout le texte accumulé au plus une fois par image (LLM_STREAM_FRAME_MS) : le chat
+ * n'est mis à jour qu'une fois par image, quel que soit le débit de tokens du modèle.
+ *
+ * Les morceaux forment une pile chaînée dont la tête est échangée atomiquement : plusieurs
+ * producteurs et un seul consommateur.
+ */
+class LlamaStreamBuffer
+{
+public:
+    LlamaStreamBuffer() = default;
+    LlamaStreamBuffer(const LlamaStreamBuffer&) = delete;
+    LlamaStreamBuffer& operator=(const LlamaStreamBuffer&) = delete;
+
+    /**
+     * @brief Destructeur, libère les morceaux non récupérés
+     */
+    ~LlamaStreamBuffer();
+
+    /**
+     * @brief Ajoute un morceau de texte (thread producteur)
+     * @param piece Morceau de texte
+     * @return true si le tampon était vide : le consommateur doit être prévenu
+     */
+    bool append(const QString& piece);
+
+    /**
+     * @brief Récupère le texte accumulé et vide le tampon (thread consommateur)
+     * @return Morceaux concaténés dans l'ordre de leur ajout
+     */
+    QString take();
+
+    /**
+     * @brief Indique si le tampon est vide
+     */
+    bool isEmpty() const { return head_.load(std::memory_order_acquire) == nullptr; }
+
+private:
+    struct Piece
+    {
+        QString text_;            ///< Texte du morceau
+        Piece* next_{nullptr};    ///< Morceau ajouté avant celui-ci
+    };
+
+    std::atomic<Piece*> head_{nullptr};  ///< Dernier morceau ajouté
+};
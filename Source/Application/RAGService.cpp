@@ -1,32 +1,49 @@
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
+#include <QSettings>
 #include <QtConcurrent/QtConcurrent>
 
-#include "DocumentProcessor.h"
 #include "LLMServices.h"
 
 #include "RAGService.h"
 
+// Refresh period of the ingestion progress (ms)
+static const int INGESTION_PROGRESS_INTERVAL = 500;
+
+// Default size of the retrieval caches (MB)
+static const int DEFAULT_CACHE_SIZE = 16;
+
 RAGService::RAGService(LLMServices* llmservices, QObject* parent) :
     QObject(parent), llmServices_(llmservices), status_("Ready")
 {
+    progressTimer_.setInterval(INGESTION_PROGRESS_INTERVAL);
+    connect(&progressTimer_, &QTimer::timeout, this, &RAGService::updateIngestionProgress);
+
+    QSettings settings;
+    cache_.setMaxBytes(qint64(settings.value("ragCacheSize", DEFAULT_CACHE_SIZE).toInt()) * 1024 * 1024);
+
     // Try to load default collection on startup
     loadCollection();
 }
 
-RAGService::~RAGService() {}
+RAGService::~RAGService()
+{
+    if (ingesting_)
+    {
+        pipeline_->cancel();
+        ingestion_.waitForFinished();
+    }
+}
 
 void RAGService::ingestFile(const QString& filePath)
 {
     status_ = "Ingesting " + QFileInfo(filePath).fileName() + "...";
     emit collectionStatusChanged();
 
-    QFuture<void> f = QtConcurrent::run(
-        [this, filePath]()
-        {
-            processFileInternal(filePath);
-        });
+    startIngestion({ filePath });
 }
 
 void RAGService::ingestDirectory(const QString& dirPath)
@@ -34,62 +51,243 @@ void RAGService::ingestDirectory(const QString& dirPath)
     status_ = "Ingesting directory...";
     emit collectionStatusChanged();
 
-    QFuture<void> f = QtConcurrent::run(
-        [this, dirPath]()
-        {
-            QDirIterator it(
-                dirPath, QStringList() << "*.pdf" << "*.txt" << "*.md", QDir::Files, QDirIterator::Subdirectories);
-            int docs = 0;
-            while (it.hasNext())
-            {
-                processFileInternal(it.next());
-                docs++;
-            }
+    startIngestion({ dirPath });
+}
 
-            QMetaObject::invokeMethod(this,
-                [this, docs]()
-                {
-                    status_ = QString("Ready (%1 docs ingested)").arg(docs);
-                    emit collectionStatusChanged();
-                    emit ingestionFinished(docs, vectorStore_.count());
-                    saveCollection();
-                });
-        });
+bool RAGService::removeDocument(const QString& filePath)
+{
+    if (vectorStore_.removeDocument(QFileInfo(filePath).absoluteFilePath()) <= 0)
+        return false;
+
+    saveCollection();
+    status_ = QString("Ready (%1 chunks)").arg(vectorStore_.count());
+    emit collectionStatusChanged();
+    return true;
 }
 
-void RAGService::processFileInternal(const QString& filePath)
+void RAGService::cancelIngestion()
+{
+    if (ingesting_)
+        pipeline_->cancel();
+}
+
+void RAGService::startIngestion(const QStringList& paths)
 {
     if (!llmServices_)
         return;
 
-    // 1. Process Doc
-    std::vector<DocumentChunk> chunks = DocumentProcessor::processFile(filePath);
+    if (ingesting_)
+    {
+        qWarning() << "RAGService: An ingestion is already running";
+        emit errorOccurred("An ingestion is already running");
+        return;
+    }
+
+    pipeline_ = std::make_unique<IngestionPipeline>(
+        [this](const QStringList& texts)
+        {
+            // Blocking call to get embeddings (batched by the pipeline)
+            return llmServices_->getEmbeddings(texts);
+        },
+        [this](const QString& path, std::vector<DocumentChunk>& chunks, std::vector<std::vector<float>>& embeddings,
+            bool complete) { addChunks(path, chunks, embeddings, complete); },
+        LLM_EMBEDDING_MAX_SEQUENCES);
+    pipeline_->setFilter([this](const QString& path) { return needsIngestion(path); });
+
+    pendingDocuments_.clear();
+    seenDocuments_.clear();
+    currentDocument_.clear();
+    documentsRemoved_ = 0;
+
+    ingesting_ = true;
+    chunksPerSecond_ = 0.0;
+    lastChunksEmbedded_ = 0;
+    progressElapsed_.start();
+    progressTimer_.start();
+    emit ingestionProgressChanged();
+
+    IngestionPipeline* pipeline = pipeline_.get();
+    ingestion_ = QtConcurrent::run(
+        [this, pipeline, paths]()
+        {
+            pipeline->run(paths);
+            if (!pipeline->isCancelled())
+                removeMissingDocuments(paths);
+            QMetaObject::invokeMethod(this, [this]() { finishIngestion(); });
+        });
+}
+
+void RAGService::finishIngestion()
+{
+    progressTimer_.stop();
+    ingesting_ = false;
+
+    int docs = pipeline_->filesExtracted();
+    status_ = QString(pipeline_->isCancelled() ? "Ingestion cancelled (%1 docs ingested)" : "Ready (%1 docs ingested)").arg(docs);
+    if (pipeline_->filesSkipped() || documentsRemoved_)
+        status_ += QString(", %1 unchanged, %2 removed").arg(pipeline_->filesSkipped()).arg(documentsRemoved_);
+    emit collectionStatusChanged();
+    emit ingestionProgressChanged();
+    emit ingestionFinished(docs, vectorStore_.count());
+    saveCollection();
+}
 
-    // 2. Compute Embeddings & Store
-    for (const auto& chunk : chunks)
+void RAGService::updateIngestionProgress()
+{
+    int chunks = pipeline_->chunksEmbedded();
+    qint64 elapsed = progressElapsed_.restart();
+    if (elapsed > 0)
+        chunksPerSecond_ = (chunks - lastChunksEmbedded_) * 1000.0 / elapsed;
+    lastChunksEmbedded_ = chunks;
+
+    status_ = QString("Ingesting... %1/%2 files, %3 chunks (%4 chunks/s)")
+                  .arg(getFilesProcessed())
+                  .arg(pipeline_->filesDiscovered())
+                  .arg(chunks)
+                  .arg(qRound(chunksPerSecond_));
+    emit collectionStatusChanged();
+    emit ingestionProgressChanged();
+}
+
+// Content hash of a file (empty if it cannot be read)
+static QByteArray hashFile(const QString& path)
+{
+    QFile file(path);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file))
+        return QByteArray();
+    return hash.result();
+}
+
+bool RAGService::needsIngestion(const QString& path)
+{
+    QFileInfo info(path);
+    DocumentRecord fingerprint;
+    fingerprint.path = path;
+    fingerprint.size = info.size();
+    fingerprint.modified = info.lastModified().toMSecsSinceEpoch();
     {
-        // Blocking call to get embedding (ensure your LLMServices::getEmbedding is thread-safe or handles validation)
-        std::vector<float> emb = llmServices_->getEmbedding(chunk.content);
+        // a file reached twice (e.g. a folder and one of its files) is ingested once
+        QMutexLocker locker(&documentsMutex_);
+        if (seenDocuments_.contains(path))
+            return false;
+        seenDocuments_.insert(path);
+    }
 
-        if (!emb.empty())
+    // same size and date : the content is not read at all
+    DocumentRecord record;
+    const bool known = vectorStore_.document(path, record) && !record.hash.isEmpty();
+    if (known && record.size == fingerprint.size && record.modified == fingerprint.modified)
+        return false;
+
+    fingerprint.hash = hashFile(path);
+    if (known && !fingerprint.hash.isEmpty() && record.hash == fingerprint.hash)
+    {
+        // touched but identical : only the fingerprint is refreshed
+        vectorStore_.updateDocument(fingerprint);
+        return false;
+    }
+
+    QMutexLocker locker(&documentsMutex_);
+    pendingDocuments_.insert(path, fingerprint);
+    return true;
+}
+
+void RAGService::addChunks(const QString& path, std::vector<DocumentChunk>& chunks,
+    std::vector<std::vector<float>>& embeddings, bool complete)
+{
+    // the first chunks of a document replace its previous version
+    if (path != currentDocument_)
+    {
+        currentDocument_ = path;
+        currentDocumentFailed_ = false;
+        vectorStore_.removeDocument(path);
+    }
+
+    std::vector<VectorEntry> entries;
+    entries.reserve(chunks.size());
+    for (size_t i = 0; i < chunks.size() && i < embeddings.size(); ++i)
+    {
+        if (!embeddings[i].empty())
         {
+            const DocumentChunk& chunk = chunks[i];
+
             VectorEntry entry;
-            entry.embedding = emb;
+            entry.embedding = std::move(embeddings[i]);
             entry.text = chunk.content;
             entry.source = QString("%1 (Page %2)").arg(chunk.sourceFile).arg(chunk.pageNumber);
 
-            // Normalize if not already
-            // LLMServices should return normalized embeddings, but let's be sure?
-            // Assuming LLMServices returns normalized for now.
+            // LLMServices returns normalized embeddings
+            entries.push_back(std::move(entry));
+        }
+        else
+        {
+            currentDocumentFailed_ = true;
+        }
+    }
+
+    // published as one snapshot : searches running meanwhile see the batch entirely or not at all
+    vectorStore_.addEntries(entries, path);
 
-            vectorStore_.addEntry(entry);
+    // the fingerprint is only recorded once all the chunks are stored :
+    // an interrupted or failed document is ingested again by the next run
+    if (complete)
+    {
+        DocumentRecord fingerprint;
+        {
+            QMutexLocker locker(&documentsMutex_);
+            fingerprint = pendingDocuments_.take(path);
         }
+        if (!currentDocumentFailed_ && !fingerprint.path.isEmpty())
+            vectorStore_.updateDocument(fingerprint);
+        currentDocument_.clear();
     }
 }
 
+void RAGService::removeMissingDocuments(const QStringList& paths)
+{
+    QStringList roots;
+    for (const QString& path : paths)
+        roots << QFileInfo(path).absoluteFilePath();
+
+    QMutexLocker locker(&documentsMutex_);
+    for (const QString& document : vectorStore_.documents())
+    {
+        if (seenDocuments_.contains(document))
+            continue;
+
+        for (const QString& root : roots)
+        {
+            if (document == root || document.startsWith(root + '/'))
+            {
+                qDebug() << "RAGService: Removing missing document" << document;
+                vectorStore_.removeDocument(document);
+                ++documentsRemoved_;
+                break;
+            }
+        }
+    }
+}
+
+int RAGService::getFilesDiscovered() const
+{
+    return pipeline_ ? pipeline_->filesDiscovered() : 0;
+}
+
+int RAGService::getFilesProcessed() const
+{
+    return pipeline_ ? pipeline_->filesExtracted() + pipeline_->filesSkipped() : 0;
+}
+
+int RAGService::getChunksEmbedded() const
+{
+    return pipeline_ ? pipeline_->chunksEmbedded() : 0;
+}
+
 void RAGService::clearCollection()
 {
     vectorStore_.clear();
+    cache_.clear();
     saveCollection();
     status_ = "Collection cleared";
     emit collectionStatusChanged();
@@ -99,12 +297,43 @@ bool RAGService::saveCollection()
 {
     // Save to a default location in app data
     // For now, let's just save to bin/rag.db
+
+    // codes used by the first search pass : "none", "int8" (4x smaller) or "binary" (32x smaller)
+    QSettings settings;
+    const QString quantization = settings.value("ragQuantization", "none").toString();
+    if (quantization == "int8")
+        vectorStore_.setQuantization(VectorStore::Int8);
+    else if (quantization == "binary")
+        vectorStore_.setQuantization(VectorStore::Binary);
+    else
+        vectorStore_.setQuantization(VectorStore::None);
+
     return vectorStore_.save("rag.db");
 }
 
 bool RAGService::loadCollection()
 {
     bool ok = vectorStore_.load("rag.db");
+    cache_.clear();
+
+    // search backend : "exhaustive" scan or "hnsw" graph (approximate, for large collections)
+    QSettings settings;
+    if (settings.value("ragIndex", "exhaustive").toString() == "hnsw")
+    {
+        HnswIndex::Parameters parameters;
+        parameters.M = settings.value("ragHnswM", parameters.M).toInt();
+        parameters.efConstruction = settings.value("ragHnswEfConstruction", parameters.efConstruction).toInt();
+        parameters.efSearch = settings.value("ragHnswEfSearch", parameters.efSearch).toInt();
+        if (vectorStore_.indexType() != VectorStore::Hnsw)
+            vectorStore_.setIndexType(VectorStore::Hnsw, parameters);
+        else
+            vectorStore_.setEfSearch(parameters.efSearch);
+    }
+    else
+    {
+        vectorStore_.setIndexType(VectorStore::Exhaustive);
+    }
+
     if (ok)
     {
         status_ = QString("Ready (%1 chunks loaded)").arg(vectorStore_.count());
@@ -129,12 +358,31 @@ std::vector<SearchResult> RAGService::search(const QString& query, int topK)
     if (!llmServices_)
         return {};
 
-    // Generate query embedding
-    std::vector<float> queryEmb = llmServices_->getEmbedding(query);
-    if (queryEmb.empty())
+    // read first : results computed while the collection changes are cached with the older generation
+    const quint64 generation = vectorStore_.generation();
+    if (!vectorStore_.count())
         return {};
 
-    return vectorStore_.search(queryEmb, topK);
+    // questions differing only by their spacing share the cache entries
+    const QString text = query.simplified();
+
+    // Generate query embedding
+    std::vector<float> queryEmb;
+    if (!cache_.embedding(text, queryEmb) || (int)queryEmb.size() != vectorStore_.dimension())
+    {
+        queryEmb = llmServices_->getEmbedding(text);
+        if (queryEmb.empty())
+            return {};
+        cache_.insertEmbedding(text, queryEmb);
+    }
+
+    std::vector<SearchResult> results;
+    if (cache_.results(queryEmb, topK, generation, results))
+        return results;
+
+    results = vectorStore_.search(queryEmb, topK);
+    cache_.insertResults(queryEmb, topK, generation, results);
+    return results;
 }
 
 QString RAGService::getCollectionStatus() const
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <QElapsedTimer>
 #include <QFutureWatcher>
+#include <QHash>
+#include <QMutex>
 #include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <memory>
 
+#include "IngestionPipeline.h"
+#include "RetrievalCache.h"
 #include "VectorStore.h"
 
 class LLMServices;
@@ -17,11 +25,27 @@ class LLMServices;
  * 
  * Il gère l'ingestion de documents, la recherche de contexte,
  * et l'intégration avec les services LLM.
+ *
+ * L'ingestion passe par un IngestionPipeline (découverte, extraction, découpage,
+ * embeddings) dont la progression est exposée à QML.
+ *
+ * L'ingestion est incrémentale : chaque fichier est identifié par son chemin et son empreinte
+ * (taille, date de modification, hash du contenu). Les fichiers inchangés sont ignorés, ceux
+ * qui ont changé remplacent leurs anciens chunks, et les fichiers disparus d'un répertoire
+ * ré-ingéré sont retirés de la collection.
+ *
+ * Les embeddings des requêtes et les résultats des recherches sont mis en cache (LRU
+ * borné en octets), les résultats étant invalidés à chaque modification de la collection.
  */
 class RAGService : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(QString collectionStatus READ getCollectionStatus NOTIFY collectionStatusChanged)
+    Q_PROPERTY(bool ingesting READ isIngesting NOTIFY ingestionProgressChanged)
+    Q_PROPERTY(int filesDiscovered READ getFilesDiscovered NOTIFY ingestionProgressChanged)
+    Q_PROPERTY(int filesProcessed READ getFilesProcessed NOTIFY ingestionProgressChanged)
+    Q_PROPERTY(int chunksEmbedded READ getChunksEmbedded NOTIFY ingestionProgressChanged)
+    Q_PROPERTY(double chunksPerSecond READ getChunksPerSecond NOTIFY ingestionProgressChanged)
 
 public:
     /**
@@ -52,8 +76,25 @@ public:
      * @param dirPath Chemin vers le répertoire à ingérer
      * 
      * Traite tous les fichiers du répertoire et les ajoute à la base vectorielle.
+     * Seuls les fichiers nouveaux ou modifiés depuis la dernière ingestion sont traités.
      */
     Q_INVOKABLE void ingestDirectory(const QString& dirPath);
+
+    /**
+     * @brief Retire un document de la base de connaissances
+     * @param filePath Chemin du fichier ingéré
+     * @return true si le document était dans la collection
+     *
+     * Ses chunks sont ignorés par la recherche, puis supprimés au prochain compactage.
+     */
+    Q_INVOKABLE bool removeDocument(const QString& filePath);
+
+    /**
+     * @brief Interrompt l'ingestion en cours
+     *
+     * Les chunks déjà calculés restent dans la base vectorielle.
+     */
+    Q_INVOKABLE void cancelIngestion();
     
     /**
      * @brief Efface la collection actuelle
@@ -82,9 +123,16 @@ public:
      * @return Liste des résultats de recherche
      * 
      * Effectue une recherche vectorielle et retourne les résultats bruts.
+     * Les requêtes identiques (aux espaces près) réutilisent l'embedding et les résultats en cache.
      */
     std::vector<SearchResult> search(const QString& query, int topK = 3);
 
+    /**
+     * @brief Retourne les compteurs de succès et d'échecs des caches de recherche
+     * @return Statistiques du cache des embeddings et du cache des résultats
+     */
+    RetrievalCache::Statistics getCacheStatistics() const { return cache_.statistics(); }
+
     // Persistence
     /**
      * @brief Sauvegarde la collection sur disque
@@ -104,11 +152,47 @@ public:
      */
     QString getCollectionStatus() const;
 
+    // Ingestion progress
+    /**
+     * @brief Indique si une ingestion est en cours
+     * @return true pendant l'ingestion
+     */
+    bool isIngesting() const { return ingesting_; }
+
+    /**
+     * @brief Retourne le nombre de fichiers trouvés par la dernière ingestion
+     * @return Nombre de fichiers découverts
+     */
+    int getFilesDiscovered() const;
+
+    /**
+     * @brief Retourne le nombre de fichiers traités par la dernière ingestion
+     * @return Nombre de fichiers extraits ou ignorés car inchangés
+     */
+    int getFilesProcessed() const;
+
+    /**
+     * @brief Retourne le nombre de chunks ajoutés par la dernière ingestion
+     * @return Nombre de chunks calculés
+     */
+    int getChunksEmbedded() const;
+
+    /**
+     * @brief Retourne le débit de l'étape d'embeddings
+     * @return Chunks par seconde, mesurés sur la dernière période de rafraîchissement
+     */
+    double getChunksPerSecond() const { return chunksPerSecond_; }
+
 signals:
     /**
      * @brief Signal émis lorsque l'état de la collection change
      */
     void collectionStatusChanged();
+
+    /**
+     * @brief Signal émis lorsque la progression de l'ingestion change
+     */
+    void ingestionProgressChanged();
     
     /**
      * @brief Signal émis lorsque l'ingestion est terminée
@@ -125,17 +209,67 @@ signals:
 
 private:
     /**
-     * @brief Traite un fichier en interne
-     * @param filePath Chemin vers le fichier à traiter
-     * 
-     * Méthode interne pour le traitement des fichiers.
+     * @brief Lance le pipeline d'ingestion en arrière-plan
+     * @param paths Fichiers et répertoires à ingérer
+     */
+    void startIngestion(const QStringList& paths);
+
+    /**
+     * @brief Termine l'ingestion (thread principal) et sauvegarde la collection
+     */
+    void finishIngestion();
+
+    /**
+     * @brief Met à jour les compteurs de progression exposés à QML
+     */
+    void updateIngestionProgress();
+
+    /**
+     * @brief Indique si un fichier doit être (ré)ingéré
+     * @param path Chemin absolu du fichier
+     * @return false si le fichier n'a pas changé depuis la dernière ingestion
+     *
+     * Appelée par les workers d'extraction du pipeline. Compare la taille et la date de
+     * modification, puis le hash du contenu si elles ont changé.
      */
-    void processFileInternal(const QString& filePath);
+    bool needsIngestion(const QString& path);
+
+    /**
+     * @brief Ajoute des chunks d'un document et leurs embeddings à la base vectorielle
+     * @param path Chemin absolu du document
+     * @param chunks Chunks du document
+     * @param embeddings Embeddings normalisés, dans l'ordre des chunks
+     * @param complete true avec les derniers chunks du document
+     *
+     * Appelée par l'étape d'embeddings du pipeline. Les premiers chunks d'un document remplacent
+     * ceux de sa version précédente, son empreinte n'est enregistrée qu'une fois complet.
+     */
+    void addChunks(const QString& path, std::vector<DocumentChunk>& chunks,
+        std::vector<std::vector<float>>& embeddings, bool complete);
+
+    /**
+     * @brief Retire les documents disparus des chemins ingérés
+     * @param paths Fichiers et répertoires de la dernière ingestion
+     */
+    void removeMissingDocuments(const QStringList& paths);
 
     LLMServices* llmServices_;      ///< Services LLM utilisés
     VectorStore vectorStore_;      ///< Base de données vectorielle
+    RetrievalCache cache_;         ///< Cache des embeddings de requêtes et des résultats
     QString status_;               ///< État actuel du service
 
-    // In-memory embedding cache or similar could go here
-    // For now simple direct calls
+    std::unique_ptr<IngestionPipeline> pipeline_; ///< Pipeline de la dernière ingestion
+    QFuture<void> ingestion_;                     ///< Tâche exécutant le pipeline
+    bool ingesting_{false};                       ///< Ingestion en cours
+    QTimer progressTimer_;                        ///< Rafraîchissement de la progression
+    QElapsedTimer progressElapsed_;               ///< Temps depuis le dernier rafraîchissement
+    int lastChunksEmbedded_{0};                   ///< Chunks au dernier rafraîchissement
+    double chunksPerSecond_{0.0};                 ///< Débit de l'étape d'embeddings
+
+    QMutex documentsMutex_;                           ///< Protège les documents de l'ingestion en cours
+    QHash<QString, DocumentRecord> pendingDocuments_; ///< Empreintes des documents à (ré)ingérer
+    QSet<QString> seenDocuments_;                     ///< Fichiers trouvés par l'ingestion en cours
+    QString currentDocument_;                         ///< Document en cours d'ajout (étape d'embeddings)
+    bool currentDocumentFailed_{false};               ///< Un embedding du document courant a échoué
+    int documentsRemoved_{0};                         ///< Documents disparus retirés par l'ingestion
 };
\ No newline at end of file
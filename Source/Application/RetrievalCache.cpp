@@ -0,0 +1,117 @@
+#include <QHash>
+#include <QMutexLocker>
+
+#include "RetrievalCache.h"
+
+// Estimated bookkeeping of one cache entry (node, key, container headers)
+static const qint64 ENTRY_OVERHEAD = 96;
+
+static qint64 embeddingCost(const QString& query, const std::vector<float>& embedding)
+{
+    return ENTRY_OVERHEAD + query.size() * sizeof(QChar) + embedding.size() * sizeof(float);
+}
+
+static qint64 resultsCost(const std::vector<SearchResult>& results)
+{
+    qint64 cost = ENTRY_OVERHEAD;
+    for (const SearchResult& result : results)
+        cost += sizeof(SearchResult) + (result.text.size() + result.source.size()) * sizeof(QChar);
+    return cost;
+}
+
+// 64-bit hash of the embedding values, the results key
+static size_t embeddingHash(const std::vector<float>& embedding)
+{
+    return qHashBits(embedding.data(), embedding.size() * sizeof(float));
+}
+
+RetrievalCache::RetrievalCache(qint64 maxBytes)
+{
+    setMaxBytes(maxBytes);
+}
+
+void RetrievalCache::setMaxBytes(qint64 maxBytes)
+{
+    QMutexLocker locker(&mutex_);
+    embeddings_.setMaxCost(maxBytes / 2);
+    results_.setMaxCost(maxBytes / 2);
+}
+
+qint64 RetrievalCache::maxBytes() const
+{
+    QMutexLocker locker(&mutex_);
+    return embeddings_.maxCost() + results_.maxCost();
+}
+
+bool RetrievalCache::embedding(const QString& query, std::vector<float>& embedding)
+{
+    QMutexLocker locker(&mutex_);
+    const std::vector<float>* cached = embeddings_.object(query);
+    if (!cached)
+    {
+        ++embeddingMisses_;
+        return false;
+    }
+
+    ++embeddingHits_;
+    embedding = *cached;
+    return true;
+}
+
+void RetrievalCache::insertEmbedding(const QString& query, const std::vector<float>& embedding)
+{
+    if (embedding.empty())
+        return;
+
+    QMutexLocker locker(&mutex_);
+    embeddings_.insert(query, new std::vector<float>(embedding), embeddingCost(query, embedding));
+}
+
+bool RetrievalCache::checkGeneration(quint64 generation)
+{
+    if (generation < generation_)
+        return false;
+    if (generation > generation_)
+    {
+        results_.clear();
+        generation_ = generation;
+    }
+    return true;
+}
+
+bool RetrievalCache::results(
+    const std::vector<float>& embedding, int topK, quint64 generation, std::vector<SearchResult>& results)
+{
+    QMutexLocker locker(&mutex_);
+    const std::vector<SearchResult>* cached =
+        checkGeneration(generation) ? results_.object({ embeddingHash(embedding), topK }) : nullptr;
+    if (!cached)
+    {
+        ++resultMisses_;
+        return false;
+    }
+
+    ++resultHits_;
+    results = *cached;
+    return true;
+}
+
+void RetrievalCache::insertResults(
+    const std::vector<float>& embedding, int topK, quint64 generation, const std::vector<SearchResult>& results)
+{
+    QMutexLocker locker(&mutex_);
+    if (checkGeneration(generation))
+        results_.insert({ embeddingHash(embedding), topK }, new std::vector<SearchResult>(results), resultsCost(results));
+}
+
+void RetrievalCache::clear()
+{
+    QMutexLocker locker(&mutex_);
+    embeddings_.clear();
+    results_.clear();
+}
+
+RetrievalCache::Statistics RetrievalCache::statistics() const
+{
+    return { embeddingHits_, embeddingMisses_, resultHits_, resultMisses_ };
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "VectorStore.h"
+
+/**
+ * LRU caches of the retrieval : query text -> embedding and (embedding hash, topK) -> results.
+ *
+ * Both caches are bounded by an estimate of their size in bytes (half of the budget each).
+ * Results are only valid for one generation of the collection : looking them up with another
+ * generation drops them all. Embeddings survive the changes of the collection, clear() drops them
+ * (another collection may come with another embedding model).
+ *
+ * All the methods can be called from any thread.
+ */
+class RetrievalCache
+{
+public:
+    struct Statistics
+    {
+        int embeddingHits{0};
+        int embeddingMisses{0};
+        int resultHits{0};
+        int resultMisses{0};
+    };
+
+    explicit RetrievalCache(qint64 maxBytes = 16 * 1024 * 1024);
+
+    void setMaxBytes(qint64 maxBytes);
+    qint64 maxBytes() const;
+
+    bool embedding(const QString& query, std::vector<float>& embedding);
+    void insertEmbedding(const QString& query, const std::vector<float>& embedding);
+
+    bool results(const std::vector<float>& embedding, int topK, quint64 generation, std::vector<SearchResult>& results);
+    // Ignored if the collection changed meanwhile (generation older than the cached one)
+    void insertResults(
+        const std::vector<float>& embedding, int topK, quint64 generation, const std::vector<SearchResult>& results);
+
+    void clear();
+
+    Statistics statistics() const;
+
+private:
+    using ResultKey = std::pair<size_t, int>;
+
+    // Drops the results of another generation (called with the mutex held)
+    bool checkGeneration(quint64 generation);
+
+    mutable QMutex mutex_;
+    QCache<QString, std::vector<float>> embeddings_;
+    QCache<ResultKey, std::vector<SearchResult>> results_;
+    quint64 generation_{0};
+
+    std::atomic<int> embeddingHits_{0};
+    std::atomic<int> embeddingMisses_{0};
+    std::atomic<int> resultHits_{0};
+    std::atomic<int> resultMisses_{0};
+};
@@ -0,0 +1,266 @@
+#include "VectorKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VECTORKERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define VECTORKERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+float VectorKernels::dotScalar(const float* a, const float* b, int n)
+{
+    // 4 independent accumulators let the compiler pipeline the multiply-adds
+    float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 += a[i] * b[i];
+        acc1 += a[i + 1] * b[i + 1];
+        acc2 += a[i + 2] * b[i + 2];
+        acc3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i)
+        acc0 += a[i] * b[i];
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+int32_t VectorKernels::dotInt8Scalar(const int8_t* a, const int8_t* b, int n)
+{
+    int32_t acc = 0;
+    for (int i = 0; i < n; ++i)
+        acc += int32_t(a[i]) * int32_t(b[i]);
+    return acc;
+}
+
+static int popcount64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+int VectorKernels::hammingScalar(const uint64_t* a, const uint64_t* b, int n)
+{
+    int distance = 0;
+    for (int i = 0; i < n; ++i)
+        distance += popcount64(a[i] ^ b[i]);
+    return distance;
+}
+
+#ifdef VECTORKERNELS_X86
+__attribute__((target("avx2,fma"))) static float dotAvx2(const float* a, const float* b, int n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+
+    // horizontal sum
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    float dot = _mm_cvtss_f32(sum);
+
+    for (; i < n; ++i)
+        dot += a[i] * b[i];
+    return dot;
+}
+
+__attribute__((target("avx2"))) static int32_t dotInt8Avx2(const int8_t* a, const int8_t* b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        // widen to 16 bits, multiply and add adjacent pairs into 32 bits
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+
+    // horizontal sum
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t dot = _mm_cvtsi128_si32(sum);
+
+    for (; i < n; ++i)
+        dot += int32_t(a[i]) * int32_t(b[i]);
+    return dot;
+}
+
+__attribute__((target("popcnt"))) static int hammingPopcnt(const uint64_t* a, const uint64_t* b, int n)
+{
+    int distance = 0;
+    for (int i = 0; i < n; ++i)
+        distance += static_cast<int>(_mm_popcnt_u64(a[i] ^ b[i]));
+    return distance;
+}
+
+__attribute__((target("avx512f"))) static float dotAvx512(const float* a, const float* b, int n)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16)
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+
+    // masked tail
+    if (i < n)
+    {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+
+    // horizontal sum
+    float lanes[16];
+    _mm512_storeu_ps(lanes, _mm512_add_ps(acc0, acc1));
+    float dot = 0.0f;
+    for (float lane : lanes)
+        dot += lane;
+    return dot;
+}
+#endif
+
+#ifdef VECTORKERNELS_NEON
+static float dotNeon(const float* a, const float* b, int n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    for (; i + 4 <= n; i += 4)
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+
+    float dot = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i)
+        dot += a[i] * b[i];
+    return dot;
+}
+
+static int32_t dotInt8Neon(const int8_t* a, const int8_t* b, int n)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        int8x16_t va = vld1q_s8(a + i);
+        int8x16_t vb = vld1q_s8(b + i);
+        int16x8_t lo = vmull_s8(vget_low_s8(va), vget_low_s8(vb));
+        int16x8_t hi = vmull_high_s8(va, vb);
+        acc = vpadalq_s16(acc, lo);
+        acc = vpadalq_s16(acc, hi);
+    }
+
+    int32_t dot = vaddvq_s32(acc);
+    for (; i < n; ++i)
+        dot += int32_t(a[i]) * int32_t(b[i]);
+    return dot;
+}
+
+static int hammingNeon(const uint64_t* a, const uint64_t* b, int n)
+{
+    int distance = 0;
+    for (int i = 0; i < n; ++i)
+        distance += vaddv_u8(vcnt_u8(vcreate_u8(a[i] ^ b[i])));
+    return distance;
+}
+#endif
+
+template <typename Function>
+struct Kernel
+{
+    Function function_;
+    const char* name_;
+};
+
+using DotKernel = Kernel<VectorKernels::DotFunction>;
+
+static DotKernel selectDotKernel()
+{
+#ifdef VECTORKERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return { dotAvx512, "avx512" };
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return { dotAvx2, "avx2" };
+#endif
+#ifdef VECTORKERNELS_NEON
+    return { dotNeon, "neon" };
+#endif
+    return { VectorKernels::dotScalar, "scalar" };
+}
+
+static const DotKernel& dotKernel()
+{
+    static const DotKernel kernel = selectDotKernel();
+    return kernel;
+}
+
+VectorKernels::DotFunction VectorKernels::dotFunction()
+{
+    return dotKernel().function_;
+}
+
+const char* VectorKernels::dotKernelName()
+{
+    return dotKernel().name_;
+}
+
+VectorKernels::DotInt8Function VectorKernels::dotInt8Function()
+{
+    static const DotInt8Function function = []() -> DotInt8Function
+    {
+#ifdef VECTORKERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return dotInt8Avx2;
+#endif
+#ifdef VECTORKERNELS_NEON
+        return dotInt8Neon;
+#endif
+        return dotInt8Scalar;
+    }();
+    return function;
+}
+
+VectorKernels::HammingFunction VectorKernels::hammingFunction()
+{
+    static const HammingFunction function = []() -> HammingFunction
+    {
+#ifdef VECTORKERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("popcnt"))
+            return hammingPopcnt;
+#endif
+#ifdef VECTORKERNELS_NEON
+        return hammingNeon;
+#endif
+        return hammingScalar;
+    }();
+    return function;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Float, int8 and binary kernels used by the VectorStore scan.
+ *
+ * The best implementation for the running CPU (AVX-512, AVX2/FMA, NEON or scalar)
+ * is selected once, on first use.
+ */
+class VectorKernels
+{
+public:
+    using DotFunction = float (*)(const float* a, const float* b, int n);
+
+    // Dot product of two float vectors of n elements (no alignment requirement)
+    static float dot(const float* a, const float* b, int n) { return dotFunction()(a, b, n); }
+
+    // Name of the selected dot product kernel (for logs and benchmarks)
+    static const char* dotKernelName();
+
+    // Dot product of two int8 vectors of n elements, accumulated in 32 bits
+    static int32_t dotInt8(const int8_t* a, const int8_t* b, int n) { return dotInt8Function()(a, b, n); }
+
+    // Number of differing bits between two bit vectors of n 64-bit words
+    static int hamming(const uint64_t* a, const uint64_t* b, int n) { return hammingFunction()(a, b, n); }
+
+    // Portable reference implementations
+    static float dotScalar(const float* a, const float* b, int n);
+    static int32_t dotInt8Scalar(const int8_t* a, const int8_t* b, int n);
+    static int hammingScalar(const uint64_t* a, const uint64_t* b, int n);
+
+private:
+    using DotInt8Function = int32_t (*)(const int8_t* a, const int8_t* b, int n);
+    using HammingFunction = int (*)(const uint64_t* a, const uint64_t* b, int n);
+
+    static DotFunction dotFunction();
+    static DotInt8Function dotInt8Function();
+    static HammingFunction hammingFunction();
+};
@@ -1,57 +1,387 @@
 #include <QDataStream>
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QSaveFile>
+#include <QThread>
+#include <QtEndian>
 #include <algorithm>
+#include <climits>
 #include <cmath>
+#include <cstring>
 #include <utility>
 
+#include "VectorKernels.h"
+
 #include "VectorStore.h"
 
-// Magic header for our file format
-static const quint32 MAGIC = 0x52414731; // "RAG1"
-static const quint32 VERSION = 1;
+// Magic headers for our file formats
+static const quint32 MAGIC_V1 = 0x52414731; // "RAG1" (legacy QDataStream format)
+static const quint32 MAGIC = 0x52414732;    // "RAG2" (columnar, memory-mapped format)
+static const quint32 VERSION_V1 = 1;
+static const quint32 VERSION = 2;
+
+// Alignment of the embedding matrix in the file (cache line / AVX-512 friendly)
+static const quint64 MATRIX_ALIGNMENT = 64;
+
+// RAG2 header, stored in native byte order at the beginning of the file
+struct VectorStoreHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 dim;
+    quint32 quantization;     // VectorStore::Quantization of the codes section
+    quint64 count;
+    quint64 embeddingsOffset; // count * dim floats
+    quint64 offsetsOffset;    // 2 * count + 1 quint64, positions in the string blob
+    quint64 stringsOffset;
+    quint64 stringsSize;
+    // followed by the quantized codes section (if any) at alignUp(stringsOffset + stringsSize, 64) :
+    // count rows of codeSize bytes, then for Int8 count float scales at the next 8-byte boundary
+};
+
+// Largest dimension accepted from a file header
+static const quint32 MAX_DIMENSION = 1 << 20;
+
+// Number of candidates kept by the quantized pass and rescored in fp32
+static const int DEFAULT_RESCORE_CANDIDATES = 256;
+
+// Rows of an in-memory segment, reserved up front : published rows never move
+static const int SEGMENT_ROWS = 4096;
+
+// Size of the string chunks of an in-memory segment (a larger row gets a chunk of its own)
+static const qsizetype STRING_CHUNK_SIZE = 1 << 20;
+
+// A mapped file cannot be replaced on every platform (Windows) : a save writes the collection to
+// whichever of path and path + ALTERNATE_SUFFIX is not mapped, then removes the other one
+static const char* ALTERNATE_SUFFIX = ".alt";
+
+// "DOCS" : documents sidecar (path + ".docs"), written with QDataStream
+static const quint32 DOCUMENTS_MAGIC = 0x53434F44;
+static const quint32 DOCUMENTS_VERSION = 1;
+
+// Fraction of tombstoned rows from which saving an indexed collection compacts it (rebuilding the graph)
+static const double COMPACTION_RATIO = 0.2;
+
+// Tombstoned rows (beyond the best K) requested from the graph, in multiples of K
+static const int DELETED_CANDIDATES_FACTOR = 3;
+
+// File holding the collection saved at path, the newest one if a save was interrupted before removing the other
+static QString dataFile(const QString& path)
+{
+    const QFileInfo file(path);
+    const QFileInfo alternate(path + ALTERNATE_SUFFIX);
+    if (alternate.exists() && (!file.exists() || alternate.lastModified() > file.lastModified()))
+        return alternate.filePath();
+    return path;
+}
+
+static quint64 alignUp(quint64 value, quint64 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Bytes per row of the quantized codes
+static int codeSizeFor(VectorStore::Quantization quantization, int dim)
+{
+    switch (quantization)
+    {
+    case VectorStore::Int8:
+        return dim;
+    case VectorStore::Binary:
+        return (dim + 63) / 64 * sizeof(quint64);
+    default:
+        return 0;
+    }
+}
+
+// Symmetric int8 quantization with one scale per vector, returns the scale
+static float quantizeInt8(const float* v, int dim, qint8* codes)
+{
+    float maxAbs = 0.0f;
+    for (int i = 0; i < dim; ++i)
+        maxAbs = std::max(maxAbs, std::abs(v[i]));
+
+    const float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+    for (int i = 0; i < dim; ++i)
+        codes[i] = static_cast<qint8>(std::lround(v[i] / scale));
+    return scale;
+}
+
+// 1-bit sign quantization, packed in 64-bit words
+static void quantizeBinary(const float* v, int dim, quint64* codes)
+{
+    std::memset(codes, 0, codeSizeFor(VectorStore::Binary, dim));
+    for (int i = 0; i < dim; ++i)
+    {
+        if (v[i] > 0.0f)
+            codes[i / 64] |= quint64(1) << (i % 64);
+    }
+}
+
+// Block of rows, with the RAG2 columnar layout : either a mapped file or owned buffers.
+// An in-memory segment reserves SEGMENT_ROWS rows and is filled in place by the writer : the rows
+// a snapshot sees are never modified, the writer only writes past them.
+struct VectorStore::Segment
+{
+    int count{0}; ///< rows of the mapped file, rows written so far in an in-memory segment (writer only)
+    int dim{0};
+    const float* embeddings{nullptr};
+    const quint64* offsets{nullptr}; ///< 2 * count + 1 positions in the strings (text then source of each row)
+    const char* strings{nullptr};    ///< contiguous string blob of the mapped file
+    const char* const* rowStrings{nullptr}; ///< text of each row followed by its source (in-memory segment)
+    Quantization quantization{None};
+    const uchar* codes{nullptr};
+    const float* scales{nullptr};
+
+    // Storage
+    std::unique_ptr<QFile> file;
+    uchar* mapped{nullptr};
+    std::unique_ptr<float[]> embeddingStorage;
+    std::unique_ptr<quint64[]> offsetStorage;
+    std::unique_ptr<const char*[]> rowStringStorage;
+    std::vector<std::unique_ptr<char[]>> stringChunks;
+    qsizetype chunkSize{0};
+    qsizetype chunkUsed{0};
+
+    ~Segment()
+    {
+        if (file && mapped)
+            file->unmap(mapped);
+    }
+
+    // Reserves the buffers of an in-memory segment
+    void reserve(int rowDim)
+    {
+        dim = rowDim;
+        embeddingStorage.reset(new float[(size_t)SEGMENT_ROWS * dim]);
+        offsetStorage.reset(new quint64[2 * SEGMENT_ROWS + 1]);
+        rowStringStorage.reset(new const char*[SEGMENT_ROWS]);
+        offsetStorage[0] = 0;
+        embeddings = embeddingStorage.get();
+        offsets = offsetStorage.get();
+        rowStrings = rowStringStorage.get();
+    }
+
+    // Writes the next row of an in-memory segment (not full)
+    void append(const VectorEntry& entry)
+    {
+        std::memcpy(embeddingStorage.get() + (size_t)count * dim, entry.embedding.data(), dim * sizeof(float));
+
+        const QByteArray text = entry.text.toUtf8();
+        const QByteArray source = entry.source.toUtf8();
+        const qsizetype size = text.size() + source.size();
+        if (stringChunks.empty() || chunkUsed + size > chunkSize)
+        {
+            // the full chunk is kept as is : the strings of the published rows stay in place
+            chunkSize = std::max(STRING_CHUNK_SIZE, size);
+            stringChunks.emplace_back(new char[chunkSize]);
+            chunkUsed = 0;
+        }
+        char* data = stringChunks.back().get() + chunkUsed;
+        std::memcpy(data, text.constData(), text.size());
+        std::memcpy(data + text.size(), source.constData(), source.size());
+        chunkUsed += size;
+
+        rowStringStorage[count] = data;
+        offsetStorage[2 * count + 1] = offsetStorage[2 * count] + text.size();
+        offsetStorage[2 * count + 2] = offsetStorage[2 * count + 1] + source.size();
+        ++count;
+    }
+
+    const float* embedding(int row) const { return embeddings + (size_t)row * dim; }
+    const char* stringsOf(int row) const { return strings ? strings + offsets[2 * row] : rowStrings[row]; }
+    QByteArrayView text(int row) const
+    {
+        return QByteArrayView(stringsOf(row), qsizetype(offsets[2 * row + 1] - offsets[2 * row]));
+    }
+    QByteArrayView source(int row) const
+    {
+        return QByteArrayView(stringsOf(row) + (offsets[2 * row + 1] - offsets[2 * row]),
+            qsizetype(offsets[2 * row + 2] - offsets[2 * row + 1]));
+    }
+};
+
+VectorStore::VectorStore() : snapshot_(std::make_shared<const Snapshot>()), rescoreCandidates_(DEFAULT_RESCORE_CANDIDATES) {}
+
+VectorStore::~VectorStore() {}
+
+std::shared_ptr<const VectorStore::Snapshot> VectorStore::snapshot() const
+{
+    return std::atomic_load(&snapshot_);
+}
+
+void VectorStore::publish(std::shared_ptr<const Snapshot> snapshot)
+{
+    std::atomic_store(&snapshot_, std::move(snapshot));
+}
+
+int VectorStore::count() const
+{
+    const std::shared_ptr<const Snapshot> current = snapshot();
+    return current->count - current->deletedCount;
+}
 
-VectorStore::VectorStore() {}
+int VectorStore::deletedCount() const
+{
+    return snapshot()->deletedCount;
+}
+
+int VectorStore::dimension() const
+{
+    return snapshot()->dim;
+}
+
+bool VectorStore::isMapped() const
+{
+    return snapshot()->mapped;
+}
+
+void VectorStore::replace(std::shared_ptr<const Snapshot> snapshot, std::unique_ptr<IndexState> index)
+{
+    {
+        // readers see either the previous snapshot and graph, or the new ones
+        QWriteLocker locker(&indexLock_);
+        publish(std::move(snapshot));
+        std::swap(index_, index);
+    }
+    ++generation_;
+    // the previous graph is released out of the lock
+}
 
 void VectorStore::clear()
 {
-    entries_.clear();
+    QMutexLocker writer(&writeMutex_);
+    std::shared_ptr<const Snapshot> empty = std::make_shared<const Snapshot>();
+    replace(empty, index_ ? createIndex(index_->graph->parameters(), empty, false) : nullptr);
+    tail_.reset();
+
+    QMutexLocker locker(&documentsMutex_);
+    documents_.clear();
 }
 
 bool VectorStore::load(const QString& path)
 {
-    QFile file(path);
+    QMutexLocker writer(&writeMutex_);
+
+    QFile file(dataFile(path));
     if (!file.open(QIODevice::ReadOnly))
     {
         qWarning() << "VectorStore: Cannot open file for reading:" << path;
         return false;
     }
 
+    quint32 magic = 0;
+    if (file.peek(reinterpret_cast<char*>(&magic), sizeof(magic)) != sizeof(magic))
+    {
+        qWarning() << "VectorStore: Invalid magic header in:" << path;
+        return false;
+    }
+
+    if (magic == MAGIC)
+    {
+        file.close();
+        std::shared_ptr<Snapshot> mapped = mapFile(file.fileName());
+        if (!mapped)
+            return false;
+
+        // the tombstones are only in the sidecar : the collection is not loaded without them rather than
+        // returning deleted rows (rows are only kept tombstoned on disk next to an HNSW graph)
+        QHash<QString, DocumentRecord> documents;
+        const QString documentsPath = path + ".docs";
+        if (!QFile::exists(documentsPath) && QFile::exists(path + ".hnsw"))
+        {
+            qWarning() << "VectorStore: Missing documents file:" << documentsPath;
+            return false;
+        }
+        if (!loadDocuments(documentsPath, *mapped, documents))
+            return false;
+        replace(mapped, loadIndex(path, mapped));
+        tail_.reset();
+
+        QMutexLocker locker(&documentsMutex_);
+        documents_.swap(documents);
+        return true;
+    }
+
+    // RAG1 is written big-endian by QDataStream
+    if (qFromBigEndian(magic) == MAGIC_V1)
+    {
+        std::vector<VectorEntry> entries;
+        if (!loadLegacy(file, entries))
+            return false;
+        file.close();
+
+        // the rows of the most common dimension are migrated (the first one to reach it on a tie),
+        // the others could not be searched with them
+        QHash<size_t, int> dimensions;
+        size_t dim = 0;
+        int dimRows = 0;
+        for (const VectorEntry& entry : entries)
+        {
+            if (entry.embedding.empty())
+                continue;
+            const int rowsOfDim = ++dimensions[entry.embedding.size()];
+            if (rowsOfDim > dimRows)
+            {
+                dim = entry.embedding.size();
+                dimRows = rowsOfDim;
+            }
+        }
+
+        std::vector<const VectorEntry*> rows;
+        for (const VectorEntry& entry : entries)
+        {
+            if (dim && entry.embedding.size() == dim)
+                rows.push_back(&entry);
+        }
+        if (rows.size() < entries.size())
+            qWarning() << "VectorStore: Skipping" << entries.size() - rows.size() << "of" << entries.size()
+                       << "legacy entries without a" << dim << "dimensions embedding in:" << path;
+
+        std::shared_ptr<const Snapshot> legacy = std::make_shared<const Snapshot>();
+        if (!rows.empty())
+            legacy = appendRows(*legacy, static_cast<int>(dim), rows);
+        replace(legacy, index_ ? createIndex(index_->graph->parameters(), legacy, true) : nullptr);
+        {
+            QMutexLocker locker(&documentsMutex_);
+            documents_.clear();
+        }
+
+        // One-time migration to the columnar format, the legacy file is kept as a backup
+        qDebug() << "VectorStore: Migrating" << path << "to RAG2 format";
+        QFile::remove(path + ".rag1");
+        if (!QFile::copy(path, path + ".rag1"))
+            qWarning() << "VectorStore: Cannot backup legacy file:" << path;
+        writer.unlock();
+        return save(path);
+    }
+
+    qWarning() << "VectorStore: Invalid magic header in:" << path;
+    return false;
+}
+
+bool VectorStore::loadLegacy(QFile& file, std::vector<VectorEntry>& entries)
+{
     QDataStream in(&file);
 
     quint32 magic;
     quint32 version;
     in >> magic >> version;
 
-    if (magic != MAGIC)
-    {
-        qWarning() << "VectorStore: Invalid magic header in:" << path;
-        return false;
-    }
-
-    if (version != VERSION)
+    if (version != VERSION_V1)
     {
         qWarning() << "VectorStore: Unsupported version:" << version;
         return false;
     }
 
-    quint32 count;
-    in >> count;
-
-    entries_.clear();
-    entries_.reserve(count);
+    quint32 n;
+    in >> n;
 
-    for (quint32 i = 0; i < count; ++i)
+    for (quint32 i = 0; i < n; ++i)
     {
         VectorEntry entry;
         quint32 dim;
@@ -62,16 +392,446 @@ bool VectorStore::load(const QString& path)
             in >> entry.embedding[j];
         }
         in >> entry.text >> entry.source;
-        entries_.push_back(std::move(entry));
+        if (in.status() != QDataStream::Ok)
+        {
+            qWarning() << "VectorStore: Truncated legacy file:" << file.fileName();
+            return false;
+        }
+        entries.push_back(std::move(entry));
     }
 
-    qDebug() << "VectorStore: Loaded" << entries_.size() << "entries from" << path;
+    qDebug() << "VectorStore: Loaded" << entries.size() << "legacy entries from" << file.fileName();
     return true;
 }
 
+std::shared_ptr<VectorStore::Snapshot> VectorStore::mapFile(const QString& path)
+{
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+    segment->file = std::make_unique<QFile>(path);
+    QFile* file = segment->file.get();
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        qWarning() << "VectorStore: Cannot open file for reading:" << path;
+        return nullptr;
+    }
+
+    const qint64 size = file->size();
+    if (size < (qint64)sizeof(VectorStoreHeader))
+    {
+        qWarning() << "VectorStore: Invalid magic header in:" << path;
+        return nullptr;
+    }
+
+    uchar* data = file->map(0, size);
+    if (!data)
+    {
+        qWarning() << "VectorStore: Cannot map file:" << path << file->errorString();
+        return nullptr;
+    }
+    segment->mapped = data;
+
+    VectorStoreHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    if (header.version != VERSION)
+    {
+        qWarning() << "VectorStore: Unsupported version:" << header.version;
+        return nullptr;
+    }
+
+    // the header is not trusted : the sections must fit in the file, computed without overflows
+    const quint64 fileSize = size;
+    auto fits = [fileSize](quint64 offset, quint64 count, quint64 elementSize)
+    {
+        return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+    };
+    const Quantization quantization = static_cast<Quantization>(header.quantization);
+    if (header.count > quint64(INT_MAX) || header.dim > MAX_DIMENSION || (header.count && !header.dim)
+        || quantization > Binary || header.embeddingsOffset % MATRIX_ALIGNMENT
+        || !fits(header.embeddingsOffset, header.count * header.dim, sizeof(float))
+        || header.offsetsOffset % sizeof(quint64) || !fits(header.offsetsOffset, 2 * header.count + 1, sizeof(quint64))
+        || !fits(header.stringsOffset, header.stringsSize, 1))
+    {
+        qWarning() << "VectorStore: Corrupted file:" << path;
+        return nullptr;
+    }
+
+    const quint64 codeSize = codeSizeFor(quantization, header.dim);
+    const quint64 codesOffset = alignUp(header.stringsOffset + header.stringsSize, MATRIX_ALIGNMENT);
+    if (codeSize && !fits(codesOffset, header.count, codeSize))
+    {
+        qWarning() << "VectorStore: Corrupted file:" << path;
+        return nullptr;
+    }
+    const quint64 scalesOffset = alignUp(codesOffset + header.count * codeSize, sizeof(float));
+    if (quantization == Int8 && !fits(scalesOffset, header.count, sizeof(float)))
+    {
+        qWarning() << "VectorStore: Corrupted file:" << path;
+        return nullptr;
+    }
+
+    // the strings of each row are read through the offsets table : it must stay within the blob
+    const quint64* offsets = reinterpret_cast<const quint64*>(data + header.offsetsOffset);
+    bool ordered = offsets[0] == 0 && offsets[2 * header.count] == header.stringsSize;
+    for (quint64 i = 0; ordered && i < 2 * header.count; ++i)
+        ordered = offsets[i] <= offsets[i + 1];
+    if (!ordered)
+    {
+        qWarning() << "VectorStore: Corrupted file:" << path;
+        return nullptr;
+    }
+
+    segment->count = static_cast<int>(header.count);
+    segment->dim = static_cast<int>(header.dim);
+    segment->embeddings = reinterpret_cast<const float*>(data + header.embeddingsOffset);
+    segment->offsets = offsets;
+    segment->strings = reinterpret_cast<const char*>(data + header.stringsOffset);
+    segment->quantization = quantization;
+    segment->codes = codeSize ? data + codesOffset : nullptr;
+    segment->scales = quantization == Int8 ? reinterpret_cast<const float*>(data + scalesOffset) : nullptr;
+    quantization_ = quantization;
+
+    std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+    snapshot->dim = segment->dim;
+    snapshot->count = segment->count;
+    if (segment->count)
+    {
+        snapshot->mapped = true;
+        snapshot->mappedCount = segment->count;
+        snapshot->segments.push_back(std::move(segment));
+    }
+
+    qDebug() << "VectorStore: Mapped" << snapshot->count << "entries from" << path;
+    return snapshot;
+}
+
+std::unique_ptr<VectorStore::IndexState> VectorStore::createIndex(
+    const HnswIndex::Parameters& parameters, const std::shared_ptr<const Snapshot>& rows, bool build) const
+{
+    std::unique_ptr<IndexState> state = std::make_unique<IndexState>();
+    IndexState* rawState = state.get();
+    state->rows = rows;
+    state->graph = std::make_unique<HnswIndex>(
+        rows->dim, parameters, [rawState](int index) { return embeddingAt(*rawState->rows, index); });
+
+    if (build)
+    {
+        for (int i = 0; i < rows->count; ++i)
+            state->graph->add(i);
+        qDebug() << "VectorStore: HNSW index built over" << rows->count << "entries";
+    }
+    return state;
+}
+
+std::unique_ptr<VectorStore::IndexState> VectorStore::loadIndex(
+    const QString& path, const std::shared_ptr<const Snapshot>& rows)
+{
+    const QString indexPath = path + ".hnsw";
+    if (!QFile::exists(indexPath))
+        return nullptr;
+
+    HnswIndex::Parameters parameters = index_ ? index_->graph->parameters() : HnswIndex::Parameters();
+    std::unique_ptr<IndexState> state = createIndex(parameters, rows, false);
+    if (!state->graph->load(indexPath, rows->count))
+    {
+        // the vectors are still valid : rebuild the graph rather than failing the load
+        qWarning() << "VectorStore: Rebuilding HNSW index:" << indexPath;
+        state = createIndex(parameters, rows, true);
+    }
+    return state;
+}
+
+void VectorStore::setIndexType(IndexType type, const HnswIndex::Parameters& parameters)
+{
+    QMutexLocker writer(&writeMutex_);
+
+    // the graph is built aside (no writer can run meanwhile), readers keep the previous backend
+    std::unique_ptr<IndexState> index;
+    if (type == Hnsw)
+        index = createIndex(parameters, snapshot(), true);
+
+    QWriteLocker locker(&indexLock_);
+    std::swap(index_, index);
+    ++generation_;
+}
+
+VectorStore::IndexType VectorStore::indexType() const
+{
+    QReadLocker locker(&indexLock_);
+    return index_ ? Hnsw : Exhaustive;
+}
+
+void VectorStore::setEfSearch(int efSearch)
+{
+    QWriteLocker locker(&indexLock_);
+    if (index_)
+        index_->graph->setEfSearch(efSearch);
+}
+
 bool VectorStore::save(const QString& path)
 {
-    QFile file(path);
+    QMutexLocker writer(&writeMutex_);
+
+    // an exhaustive collection is rewritten anyway : its tombstoned rows are dropped for free,
+    // an indexed one waits for enough of them since the graph has to be rebuilt
+    const std::shared_ptr<const Snapshot> current = snapshot();
+    const bool compact = current->deletedCount && (!index_ || current->deletedCount >= current->count * COMPACTION_RATIO);
+    return write(path, compact);
+}
+
+bool VectorStore::compact(const QString& path)
+{
+    QMutexLocker writer(&writeMutex_);
+    return write(path, snapshot()->deletedCount > 0);
+}
+
+// New rows of the ranges once the dropped rows (remap == -1) are removed
+static std::vector<std::pair<int, int>> remapRanges(const std::vector<std::pair<int, int>>& ranges, const std::vector<int>& remap)
+{
+    std::vector<std::pair<int, int>> remapped;
+    for (const std::pair<int, int>& range : ranges)
+    {
+        for (int row = range.first; row < range.first + range.second && row < (int)remap.size(); ++row)
+        {
+            if (remap[row] < 0)
+                continue;
+            if (!remapped.empty() && remapped.back().first + remapped.back().second == remap[row])
+                ++remapped.back().second;
+            else
+                remapped.emplace_back(remap[row], 1);
+        }
+    }
+    return remapped;
+}
+
+bool VectorStore::write(const QString& path, bool compact)
+{
+    // no writer can run meanwhile : the snapshot is the whole collection
+    std::shared_ptr<const Snapshot> current = snapshot();
+
+    // the mapped file is left untouched, searches still running keep using it
+    const QString mappedPath = current->mapped ? current->segments.front()->file->fileName() : QString();
+    const QString dataPath = mappedPath == path ? path + ALTERNATE_SUFFIX : path;
+    const QString otherPath = dataPath == path ? path + ALTERNATE_SUFFIX : path;
+
+    QSaveFile file(dataPath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "VectorStore: Cannot open file for writing:" << dataPath;
+        return false;
+    }
+    const int dim = current->dim;
+    const Quantization quantization = quantization_;
+
+    // rows written, as runs of consecutive rows of a segment (whole segments unless compacting)
+    struct Run
+    {
+        const Segment* segment;
+        int first;
+        int count;
+    };
+    std::vector<Run> runs;
+    std::vector<int> remap; ///< new row of each row when compacting (-1 : dropped)
+    int n = 0;
+    int index = 0;
+    for (size_t s = 0; s < current->segments.size(); ++s)
+    {
+        const std::shared_ptr<const Segment>& segment = current->segments[s];
+        const int rows = rowsInSegment(*current, s);
+        if (!compact)
+        {
+            runs.push_back({ segment.get(), 0, rows });
+            n += rows;
+            continue;
+        }
+
+        for (int i = 0; i < rows; ++i, ++index)
+        {
+            if (current->isDeleted(index))
+            {
+                remap.push_back(-1);
+                continue;
+            }
+            remap.push_back(n++);
+            if (!runs.empty() && runs.back().segment == segment.get() && runs.back().first + runs.back().count == i)
+                ++runs.back().count;
+            else
+                runs.push_back({ segment.get(), i, 1 });
+        }
+    }
+
+    // offsets of the text and the source of each entry in the string blob
+    std::vector<quint64> offsets;
+    offsets.reserve(2 * n + 1);
+    quint64 stringsSize = 0;
+    for (const Run& run : runs)
+    {
+        for (int i = run.first; i < run.first + run.count; ++i)
+        {
+            offsets.push_back(stringsSize);
+            stringsSize += run.segment->text(i).size();
+            offsets.push_back(stringsSize);
+            stringsSize += run.segment->source(i).size();
+        }
+    }
+    offsets.push_back(stringsSize);
+
+    VectorStoreHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.dim = dim;
+    header.quantization = quantization;
+    header.count = n;
+    header.embeddingsOffset = alignUp(sizeof(header), MATRIX_ALIGNMENT);
+    header.offsetsOffset = alignUp(header.embeddingsOffset + (quint64)n * dim * sizeof(float), sizeof(quint64));
+    header.stringsOffset = header.offsetsOffset + offsets.size() * sizeof(quint64);
+    header.stringsSize = stringsSize;
+
+    const QByteArray padding(MATRIX_ALIGNMENT, '\0');
+    auto writeBlock = [&file](const void* data, qint64 size)
+    {
+        return !size || file.write(reinterpret_cast<const char*>(data), size) == size;
+    };
+
+    bool ok = writeBlock(&header, sizeof(header));
+    ok = ok && writeBlock(padding.constData(), header.embeddingsOffset - sizeof(header));
+
+    // embedding matrix, run after run
+    for (const Run& run : runs)
+        ok = ok && writeBlock(run.segment->embedding(run.first), (qint64)run.count * dim * sizeof(float));
+    const quint64 matrixEnd = header.embeddingsOffset + (quint64)n * dim * sizeof(float);
+    ok = ok && writeBlock(padding.constData(), header.offsetsOffset - matrixEnd);
+
+    ok = ok && writeBlock(offsets.data(), offsets.size() * sizeof(quint64));
+
+    // string blob, the strings of consecutive rows are contiguous in the mapped file,
+    // in-memory segments keep the text and the source of each row together
+    for (const Run& run : runs)
+    {
+        const Segment* segment = run.segment;
+        if (segment->strings)
+        {
+            const quint64 begin = segment->offsets[2 * run.first];
+            ok = ok && writeBlock(segment->strings + begin, segment->offsets[2 * (run.first + run.count)] - begin);
+            continue;
+        }
+        for (int i = run.first; ok && i < run.first + run.count; ++i)
+            ok = writeBlock(segment->rowStrings[i], segment->offsets[2 * i + 2] - segment->offsets[2 * i]);
+    }
+
+    // quantized codes, computed from the fp32 rows
+    const int codeSize = codeSizeFor(quantization, dim);
+    if (ok && codeSize)
+    {
+        const quint64 stringsEnd = header.stringsOffset + header.stringsSize;
+        ok = writeBlock(padding.constData(), alignUp(stringsEnd, MATRIX_ALIGNMENT) - stringsEnd);
+
+        std::vector<float> scales;
+        if (quantization == Int8)
+            scales.reserve(n);
+        std::vector<quint64> codes((codeSize + sizeof(quint64) - 1) / sizeof(quint64));
+        for (const Run& run : runs)
+        {
+            for (int i = run.first; ok && i < run.first + run.count; ++i)
+            {
+                const float* row = run.segment->embedding(i);
+                if (quantization == Int8)
+                    scales.push_back(quantizeInt8(row, dim, reinterpret_cast<qint8*>(codes.data())));
+                else
+                    quantizeBinary(row, dim, codes.data());
+                ok = writeBlock(codes.data(), codeSize);
+            }
+        }
+
+        const quint64 codesEnd = alignUp(stringsEnd, MATRIX_ALIGNMENT) + (quint64)n * codeSize;
+        ok = ok && writeBlock(padding.constData(), alignUp(codesEnd, sizeof(float)) - codesEnd);
+        ok = ok && writeBlock(scales.data(), scales.size() * sizeof(float));
+    }
+
+    if (!ok)
+    {
+        qWarning() << "VectorStore: Cannot write file:" << dataPath << file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+
+    if (!file.commit())
+    {
+        qWarning() << "VectorStore: Cannot write file:" << dataPath << file.errorString();
+        return false;
+    }
+
+    // the saved file now backs the whole collection (a single segment)
+    std::shared_ptr<Snapshot> mapped = mapFile(dataPath);
+    if (!mapped)
+        return false;
+    tail_.reset();
+
+    // the previous file is removed once the searches running on the previous snapshot release its mapping
+    std::weak_ptr<const Segment> previous;
+    if (mappedPath == otherPath)
+        previous = current->segments.front();
+    const int deletedCount = current->deletedCount;
+    const std::shared_ptr<const std::vector<bool>> deleted = current->deleted;
+    current.reset();
+    auto removeOther = [&previous, &otherPath]()
+    {
+        while (!previous.expired())
+            QThread::yieldCurrentThread();
+        QFile::remove(otherPath);
+    };
+
+    if (compact)
+    {
+        {
+            QMutexLocker locker(&documentsMutex_);
+            for (DocumentRecord& record : documents_)
+                record.ranges = remapRanges(record.ranges, remap);
+        }
+        qDebug() << "VectorStore: Compacted" << path << ":" << deletedCount << "rows dropped";
+    }
+    else
+    {
+        mapped->deleted = deleted;
+        mapped->deletedCount = deletedCount;
+    }
+    ok = saveDocuments(path + ".docs", *mapped);
+
+    if (!index_)
+    {
+        QFile::remove(path + ".hnsw");
+        publish(mapped);
+        removeOther();
+        return ok;
+    }
+
+    // compaction renumbers the rows : the graph is rebuilt, searches keep the previous one meanwhile
+    if (compact)
+    {
+        std::unique_ptr<IndexState> index = createIndex(index_->graph->parameters(), mapped, true);
+        ok = index->graph->save(path + ".hnsw") && ok;
+        replace(mapped, std::move(index));
+        removeOther();
+        return ok;
+    }
+
+    // the graph refers to row indexes, which are unchanged by the save
+    ok = index_->graph->save(path + ".hnsw") && ok;
+    {
+        QWriteLocker locker(&indexLock_);
+        publish(mapped);
+        index_->rows = mapped;
+    }
+    removeOther();
+    return ok;
+}
+
+bool VectorStore::saveDocuments(const QString& path, const Snapshot& rows)
+{
+    // always written, even empty : its absence cannot be mistaken for a collection without tombstones
+    QMutexLocker locker(&documentsMutex_);
+    QSaveFile file(path);
     if (!file.open(QIODevice::WriteOnly))
     {
         qWarning() << "VectorStore: Cannot open file for writing:" << path;
@@ -79,74 +839,458 @@ bool VectorStore::save(const QString& path)
     }
 
     QDataStream out(&file);
+    out << DOCUMENTS_MAGIC << DOCUMENTS_VERSION << quint32(rows.count);
 
-    out << MAGIC << VERSION;
-    out << (quint32)entries_.size();
+    // tombstones, as the list of the deleted rows
+    out << quint32(rows.deletedCount);
+    for (int row = 0; rows.deletedCount && row < (int)rows.deleted->size(); ++row)
+    {
+        if ((*rows.deleted)[row])
+            out << qint32(row);
+    }
+
+    out << quint32(documents_.size());
+    for (const DocumentRecord& record : documents_)
+    {
+        out << record.path << record.size << record.modified << record.hash << quint32(record.ranges.size());
+        for (const std::pair<int, int>& range : record.ranges)
+            out << qint32(range.first) << qint32(range.second);
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit())
+    {
+        qWarning() << "VectorStore: Cannot write file:" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
 
-    for (const auto& entry : entries_)
+bool VectorStore::loadDocuments(const QString& path, Snapshot& rows, QHash<QString, DocumentRecord>& documents)
+{
+    QFile file(path);
+    if (!file.exists())
+        return true;
+    if (!file.open(QIODevice::ReadOnly))
     {
-        out << (quint32)entry.embedding.size();
-        for (float val : entry.embedding)
+        qWarning() << "VectorStore: Cannot open file for reading:" << path;
+        return false;
+    }
+
+    QDataStream in(&file);
+    quint32 magic;
+    quint32 version;
+    quint32 count;
+    in >> magic >> version >> count;
+    if (magic != DOCUMENTS_MAGIC || version != DOCUMENTS_VERSION || (int)count != rows.count)
+    {
+        // documents and tombstones unknown : the collection has to be ingested again
+        qWarning() << "VectorStore: Documents do not match the vectors:" << path;
+        return false;
+    }
+
+    std::shared_ptr<std::vector<bool>> deleted = std::make_shared<std::vector<bool>>(rows.count, false);
+    quint32 deletedCount;
+    in >> deletedCount;
+    bool ok = deletedCount <= count;
+    for (quint32 i = 0; ok && i < deletedCount; ++i)
+    {
+        qint32 row;
+        in >> row;
+        ok = row >= 0 && row < rows.count && !(*deleted)[row];
+        if (ok)
+            (*deleted)[row] = true;
+    }
+
+    quint32 n = 0;
+    in >> n;
+    for (quint32 i = 0; ok && i < n; ++i)
+    {
+        DocumentRecord record;
+        quint32 ranges;
+        in >> record.path >> record.size >> record.modified >> record.hash >> ranges;
+        for (quint32 j = 0; ok && j < ranges && in.status() == QDataStream::Ok; ++j)
         {
-            out << val;
+            qint32 first;
+            qint32 rangeCount;
+            in >> first >> rangeCount;
+            ok = first >= 0 && rangeCount >= 0 && qint64(first) + rangeCount <= rows.count;
+            record.ranges.emplace_back(first, rangeCount);
         }
-        out << entry.text << entry.source;
+        ok = ok && in.status() == QDataStream::Ok;
+        documents.insert(record.path, std::move(record));
     }
 
+    if (!ok || in.status() != QDataStream::Ok)
+    {
+        qWarning() << "VectorStore: Corrupted file:" << path;
+        documents.clear();
+        return false;
+    }
+
+    rows.deleted = std::move(deleted);
+    rows.deletedCount = static_cast<int>(deletedCount);
+    qDebug() << "VectorStore: Loaded" << documents.size() << "documents from" << path;
     return true;
 }
 
 void VectorStore::addEntry(const VectorEntry& entry)
 {
-    entries_.push_back(entry);
+    addEntries({ entry });
 }
 
-std::vector<SearchResult> VectorStore::search(const std::vector<float>& queryEmb, int topK)
+void VectorStore::addEntries(const std::vector<VectorEntry>& entries, const QString& document)
 {
-    std::vector<SearchResult> results;
-    if (entries_.empty() || queryEmb.empty())
-        return results;
+    QMutexLocker writer(&writeMutex_);
+
+    const std::shared_ptr<const Snapshot> current = snapshot();
+    int dim = current->dim;
+    std::vector<const VectorEntry*> rows;
+    rows.reserve(entries.size());
+    for (const VectorEntry& entry : entries)
+    {
+        if (entry.embedding.empty())
+            continue;
+
+        if (!dim)
+            dim = static_cast<int>(entry.embedding.size());
 
-    // Use a pair of <score, index> to sort
-    std::vector<std::pair<float, int>> scores;
-    scores.reserve(entries_.size());
+        if ((int)entry.embedding.size() != dim)
+        {
+            qWarning() << "VectorStore: Embedding dimension mismatch:" << entry.embedding.size() << "expected" << dim;
+            continue;
+        }
+        rows.push_back(&entry);
+    }
+    if (rows.empty())
+        return;
 
-    for (size_t i = 0; i < entries_.size(); ++i)
+    std::shared_ptr<const Snapshot> next = appendRows(*current, dim, rows);
+
+    if (!document.isEmpty())
     {
-        // Assuming queryEmb is already normalized, and stored embeddings are normalized
-        // Cosine Sim = Dot Product
-        float score = cosineSimilarity(queryEmb, entries_[i].embedding);
-        scores.push_back({ score, static_cast<int>(i) });
+        QMutexLocker locker(&documentsMutex_);
+        DocumentRecord& record = documents_[document];
+        record.path = document;
+        if (!record.ranges.empty() && record.ranges.back().first + record.ranges.back().second == current->count)
+            record.ranges.back().second += static_cast<int>(rows.size());
+        else
+            record.ranges.emplace_back(current->count, static_cast<int>(rows.size()));
     }
 
-    // Sort descending by score
-    std::partial_sort(scores.begin(), scores.begin() + std::min((size_t)topK, scores.size()), scores.end(),
-        [](const std::pair<float, int>& a, const std::pair<float, int>& b)
+    if (!index_)
+    {
+        publish(next);
+        ++generation_;
+        return;
+    }
+
+    // the dimension of an empty collection is only known now
+    if (!current->dim)
+    {
+        replace(next, createIndex(index_->graph->parameters(), next, true));
+        return;
+    }
+
+    // rows are searchable as soon as published (scanned until inserted in the graph),
+    // the graph is locked for one insertion at a time so that searches interleave
+    publish(next);
+    for (int row = current->count; row < next->count; ++row)
+    {
+        QWriteLocker locker(&indexLock_);
+        index_->rows = next;
+        index_->graph->add(row);
+    }
+    // after the insertions : results cached meanwhile belong to the previous generation
+    ++generation_;
+}
+
+bool VectorStore::document(const QString& path, DocumentRecord& record) const
+{
+    QMutexLocker locker(&documentsMutex_);
+    auto it = documents_.constFind(path);
+    if (it == documents_.constEnd())
+        return false;
+    record = *it;
+    return true;
+}
+
+QStringList VectorStore::documents() const
+{
+    QMutexLocker locker(&documentsMutex_);
+    return documents_.keys();
+}
+
+void VectorStore::updateDocument(const DocumentRecord& record)
+{
+    QMutexLocker locker(&documentsMutex_);
+    DocumentRecord& current = documents_[record.path];
+    current.path = record.path;
+    current.size = record.size;
+    current.modified = record.modified;
+    current.hash = record.hash;
+}
+
+int VectorStore::removeDocument(const QString& path)
+{
+    QMutexLocker writer(&writeMutex_);
+
+    DocumentRecord record;
+    {
+        QMutexLocker locker(&documentsMutex_);
+        auto it = documents_.find(path);
+        if (it == documents_.end())
+            return 0;
+        record = std::move(*it);
+        documents_.erase(it);
+    }
+
+    // the tombstones are copied on write, like the segments
+    const std::shared_ptr<const Snapshot> current = snapshot();
+    std::shared_ptr<std::vector<bool>> deleted = current->deleted
+        ? std::make_shared<std::vector<bool>>(*current->deleted) : std::make_shared<std::vector<bool>>();
+    deleted->resize(current->count, false);
+
+    int removed = 0;
+    for (const std::pair<int, int>& range : record.ranges)
+    {
+        for (int row = range.first; row < range.first + range.second && row < current->count; ++row)
         {
-            return a.first > b.first;
-        });
+            if (!(*deleted)[row])
+            {
+                (*deleted)[row] = true;
+                ++removed;
+            }
+        }
+    }
+    if (!removed)
+        return 0;
+
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*current);
+    next->deleted = std::move(deleted);
+    next->deletedCount += removed;
+    publish(next);
+    ++generation_;
+    return removed;
+}
+
+std::shared_ptr<const VectorStore::Snapshot> VectorStore::appendRows(
+    const Snapshot& current, int dim, const std::vector<const VectorEntry*>& entries)
+{
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(current);
+    next->dim = dim;
 
-    // Extract top K
-    for (int i = 0; i < topK && i < (int)scores.size(); ++i)
+    // the tail segment is filled in place, past the rows published by the current snapshot
+    if (tail_ && (current.segments.empty() || current.segments.back() != tail_
+        || tail_->count != rowsInSegment(current, current.segments.size() - 1)))
+        tail_.reset();
+
+    for (const VectorEntry* entry : entries)
     {
-        const VectorEntry& entry = entries_[scores[i].second];
-        results.push_back({ entry.text, scores[i].first, entry.source });
+        if (!tail_ || tail_->count == SEGMENT_ROWS)
+        {
+            tail_ = std::make_shared<Segment>();
+            tail_->reserve(dim);
+            next->segments.push_back(tail_);
+        }
+        tail_->append(*entry);
     }
 
-    return results;
+    next->count += static_cast<int>(entries.size());
+    return next;
 }
 
-float VectorStore::cosineSimilarity(const std::vector<float>& a, const std::vector<float>& b)
+const VectorStore::Segment& VectorStore::segmentOf(const Snapshot& snapshot, int& row)
 {
-    if (a.size() != b.size())
-        return 0.0f;
+    if (row < snapshot.mappedCount)
+        return *snapshot.segments.front();
+
+    // in-memory segments all hold SEGMENT_ROWS rows, except the last one
+    row -= snapshot.mappedCount;
+    const Segment& segment = *snapshot.segments[(snapshot.mapped ? 1 : 0) + row / SEGMENT_ROWS];
+    row %= SEGMENT_ROWS;
+    return segment;
+}
 
-    float dot = 0.0f;
-    for (size_t i = 0; i < a.size(); ++i)
+int VectorStore::rowsInSegment(const Snapshot& snapshot, size_t segment)
+{
+    if (snapshot.mapped && segment == 0)
+        return snapshot.mappedCount;
+
+    // in-memory segments all hold SEGMENT_ROWS rows, except the last one
+    const int first = snapshot.mappedCount + static_cast<int>(segment - (snapshot.mapped ? 1 : 0)) * SEGMENT_ROWS;
+    return std::min(SEGMENT_ROWS, snapshot.count - first);
+}
+
+const float* VectorStore::embeddingAt(const Snapshot& snapshot, int index)
+{
+    const Segment& segment = segmentOf(snapshot, index);
+    return segment.embedding(index);
+}
+
+// Bounded min-heap of <score, index> : the worst of the current top K sits on top
+class TopKHeap
+{
+public:
+    using ScoredIndex = std::pair<float, int>;
+
+    explicit TopKHeap(int k) : k_(k) { heap_.reserve(k + 1); }
+
+    void push(float score, int index)
     {
-        dot += a[i] * b[i];
+        if ((int)heap_.size() < k_)
+        {
+            heap_.emplace_back(score, index);
+            std::push_heap(heap_.begin(), heap_.end(), worstFirst);
+        }
+        else if (score > heap_.front().first)
+        {
+            std::pop_heap(heap_.begin(), heap_.end(), worstFirst);
+            heap_.back() = { score, index };
+            std::push_heap(heap_.begin(), heap_.end(), worstFirst);
+        }
     }
-    // Assumes vectors are normalized. If NOT, we would divide by (norm(a)*norm(b))
-    return dot;
+
+    // Sort descending by score
+    const std::vector<ScoredIndex>& sorted()
+    {
+        std::sort_heap(heap_.begin(), heap_.end(), worstFirst);
+        return heap_;
+    }
+
+private:
+    static bool worstFirst(const ScoredIndex& a, const ScoredIndex& b) { return a.first > b.first; }
+
+    int k_;
+    std::vector<ScoredIndex> heap_;
+};
+
+std::vector<SearchResult> VectorStore::search(const std::vector<float>& queryEmb, int topK) const
+{
+    std::vector<SearchResult> results;
+    if (topK <= 0 || queryEmb.empty())
+        return results;
+
+    const float* query = queryEmb.data();
+    TopKHeap heap(topK);
+
+    auto extractResults = [&](const Snapshot& rows)
+    {
+        // Extract top K
+        const std::vector<TopKHeap::ScoredIndex>& best = heap.sorted();
+        results.reserve(best.size());
+        for (const TopKHeap::ScoredIndex& scored : best)
+        {
+            int row = scored.second;
+            const Segment& segment = segmentOf(rows, row);
+            results.push_back(
+                { QString::fromUtf8(segment.text(row)), scored.first, QString::fromUtf8(segment.source(row)) });
+        }
+    };
+
+    // Linear scan over a contiguous block of fp32 rows
+    auto scan = [&](const Snapshot& rows, const float* matrix, int count, int dim, int baseIndex)
+    {
+        const float* row = matrix;
+        for (int i = 0; i < count; ++i, row += dim)
+        {
+            if (rows.isDeleted(baseIndex + i))
+                continue;
+
+            // Assuming queryEmb is already normalized, and stored embeddings are normalized
+            // Cosine Sim = Dot Product
+            heap.push(cosineSimilarity(query, row, dim), baseIndex + i);
+        }
+    };
+
+    {
+        QReadLocker locker(&indexLock_);
+        if (index_)
+        {
+            // loaded under the lock : contains at least the rows of the graph
+            const std::shared_ptr<const Snapshot> current = snapshot();
+            if (!current->count || (int)queryEmb.size() != current->dim)
+                return results;
+
+            // tombstoned rows are still in the graph : a few more candidates are requested to replace them
+            const int candidates = topK + std::min(current->deletedCount, DELETED_CANDIDATES_FACTOR * topK);
+            for (const HnswIndex::ScoredIndex& scored : index_->graph->search(query, candidates))
+            {
+                if (!current->isDeleted(scored.second))
+                    heap.push(scored.first, scored.second);
+            }
+
+            // rows published but not inserted in the graph yet
+            for (int i = index_->graph->count(); i < current->count; ++i)
+            {
+                if (!current->isDeleted(i))
+                    heap.push(cosineSimilarity(query, embeddingAt(*current, i), current->dim), i);
+            }
+
+            extractResults(*current);
+            return results;
+        }
+    }
+
+    const std::shared_ptr<const Snapshot> current = snapshot();
+    const int dim = current->dim;
+    if (!current->count || (int)queryEmb.size() != dim)
+        return results;
+
+    int baseIndex = 0;
+    for (size_t s = 0; s < current->segments.size(); ++s)
+    {
+        const std::shared_ptr<const Segment>& segment = current->segments[s];
+        const int rows = rowsInSegment(*current, s);
+        if (segment->quantization == None)
+        {
+            scan(*current, segment->embeddings, rows, dim, baseIndex);
+            baseIndex += rows;
+            continue;
+        }
+
+        // Two-stage scan : quantized pass over the whole mapped segment, then exact fp32 rescoring
+        // of the best candidates (only their fp32 rows are read from the mapped file)
+        TopKHeap candidates(std::max(topK, rescoreCandidates_.load()));
+        const int codeSize = codeSizeFor(segment->quantization, dim);
+        std::vector<quint64> queryCodes((codeSize + sizeof(quint64) - 1) / sizeof(quint64));
+        const uchar* codes = segment->codes;
+
+        if (segment->quantization == Int8)
+        {
+            const qint8* queryInt8 = reinterpret_cast<const qint8*>(queryCodes.data());
+            const float queryScale = quantizeInt8(query, dim, reinterpret_cast<qint8*>(queryCodes.data()));
+            for (int i = 0; i < rows; ++i, codes += codeSize)
+            {
+                if (current->isDeleted(baseIndex + i))
+                    continue;
+                const int32_t dot = VectorKernels::dotInt8(queryInt8, reinterpret_cast<const qint8*>(codes), dim);
+                candidates.push(queryScale * segment->scales[i] * dot, i);
+            }
+        }
+        else
+        {
+            const int words = codeSize / sizeof(quint64);
+            quantizeBinary(query, dim, queryCodes.data());
+            for (int i = 0; i < rows; ++i, codes += codeSize)
+            {
+                if (current->isDeleted(baseIndex + i))
+                    continue;
+                const int distance = VectorKernels::hamming(queryCodes.data(), reinterpret_cast<const quint64*>(codes), words);
+                candidates.push(-static_cast<float>(distance), i);
+            }
+        }
+
+        for (const TopKHeap::ScoredIndex& candidate : candidates.sorted())
+            heap.push(cosineSimilarity(query, segment->embedding(candidate.second), dim), baseIndex + candidate.second);
+        baseIndex += rows;
+    }
+
+    extractResults(*current);
+    return results;
 }
 
+float VectorStore::cosineSimilarity(const float* a, const float* b, int dim)
+{
+    // Assumes vectors are normalized. If NOT, we would divide by (norm(a)*norm(b))
+    return VectorKernels::dot(a, b, dim);
+}
@@ -1,8 +1,18 @@
 #pragma once
 
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
 #include <QString>
+#include <QStringList>
+#include <atomic>
+#include <memory>
 #include <vector>
 
+#include "HnswIndex.h"
+
 struct SearchResult
 {
     QString text;
@@ -17,25 +27,175 @@ struct VectorEntry
     QString source; // metadata
 };
 
+// Ingested file : fingerprint used to detect changes and rows holding its chunks
+struct DocumentRecord
+{
+    QString path;                            // absolute file path (identity of the document)
+    qint64 size{0};
+    qint64 modified{0};                      // last modification (ms since epoch)
+    QByteArray hash;                         // content hash, empty until the document is completely ingested
+    std::vector<std::pair<int, int>> ranges; // rows of its chunks, as (first, count)
+};
+
+/**
+ * Vector database with a columnar on-disk format ("RAG2").
+ *
+ * File layout: header, one contiguous 64-byte aligned float matrix (count rows of dim floats),
+ * an offsets table (2 * count + 1 entries) and a UTF-8 string blob (text then source of each entry).
+ * The file is memory-mapped on load : opening only validates the header and the offsets table,
+ * and search runs straight off the page cache.
+ * Optionally, int8 (per-vector scale) or 1-bit sign codes are stored after the string blob :
+ * search then scans the compact codes and rescores the best candidates with the fp32 rows.
+ * A collection can instead be searched through an HNSW graph, saved next to the file (path + ".hnsw").
+ * The mapped file is never replaced : a save writes the collection to path or to path + ".alt",
+ * whichever is not mapped, then removes the other one once no search uses it.
+ * Legacy "RAG1" files are migrated to RAG2 on first load.
+ *
+ * Concurrency: rows live in segments (the mapped file, then in-memory segments of SEGMENT_ROWS
+ * rows reserved up front). Writers are serialized, write the new rows in place past the published
+ * ones (a new segment only when the last one is full) and publish a new snapshot (row count)
+ * atomically; published rows never move, so a search works on the snapshot it started with and
+ * never waits for an ingestion. Segments are released with the last snapshot using them.
+ * The HNSW graph is guarded by a reader-writer lock, held by the writer for one insertion at a
+ * time; rows published but not inserted yet are scanned exhaustively.
+ *
+ * Documents: rows can be attributed to a document (path + fingerprint), recorded in a sidecar
+ * file (path + ".docs"). Removing a document tombstones its rows : search skips them until a
+ * compaction rewrites the file without them. Exhaustive collections are compacted by every save
+ * (the file is rewritten anyway), indexed ones once COMPACTION_RATIO of the rows are dead since
+ * the graph has to be rebuilt. The sidecar holds the tombstones : a collection whose sidecar is
+ * corrupted (or missing next to its graph) fails to load rather than returning deleted rows.
+ */
 class VectorStore
 {
 public:
+    // Quantization of the codes used by the first search pass (recorded in the file header)
+    enum Quantization : quint32
+    {
+        None = 0,
+        Int8 = 1,
+        Binary = 2,
+    };
+
+    // Search backend of the collection
+    enum IndexType
+    {
+        Exhaustive, ///< linear scan (exact, optionally quantized)
+        Hnsw,       ///< approximate nearest neighbours graph
+    };
+
     VectorStore();
+    ~VectorStore();
 
     bool load(const QString& path);
     bool save(const QString& path);
     void clear();
 
+    // Like save, but always drops the tombstoned rows
+    bool compact(const QString& path);
+
     void addEntry(const VectorEntry& entry);
+    // Publishes several entries at once (a single new snapshot), attributed to `document` if not empty
+    void addEntries(const std::vector<VectorEntry>& entries, const QString& document = QString());
+
+    // Documents, can be queried from any thread
+    bool document(const QString& path, DocumentRecord& record) const;
+    QStringList documents() const;
+    // Sets the fingerprint of a document (created without rows if needed), its rows are unchanged
+    void updateDocument(const DocumentRecord& record);
+    // Drops the document and tombstones its rows, returns the number of rows removed
+    int removeDocument(const QString& path);
 
     // Returns top K results sorted by similarity (descending)
-    std::vector<SearchResult> search(const std::vector<float>& queryEmb, int topK);
+    std::vector<SearchResult> search(const std::vector<float>& queryEmb, int topK) const;
+
+    // Live entries (tombstoned rows are not counted)
+    int count() const;
+    int deletedCount() const;
+    int dimension() const;
+    bool isMapped() const;
+
+    // Incremented after each change of the search results (rows added or removed, backend switched)
+    quint64 generation() const { return generation_; }
+
+    // Quantization written by the next save (loading a file adopts the file's one)
+    void setQuantization(Quantization quantization) { quantization_ = quantization; }
+    Quantization quantization() const { return quantization_; }
+
+    // Number of candidates of the quantized pass rescored with fp32 vectors
+    void setRescoreCandidates(int candidates) { rescoreCandidates_ = candidates; }
+    int rescoreCandidates() const { return rescoreCandidates_; }
 
-    int count() const { return entries_.size(); }
+    // Switches the search backend, the HNSW graph is built over the current rows
+    // (loading a file adopts the file's backend)
+    void setIndexType(IndexType type, const HnswIndex::Parameters& parameters = HnswIndex::Parameters());
+    IndexType indexType() const;
+    void setEfSearch(int efSearch);
 
 private:
-    std::vector<VectorEntry> entries_;
+    struct Segment;
+
+    // Immutable view of the collection
+    struct Snapshot
+    {
+        int dim{0};
+        int count{0};
+        bool mapped{false};  ///< the first segment is the mapped file
+        int mappedCount{0}; ///< rows of the mapped segment
+        std::vector<std::shared_ptr<const Segment>> segments;
+        std::shared_ptr<const std::vector<bool>> deleted; ///< tombstones (rows past its size are live)
+        int deletedCount{0};
+
+        bool isDeleted(int row) const { return deletedCount && row < (int)deleted->size() && (*deleted)[row]; }
+    };
+
+    // HNSW graph and the rows its accessor reads
+    struct IndexState
+    {
+        std::unique_ptr<HnswIndex> graph;
+        std::shared_ptr<const Snapshot> rows;
+    };
+
+    std::shared_ptr<const Snapshot> snapshot() const;
+    void publish(std::shared_ptr<const Snapshot> snapshot);
+
+    // Writes the collection and maps it back (called with the writer lock held)
+    bool write(const QString& path, bool compact);
+    bool saveDocuments(const QString& path, const Snapshot& rows);
+
+    // Loaders (called with the writer lock held)
+    bool loadLegacy(QFile& file, std::vector<VectorEntry>& entries);
+    std::shared_ptr<Snapshot> mapFile(const QString& path);
+    bool loadDocuments(const QString& path, Snapshot& rows, QHash<QString, DocumentRecord>& documents);
+    std::unique_ptr<IndexState> loadIndex(const QString& path, const std::shared_ptr<const Snapshot>& rows);
+    std::unique_ptr<IndexState> createIndex(
+        const HnswIndex::Parameters& parameters, const std::shared_ptr<const Snapshot>& rows, bool build) const;
+    void replace(std::shared_ptr<const Snapshot> snapshot, std::unique_ptr<IndexState> index);
+
+    // New snapshot with the entries appended, written in place in the tail segment (writer lock held)
+    std::shared_ptr<const Snapshot> appendRows(
+        const Snapshot& current, int dim, const std::vector<const VectorEntry*>& entries);
+
+    // Row accessors over the segments of a snapshot
+    static const Segment& segmentOf(const Snapshot& snapshot, int& row);
+    static int rowsInSegment(const Snapshot& snapshot, size_t segment);
+    static const float* embeddingAt(const Snapshot& snapshot, int index);
+
+    std::shared_ptr<const Snapshot> snapshot_; ///< current snapshot (atomic access only)
+    QMutex writeMutex_;                        ///< serializes the writers
+    std::shared_ptr<Segment> tail_;            ///< in-memory segment being filled (writer only)
+
+    mutable QReadWriteLock indexLock_;
+    std::unique_ptr<IndexState> index_;
+
+    // modified by the writers (rows) and by updateDocument (fingerprints)
+    mutable QMutex documentsMutex_;
+    QHash<QString, DocumentRecord> documents_;
+
+    std::atomic<quint64> generation_{0};
+    std::atomic<Quantization> quantization_{None};
+    std::atomic<int> rescoreCandidates_;
 
     // Helper: Cosine similarity between two normalized vectors is just their dot product
-    static float cosineSimilarity(const std::vector<float>& a, const std::vector<float>& b);
+    static float cosineSimilarity(const float* a, const float* b, int dim);
 };
@@ -93,7 +93,9 @@ Drawer {
 
                             Label {
                                 id: tokensLabel
-                                text: chatObject ? " • " + chatObject.contextSizeUsed + "/" + chatObject.contextSize : ""
+                                text: chatObject ? (chatObject.prefillProgress < 1 ? " • " + Math.round(chatObject.prefillProgress * 100) + "%" : "")
+                                                   + " • " + chatObject.contextSizeUsed + "/" + chatObject.contextSize
+                                                   + (chatObject.acceptanceRate >= 0 ? " • draft " + Math.round(chatObject.acceptanceRate * 100) + "%" : "") : ""
                                 color: themeManager.color("buttonText")
                                 font.pixelSize: 10
                                 Layout.alignment: Qt.AlignRight
@@ -152,6 +154,27 @@ Drawer {
                         MenuItem { text: "65536"; onTriggered: chatObject.contextSize = 65536 }
                         MenuItem { text: "128000"; onTriggered: chatObject.contextSize = 128000 }
                     }
+                    Menu {
+                        id: draftModelMenu
+                        title: "Set Draft Model"
+                        MenuItem {
+                            text: "None"
+                            checkable: true
+                            checked: chatObject && chatObject.draftModel === ""
+                            onTriggered: chatObject.draftModel = ""
+                        }
+                        Instantiator {
+                            model: chatController ? chatController.getAvailableModels() : []
+                            delegate: MenuItem {
+                                text: modelData.name
+                                checkable: true
+                                checked: chatObject && chatObject.draftModel === modelData.name
+                                onTriggered: chatObject.draftModel = modelData.name
+                            }
+                            onObjectAdded: (index, object) => draftModelMenu.insertItem(index + 1, object)
+                            onObjectRemoved: (index, object) => draftModelMenu.removeItem(object)
+                        }
+                    }
                     MenuSeparator {}                    
                     Menu {
                         title: "Copy Chat to Clipboard"
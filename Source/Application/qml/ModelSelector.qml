@@ -16,6 +16,24 @@ ComboBox {
             chatController.setModel(currentValue.name)
         }
     }
+
+    // Preload the model highlighted in the list, once the pointer rests on it
+    onHighlightedIndexChanged: {
+        if (highlightedIndex >= 0)
+            preloadTimer.restart()
+        else
+            preloadTimer.stop()
+    }
+
+    Timer {
+        id: preloadTimer
+        interval: 400
+        onTriggered: {
+            var entry = modelSelector.modelList[modelSelector.highlightedIndex]
+            if (chatController && entry)
+                chatController.preloadModel(entry.name)
+        }
+    }
     
     delegate: ItemDelegate {
         width: modelSelector.width
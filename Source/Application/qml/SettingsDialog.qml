@@ -124,6 +124,24 @@ Dialog {
                 wrapMode: Text.WordWrap
             }
 
+            RowLayout {
+                Layout.fillWidth: true
+                spacing: 10
+                visible: chatController && chatController.ragService ? chatController.ragService.ingesting : false
+
+                ProgressBar {
+                    Layout.fillWidth: true
+                    from: 0
+                    to: Math.max(1, chatController.ragService.filesDiscovered)
+                    value: chatController.ragService.filesProcessed
+                }
+
+                Button {
+                    text: "Cancel"
+                    onClicked: chatController.ragService.cancelIngestion()
+                }
+            }
+
             // Context Settings Section
             Rectangle {
                 Layout.fillWidth: true
@@ -1230,6 +1230,12 @@ extern "C" {
     /// #details Updates the logits l_i` = l_i/t. When t <= 0.0f, the maximum logit is kept at it's original value, the rest are set to -inf
     LLAMA_API struct llama_sampler * llama_sampler_init_temp       (float   t);
 
+    /// @details Top-K, top-P, min-P and temperature in one sampler, same result as the chain top_k -> top_p -> min_p -> temp
+    /// The logits are scanned once for their max (and their softmax sum when top-P applies to all of them), then once to
+    /// select the candidates above a cut: only those are sorted. With t <= 0 only the max logit is kept, as a single
+    /// candidate. Setting k <= 0, p >= 1 or min_p <= 0 disables a stage
+    LLAMA_API struct llama_sampler * llama_sampler_init_fused      (int32_t k, float p, float min_p, float t, size_t min_keep);
+
     /// @details Dynamic temperature implementation (a.k.a. entropy) described in the paper https://arxiv.org/abs/2309.02772.
     LLAMA_API struct llama_sampler * llama_sampler_init_temp_ext   (float   t, float   delta, float exponent);
 
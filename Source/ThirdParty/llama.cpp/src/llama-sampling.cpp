@@ -18,6 +18,11 @@
 #include <unordered_map>
 #include <stdexcept>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LLAMA_SAMPLING_SSE2
+#include <emmintrin.h>
+#endif
+
 // the ring buffer works similarly to std::deque, but with a fixed capacity
 template<typename T>
 struct ring_buffer {
@@ -1117,6 +1122,290 @@ struct llama_sampler * llama_sampler_init_temp(float temp) {
     );
 }
 
+// fused top-k / top-p / min-p / temp
+
+// without top-k, the candidates are selected above a cut: the min-p threshold, or LLAMA_FUSED_LOGIT_STEP below the
+// max logit, lowered by LLAMA_FUSED_LOGIT_STEP while it keeps too few candidates, then all of them
+static constexpr float LLAMA_FUSED_LOGIT_STEP = 12.0f;
+static constexpr int   LLAMA_FUSED_MAX_STEPS  = 3;
+
+// the top-k candidates are gathered in a buffer of LLAMA_FUSED_TOP_K_SLACK more, trimmed back to k when it is full
+static constexpr size_t LLAMA_FUSED_TOP_K_SLACK = 256;
+
+// copies the logits of the candidates next to each other and returns their max
+static float llama_fused_gather(const llama_token_data_array * cur_p, float * logits) {
+    const llama_token_data * data = cur_p->data;
+    const size_t n = cur_p->size;
+
+    size_t i = 0;
+    float max_l = -INFINITY;
+#ifdef LLAMA_SAMPLING_SSE2
+    __m128 vmax = _mm_set1_ps(-INFINITY);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_setr_ps(data[i].logit, data[i + 1].logit, data[i + 2].logit, data[i + 3].logit);
+        _mm_storeu_ps(logits + i, v);
+        vmax = _mm_max_ps(vmax, v);
+    }
+    float tmp[4];
+    _mm_storeu_ps(tmp, vmax);
+    max_l = std::max(std::max(tmp[0], tmp[1]), std::max(tmp[2], tmp[3]));
+#endif
+    for (; i < n; ++i) {
+        logits[i] = data[i].logit;
+        max_l = std::max(max_l, logits[i]);
+    }
+    return max_l;
+}
+
+// sum of exp(x[i] - max_l), accumulated in order with expf like llama_sampler_softmax_impl: a vectorized exp or
+// summation order would round the normalizer differently and move the nucleus boundary
+static float llama_fused_sum_exp(const float * x, size_t n, float max_l) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += expf(x[i] - max_l);
+    }
+    return sum;
+}
+
+// the k candidates with the largest logits, not sorted: one pass, the threshold rises with each trim of the buffer
+static void llama_fused_top_k(const llama_token_data_array * cur_p, size_t k, std::vector<llama_token_data> & buf) {
+    static const auto comp = [](const llama_token_data & a, const llama_token_data & b) {
+        return a.logit > b.logit;
+    };
+
+    const llama_token_data * data = cur_p->data;
+    const size_t n        = cur_p->size;
+    const size_t capacity = k + std::max(k, LLAMA_FUSED_TOP_K_SLACK);
+
+    buf.clear();
+    buf.reserve(capacity);
+    float threshold = -INFINITY;
+
+    const auto push = [&](const llama_token_data & td) {
+        buf.push_back(td);
+        if (buf.size() == capacity) {
+            std::nth_element(buf.begin(), buf.begin() + k - 1, buf.end(), comp);
+            buf.resize(k);
+            threshold = buf[k - 1].logit;
+        }
+    };
+
+    size_t i = 0;
+#ifdef LLAMA_SAMPLING_SSE2
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v    = _mm_setr_ps(data[i].logit, data[i + 1].logit, data[i + 2].logit, data[i + 3].logit);
+        const int    mask = _mm_movemask_ps(_mm_cmpge_ps(v, _mm_set1_ps(threshold)));
+        for (int j = 0; mask && j < 4; ++j) {
+            if ((mask & (1 << j)) && data[i + j].logit >= threshold) {
+                push(data[i + j]);
+            }
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (data[i].logit >= threshold) {
+            push(data[i]);
+        }
+    }
+
+    if (buf.size() > k) {
+        std::nth_element(buf.begin(), buf.begin() + k - 1, buf.end(), comp);
+        buf.resize(k);
+    }
+}
+
+// copies the candidates with a logit >= cut
+static void llama_fused_select(const llama_token_data_array * cur_p, const float * logits, float cut,
+                               std::vector<llama_token_data> & buf) {
+    buf.clear();
+
+    size_t i = 0;
+#ifdef LLAMA_SAMPLING_SSE2
+    const __m128 vcut = _mm_set1_ps(cut);
+    for (; i + 4 <= cur_p->size; i += 4) {
+        const int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(logits + i), vcut));
+        for (int j = 0; mask && j < 4; ++j) {
+            if (mask & (1 << j)) {
+                buf.push_back(cur_p->data[i + j]);
+            }
+        }
+    }
+#endif
+    for (; i < cur_p->size; ++i) {
+        if (logits[i] >= cut) {
+            buf.push_back(cur_p->data[i]);
+        }
+    }
+}
+
+struct llama_sampler_fused {
+    const int32_t k;
+    const float   top_p;
+    const float   min_p;
+    const float   temp;
+    const size_t  min_keep;
+
+    std::vector<float>            logits; // logits of the candidates, next to each other
+    std::vector<llama_token_data> buf;    // candidates above the cut
+};
+
+static const char * llama_sampler_fused_name(const struct llama_sampler * /*smpl*/) {
+    return "fused";
+}
+
+static void llama_sampler_fused_apply(struct llama_sampler * smpl, llama_token_data_array * cur_p) {
+    auto * ctx = (llama_sampler_fused *) smpl->ctx;
+
+    const size_t n = cur_p->size;
+    if (n == 0) {
+        return;
+    }
+
+    const size_t k         = ctx->k > 0 ? std::min<size_t>(ctx->k, n) : n;
+    const bool   use_top_p = ctx->top_p < 1.0f;
+    const bool   use_min_p = ctx->min_p > 0.0f;
+
+    if (k == n && !use_top_p && !use_min_p) {
+        llama_sampler_temp_impl(cur_p, ctx->temp);
+        return;
+    }
+
+    // greedy: only the max logit survives the filters, nothing to select nor sort
+    if (ctx->temp <= 0.0f) {
+        auto & logits = ctx->logits;
+        logits.resize(n);
+        const float max_l = llama_fused_gather(cur_p, logits.data());
+        const size_t i = std::find(logits.begin(), logits.end(), max_l) - logits.begin();
+        // only nan logits
+        if (i == n) {
+            return;
+        }
+        cur_p->data[0] = cur_p->data[i];
+        cur_p->size    = 1;
+        cur_p->sorted  = true;
+        return;
+    }
+
+    static const auto comp = [](const llama_token_data & a, const llama_token_data & b) {
+        return a.logit > b.logit;
+    };
+
+    auto & buf = ctx->buf;
+    float max_l = 0.0f;
+    float sum   = 0.0f;
+
+    if (k < n) {
+        // the top-k candidates give the max logit and the top-p normalization
+        llama_fused_top_k(cur_p, k, buf);
+        std::sort(buf.begin(), buf.end(), comp);
+        max_l = buf[0].logit;
+        if (use_top_p) {
+            for (const auto & td : buf) {
+                sum += expf(td.logit - max_l);
+            }
+        }
+    } else {
+        // the max logit and the top-p normalization over all the candidates, then the candidates above the cut
+        auto & logits = ctx->logits;
+        logits.resize(n);
+        max_l = llama_fused_gather(cur_p, logits.data());
+        if (use_top_p) {
+            sum = llama_fused_sum_exp(logits.data(), n, max_l);
+        }
+
+        float cut = use_min_p ? max_l + logf(ctx->min_p) : max_l - LLAMA_FUSED_LOGIT_STEP;
+        for (int step = 1; ; ++step) {
+            llama_fused_select(cur_p, logits.data(), cut, buf);
+
+            // enough candidates for min_keep, and for the nucleus unless min-p bounds it
+            bool enough = buf.size() >= std::min(ctx->min_keep, n);
+            if (enough && use_top_p && !use_min_p) {
+                float cum_sum = 0.0f;
+                for (const auto & td : buf) {
+                    cum_sum += expf(td.logit - max_l) / sum;
+                }
+                enough = cum_sum >= ctx->top_p;
+            }
+            if (enough || cut == -INFINITY) {
+                break;
+            }
+            cut = step < LLAMA_FUSED_MAX_STEPS ? std::min(cut, max_l - (step + 1) * LLAMA_FUSED_LOGIT_STEP) : -INFINITY;
+        }
+        std::sort(buf.begin(), buf.end(), comp);
+    }
+
+    // only nan logits
+    if (buf.empty()) {
+        return;
+    }
+
+    size_t size = buf.size();
+
+    // top-p
+    if (use_top_p) {
+        float cum_sum = 0.0f;
+        for (size_t i = 0; i < buf.size(); ++i) {
+            cum_sum += expf(buf[i].logit - max_l) / sum;
+            if (cum_sum >= ctx->top_p && i + 1 >= ctx->min_keep) {
+                size = i + 1;
+                break;
+            }
+        }
+    }
+
+    // min-p, the first candidate always matches
+    if (use_min_p) {
+        const float min_logit = max_l + logf(ctx->min_p);
+        size_t i = 1;
+        while (i < size && (buf[i].logit >= min_logit || i < ctx->min_keep)) {
+            ++i;
+        }
+        size = i;
+    }
+
+    // temp
+    for (size_t i = 0; i < size; ++i) {
+        buf[i].logit /= ctx->temp;
+    }
+
+    std::copy(buf.begin(), buf.begin() + size, cur_p->data);
+    cur_p->size   = size;
+    cur_p->sorted = true;
+}
+
+static struct llama_sampler * llama_sampler_fused_clone(const struct llama_sampler * smpl) {
+    const auto * ctx = (const llama_sampler_fused *) smpl->ctx;
+    return llama_sampler_init_fused(ctx->k, ctx->top_p, ctx->min_p, ctx->temp, ctx->min_keep);
+}
+
+static void llama_sampler_fused_free(struct llama_sampler * smpl) {
+    delete (llama_sampler_fused *) smpl->ctx;
+}
+
+static struct llama_sampler_i llama_sampler_fused_i = {
+    /* .name   = */ llama_sampler_fused_name,
+    /* .accept = */ nullptr,
+    /* .apply  = */ llama_sampler_fused_apply,
+    /* .reset  = */ nullptr,
+    /* .clone  = */ llama_sampler_fused_clone,
+    /* .free   = */ llama_sampler_fused_free,
+};
+
+struct llama_sampler * llama_sampler_init_fused(int32_t k, float p, float min_p, float temp, size_t min_keep) {
+    return llama_sampler_init(
+        /* .iface = */ &llama_sampler_fused_i,
+        /* .ctx   = */ new llama_sampler_fused {
+            /* .k        = */ k,
+            /* .top_p    = */ p,
+            /* .min_p    = */ min_p,
+            /* .temp     = */ temp,
+            /* .min_keep = */ min_keep,
+            /* .logits   = */ {},
+            /* .buf      = */ {},
+        }
+    );
+}
+
 // temp-ext
 
 struct llama_sampler_temp_ext {
@@ -29,6 +29,12 @@ public:
     bool isReady() const override { return ready_; }
     void setReady(bool ready) { ready_ = ready; }
 
+    std::vector<float> getEmbedding(const QString& text) override
+    {
+        return embeddings_.value(text);
+    }
+
     std::vector<LLMModel> models_;
+    QHash<QString, std::vector<float>> embeddings_;
     bool ready_{false};
 };
@@ -23,6 +23,7 @@ private slots:
     void test_update_content_and_history();
     void test_streaming_and_sanitization();
     void test_streaming_and_end_tag();
+    void test_streaming_split_tags();
     void test_serialization_json();
     void test_export_helpers();
     void test_finalize_stream();
@@ -182,6 +183,41 @@ void ChatTest::test_streaming_and_end_tag()
     QCOMPARE(chat.data(chat.rowCount()-1, Chat::MessageRole::Content).toString(), QString("Response2"));
 }
 
+void ChatTest::test_streaming_split_tags()
+{
+    qDebug() << "LLMServicesTest::test_streaming_split_tags()";
+    LLMServices llmservices(nullptr);
+    MockLLMService* mock = new MockLLMService(LLMEnum::LLMType::LlamaCpp, &llmservices, "Mock");
+    llmservices.addAPI(mock);
+
+    ChatImpl chat(&llmservices);
+    chat.updateContent("Ask");
+    const int first = chat.rowCount() - 1;
+
+    // les balises sont coupées entre les morceaux du flux
+    const QString stream("<think>Thought1</think>Response1 <b> <thinking");
+    for (const QChar& c : stream)
+        chat.updateCurrentAIStream(QString(c));
+
+    QCOMPARE(chat.rowCount(), first + 2);
+    QCOMPARE(chat.data(first, Chat::MessageRole::Role).toString(), QString("thought"));
+    QCOMPARE(chat.data(first, Chat::MessageRole::Content).toString(), QString("Thought1"));
+    QCOMPARE(chat.data(first + 1, Chat::MessageRole::Role).toString(), QString("assistant"));
+    QCOMPARE(chat.data(first + 1, Chat::MessageRole::Content).toString(), QString("Response1 <b> <thinking"));
+
+    // seule la ligne en cours d'écriture est mise à jour
+    QSignalSpy spy(&chat, &QAbstractItemModel::dataChanged);
+    chat.updateCurrentAIStream(" more");
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).value<QModelIndex>().row(), first + 1);
+    QCOMPARE(spy.at(0).at(1).value<QModelIndex>().row(), first + 1);
+
+    // la réponse finale complète le texte diffusé
+    chat.updateCurrentAIStream(stream + " more and the end<end>");
+    QCOMPARE(chat.rowCount(), first + 2);
+    QCOMPARE(chat.data(first + 1, Chat::MessageRole::Content).toString(), QString("Response1 <b> <thinking more and the end"));
+}
+
 void ChatTest::test_serialization_json()
 {
     qDebug() << "LLMServicesTest::test_serialization_json()";
@@ -191,6 +227,12 @@ void ChatTest::test_serialization_json()
 
     ChatImpl chat1(&llmservices, "Original", "System", false);
     chat1.setApi("API");
+    chat1.setDraftModel("draft:0.5B");
+    SamplerProfile sampler;
+    sampler.temperature_ = 0.3f;
+    sampler.topK_ = 40;
+    sampler.topP_ = 0.9f;
+    chat1.setSampler(sampler);
     chat1.updateContent("Hello");
     chat1.updateCurrentAIStream("Hi there");
 
@@ -203,6 +245,8 @@ void ChatTest::test_serialization_json()
     QCOMPARE(chat2.getName(), QString("Original"));
     QCOMPARE(chat2.getCurrentApi(), QString("API"));
     QCOMPARE(chat2.getStreamed(), false);
+    QCOMPARE(chat2.getDraftModel(), QString("draft:0.5B"));
+    QVERIFY(chat2.getSampler() == sampler);
     QCOMPARE(chat2.rowCount(), 2);
     QCOMPARE(chat2.data(1, Chat::MessageRole::Role).toString(), QString("assistant"));
     QCOMPARE(chat2.data(1, Chat::MessageRole::Content).toString(), QString("Hi there"));
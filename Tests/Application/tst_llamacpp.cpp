@@ -1,8 +1,18 @@
 #include <QtTest>
+#include <QDir>
+#include <QStandardPaths>
+#include <random>
 
 #include "mock_services.h"
 
 #include "../../Source/Application/LlamaCppService.h"
+#include "../../Source/Application/LlamaMemoryEstimator.h"
+#include "../../Source/Application/LlamaModelResidency.h"
+#include "../../Source/Application/LlamaPrefixCache.h"
+#include "../../Source/Application/LlamaSessionStore.h"
+#include "../../Source/Application/LlamaSpeculative.h"
+#include "../../Source/Application/LlamaStreamBuffer.h"
+#include "../../Source/Application/LlamaDetokenizer.h"
 #include "../../Source/Application/ChatImpl.h"
 
 class LlamaCppTest : public QObject
@@ -14,6 +24,16 @@ private slots:
     void test_llamacpp_service();
     void test_llamacpp_parameters();
     void test_llamacpp_streaming();
+    void test_llamacpp_stream_buffer();
+    void test_llamacpp_detokenizer();
+    void test_llamacpp_prefix_cache();
+    void test_llamacpp_session_store();
+    void test_llamacpp_ngram_drafter();
+    void test_llamacpp_model_residency();
+    void test_llamacpp_memory_estimator();
+    void test_llamacpp_fused_sampler();
+    void test_llamacpp_embedding_context_reuse();
+    void test_llamacpp_generate_step_overhead();
 };
 
 void LlamaCppTest::initTestCase()
@@ -48,6 +68,36 @@ void LlamaCppTest::test_llamacpp_parameters()
     QCOMPARE(service->getGpuLayers(), 32);
     QCOMPARE(service->getContextSize(), 4096);
     QVERIFY(service->isUsingGpu() == true);
+
+    service->setUseSharedEngine(true);
+    service->setMaxSequences(0);
+
+    QVERIFY(service->isUsingSharedEngine() == true);
+    QCOMPARE(service->getMaxSequences(), 1);
+
+    service->setContextShift(true);
+    QVERIFY(service->isUsingContextShift() == true);
+
+    // micro-batches are never larger than the batch
+    service->setBatchSize(256, 1024);
+    QCOMPARE(service->getBatchSize(), 256);
+    QCOMPARE(service->getUBatchSize(), 256);
+
+    service->setDraftTokens(-1);
+    QCOMPARE(service->getDraftTokens(), 0);
+    service->setDraftTokens(4);
+    QCOMPARE(service->getDraftTokens(), 4);
+
+    QVERIFY(service->isUsingPromptLookup());
+    service->setPromptLookup(false);
+    QVERIFY(!service->isUsingPromptLookup());
+    service->setPromptLookup(true);
+
+    service->setModelMemoryBudget(-1);
+    QCOMPARE(service->getModelMemoryBudget(), 0);
+    service->setModelMemoryBudget(4096);
+    QCOMPARE(service->getModelMemoryBudget(), 4096);
+    QCOMPARE(service->getModelMemoryBudgetBytes(), qint64(4096) * 1024 * 1024);
 }
 
 void LlamaCppTest::test_llamacpp_streaming()
@@ -71,5 +121,513 @@ void LlamaCppTest::test_llamacpp_streaming()
     QVERIFY(chat.data(chat.rowCount()-1, Chat::MessageRole::Content).toString().isEmpty() == false);
 }
 
+void LlamaCppTest::test_llamacpp_stream_buffer()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_stream_buffer()";
+    LlamaStreamBuffer buffer;
+
+    // only the first piece since the last take wakes the consumer up
+    QVERIFY(buffer.isEmpty());
+    QVERIFY(buffer.append("Bon"));
+    QVERIFY(!buffer.append("jour"));
+    QVERIFY(!buffer.append(""));
+    QCOMPARE(buffer.take(), QString("Bonjour"));
+    QVERIFY(buffer.isEmpty());
+    QVERIFY(buffer.take().isEmpty());
+
+    // a producer thread against a consumer taking as it goes : nothing lost, nothing reordered
+    const int count = 20000;
+    QString expected;
+    for (int i = 0; i < count; ++i)
+        expected += QString::number(i % 10);
+
+    QThread* producer = QThread::create([&buffer, count]()
+    {
+        for (int i = 0; i < count; ++i)
+            buffer.append(QString::number(i % 10));
+    });
+    producer->start();
+    QString received;
+    while (!producer->isFinished())
+        received += buffer.take();
+    producer->wait();
+    received += buffer.take();
+    delete producer;
+
+    QCOMPARE(received, expected);
+}
+
+static std::vector<llama_token> makeTokens(std::initializer_list<llama_token> head, int count, llama_token first)
+{
+    std::vector<llama_token> tokens(head);
+    for (int i = 0; i < count; ++i)
+        tokens.push_back(first + i);
+    return tokens;
+}
+
+void LlamaCppTest::test_llamacpp_detokenizer()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_detokenizer()";
+
+    // characters of 1 to 4 bytes, split at every byte as byte tokens would split them
+    const QString expected = QString::fromUtf8("a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80 z");
+    const QByteArray bytes = expected.toUtf8();
+    LlamaDetokenizer detokenizer;
+    QString received;
+    for (char byte : bytes)
+    {
+        detokenizer.append(&byte, 1);
+        const QString text = detokenizer.take();
+        QVERIFY(!text.contains(QChar::ReplacementCharacter));
+        received += text;
+    }
+    QCOMPARE(received, expected);
+    QCOMPARE(detokenizer.pending(), size_t(0));
+
+    // an incomplete character waits for its end, reset forgets it
+    detokenizer.append("ok\xE2\x82", 4);
+    QCOMPARE(detokenizer.take(), QString("ok"));
+    QCOMPARE(detokenizer.pending(), size_t(2));
+    QVERIFY(detokenizer.take().isEmpty());
+    detokenizer.reset();
+    QCOMPARE(detokenizer.pending(), size_t(0));
+
+    // invalid bytes do not block the stream
+    detokenizer.append("\x80x\xFFy", 4);
+    QCOMPARE(detokenizer.take().right(1), QString("y"));
+}
+
+void LlamaCppTest::test_llamacpp_prefix_cache()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_prefix_cache()";
+    LlamaPrefixCache cache(10000);
+
+    std::vector<llama_token> a = makeTokens({1, 2, 3}, 40, 100);
+    cache.store(a, std::vector<uint8_t>(1000, 1));
+    QCOMPARE(cache.count(), 1);
+
+    // a prefix of a stored sequence is redundant, a short sequence is not worth it
+    cache.store(std::vector<llama_token>(a.begin(), a.begin() + 35), std::vector<uint8_t>(900, 2));
+    cache.store(makeTokens({9}, 5, 0), std::vector<uint8_t>(10, 3));
+    QCOMPARE(cache.count(), 1);
+
+    // b diverges from a after 30 tokens
+    std::vector<llama_token> b(a.begin(), a.begin() + 30);
+    b.push_back(7);
+    for (int i = 0; i < 20; ++i)
+        b.push_back(500 + i);
+    cache.store(b, std::vector<uint8_t>(1000, 4));
+    QCOMPARE(cache.count(), 2);
+
+    LlamaPrefixCache::Match match = cache.lookup(makeTokens({1, 2, 3}, 27, 100));
+    QCOMPARE(match.length, 30);
+    QVERIFY(match.state != nullptr);
+
+    std::vector<llama_token> query = a;
+    query.push_back(77);
+    match = cache.lookup(query);
+    QCOMPARE(match.length, 43);
+    QCOMPARE(int(match.state->data[0]), 1);
+
+    match = cache.lookup({5, 6});
+    QCOMPARE(match.length, 0);
+    QVERIFY(match.state == nullptr);
+
+    // a longer sequence replaces the state of its prefix
+    std::vector<llama_token> longer = makeTokens({1, 2, 3}, 50, 100);
+    cache.store(longer, std::vector<uint8_t>(1100, 5));
+    QCOMPARE(cache.count(), 2);
+    QCOMPARE(int(cache.lookup(a).state->data[0]), 5);
+
+    // the least recently used state is evicted beyond the budget
+    cache.lookup(b);
+    cache.store(makeTokens({8}, 40, 0), std::vector<uint8_t>(8000, 6));
+    QCOMPARE(cache.count(), 2);
+    QVERIFY(cache.size() <= 10000);
+    QCOMPARE(cache.lookup(longer).length, 30);
+    QCOMPARE(cache.lookup(b).length, int(b.size()));
+
+    cache.store(a, std::vector<uint8_t>(100, 7));
+    QCOMPARE(cache.lookup(a).length, 43);
+    QCOMPARE(int(cache.lookup(b).state->data[0]), 4);
+
+    cache.clear();
+    QCOMPARE(cache.count(), 0);
+    QCOMPARE(cache.size(), size_t(0));
+}
+
+void LlamaCppTest::test_llamacpp_session_store()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_session_store()";
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // the hash identifies the content of the model file
+    QFile model(dir.filePath("model.gguf"));
+    QVERIFY(model.open(QIODevice::WriteOnly));
+    model.write(QByteArray(3 * 1024 * 1024, 'a'));
+    model.close();
+    const QString hash = LlamaSessionStore::modelHash(model.fileName());
+    QVERIFY(!hash.isEmpty());
+    QCOMPARE(LlamaSessionStore::modelHash(model.fileName()), hash);
+    QVERIFY(LlamaSessionStore::modelHash(dir.filePath("missing.gguf")).isEmpty());
+
+    // the key changes with the layout of the kv cache
+    llama_context_params params = llama_context_default_params();
+    params.type_k = GGML_TYPE_Q8_0;
+    const QString key = LlamaSessionStore::contextKey(hash, params);
+    QCOMPARE(LlamaSessionStore::contextKey(hash, params), key);
+    params.type_k = GGML_TYPE_F16;
+    QVERIFY(LlamaSessionStore::contextKey(hash, params) != key);
+    QVERIFY(LlamaSessionStore::contextKey("other", params) != key);
+
+    // nothing to save or restore without a context
+    LlamaSessionStore store(dir.filePath("kvcache"), 1024 * 1024);
+    QVERIFY(QDir(dir.filePath("kvcache")).exists());
+    QVERIFY(!store.save(nullptr, 0, "chat", key, { 1, 2, 3 }));
+    QCOMPARE(store.restore(nullptr, 0, "chat", key, { 1, 2, 3 }, 2), 0);
+    QVERIFY(!store.contains("chat", key));
+    QCOMPARE(store.size(), qint64(0));
+}
+
+void LlamaCppTest::test_llamacpp_ngram_drafter()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_ngram_drafter()";
+
+    LlamaNgramDrafter drafter;
+    using Tokens = std::vector<llama_token>;
+
+    // the tokens which followed the last bigram in the prompt
+    QCOMPARE(drafter.propose({ 1, 2, 3, 4, 5, 6, 9, 2, 3 }, 8), Tokens({ 4, 5, 6, 9, 2, 3 }));
+    QCOMPARE(drafter.propose({ 1, 2, 3, 4, 5, 6, 9, 2, 3 }, 2), Tokens({ 4, 5 }));
+
+    // the longest match wins over a more recent shorter one
+    QCOMPARE(drafter.propose({ 7, 2, 3, 4, 8, 3, 4, 5, 7, 2, 3, 4 }, 2), Tokens({ 8, 3 }));
+
+    // the most recent of the matches of the same length
+    QCOMPARE(drafter.propose({ 3, 4, 5, 3, 4, 6, 0, 3, 4 }, 1), Tokens({ 6 }));
+
+    // a single matching token is not enough
+    QVERIFY(drafter.propose({ 1, 2, 3, 4, 2 }, 8).empty());
+    QVERIFY(drafter.propose({ 2, 3 }, 8).empty());
+    QVERIFY(drafter.propose({ 1, 2, 3, 1, 2 }, 0).empty());
+}
+
+void LlamaCppTest::test_llamacpp_model_residency()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_model_residency()";
+
+    LlamaModelResidency residency;
+    residency.add("a", 40);
+    residency.add("b", 30);
+    residency.add("c", 20);
+    QCOMPARE(residency.size(), qint64(90));
+
+    // nothing to evict within the budget
+    QVERIFY(residency.evictionCandidates(10, 100).isEmpty());
+
+    // least recently used first
+    QCOMPARE(residency.evictionCandidates(30, 100), QStringList({ "a" }));
+    residency.touch("a");
+    QCOMPARE(residency.evictionCandidates(30, 100), QStringList({ "b" }));
+    QCOMPARE(residency.evictionCandidates(60, 100), QStringList({ "b", "c" }));
+
+    // a referenced model stays, even beyond the budget
+    residency.acquire("b");
+    residency.acquire("b");
+    QCOMPARE(residency.references("b"), 2);
+    QCOMPARE(residency.evictionCandidates(60, 100), QStringList({ "c", "a" }));
+    QCOMPARE(residency.evictionCandidates(100, 100), QStringList({ "c", "a" }));
+    residency.release("b");
+    QCOMPARE(residency.evictionCandidates(100, 100), QStringList({ "c", "a" }));
+    residency.release("b");
+    QCOMPARE(residency.evictionCandidates(100, 100), QStringList({ "c", "a", "b" }));
+    residency.release("b");
+    QCOMPARE(residency.references("b"), 0);
+
+    // an unknown model is not referenced
+    residency.acquire("d");
+    QVERIFY(!residency.contains("d"));
+    QCOMPARE(residency.references("d"), 0);
+
+    residency.remove("a");
+    QVERIFY(!residency.contains("a"));
+    QCOMPARE(residency.size(), qint64(50));
+}
+
+void LlamaCppTest::test_llamacpp_memory_estimator()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_memory_estimator()";
+
+    // an 8B model with grouped query attention
+    LlamaModelShape shape;
+    shape.n_layer = 32;
+    shape.n_embd = 4096;
+    shape.n_head = 32;
+    shape.n_head_kv = 8;
+    shape.n_embd_head_k = 128;
+    shape.n_embd_head_v = 128;
+    shape.n_ff = 14336;
+    shape.n_vocab = 128256;
+    shape.weights = qint64(4920) * 1024 * 1024;
+    shape.n_params = 8030000000;
+    QVERIFY(shape.isValid());
+    const qint64 MiB = 1024 * 1024;
+
+    // 2 x 32 layers x 4096 cells x 1024 values
+    QCOMPARE(LlamaEstimateKvCache(shape, 4096, GGML_TYPE_F16, GGML_TYPE_F16), 512 * MiB);
+    QCOMPARE(LlamaEstimateKvCache(shape, 4096, GGML_TYPE_Q8_0, GGML_TYPE_Q8_0), qint64(272) * MiB);
+    QCOMPARE(LlamaEstimateKvCache(shape, 8192, GGML_TYPE_F16, GGML_TYPE_F16), 1024 * MiB);
+
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = 8192;
+    params.n_ubatch = 512;
+    params.n_seq_max = 1;
+    params.type_k = GGML_TYPE_F16;
+    params.type_v = GGML_TYPE_F16;
+    params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+
+    // the compute buffers follow n_ubatch, and the context without flash attention
+    const qint64 compute = LlamaEstimateCompute(shape, params);
+    QVERIFY(compute > 100 * MiB && compute < 1024 * MiB);
+    llama_context_params smaller = params;
+    smaller.n_ubatch = 128;
+    QVERIFY(LlamaEstimateCompute(shape, smaller) < compute);
+    llama_context_params noFlash = params;
+    noFlash.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_DISABLED;
+    QVERIFY(LlamaEstimateCompute(shape, noFlash) > compute);
+    QCOMPARE(LlamaEstimateContext(shape, params), 1024 * MiB + compute);
+
+    // the kv cache is quantized until the context fits
+    llama_context_params fitted = params;
+    QVERIFY(LlamaFitContext(shape, fitted, 2048 * MiB));
+    QCOMPARE(fitted.type_k, GGML_TYPE_F16);
+    fitted = params;
+    QVERIFY(LlamaFitContext(shape, fitted, 1024 * MiB));
+    QCOMPARE(fitted.type_k, GGML_TYPE_Q8_0);
+    QCOMPARE(fitted.type_v, GGML_TYPE_Q8_0);
+    fitted = params;
+    QVERIFY(!LlamaFitContext(shape, fitted, 256 * MiB));
+    QCOMPARE(fitted.type_k, GGML_TYPE_Q4_0);
+
+    // the values stay in f16 without flash attention
+    fitted = noFlash;
+    LlamaFitContext(shape, fitted, 1024 * MiB);
+    QCOMPARE(fitted.type_k, GGML_TYPE_Q4_0);
+    QCOMPARE(fitted.type_v, GGML_TYPE_F16);
+
+    // offloaded layers grow with the memory, up to all the layers and the output head
+    QCOMPARE(LlamaFitGpuLayers(shape, params, 256 * MiB), 0);
+    const int half = LlamaFitGpuLayers(shape, params, 3 * 1024 * MiB);
+    QVERIFY(half > 0 && half < shape.n_layer);
+    QVERIFY(LlamaFitGpuLayers(shape, params, 4 * 1024 * MiB) > half);
+    QCOMPARE(LlamaFitGpuLayers(shape, params, 16 * 1024 * MiB), shape.n_layer + 1);
+    QCOMPARE(LlamaFitGpuLayers(LlamaModelShape(), params, 16 * 1024 * MiB), 0);
+}
+
+void LlamaCppTest::test_llamacpp_fused_sampler()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_fused_sampler()";
+
+    // logits of a large vocabulary : a gaussian, where the nucleus holds most of the tokens,
+    // then a few likely tokens above the same gaussian tail
+    const int n_vocab = 151936;
+    std::vector<float> logits(n_vocab);
+    std::mt19937 random(42);
+    std::normal_distribution<float> normal(0.0f, 2.5f);
+    for (float& logit : logits)
+        logit = normal(random);
+
+    std::vector<llama_token_data> candidates(n_vocab);
+    auto filter = [&](llama_sampler* smpl)
+    {
+        for (int i = 0; i < n_vocab; ++i)
+            candidates[i] = { i, logits[i], 0.0f };
+        llama_token_data_array array = { candidates.data(), candidates.size(), -1, false };
+        llama_sampler_apply(smpl, &array);
+        return std::vector<llama_token_data>(array.data, array.data + array.size);
+    };
+    auto byId = [](const llama_token_data& a, const llama_token_data& b) { return a.id < b.id; };
+
+    // the same tokens and logits as the chain top_k -> top_p -> min_p -> temp
+    const SamplerProfile profiles[] = {
+        {}, { 0.7f, 40, 0.95f, 0.05f }, { 0.7f, 40, 0.9f, 0.0f }, { 1.0f, 0, 0.9f, 0.0f }, { 1.0f, 0, 0.999f, 0.0f },
+        { 0.0f, 0, 1.0f, 0.001f }
+    };
+    for (int spikes : { 0, 5 })
+    {
+        for (int i = 0; i < spikes; ++i)
+            logits[random() % n_vocab] += 8.0f + 4.0f * i;
+
+        for (const SamplerProfile& profile : profiles)
+        {
+            llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+            llama_sampler_chain_add(chain, llama_sampler_init_top_k(profile.topK_));
+            llama_sampler_chain_add(chain, llama_sampler_init_top_p(profile.topP_, 1));
+            llama_sampler_chain_add(chain, llama_sampler_init_min_p(profile.minP_, 1));
+            llama_sampler_chain_add(chain, llama_sampler_init_temp(profile.temperature_));
+            llama_sampler* fused =
+                llama_sampler_init_fused(profile.topK_, profile.topP_, profile.minP_, profile.temperature_, 1);
+
+            // with a temperature of 0 the chain keeps the other tokens at -inf
+            std::vector<llama_token_data> expected = filter(chain);
+            expected.erase(std::remove_if(expected.begin(), expected.end(),
+                                          [](const llama_token_data& td) { return std::isinf(td.logit); }),
+                           expected.end());
+            std::vector<llama_token_data> kept = filter(fused);
+            std::sort(expected.begin(), expected.end(), byId);
+            std::sort(kept.begin(), kept.end(), byId);
+
+            // a float rounding of the softmax sum may move the nucleus boundary by a few tokens of the tail :
+            // the smaller set is in the larger one, with the same logits
+            const std::vector<llama_token_data>& smaller = kept.size() < expected.size() ? kept : expected;
+            const std::vector<llama_token_data>& larger = kept.size() < expected.size() ? expected : kept;
+            QVERIFY(larger.size() - smaller.size() <= 1 + larger.size() / 1000);
+            size_t j = 0;
+            for (const llama_token_data& td : smaller)
+            {
+                while (j < larger.size() && larger[j].id < td.id)
+                    ++j;
+                QVERIFY(j < larger.size() && larger[j].id == td.id);
+                QCOMPARE(td.logit, larger[j].logit);
+            }
+
+            QElapsedTimer timer;
+            qint64 chainTime = 0;
+            qint64 fusedTime = 0;
+            for (int i = 0; i < 50; ++i)
+            {
+                timer.start();
+                filter(chain);
+                chainTime += timer.nsecsElapsed();
+                timer.start();
+                filter(fused);
+                fusedTime += timer.nsecsElapsed();
+            }
+            qDebug() << "fused sampler: spikes" << spikes << "top-k" << profile.topK_ << "top-p" << profile.topP_
+                     << "min-p" << profile.minP_ << "temp" << profile.temperature_ << ":" << chainTime / 50000
+                     << "us with the chain," << fusedTime / 50000 << "us fused";
+
+            llama_sampler_free(chain);
+            llama_sampler_free(fused);
+        }
+    }
+}
+
+void LlamaCppTest::test_llamacpp_embedding_context_reuse()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_embedding_context_reuse()";
+
+    // any small gguf model : LLAMABOT_TEST_MODEL=/path/to/model.gguf
+    const QString path = qEnvironmentVariable("LLAMABOT_TEST_MODEL");
+    if (path.isEmpty())
+        QSKIP("LLAMABOT_TEST_MODEL is not set");
+
+    // the service finds its models in the application data
+    QStandardPaths::setTestModeEnabled(true);
+    const QString modelsPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/models";
+    QVERIFY(QDir().mkpath(modelsPath));
+    const QString link = modelsPath + "/" + QFileInfo(path).fileName();
+    QFile::remove(link);
+    QVERIFY(QFile::link(QFileInfo(path).absoluteFilePath(), link));
+
+    {
+        LLMServices services(nullptr);
+        LlamaCppService service(&services, "LlamaCppEmbeddings");
+
+        // more tokens than a batch (and than the training context of BERT-like models)
+        QStringList texts;
+        for (int i = 0; i < 256; ++i)
+            texts << QString("chunk %1 : the quick brown fox jumps over the lazy dog. ").arg(i).repeated(4);
+
+        for (int call = 0; call < 2; ++call)
+        {
+            std::vector<std::vector<float>> embeddings = service.getEmbeddings(texts);
+            QCOMPARE(embeddings.size(), size_t(texts.size()));
+            QVERIFY(!embeddings.front().empty() && !embeddings.back().empty());
+        }
+
+        // the second call reuses the context of the first one
+        QCOMPARE(service.getEmbeddingContextAllocations(), 1);
+    }
+
+    QFile::remove(link);
+    QStandardPaths::setTestModeEnabled(false);
+}
+
+void LlamaCppTest::test_llamacpp_generate_step_overhead()
+{
+    qDebug() << "LlamaCppTest::test_llamacpp_generate_step_overhead()";
+
+    // any small gguf model : LLAMABOT_TEST_MODEL=/path/to/model.gguf
+    const QString path = qEnvironmentVariable("LLAMABOT_TEST_MODEL");
+    if (path.isEmpty())
+        QSKIP("LLAMABOT_TEST_MODEL is not set");
+
+    llama_model_params modelParams = llama_model_default_params();
+    modelParams.n_gpu_layers = 0;
+    LlamaModelData model;
+    model.model_ = llama_model_load_from_file(path.toUtf8().constData(), modelParams);
+    QVERIFY(model.model_ != nullptr);
+
+    // the same decode and sampling with and without LlamaGenerateStep, their timings measured by llama.cpp
+    llama_context_params contextParams = llama_context_default_params();
+    contextParams.n_ctx = 512;
+    contextParams.no_perf = false;
+    llama_sampler_chain_params samplerParams = llama_sampler_chain_default_params();
+    samplerParams.no_perf = false;
+
+    {
+        LlamaCppChatData data;
+        data.model_ = &model;
+        data.ctx_ = llama_init_from_model(model.model_, contextParams);
+        data.smpl_ = llama_sampler_chain_init(samplerParams);
+        llama_sampler_chain_add(data.smpl_, llama_sampler_init_greedy());
+
+        llama_context* ctx = llama_init_from_model(model.model_, contextParams);
+        llama_sampler* smpl = llama_sampler_chain_init(samplerParams);
+        llama_sampler_chain_add(smpl, llama_sampler_init_greedy());
+        QVERIFY(data.ctx_ && ctx);
+
+        data.currentToken_ = llama_vocab_bos(llama_model_get_vocab(model.model_));
+        llama_token token = data.currentToken_;
+        int steps = 0;
+        qint64 stepTime = 0;
+        qint64 referenceTime = 0;
+        QElapsedTimer timer;
+        for (; steps < 400; ++steps)
+        {
+            setBatchForNextToken(data);
+            timer.start();
+            const int generated = LlamaGenerateStep(data);
+            stepTime += timer.nsecsElapsed();
+            if (generated <= 0)
+                break;
+
+            timer.start();
+            llama_decode(ctx, llama_batch_get_one(&token, 1));
+            token = llama_sampler_sample(smpl, ctx, -1);
+            referenceTime += timer.nsecsElapsed();
+        }
+        QVERIFY(steps > 0);
+        QCOMPARE(data.n_past_, llama_memory_seq_pos_max(llama_get_memory(data.ctx_), 0) + 1);
+
+        auto untimed = [](qint64 wall, llama_context* ctx, llama_sampler* smpl)
+        {
+            const llama_perf_context_data context = llama_perf_context(ctx);
+            const llama_perf_sampler_data sampler = llama_perf_sampler(smpl);
+            return wall / 1000.0 - 1000.0 * (context.t_p_eval_ms + context.t_eval_ms + sampler.t_sample_ms);
+        };
+        const double overhead = (untimed(stepTime, data.ctx_, data.smpl_) - untimed(referenceTime, ctx, smpl)) / steps;
+        qDebug() << "LlamaGenerateStep: overhead per token outside llama_decode and the sampler" << overhead << "us";
+        QVERIFY(overhead < 5.0);
+
+        llama_sampler_free(smpl);
+        llama_free(ctx);
+    }
+    llama_model_free(model.model_);
+}
+
 QTEST_MAIN(LlamaCppTest)
 #include "tst_llamacpp.moc"
@@ -30,6 +30,7 @@ private slots:
     void test_post_function();
     void test_get_available_models();
     void test_get_embedding();
+    void test_get_embeddings();
     void test_error_handling();
     void test_edge_cases();
 };
@@ -211,6 +212,30 @@ void LLMServicesTest::test_get_embedding()
     QVERIFY(embedding.empty());
 }
 
+void LLMServicesTest::test_get_embeddings()
+{
+    qDebug() << "LLMServicesTest::test_get_embeddings()";
+    LLMServices services(nullptr);
+    MockLLMService* mock = new MockLLMService(LLMEnum::LLMType::LlamaCpp, &services, "EmbeddingsAPI");
+    mock->setReady(true);
+    mock->embeddings_["first"] = { 1.0f, 0.0f };
+    mock->embeddings_["second"] = { 0.0f, 1.0f };
+    services.addAPI(mock);
+
+    // Un embedding par texte, dans l'ordre, vide pour les textes non encodés
+    std::vector<std::vector<float>> embeddings = services.getEmbeddings({ "second", "unknown", "first" });
+    QCOMPARE(static_cast<int>(embeddings.size()), 3);
+    QCOMPARE(embeddings[0], std::vector<float>({ 0.0f, 1.0f }));
+    QVERIFY(embeddings[1].empty());
+    QCOMPARE(embeddings[2], std::vector<float>({ 1.0f, 0.0f }));
+
+    // Aucun service prêt : autant de résultats vides que de textes
+    mock->setReady(false);
+    embeddings = services.getEmbeddings({ "first", "second" });
+    QCOMPARE(static_cast<int>(embeddings.size()), 2);
+    QVERIFY(embeddings[0].empty() && embeddings[1].empty());
+}
+
 void LLMServicesTest::test_error_handling()
 {
     qDebug() << "LLMServicesTest::test_error_handling()";
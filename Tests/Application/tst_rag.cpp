@@ -1,9 +1,19 @@
 #include <QtTest>
 #include <QTemporaryFile>
 #include <QTemporaryDir>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
 
+#include "../../Source/Application/VectorKernels.h"
 #include "../../Source/Application/VectorStore.h"
 #include "../../Source/Application/DocumentProcessor.h"
+#include "../../Source/Application/IngestionPipeline.h"
+#include "../../Source/Application/RetrievalCache.h"
 
 class RAGTest : public QObject
 {
@@ -14,12 +24,51 @@ private slots:
     void test_vector_store_add_and_search();
     void test_vector_store_persistence();
     void test_vector_store_empty_search();
+    void test_vector_store_append_after_load();
+    void test_vector_store_segments();
+    void test_vector_store_legacy_migration();
+    void test_vector_store_corrupted_file();
+    void test_vector_store_top_k_order();
+    void test_vector_store_quantization_data();
+    void test_vector_store_quantization();
+    void test_vector_kernels_dot();
+    void test_vector_kernels_quantized();
+    void test_hnsw_persistence();
+    void test_hnsw_recall_benchmark_data();
+    void test_hnsw_recall_benchmark();
+    void test_vector_store_concurrent_search();
+    void test_vector_store_documents();
+    void test_vector_store_corrupted_documents();
+    void test_retrieval_cache();
     
     // DocumentProcessor Tests
     void test_document_processor_text_file();
     void test_document_processor_invalid_file();
+    void test_ingestion_pipeline();
+
+private:
+    // Collections shared by the benchmark rows
+    std::unique_ptr<VectorStore> exhaustiveStore_;
+    std::unique_ptr<VectorStore> hnswStore_;
+    std::vector<std::vector<float>> benchmarkQueries_;
 };
 
+// Normalized random embeddings, with most of the energy in a few dimensions like real text embeddings
+static std::vector<float> randomEmbedding(std::mt19937& random, int dim)
+{
+    std::normal_distribution<float> normal;
+    std::vector<float> v(dim);
+    float norm = 0.0f;
+    for (int i = 0; i < dim; ++i)
+    {
+        v[i] = normal(random) * (i < 12 ? 1.0f : 0.1f);
+        norm += v[i] * v[i];
+    }
+    for (float& x : v)
+        x /= std::sqrt(norm);
+    return v;
+}
+
 void RAGTest::test_vector_store_add_and_search()
 {
     VectorStore store;
@@ -80,6 +129,698 @@ void RAGTest::test_vector_store_empty_search()
     QVERIFY(results.empty());
 }
 
+void RAGTest::test_vector_store_append_after_load()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    {
+        VectorStore store;
+        VectorEntry e;
+        e.text = "Mapped";
+        e.embedding = {1.0f, 0.0f};
+        e.source = "a.txt";
+        store.addEntry(e);
+        QVERIFY(store.save(path));
+    }
+
+    VectorStore store;
+    QVERIFY(store.load(path));
+    QVERIFY(store.isMapped());
+    QCOMPARE(store.dimension(), 2);
+
+    // entries added after loading are searched together with the mapped ones
+    VectorEntry e;
+    e.text = "Appended";
+    e.embedding = {0.0f, 1.0f};
+    e.source = "b.txt";
+    store.addEntry(e);
+    QCOMPARE(store.count(), 2);
+    QCOMPARE(store.search({0.0f, 1.0f}, 1)[0].text, QString("Appended"));
+
+    // mismatching dimensions are rejected
+    e.embedding = {1.0f, 0.0f, 0.0f};
+    store.addEntry(e);
+    QCOMPARE(store.count(), 2);
+
+    QVERIFY(store.save(path));
+    QCOMPARE(store.count(), 2);
+    auto results = store.search({1.0f, 0.0f}, 2);
+    QCOMPARE(results[0].text, QString("Mapped"));
+    QCOMPARE(results[0].source, QString("a.txt"));
+    QCOMPARE(results[1].text, QString("Appended"));
+
+    // the mapped file is never replaced : the save went to the alternate file, the previous one is removed
+    QVERIFY(QFile::exists(path + ".alt"));
+    QVERIFY(!QFile::exists(path));
+    store.clear();
+
+    VectorStore reloaded;
+    QVERIFY(reloaded.load(path));
+    QCOMPARE(reloaded.count(), 2);
+    QVERIFY(reloaded.save(path));
+    QVERIFY(QFile::exists(path));
+    QVERIFY(!QFile::exists(path + ".alt"));
+    QCOMPARE(reloaded.search({0.0f, 1.0f}, 1)[0].text, QString("Appended"));
+}
+
+void RAGTest::test_vector_store_segments()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    std::mt19937 random(3);
+    std::vector<std::vector<float>> embeddings;
+    for (int i = 0; i < 9000; ++i)
+        embeddings.push_back(randomEmbedding(random, 8));
+
+    // batches and single rows filling several in-memory segments, with strings of various sizes
+    VectorStore store;
+    std::vector<VectorEntry> batch;
+    for (int i = 0; i < 9000; ++i)
+    {
+        VectorEntry e{ embeddings[i], QString::number(i), QString("s").repeated(i % 7) };
+        if (i % 1000 == 999)
+        {
+            store.addEntry(e);
+            continue;
+        }
+        batch.push_back(std::move(e));
+        if (batch.size() == 300)
+        {
+            store.addEntries(batch);
+            batch.clear();
+        }
+    }
+    store.addEntries(batch);
+    QCOMPARE(store.count(), 9000);
+
+    for (int i : { 0, 4095, 4096, 4097, 8191, 8192, 8999 })
+    {
+        auto results = store.search(embeddings[i], 1);
+        QCOMPARE(results[0].text, QString::number(i));
+        QCOMPARE(results[0].source, QString("s").repeated(i % 7));
+    }
+
+    // rows appended after a save start a new segment past the mapped file
+    QVERIFY(store.save(path));
+    store.addEntry({ embeddings[0], "appended", "a.txt" });
+    QVERIFY(store.save(path));
+
+    VectorStore loaded;
+    QVERIFY(loaded.load(path));
+    QCOMPARE(loaded.count(), 9001);
+    QCOMPARE(loaded.search(embeddings[4096], 1)[0].text, QString("4096"));
+    QCOMPARE(loaded.search(embeddings[8999], 1)[0].source, QString("s").repeated(8999 % 7));
+}
+
+void RAGTest::test_vector_store_legacy_migration()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    // write a RAG1 file, whose first entry has no embedding and last one another dimension
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QDataStream out(&file);
+        out << quint32(0x52414731) << quint32(1) << quint32(4);
+        out << quint32(0) << QString("Legacy empty") << QString("empty.txt");
+        out << quint32(3) << 1.0f << 0.0f << 0.0f << QString("Legacy X") << QString("x.txt");
+        out << quint32(3) << 0.0f << 1.0f << 0.0f << QString("Legacy Y") << QString("y.txt");
+        out << quint32(2) << 0.0f << 1.0f << QString("Legacy Z") << QString("z.txt");
+    }
+
+    {
+        VectorStore store;
+        QVERIFY(store.load(path));
+        QCOMPARE(store.count(), 2);
+        auto results = store.search({0.0f, 1.0f, 0.0f}, 1);
+        QCOMPARE(results[0].text, QString("Legacy Y"));
+        QCOMPARE(results[0].source, QString("y.txt"));
+    }
+
+    // the file was migrated to RAG2 and the legacy one kept as a backup
+    QVERIFY(QFile::exists(path + ".rag1"));
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    quint32 magic = 0;
+    QCOMPARE(file.read(reinterpret_cast<char*>(&magic), sizeof(magic)), qint64(sizeof(magic)));
+    QCOMPARE(magic, quint32(0x52414732));
+    file.close();
+
+    VectorStore store;
+    QVERIFY(store.load(path));
+    QVERIFY(store.isMapped());
+    QCOMPARE(store.count(), 2);
+}
+
+void RAGTest::test_vector_store_corrupted_file()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    {
+        VectorStore store;
+        store.addEntry({ { 1.0f, 0.0f }, "X", "x.txt" });
+        store.addEntry({ { 0.0f, 1.0f }, "Y", "y.txt" });
+        QVERIFY(store.save(path));
+    }
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray original = file.readAll();
+    file.close();
+
+    // header fields : count at byte 16, offsets table position at byte 32
+    auto loadPatched = [&](qsizetype position, quint64 value)
+    {
+        QByteArray patched = original;
+        std::memcpy(patched.data() + position, &value, sizeof(value));
+        QFile out(path);
+        if (!out.open(QIODevice::WriteOnly) || out.write(patched) != patched.size())
+            return true;
+        out.close();
+        VectorStore store;
+        return store.load(path);
+    };
+
+    // counts whose sections do not fit in the file, or overflow the size computations
+    QVERIFY(!loadPatched(16, quint64(INT_MAX)));
+    QVERIFY(!loadPatched(16, quint64(INT_MAX) + 1));
+    QVERIFY(!loadPatched(16, quint64(1) << 62));
+
+    // offsets pointing past the string blob, or not in order
+    quint64 offsetsOffset;
+    std::memcpy(&offsetsOffset, original.constData() + 32, sizeof(offsetsOffset));
+    QVERIFY(!loadPatched(offsetsOffset + sizeof(quint64), quint64(1) << 40));
+    QVERIFY(!loadPatched(offsetsOffset + 2 * sizeof(quint64), 0));
+
+    QFile restore(path);
+    QVERIFY(restore.open(QIODevice::WriteOnly));
+    restore.write(original);
+    restore.close();
+    VectorStore store;
+    QVERIFY(store.load(path));
+    QCOMPARE(store.search({ 0.0f, 1.0f }, 1)[0].text, QString("Y"));
+}
+
+void RAGTest::test_vector_store_top_k_order()
+{
+    VectorStore store;
+    for (int i = 0; i < 100; ++i)
+    {
+        // angle grows with i : similarity to the X axis decreases
+        float angle = i * 0.01f;
+        VectorEntry e;
+        e.text = QString::number(i);
+        e.embedding = {std::cos(angle), std::sin(angle)};
+        e.source = "angles.txt";
+        store.addEntry(e);
+    }
+
+    auto results = store.search({1.0f, 0.0f}, 5);
+    QCOMPARE(results.size(), 5UL);
+    for (int i = 0; i < 5; ++i)
+        QCOMPARE(results[i].text, QString::number(i));
+
+    // topK larger than the collection
+    QCOMPARE(store.search({1.0f, 0.0f}, 500).size(), 100UL);
+}
+
+void RAGTest::test_vector_store_quantization_data()
+{
+    QTest::addColumn<int>("quantization");
+    QTest::newRow("int8") << int(VectorStore::Int8);
+    QTest::newRow("binary") << int(VectorStore::Binary);
+}
+
+void RAGTest::test_vector_store_quantization()
+{
+    QFETCH(int, quantization);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    // 200 unit vectors on a circle, embedded in 70 dimensions (binary codes span two words)
+    auto embeddingFor = [](float angle)
+    {
+        std::vector<float> v(70, 0.0f);
+        v[0] = std::cos(angle);
+        v[69] = std::sin(angle);
+        return v;
+    };
+
+    {
+        VectorStore store;
+        store.setQuantization(VectorStore::Quantization(quantization));
+        for (int i = 0; i < 200; ++i)
+        {
+            VectorEntry e;
+            e.text = QString::number(i);
+            e.embedding = embeddingFor(i * 0.03f);
+            e.source = "circle.txt";
+            store.addEntry(e);
+        }
+        QVERIFY(store.save(path));
+    }
+
+    VectorStore store;
+    QVERIFY(store.load(path));
+    QCOMPARE(int(store.quantization()), quantization);
+    QCOMPARE(store.count(), 200);
+
+    // scores are exact fp32 after rescoring
+    auto results = store.search(embeddingFor(50 * 0.03f), 3);
+    QCOMPARE(results.size(), 3UL);
+    QCOMPARE(results[0].text, QString("50"));
+    QVERIFY(std::abs(results[0].score - 1.0f) < 1e-4f);
+    QVERIFY(results[1].text == "49" || results[1].text == "51");
+
+    // quantized files are saved again with the same quantization
+    QVERIFY(store.save(path));
+    QCOMPARE(int(store.quantization()), quantization);
+    QCOMPARE(store.search(embeddingFor(120 * 0.03f), 1)[0].text, QString("120"));
+}
+
+void RAGTest::test_vector_kernels_dot()
+{
+    qDebug() << "VectorKernels: dot kernel:" << VectorKernels::dotKernelName();
+
+    // odd sizes and unaligned pointers exercise the kernel tails
+    std::vector<float> a(1030), b(1030);
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        a[i] = std::sin(float(i));
+        b[i] = std::cos(float(i) * 0.5f);
+    }
+    for (int n : {0, 1, 7, 8, 15, 16, 31, 33, 384, 1023})
+    {
+        float expected = VectorKernels::dotScalar(a.data() + 1, b.data() + 1, n);
+        QVERIFY(std::abs(VectorKernels::dot(a.data() + 1, b.data() + 1, n) - expected) < 1e-3f);
+    }
+}
+
+void RAGTest::test_vector_kernels_quantized()
+{
+    std::vector<int8_t> a(1030), b(1030);
+    std::vector<uint64_t> x(17), y(17);
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        a[i] = int8_t(int(i * 37) % 255 - 127);
+        b[i] = int8_t(int(i * 91) % 255 - 127);
+    }
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        x[i] = 0x9E3779B97F4A7C15ULL * (i + 1);
+        y[i] = 0xC2B2AE3D27D4EB4FULL * (i + 3);
+    }
+
+    for (int n : {0, 1, 15, 16, 31, 33, 384, 1023})
+        QCOMPARE(VectorKernels::dotInt8(a.data() + 1, b.data() + 1, n), VectorKernels::dotInt8Scalar(a.data() + 1, b.data() + 1, n));
+    for (int words : {0, 1, 6, 17})
+        QCOMPARE(VectorKernels::hamming(x.data(), y.data(), words), VectorKernels::hammingScalar(x.data(), y.data(), words));
+}
+
+void RAGTest::test_hnsw_persistence()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    std::mt19937 random(7);
+    std::vector<std::vector<float>> embeddings;
+    for (int i = 0; i < 300; ++i)
+        embeddings.push_back(randomEmbedding(random, 32));
+
+    {
+        // the graph is built over the entries already present, then grows with addEntry
+        VectorStore store;
+        for (int i = 0; i < 100; ++i)
+            store.addEntry({ embeddings[i], QString::number(i), "random.txt" });
+        store.setIndexType(VectorStore::Hnsw);
+        for (int i = 100; i < 200; ++i)
+            store.addEntry({ embeddings[i], QString::number(i), "random.txt" });
+        QCOMPARE(store.indexType(), VectorStore::Hnsw);
+        QCOMPARE(store.search(embeddings[150], 1)[0].text, QString("150"));
+        QVERIFY(store.save(path));
+        QCOMPARE(store.indexType(), VectorStore::Hnsw);
+    }
+    QVERIFY(QFile::exists(path + ".hnsw"));
+
+    VectorStore store;
+    QVERIFY(store.load(path));
+    QCOMPARE(store.indexType(), VectorStore::Hnsw);
+    QCOMPARE(store.count(), 200);
+    for (int i = 200; i < 300; ++i)
+        store.addEntry({ embeddings[i], QString::number(i), "random.txt" });
+    for (int i : {0, 42, 199, 250, 299})
+    {
+        auto results = store.search(embeddings[i], 1);
+        QCOMPARE(results[0].text, QString::number(i));
+        QVERIFY(std::abs(results[0].score - 1.0f) < 1e-4f);
+    }
+
+    // a graph whose top layer is above the one of its entry point is rebuilt rather than searched
+    {
+        QFile graph(path + ".hnsw");
+        QVERIFY(graph.open(QIODevice::ReadWrite));
+        qint32 maxLevel = 0;
+        QVERIFY(graph.seek(20));
+        QCOMPARE(graph.read(reinterpret_cast<char*>(&maxLevel), sizeof(maxLevel)), qint64(sizeof(maxLevel)));
+        maxLevel += 3;
+        QVERIFY(graph.seek(20));
+        QCOMPARE(graph.write(reinterpret_cast<const char*>(&maxLevel), sizeof(maxLevel)), qint64(sizeof(maxLevel)));
+    }
+    VectorStore rebuilt;
+    QVERIFY(rebuilt.load(path));
+    QCOMPARE(rebuilt.indexType(), VectorStore::Hnsw);
+    QCOMPARE(rebuilt.search(embeddings[42], 1)[0].text, QString("42"));
+
+    // back to the exhaustive scan : the graph file is removed on save
+    store.setIndexType(VectorStore::Exhaustive);
+    QVERIFY(store.save(path));
+    QVERIFY(!QFile::exists(path + ".hnsw"));
+}
+
+void RAGTest::test_hnsw_recall_benchmark_data()
+{
+    QTest::addColumn<int>("efSearch");
+    QTest::newRow("exhaustive") << 0;
+    QTest::newRow("hnsw ef=16") << 16;
+    QTest::newRow("hnsw ef=64") << 64;
+    QTest::newRow("hnsw ef=256") << 256;
+}
+
+void RAGTest::test_hnsw_recall_benchmark()
+{
+    QFETCH(int, efSearch);
+    const int topK = 10;
+
+    // the recall is checked on a small collection, the timings on a large one : LLAMABOT_RAG_BENCHMARK=1
+    const bool benchmark = qEnvironmentVariableIsSet("LLAMABOT_RAG_BENCHMARK");
+
+    if (!exhaustiveStore_)
+    {
+        std::mt19937 random(1);
+        exhaustiveStore_ = std::make_unique<VectorStore>();
+        hnswStore_ = std::make_unique<VectorStore>();
+        HnswIndex::Parameters parameters;
+        parameters.efConstruction = 100;
+        hnswStore_->setIndexType(VectorStore::Hnsw, parameters);
+
+        std::vector<VectorEntry> entries;
+        for (int i = 0; i < (benchmark ? 20000 : 3000); ++i)
+            entries.push_back({ randomEmbedding(random, 64), QString::number(i), "random.txt" });
+
+        QElapsedTimer timer;
+        timer.start();
+        exhaustiveStore_->addEntries(entries);
+        hnswStore_->addEntries(entries);
+        for (int i = 0; i < 100; ++i)
+            benchmarkQueries_.push_back(randomEmbedding(random, 64));
+        qDebug() << "HNSW: built over" << hnswStore_->count() << "entries in" << timer.elapsed() << "ms";
+    }
+
+    VectorStore* store = efSearch ? hnswStore_.get() : exhaustiveStore_.get();
+    store->setEfSearch(efSearch);
+
+    // recall@10 against the exact results
+    if (efSearch)
+    {
+        double found = 0.0;
+        for (const std::vector<float>& query : benchmarkQueries_)
+        {
+            QSet<QString> expected;
+            for (const SearchResult& result : exhaustiveStore_->search(query, topK))
+                expected.insert(result.text);
+            for (const SearchResult& result : store->search(query, topK))
+                found += expected.contains(result.text);
+        }
+        const double recall = found / (benchmarkQueries_.size() * topK);
+        qDebug() << "HNSW: efSearch" << efSearch << "recall@10" << recall;
+        if (efSearch >= 64)
+            QVERIFY(recall > 0.9);
+    }
+
+    if (!benchmark)
+        return;
+
+    QBENCHMARK
+    {
+        for (const std::vector<float>& query : benchmarkQueries_)
+            store->search(query, topK);
+    }
+}
+
+void RAGTest::test_vector_store_concurrent_search()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    std::mt19937 random(11);
+    std::vector<std::vector<float>> embeddings;
+    for (int i = 0; i < 2000; ++i)
+        embeddings.push_back(randomEmbedding(random, 32));
+
+    VectorStore store;
+    store.setIndexType(VectorStore::Hnsw);
+    for (int i = 0; i < 500; ++i)
+        store.addEntry({ embeddings[i], QString::number(i), "random.txt" });
+
+    // searches run while batches are appended and the collection is compacted to disk
+    std::atomic<bool> done{false};
+    std::atomic<int> searches{0};
+    std::atomic<int> failures{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t)
+    {
+        readers.emplace_back([&, t]()
+        {
+            std::mt19937 readerRandom(t);
+            while (!done)
+            {
+                const int i = readerRandom() % store.count();
+                auto results = store.search(embeddings[i], 1);
+                if (results.empty() || std::abs(results[0].score - 1.0f) > 1e-4f)
+                    ++failures;
+                ++searches;
+            }
+        });
+    }
+
+    std::vector<VectorEntry> batch;
+    for (int i = 500; i < 2000; ++i)
+    {
+        batch.push_back({ embeddings[i], QString::number(i), "random.txt" });
+        if (batch.size() == 64 || i == 1999)
+        {
+            store.addEntries(batch);
+            batch.clear();
+        }
+        if (i == 1200)
+            QVERIFY(store.save(dir.filePath("rag.db")));
+    }
+
+    done = true;
+    for (std::thread& reader : readers)
+        reader.join();
+
+    QCOMPARE(store.count(), 2000);
+    QVERIFY(searches > 0);
+    QCOMPARE(failures.load(), 0);
+    QCOMPARE(store.search(embeddings[1999], 1)[0].text, QString("1999"));
+}
+
+void RAGTest::test_vector_store_documents()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    std::mt19937 random(5);
+    std::vector<std::vector<float>> embeddings;
+    for (int i = 0; i < 30; ++i)
+        embeddings.push_back(randomEmbedding(random, 16));
+
+    auto addDocument = [&](VectorStore& store, const QString& document, int first, int count)
+    {
+        std::vector<VectorEntry> entries;
+        for (int i = first; i < first + count; ++i)
+            entries.push_back({ embeddings[i], QString::number(i), document });
+        store.addEntries(entries, document);
+        store.updateDocument({ document, count, 1000 + first, QByteArray::number(first), {} });
+    };
+
+    {
+        VectorStore store;
+        addDocument(store, "/docs/a.txt", 0, 10);
+        addDocument(store, "/docs/b.txt", 10, 10);
+        addDocument(store, "/docs/c.txt", 20, 10);
+
+        DocumentRecord record;
+        QVERIFY(store.document("/docs/b.txt", record));
+        QCOMPARE(record.size, qint64(10));
+        QCOMPARE(record.hash, QByteArray("10"));
+        QCOMPARE(record.ranges.size(), size_t(1));
+        QCOMPARE(record.ranges[0], std::make_pair(10, 10));
+
+        // tombstoned rows are skipped by search right away
+        QCOMPARE(store.removeDocument("/docs/b.txt"), 10);
+        QCOMPARE(store.removeDocument("/docs/b.txt"), 0);
+        QCOMPARE(store.count(), 20);
+        QCOMPARE(store.deletedCount(), 10);
+        QVERIFY(!store.document("/docs/b.txt", record));
+        for (const SearchResult& result : store.search(embeddings[15], 5))
+            QVERIFY(result.source != "/docs/b.txt");
+
+        // an exhaustive collection is compacted by save
+        QVERIFY(store.save(path));
+        QCOMPARE(store.deletedCount(), 0);
+        QCOMPARE(store.count(), 20);
+        QVERIFY(store.document("/docs/c.txt", record));
+        QCOMPARE(record.ranges[0], std::make_pair(10, 10));
+    }
+    QVERIFY(QFile::exists(path + ".docs"));
+
+    VectorStore store;
+    QVERIFY(store.load(path));
+    QCOMPARE(store.documents().size(), qsizetype(2));
+    DocumentRecord record;
+    QVERIFY(store.document("/docs/c.txt", record));
+    QCOMPARE(record.modified, qint64(1020));
+    QCOMPARE(store.search(embeddings[25], 1)[0].text, QString("25"));
+
+    // indexed collection : a few tombstones are kept (and persisted) rather than rebuilding the graph
+    store.setIndexType(VectorStore::Hnsw);
+    addDocument(store, "/docs/b.txt", 10, 10);
+    std::vector<VectorEntry> extra{ { embeddings[0], "extra", "/docs/a.txt" } };
+    store.addEntries(extra, "/docs/a.txt");
+    QVERIFY(store.document("/docs/a.txt", record));
+    QCOMPARE(record.ranges.size(), size_t(2));
+    std::vector<VectorEntry> copies{ { embeddings[3], "copy", "/docs/d.txt" }, { embeddings[4], "copy", "/docs/d.txt" } };
+    store.addEntries(copies, "/docs/d.txt");
+    QCOMPARE(store.removeDocument("/docs/d.txt"), 2);
+    QVERIFY(store.save(path));
+    QCOMPARE(store.deletedCount(), 2);
+
+    VectorStore reloaded;
+    QVERIFY(reloaded.load(path));
+    QCOMPARE(reloaded.indexType(), VectorStore::Hnsw);
+    QCOMPARE(reloaded.deletedCount(), 2);
+    QCOMPARE(reloaded.count(), 31);
+    QCOMPARE(reloaded.search(embeddings[3], 1)[0].text, QString("3"));
+
+    QVERIFY(reloaded.compact(path));
+    QCOMPARE(reloaded.deletedCount(), 0);
+    QCOMPARE(reloaded.count(), 31);
+    QVERIFY(reloaded.document("/docs/a.txt", record));
+    QCOMPARE(record.ranges[1], std::make_pair(30, 1));
+    QCOMPARE(reloaded.search(embeddings[12], 1)[0].text, QString("12"));
+}
+
+void RAGTest::test_vector_store_corrupted_documents()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("rag.db");
+
+    std::mt19937 random(9);
+    std::vector<VectorEntry> kept;
+    std::vector<VectorEntry> removed;
+    for (int i = 0; i < 20; ++i)
+        kept.push_back({ randomEmbedding(random, 16), QString::number(i), "/docs/kept.txt" });
+    removed.push_back({ randomEmbedding(random, 16), "removed", "/docs/removed.txt" });
+
+    // indexed collection : the tombstoned row is kept in the file, only the sidecar knows it is dead
+    {
+        VectorStore store;
+        store.setIndexType(VectorStore::Hnsw);
+        store.addEntries(kept, "/docs/kept.txt");
+        store.addEntries(removed, "/docs/removed.txt");
+        QCOMPARE(store.removeDocument("/docs/removed.txt"), 1);
+        QVERIFY(store.save(path));
+        QCOMPARE(store.deletedCount(), 1);
+    }
+
+    QFile documents(path + ".docs");
+    QVERIFY(documents.open(QIODevice::ReadWrite));
+    QVERIFY(documents.resize(documents.size() / 2));
+    documents.close();
+
+    VectorStore store;
+    QVERIFY(!store.load(path));
+    for (const SearchResult& result : store.search(removed.front().embedding, 5))
+        QVERIFY(result.source != "/docs/removed.txt");
+
+    // a range whose end overflows 32 bits is not taken for a range inside the collection
+    QVERIFY(documents.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    {
+        QDataStream out(&documents);
+        out << quint32(0x53434F44) << quint32(1) << quint32(kept.size() + removed.size()) << quint32(0);
+        out << quint32(1) << QString("/docs/kept.txt") << qint64(0) << qint64(0) << QByteArray() << quint32(1);
+        out << qint32(INT_MAX - 1) << qint32(10);
+    }
+    documents.close();
+    QVERIFY(!store.load(path));
+
+    // a missing sidecar next to the graph is not read as "no tombstones" either
+    QVERIFY(QFile::remove(path + ".docs"));
+    QVERIFY(!store.load(path));
+    QCOMPARE(store.count(), 0);
+}
+
+void RAGTest::test_retrieval_cache()
+{
+    RetrievalCache cache(64 * 1024);
+    std::vector<float> first(128, 0.5f);
+    std::vector<float> second(128, 0.25f);
+    std::vector<float> embedding;
+
+    QVERIFY(!cache.embedding("hello", embedding));
+    cache.insertEmbedding("hello", first);
+    QVERIFY(cache.embedding("hello", embedding));
+    QCOMPARE(embedding, first);
+
+    std::vector<SearchResult> results{ { "text", 0.9f, "a.txt" } };
+    std::vector<SearchResult> cached;
+    QVERIFY(!cache.results(first, 3, 1, cached));
+    cache.insertResults(first, 3, 1, results);
+    QVERIFY(cache.results(first, 3, 1, cached));
+    QCOMPARE(cached.size(), size_t(1));
+    QCOMPARE(cached[0].text, QString("text"));
+    QVERIFY(!cache.results(first, 5, 1, cached));
+    QVERIFY(!cache.results(second, 3, 1, cached));
+
+    // results computed on an older collection are not cached, a newer one drops them all
+    cache.insertResults(second, 3, 0, results);
+    QVERIFY(!cache.results(second, 3, 1, cached));
+    QVERIFY(!cache.results(first, 3, 2, cached));
+    QVERIFY(cache.embedding("hello", embedding));
+
+    // bounded by bytes : the least recently used entries go first
+    for (int i = 0; i < 200; ++i)
+        cache.insertEmbedding(QString::number(i), first);
+    QVERIFY(!cache.embedding("0", embedding));
+    QVERIFY(cache.embedding("199", embedding));
+
+    RetrievalCache::Statistics statistics = cache.statistics();
+    QCOMPARE(statistics.embeddingHits, 3);
+    QCOMPARE(statistics.embeddingMisses, 2);
+    QCOMPARE(statistics.resultHits, 1);
+    QCOMPARE(statistics.resultMisses, 5);
+
+    // the generation of the collection follows its changes
+    VectorStore store;
+    const quint64 generation = store.generation();
+    store.addEntry({ { 1.0f, 0.0f }, "a", "a.txt" });
+    QVERIFY(store.generation() > generation);
+}
+
 void RAGTest::test_document_processor_text_file()
 {
     QTemporaryDir dir;
@@ -106,5 +847,64 @@ void RAGTest::test_document_processor_invalid_file()
     QVERIFY(chunks.empty());
 }
 
+void RAGTest::test_ingestion_pipeline()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // files at the top level and in nested subdirectories, plus an unsupported one
+    QStringList files = { "root.txt", "a/one.txt", "a/two.md", "a/deep/three.txt", "b/four.txt", "b/five.md" };
+    QVERIFY(QDir(dir.path()).mkpath("a/deep"));
+    QVERIFY(QDir(dir.path()).mkpath("b"));
+    for (const QString& name : files + QStringList{ "b/ignored.bin" })
+    {
+        QFile file(dir.filePath(name));
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+        file.write(QString("Content of %1. ").arg(name).repeated(40).toUtf8());
+    }
+
+    int embedCalls = 0;
+    QSet<QString> sources;
+    QSet<QString> completed;
+    int chunks = 0;
+    IngestionPipeline pipeline(
+        [&embedCalls](const QStringList& texts)
+        {
+            ++embedCalls;
+            return std::vector<std::vector<float>>(texts.size(), std::vector<float>{ 1.0f, 0.0f });
+        },
+        [&](const QString& path, std::vector<DocumentChunk>& batch, std::vector<std::vector<float>>& embeddings,
+            bool complete)
+        {
+            // the chunks of a document arrive together, before the next document
+            QCOMPARE(embeddings.size(), batch.size());
+            QVERIFY(batch.size() <= 4);
+            QVERIFY(!completed.contains(path));
+            for (const DocumentChunk& chunk : batch)
+            {
+                QCOMPARE(chunk.sourceFile, QFileInfo(path).fileName());
+                sources.insert(chunk.sourceFile);
+            }
+            chunks += static_cast<int>(batch.size());
+            if (complete)
+                completed.insert(path);
+        },
+        4, 2);
+    pipeline.setFilter([](const QString& path) { return !path.endsWith("five.md"); });
+    pipeline.run({ dir.path() });
+
+    QCOMPARE(pipeline.filesDiscovered(), files.size());
+    QCOMPARE(pipeline.filesExtracted(), files.size() - 1);
+    QCOMPARE(pipeline.filesSkipped(), 1);
+    QCOMPARE(sources.size(), files.size() - 1);
+    QCOMPARE(completed.size(), files.size() - 1);
+    QVERIFY(completed.contains(QFileInfo(dir.filePath("a/deep/three.txt")).absoluteFilePath()));
+    QVERIFY(chunks > files.size());
+    QCOMPARE(pipeline.chunksCreated(), chunks);
+    QCOMPARE(pipeline.chunksEmbedded(), chunks);
+    QVERIFY(embedCalls >= chunks / 4);
+    QVERIFY(!pipeline.isCancelled());
+}
+
 QTEST_MAIN(RAGTest)
 #include "tst_rag.moc"